@@ -33,9 +33,15 @@ TARGET_RECOVERY_GUI := true
 LOCAL_SRC_FILES := \
     twrp.cpp \
     fixPermissions.cpp \
+    packageList.cpp \
     twrpTar.cpp \
+    twrpGzip.cpp \
+    twrpTarIndex.cpp \
 	twrpDU.cpp \
+    twrpThroughput.cpp \
     twrpDigest.cpp \
+    twrpSparse.cpp \
+    twrpWipe.cpp \
     find_file.cpp \
     infomanager.cpp
 
@@ -46,7 +52,9 @@ LOCAL_SRC_FILES += \
     twinstall.cpp \
     twrp-functions.cpp \
     openrecoveryscript.cpp \
-    tarWrite.c
+    tarWrite.c \
+    twlog.c \
+    ext4_used.c
 
 ifneq ($(TARGET_RECOVERY_REBOOT_SRC),)
   LOCAL_SRC_FILES += $(TARGET_RECOVERY_REBOOT_SRC)
@@ -79,7 +87,7 @@ LOCAL_CFLAGS += -DRECOVERY_API_VERSION=$(RECOVERY_API_VERSION)
 #    libm \
 #    libc
 
-LOCAL_C_INCLUDES += bionic external/stlport/stlport
+LOCAL_C_INCLUDES += bionic external/stlport/stlport external/zlib
 
 LOCAL_STATIC_LIBRARIES :=
 LOCAL_SHARED_LIBRARIES :=
@@ -145,6 +153,9 @@ endif
 ifneq ($(TW_NO_SCREEN_TIMEOUT),)
     LOCAL_CFLAGS += -DTW_NO_SCREEN_TIMEOUT
 endif
+ifneq ($(TW_LOG_LEVEL),)
+    LOCAL_CFLAGS += -DTW_LOG_LEVEL=$(TW_LOG_LEVEL)
+endif
 ifeq ($(BOARD_HAS_NO_REAL_SDCARD), true)
     LOCAL_CFLAGS += -DBOARD_HAS_NO_REAL_SDCARD
 endif
@@ -413,6 +424,27 @@ include $(BUILD_PHONY_PACKAGE)
 RECOVERY_BUSYBOX_SYMLINKS :=
 endif # !TW_USE_TOOLBOX
 
+include $(CLEAR_VARS)
+LOCAL_MODULE := packagelist_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_C_INCLUDES += bionic external/stlport/stlport
+LOCAL_SRC_FILES := \
+    packageList_test.cpp \
+    packageList.cpp
+LOCAL_SHARED_LIBRARIES += libc libstdc++ libstlport
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := twrpsparse_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS += -DBUILD_TWRPTAR_MAIN
+LOCAL_C_INCLUDES += bionic external/stlport/stlport
+LOCAL_SRC_FILES := \
+    twrpSparse_test.cpp \
+    twrpSparse.cpp
+LOCAL_SHARED_LIBRARIES += libc libstdc++ libstlport
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE := verifier_test
 LOCAL_FORCE_STATIC_EXECUTABLE := true
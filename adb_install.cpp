@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mount.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -32,8 +33,10 @@
 extern "C" {
 #include "minadbd/adb.h"
 }
+#include "minadbd/fuse_sideload.h"
 
 static RecoveryUI* ui = NULL;
+static pid_t sideload_child = 0;
 
 static void
 set_usb_driver(bool enabled) {
@@ -79,7 +82,7 @@ maybe_restart_adbd() {
 }
 
 int
-apply_from_adb(const char* install_file) {
+apply_from_adb(const char* install_file, std::string& package_file) {
 
     stop_adbd();
     set_usb_driver(true);
@@ -95,19 +98,34 @@ apply_from_adb(const char* install_file) {
 	char child_prop[PROPERTY_VALUE_MAX];
 	sprintf(child_prop, "%i", child);
 	property_set("tw_child_pid", child_prop);
-    int status;
+    int status = 0;
     // TODO(dougz): there should be a way to cancel waiting for a
     // package (by pushing some button combo on the device).  For now
     // you just have to 'adb sideload' a file that's not a valid
     // package, like "/dev/null".
-    waitpid(child, &status, 0);
+    //
+    // Hosts that support sideload-host keep the child running and serve
+    // the package through fuse, older hosts copy it to install_file and
+    // the child exits.
+    struct stat st;
+    for (;;) {
+        pid_t ret = waitpid(child, &status, WNOHANG);
+        if (ret == child || (ret < 0 && errno != EINTR))
+            break;
+        if (stat(FUSE_SIDELOAD_HOST_PATHNAME, &st) == 0) {
+            printf("Installing the package while it is received.\n");
+            sideload_child = child;
+            package_file = FUSE_SIDELOAD_HOST_PATHNAME;
+            return 0;
+        }
+        usleep(250000);
+    }
     if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
         printf("status %d\n", WEXITSTATUS(status));
     }
     set_usb_driver(false);
     maybe_restart_adbd();
 
-    struct stat st;
     if (stat(install_file, &st) != 0) {
         if (errno == ENOENT) {
             printf("No package received.\n");
@@ -116,5 +134,26 @@ apply_from_adb(const char* install_file) {
         }
         return -1;
     }
+	package_file = install_file;
 	return 0;
 }
+
+void
+finish_adb_sideload(void) {
+    if (sideload_child == 0)
+        return;
+
+    // Looking up the exit flag makes the child unmount the package and exit
+    struct stat st;
+    int status;
+    stat(FUSE_SIDELOAD_HOST_EXIT_PATHNAME, &st);
+    waitpid(sideload_child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("status %d\n", WEXITSTATUS(status));
+    }
+    // Still mounted if the child was killed
+    umount2(FUSE_SIDELOAD_HOST_MOUNTPOINT, MNT_DETACH);
+    sideload_child = 0;
+    set_usb_driver(false);
+    maybe_restart_adbd();
+}
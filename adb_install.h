@@ -17,8 +17,15 @@
 #ifndef _ADB_INSTALL_H
 #define _ADB_INSTALL_H
 
+#include <string>
+
 //class RecoveryUI;
 
-int apply_from_adb(const char* install_file);
+// Waits for "adb sideload". Returns 0 once a package can be installed from
+// package_file: install_file for older hosts that copy the whole package,
+// or the file the host streams through fuse. finish_adb_sideload has to be
+// called once the package was installed.
+int apply_from_adb(const char* install_file, std::string& package_file);
+void finish_adb_sideload(void);
 
 #endif
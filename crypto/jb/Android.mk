@@ -5,8 +5,9 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := libcryptfsjb
 LOCAL_MODULE_TAGS := eng optional
 LOCAL_CFLAGS :=
-LOCAL_SRC_FILES = cryptfs.c
+LOCAL_SRC_FILES = cryptfs.c ../../ext4_used.c
 LOCAL_C_INCLUDES += \
+    $(commands_recovery_local_path) \
     system/extras/ext4_utils \
     external/openssl/include \
     $(commands_recovery_local_path)/crypto/scrypt/lib/crypto
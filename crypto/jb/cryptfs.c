@@ -36,6 +36,9 @@
 #include <openssl/evp.h>
 #include <openssl/sha.h>
 #include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
 #include <ext4.h>
 #include <linux/kdev_t.h>
 #include <fs_mgr.h>
@@ -49,6 +52,7 @@
 #include "VolumeManager.h"
 #include "VoldUtil.h"*/
 #include "crypto_scrypt.h"
+#include "ext4_used.h"
 
 #define DM_CRYPT_BUF_SIZE 4096
 #define DATA_MNT_POINT "/data"
@@ -1474,81 +1478,292 @@ static int cryptfs_enable_wipe(char *crypto_blkdev, off64_t size, int type)
     return -1;
 }
 
-#define CRYPT_INPLACE_BUFSIZE 4096
-#define CRYPT_SECTORS_PER_BUFSIZE (CRYPT_INPLACE_BUFSIZE / 512)
+/* In place encryption reads the filesystem from the real block device and
+ * writes it back through dm-crypt.  A reader thread fills one buffer while
+ * the other one is written, so reading and writing overlap.  When the
+ * filesystem is a cleanly unmounted ext4, blocks it does not use are not
+ * copied at all.
+ */
+#define CRYPT_INPLACE_BUFSIZE (4 * 1024 * 1024)
+#define CRYPT_INPLACE_BUFFERS 2
+#define CRYPT_INPLACE_UNIT 4096         /* granularity of the used block map */
+
+struct inplace_buf {
+    char *data;
+    off64_t offset;
+    size_t len;
+    int full;
+};
+
+struct inplace_data {
+    int realfd;
+    off64_t size;                       /* bytes to encrypt */
+    unsigned char *used;                /* bit per unit, NULL if all are used */
+    struct inplace_buf bufs[CRYPT_INPLACE_BUFFERS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int reader_done;
+    int error;
+};
+
+static int read_fully(int fd, void *buf, size_t len, off64_t offset)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = pread64(fd, p, len, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        offset += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int write_fully(int fd, const void *buf, size_t len, off64_t offset)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = pwrite64(fd, p, len, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        offset += r;
+        len -= r;
+    }
+    return 0;
+}
+
+struct used_map {
+    unsigned char *bits;                /* bit per unit */
+    off64_t units;
+};
+
+static void mark_used(void *cookie, unsigned long long block,
+                      unsigned long long count, unsigned int block_size)
+{
+    struct used_map *map = cookie;
+    off64_t unit = (off64_t) block * block_size / CRYPT_INPLACE_UNIT;
+    off64_t last = ((off64_t) (block + count) * block_size - 1) / CRYPT_INPLACE_UNIT;
+
+    if (count == 0)
+        return;
+    for (; unit <= last && unit < map->units; unit++)
+        map->bits[unit >> 3] |= 1 << (unit & 7);
+}
+
+/* Returns a bit per CRYPT_INPLACE_UNIT of the first size bytes of dev that
+ * is set when the ext4 filesystem on it uses any block of that unit, or
+ * NULL if every unit has to be encrypted.
+ */
+static unsigned char *get_ext4_used_map(char *dev, off64_t size)
+{
+    struct used_map map;
+    int fd, ret;
+
+    map.units = (size + CRYPT_INPLACE_UNIT - 1) / CRYPT_INPLACE_UNIT;
+    map.bits = calloc((map.units + 7) / 8, 1);
+    if (map.bits == NULL)
+        return NULL;
+    if ((fd = open(dev, O_RDONLY)) < 0) {
+        free(map.bits);
+        return NULL;
+    }
+    ret = ext4_used_blocks(fd, size, CRYPT_INPLACE_UNIT, mark_used, &map);
+    close(fd);
+    if (ret == 0)
+        return map.bits;
+
+    if (ret == EXT4_USED_UNCLEAN)
+        printf("Filesystem was not cleanly unmounted, encrypting every block\n");
+    else if (ret == EXT4_USED_CORRUPT || ret == EXT4_USED_READ_ERROR)
+        printf("Cannot read the ext4 block bitmaps, encrypting every block\n");
+    free(map.bits);
+    return NULL;
+}
+
+static inline int unit_used(struct inplace_data *data, off64_t pos)
+{
+    off64_t unit = pos / CRYPT_INPLACE_UNIT;
+    return data->used == NULL || (data->used[unit >> 3] & (1 << (unit & 7)));
+}
+
+/* Reads runs of used units into the buffers in turn */
+static void *inplace_reader(void *arg)
+{
+    struct inplace_data *data = arg;
+    off64_t pos = 0;
+    int k = 0;
+
+    while (pos < data->size) {
+        struct inplace_buf *buf = &data->bufs[k];
+        size_t len = 0;
+
+        while (pos < data->size && !unit_used(data, pos))
+            pos += CRYPT_INPLACE_UNIT;
+        if (pos >= data->size)
+            break;
+        while (len < CRYPT_INPLACE_BUFSIZE && pos + (off64_t) len < data->size &&
+               unit_used(data, pos + len)) {
+            off64_t left = data->size - (pos + len);
+            len += left < CRYPT_INPLACE_UNIT ? left : CRYPT_INPLACE_UNIT;
+        }
+
+        pthread_mutex_lock(&data->lock);
+        while (buf->full && !data->error)
+            pthread_cond_wait(&data->cond, &data->lock);
+        pthread_mutex_unlock(&data->lock);
+        if (data->error)
+            break;
+
+        if (read_fully(data->realfd, buf->data, len, pos) != 0) {
+            printf("Error reading real_blkdev at %lld for inplace encrypt\n", pos);
+            pthread_mutex_lock(&data->lock);
+            data->error = 1;
+            pthread_cond_broadcast(&data->cond);
+            pthread_mutex_unlock(&data->lock);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&data->lock);
+        buf->offset = pos;
+        buf->len = len;
+        buf->full = 1;
+        pthread_cond_broadcast(&data->cond);
+        pthread_mutex_unlock(&data->lock);
+        pos += len;
+        k = (k + 1) % CRYPT_INPLACE_BUFFERS;
+    }
+
+    pthread_mutex_lock(&data->lock);
+    data->reader_done = 1;
+    pthread_cond_broadcast(&data->cond);
+    pthread_mutex_unlock(&data->lock);
+    return NULL;
+}
+
+static void update_inplace_progress(off64_t sectors_done, off64_t one_pct, off64_t *cur_pct)
+{
+    off64_t new_pct;
+    char buf[8];
+
+    if (one_pct <= 0)
+        return;
+    new_pct = sectors_done / one_pct;
+    if (new_pct > *cur_pct) {
+        *cur_pct = new_pct;
+        snprintf(buf, sizeof(buf), "%lld", new_pct);
+        property_set("vold.encrypt_progress", buf);
+    }
+}
+
+/* size, size_already_done and tot_size are in 512 byte sectors.  On success
+ * size is added to size_already_done; vold.encrypt_progress is the percent
+ * of tot_size done, counting size_already_done.
+ */
 static int cryptfs_enable_inplace(char *crypto_blkdev, char *real_blkdev, off64_t size,
                                   off64_t *size_already_done, off64_t tot_size)
 {
-    int realfd, cryptofd;
-    char *buf[CRYPT_INPLACE_BUFSIZE];
+    struct inplace_data data;
+    pthread_t reader;
+    int cryptofd, i, k = 0;
     int rc = -1;
-    off64_t numblocks, i, remainder;
-    off64_t one_pct, cur_pct, new_pct;
-    off64_t blocks_already_done, tot_numblocks;
+    off64_t written = 0, one_pct, cur_pct = 0;
+    time_t start = time(NULL);
+
+    memset(&data, 0, sizeof(data));
+    pthread_mutex_init(&data.lock, NULL);
+    pthread_cond_init(&data.cond, NULL);
+    data.size = size * 512;
 
-    if ( (realfd = open(real_blkdev, O_RDONLY)) < 0) { 
+    /* Bypass the page cache, every block is read and written once */
+    if ( (data.realfd = open(real_blkdev, O_RDONLY | O_DIRECT)) < 0 &&
+         (data.realfd = open(real_blkdev, O_RDONLY)) < 0) {
         printf("Error opening real_blkdev %s for inplace encrypt\n", real_blkdev);
         return -1;
     }
 
-    if ( (cryptofd = open(crypto_blkdev, O_WRONLY)) < 0) { 
+    if ( (cryptofd = open(crypto_blkdev, O_WRONLY | O_DIRECT)) < 0 &&
+         (cryptofd = open(crypto_blkdev, O_WRONLY)) < 0) {
         printf("Error opening crypto_blkdev %s for inplace encrypt\n", crypto_blkdev);
-        close(realfd);
+        close(data.realfd);
         return -1;
     }
 
-    /* This is pretty much a simple loop of reading 4K, and writing 4K.
-     * The size passed in is the number of 512 byte sectors in the filesystem.
-     * So compute the number of whole 4K blocks we should read/write,
-     * and the remainder.
-     */
-    numblocks = size / CRYPT_SECTORS_PER_BUFSIZE;
-    remainder = size % CRYPT_SECTORS_PER_BUFSIZE;
-    tot_numblocks = tot_size / CRYPT_SECTORS_PER_BUFSIZE;
-    blocks_already_done = *size_already_done / CRYPT_SECTORS_PER_BUFSIZE;
-
-    printf("Encrypting filesystem in place...");
-
-    one_pct = tot_numblocks / 100;
-    cur_pct = 0;
-    /* process the majority of the filesystem in blocks */
-    for (i=0; i<numblocks; i++) {
-        new_pct = (i + blocks_already_done) / one_pct;
-        if (new_pct > cur_pct) {
-            char buf[8];
-
-            cur_pct = new_pct;
-            snprintf(buf, sizeof(buf), "%lld", cur_pct);
-            property_set("vold.encrypt_progress", buf);
-        }
-        if (unix_read(realfd, buf, CRYPT_INPLACE_BUFSIZE) <= 0) {
-            printf("Error reading real_blkdev %s for inplace encrypt\n", crypto_blkdev);
-            goto errout;
-        }
-        if (unix_write(cryptofd, buf, CRYPT_INPLACE_BUFSIZE) <= 0) {
-            printf("Error writing crypto_blkdev %s for inplace encrypt\n", crypto_blkdev);
+    for (i = 0; i < CRYPT_INPLACE_BUFFERS; i++) {
+        /* O_DIRECT needs aligned buffers */
+        data.bufs[i].data = memalign(4096, CRYPT_INPLACE_BUFSIZE);
+        if (!data.bufs[i].data) {
+            printf("Cannot allocate buffers for inplace encrypt\n");
             goto errout;
         }
     }
 
-    /* Do any remaining sectors */
-    for (i=0; i<remainder; i++) {
-        if (unix_read(realfd, buf, 512) <= 0) {
-            printf("Error reading rival sectors from real_blkdev %s for inplace encrypt\n", crypto_blkdev);
-            goto errout;
+    data.used = get_ext4_used_map(real_blkdev, data.size);
+    printf("Encrypting filesystem in place%s...\n", data.used ? ", skipping unused blocks" : "");
+
+    if (pthread_create(&reader, NULL, inplace_reader, &data) != 0) {
+        printf("Cannot start reader for inplace encrypt\n");
+        goto errout;
+    }
+
+    one_pct = tot_size / 100;
+    for (;;) {
+        struct inplace_buf *buf = &data.bufs[k];
+
+        pthread_mutex_lock(&data.lock);
+        while (!buf->full && !data.reader_done && !data.error)
+            pthread_cond_wait(&data.cond, &data.lock);
+        if (!buf->full || data.error) {
+            pthread_mutex_unlock(&data.lock);
+            break;
         }
-        if (unix_write(cryptofd, buf, 512) <= 0) {
-            printf("Error writing final sectors to crypto_blkdev %s for inplace encrypt\n", crypto_blkdev);
-            goto errout;
+        pthread_mutex_unlock(&data.lock);
+
+        if (write_fully(cryptofd, buf->data, buf->len, buf->offset) != 0) {
+            printf("Error writing crypto_blkdev %s for inplace encrypt\n", crypto_blkdev);
+            pthread_mutex_lock(&data.lock);
+            data.error = 1;
+            pthread_cond_broadcast(&data.cond);
+            pthread_mutex_unlock(&data.lock);
+            break;
         }
+        written += buf->len;
+
+        update_inplace_progress((*size_already_done + (buf->offset + buf->len) / 512), one_pct, &cur_pct);
+
+        pthread_mutex_lock(&data.lock);
+        buf->full = 0;
+        pthread_cond_broadcast(&data.cond);
+        pthread_mutex_unlock(&data.lock);
+        k = (k + 1) % CRYPT_INPLACE_BUFFERS;
     }
+    pthread_join(reader, NULL);
+
+    if (data.error || fsync(cryptofd) != 0)
+        goto errout;
 
+    /* Unused blocks at the end were skipped without progress */
+    update_inplace_progress(*size_already_done + size, one_pct, &cur_pct);
+    printf("Encrypted %lld MB, skipped %lld MB of unused blocks in %ld seconds\n",
+           written >> 20, (data.size - written) >> 20, (long) (time(NULL) - start));
     *size_already_done += size;
     rc = 0;
 
 errout:
-    close(realfd);
+    for (i = 0; i < CRYPT_INPLACE_BUFFERS; i++)
+        free(data.bufs[i].data);
+    free(data.used);
+    close(data.realfd);
     close(cryptofd);
+    pthread_cond_destroy(&data.cond);
+    pthread_mutex_destroy(&data.lock);
 
     return rc;
 }
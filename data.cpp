@@ -78,6 +78,41 @@ extern blanktimer blankTimer;
 #endif
 extern bool datamedia;
 
+// Partitions may be backed up on several threads at once while the GUI
+// reads values, so every lookup and change of the value maps holds this lock.
+// The lock is recursive as setting some values sets others.
+static pthread_mutex_t values_lock;
+static pthread_once_t values_lock_once = PTHREAD_ONCE_INIT;
+
+// Backup jobs fork twrpTar while other jobs may hold the lock, it is taken
+// around fork() so the child never inherits it held by a thread it lacks
+static void values_atfork_prepare(void) {
+	pthread_mutex_lock(&values_lock);
+}
+
+static void values_atfork_release(void) {
+	pthread_mutex_unlock(&values_lock);
+}
+
+static void init_values_lock(void) {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&values_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_atfork(values_atfork_prepare, values_atfork_release, values_atfork_release);
+}
+
+static void lock_values(void) {
+	pthread_once(&values_lock_once, init_values_lock);
+	pthread_mutex_lock(&values_lock);
+}
+
+static void unlock_values(void) {
+	pthread_mutex_unlock(&values_lock);
+}
+
 // Device ID functions
 void DataManager::sanitize_device_id(char* device_id) {
 	const char* whitelist ="abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890-._";
@@ -220,9 +255,11 @@ void DataManager::get_device_id(void) {
 
 int DataManager::ResetDefaults()
 {
+	lock_values();
 	mValues.clear();
 	mConstValues.clear();
 	SetDefaultValues();
+	unlock_values();
 	return 0;
 }
 
@@ -269,6 +306,7 @@ int DataManager::LoadValues(const string filename)
 
 		map<string, TStrIntPair>::iterator pos;
 
+		lock_values();
 		pos = mValues.find(Name);
 		if (pos != mValues.end())
 		{
@@ -277,10 +315,13 @@ int DataManager::LoadValues(const string filename)
 		}
 		else
 			mValues.insert(TNameValuePair(Name, TStrIntPair(Value, 1)));
+		unlock_values();
 #ifndef TW_NO_SCREEN_TIMEOUT
 		if (Name == "tw_screen_timeout_secs")
 			blankTimer.setTime(atoi(Value.c_str()));
 #endif
+		if (Name == "tw_log_level")
+			twlog_level = atoi(Value.c_str());
 	}
 error:
 	fclose(in);
@@ -319,6 +360,7 @@ int DataManager::SaveValues()
 	fwrite(&file_version, 1, sizeof(int), out);
 
 	map<string, TStrIntPair>::iterator iter;
+	lock_values();
 	for (iter = mValues.begin(); iter != mValues.end(); ++iter)
 	{
 		// Save only the persisted data
@@ -332,12 +374,23 @@ int DataManager::SaveValues()
 			fwrite(iter->second.first.c_str(), 1, length, out);
 		}
 	}
+	unlock_values();
 	fclose(out);
 #endif // ifdef TW_OEM_BUILD
 	return 0;
 }
 
 int DataManager::GetValue(const string varName, string& value)
+{
+	int ret;
+
+	lock_values();
+	ret = GetValueLocked(varName, value);
+	unlock_values();
+	return ret;
+}
+
+int DataManager::GetValueLocked(const string& varName, string& value)
 {
 	string localStr = varName;
 
@@ -407,19 +460,24 @@ unsigned long long DataManager::GetValue(const string varName, unsigned long lon
 // This is a dangerous function. It will create the value if it doesn't exist so it has a valid c_str
 string& DataManager::GetValueRef(const string varName)
 {
+	lock_values();
 	if (!mInitialized)
 		SetDefaultValues();
 
 	map<string, string>::iterator constPos;
 	constPos = mConstValues.find(varName);
 	if (constPos != mConstValues.end())
+	{
+		unlock_values();
 		return constPos->second;
+	}
 
 	map<string, TStrIntPair>::iterator pos;
 	pos = mValues.find(varName);
 	if (pos == mValues.end())
 		pos = (mValues.insert(TNameValuePair(varName, TStrIntPair("", 0)))).first;
 
+	unlock_values();
 	return pos->second.first;
 }
 
@@ -442,6 +500,16 @@ int DataManager::GetIntValue(const string varName)
 }
 
 int DataManager::SetValue(const string varName, string value, int persist /* = 0 */)
+{
+	int ret;
+
+	lock_values();
+	ret = SetValueLocked(varName, value, persist);
+	unlock_values();
+	return ret;
+}
+
+int DataManager::SetValueLocked(const string& varName, const string& value, int persist)
 {
 	if (!mInitialized)
 		SetDefaultValues();
@@ -472,6 +540,8 @@ int DataManager::SetValue(const string varName, string value, int persist /* = 0
 #endif
 	if (varName == "tw_storage_path") {
 		SetBackupFolder();
+	} else if (varName == "tw_log_level") {
+		twlog_level = atoi(value.c_str());
 	}
 	gui_notifyVarChange(varName.c_str(), value.c_str());
 	return 0;
@@ -533,8 +603,10 @@ void DataManager::DumpValues()
 {
 	map<string, TStrIntPair>::iterator iter;
 	gui_print("Data Manager dump - Values with leading X are persisted.\n");
+	lock_values();
 	for (iter = mValues.begin(); iter != mValues.end(); ++iter)
 		gui_print("%c %s=%s\n", iter->second.second ? 'X' : ' ', iter->first.c_str(), iter->second.first.c_str());
+	unlock_values();
 }
 
 void DataManager::update_tz_environment_variables(void)
@@ -755,6 +827,14 @@ void DataManager::SetDefaultValues()
 	mValues.insert(make_pair(TW_RM_RF_VAR, make_pair("0", 1)));
 	mValues.insert(make_pair(TW_SKIP_MD5_CHECK_VAR, make_pair("0", 1)));
 	mValues.insert(make_pair(TW_SKIP_MD5_GENERATE_VAR, make_pair("0", 1)));
+	mValues.insert(make_pair(TW_SPARSE_IMAGES_VAR, make_pair("0", 1)));
+	mValues.insert(make_pair(TW_BACKUP_IO_JOBS_VAR, make_pair("1", 1)));
+	mValues.insert(make_pair(TW_BACKUP_CPU_JOBS_VAR, make_pair("1", 1)));
+	mValues.insert(make_pair(TW_COMPRESSION_LEVEL_VAR, make_pair("6", 1)));
+	mValues.insert(make_pair(TW_COMPRESSION_LEVELS_VAR, make_pair("", 1)));
+	mValues.insert(make_pair(TW_ADAPTIVE_COMPRESSION_VAR, make_pair("1", 1)));
+	// Other tar readers restore references as hard links, so it is opt in
+	mValues.insert(make_pair(TW_BACKUP_DEDUP_VAR, make_pair("0", 1)));
 	mValues.insert(make_pair(TW_SDEXT_SIZE, make_pair("512", 1)));
 	mValues.insert(make_pair(TW_SWAP_SIZE, make_pair("32", 1)));
 	mValues.insert(make_pair(TW_SDPART_FILE_SYSTEM, make_pair("ext3", 1)));
@@ -762,6 +842,7 @@ void DataManager::SetDefaultValues()
 	mValues.insert(make_pair(TW_TIME_ZONE_GUIOFFSET, make_pair("0", 1)));
 	mValues.insert(make_pair(TW_TIME_ZONE_GUIDST, make_pair("1", 1)));
 	mValues.insert(make_pair(TW_ACTION_BUSY, make_pair("0", 0)));
+	mValues.insert(make_pair(TW_ETA_VAR, make_pair("", 0)));
 	mValues.insert(make_pair("tw_wipe_cache", make_pair("0", 0)));
 	mValues.insert(make_pair("tw_wipe_dalvik", make_pair("0", 0)));
 	if (GetIntValue(TW_HAS_INTERNAL) == 1 && GetIntValue(TW_HAS_DATA_MEDIA) == 1 && GetIntValue(TW_HAS_EXTERNAL) == 0)
@@ -781,6 +862,7 @@ void DataManager::SetDefaultValues()
 	mValues.insert(make_pair("tw_background_thread_running", make_pair("0", 0)));
 	mValues.insert(make_pair(TW_RESTORE_FILE_DATE, make_pair("0", 0)));
 	mValues.insert(make_pair("tw_military_time", make_pair("0", 1)));
+	mValues.insert(make_pair("tw_log_level", make_pair("1", 1)));
 #ifdef TW_NO_SCREEN_TIMEOUT
 	mValues.insert(make_pair("tw_screen_timeout_secs", make_pair("0", 1)));
 	mValues.insert(make_pair("tw_no_screen_timeout", make_pair("1", 1)));
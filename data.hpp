@@ -79,6 +79,8 @@ protected:
 
 protected:
 	static int SaveValues();
+	static int SetValueLocked(const string& varName, const string& value, int persist);
+	static int GetValueLocked(const string& varName, string& value);
 
 	static int GetMagicValue(string varName, string& value);
 
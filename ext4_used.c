@@ -0,0 +1,149 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "ext4_used.h"
+
+// ext4 on disk layout, see fs/ext4/ext4.h in the kernel
+#define EXT4_SUPER_MAGIC        0xEF53
+#define EXT4_VALID_FS           0x0001
+#define EXT4_BG_BLOCK_UNINIT    0x0002
+#define EXT4_FEATURE_INCOMPAT_RECOVER   0x0004
+#define EXT4_FEATURE_INCOMPAT_META_BG   0x0010
+#define EXT4_FEATURE_INCOMPAT_64BIT     0x0080
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM         0x0010
+#define EXT4_FEATURE_RO_COMPAT_BIGALLOC         0x0200
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM    0x0400
+
+static inline uint16_t le16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int read_fully(int fd, void *buf, size_t len, off64_t offset) {
+	char *p = (char*) buf;
+
+	while (len > 0) {
+		ssize_t ret = pread64(fd, p, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+int ext4_used_blocks(int fd, unsigned long long size, unsigned max_block_size, ext4_mark_used_t mark, void *cookie) {
+	unsigned char sb[1024], *gdt = NULL, *bitmap = NULL;
+	unsigned long long blocks_count, first_data_block, groups, group, i;
+	unsigned block_size, blocks_per_group, inodes_per_group, inode_size, desc_size;
+	uint32_t incompat, ro_compat;
+	int ret = 0;
+
+	if (read_fully(fd, sb, sizeof(sb), 1024) != 0 || le16(sb + 56) != EXT4_SUPER_MAGIC)
+		return EXT4_USED_NOT_EXT4;
+	incompat = le32(sb + 96);
+	ro_compat = le32(sb + 100);
+	if (!(le16(sb + 58) & EXT4_VALID_FS) || (incompat & EXT4_FEATURE_INCOMPAT_RECOVER))
+		return EXT4_USED_UNCLEAN;
+	if ((incompat & EXT4_FEATURE_INCOMPAT_META_BG) || (ro_compat & EXT4_FEATURE_RO_COMPAT_BIGALLOC))
+		return EXT4_USED_UNSUPPORTED;
+
+	block_size = 1024 << le32(sb + 24);
+	blocks_count = le32(sb + 4);
+	desc_size = 32;
+	if (incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		blocks_count |= (unsigned long long) le32(sb + 0x150) << 32;
+		desc_size = le16(sb + 0xFE);
+	}
+	first_data_block = le32(sb + 20);
+	blocks_per_group = le32(sb + 32);
+	inodes_per_group = le32(sb + 40);
+	inode_size = le32(sb + 76) >= 1 ? le16(sb + 88) : 128;
+	if (block_size > max_block_size)
+		return EXT4_USED_UNSUPPORTED;
+	if (blocks_per_group == 0 || blocks_per_group > block_size * 8 || desc_size < 32 || desc_size > block_size ||
+		blocks_count <= first_data_block || blocks_count * block_size > size)
+		return EXT4_USED_CORRUPT;
+
+	groups = (blocks_count - first_data_block + blocks_per_group - 1) / blocks_per_group;
+	gdt = (unsigned char*) malloc(groups * desc_size);
+	bitmap = (unsigned char*) malloc(block_size);
+	if (gdt == NULL || bitmap == NULL || read_fully(fd, gdt, groups * desc_size, (off64_t) (first_data_block + 1) * block_size) != 0) {
+		ret = EXT4_USED_READ_ERROR;
+		goto exit;
+	}
+
+	// Boot block, superblock and everything past the end of the filesystem
+	mark(cookie, 0, first_data_block + 1, block_size);
+	mark(cookie, blocks_count, (size + block_size - 1) / block_size - blocks_count, block_size);
+
+	for (group = 0; group < groups; group++) {
+		const unsigned char *desc = gdt + group * desc_size;
+		unsigned long long start = first_data_block + group * blocks_per_group;
+		unsigned long long count = blocks_count - start < blocks_per_group ? blocks_count - start : blocks_per_group;
+		unsigned long long block_bitmap = le32(desc), inode_bitmap = le32(desc + 4), inode_table = le32(desc + 8);
+		unsigned long long free_blocks = le16(desc + 12);
+
+		if (desc_size >= 64) {
+			block_bitmap |= (unsigned long long) le32(desc + 0x20) << 32;
+			inode_bitmap |= (unsigned long long) le32(desc + 0x24) << 32;
+			inode_table |= (unsigned long long) le32(desc + 0x28) << 32;
+			free_blocks |= (unsigned long long) le16(desc + 0x2C) << 16;
+		}
+		if (block_bitmap >= blocks_count || inode_bitmap >= blocks_count || inode_table >= blocks_count || free_blocks > count) {
+			ret = EXT4_USED_CORRUPT;
+			goto exit;
+		}
+
+		// Flex groups keep the metadata of a group in another one
+		mark(cookie, block_bitmap, 1, block_size);
+		mark(cookie, inode_bitmap, 1, block_size);
+		mark(cookie, inode_table, ((unsigned long long) inodes_per_group * inode_size + block_size - 1) / block_size, block_size);
+
+		if ((le16(desc + 18) & EXT4_BG_BLOCK_UNINIT) && (ro_compat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM | EXT4_FEATURE_RO_COMPAT_METADATA_CSUM))) {
+			// No bitmap yet, the only used blocks are the superblock
+			// and descriptor backups at the start of the group
+			mark(cookie, start, count - free_blocks, block_size);
+			continue;
+		}
+		if (read_fully(fd, bitmap, block_size, (off64_t) block_bitmap * block_size) != 0) {
+			ret = EXT4_USED_READ_ERROR;
+			goto exit;
+		}
+		for (i = 0; i < count; i++) {
+			if (bitmap[i >> 3] & (1 << (i & 7)))
+				mark(cookie, start + i, 1, block_size);
+		}
+	}
+
+exit:
+	free(gdt);
+	free(bitmap);
+	return ret;
+}
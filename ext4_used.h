@@ -0,0 +1,47 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EXT4_USED_H
+#define EXT4_USED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reasons ext4_used_blocks gives up, every block has to be treated as used then
+#define EXT4_USED_NOT_EXT4      -1   // No ext4 superblock
+#define EXT4_USED_UNCLEAN       -2   // Not cleanly unmounted, the bitmaps may be stale
+#define EXT4_USED_UNSUPPORTED   -3   // meta_bg, bigalloc or blocks larger than max_block_size
+#define EXT4_USED_CORRUPT       -4   // A group descriptor points outside the filesystem
+#define EXT4_USED_READ_ERROR    -5
+
+// Called for every run of used filesystem blocks, runs may overlap
+typedef void (*ext4_mark_used_t)(void *cookie, unsigned long long block, unsigned long long count, unsigned block_size);
+
+// Reads the block bitmaps of the ext4 filesystem in the first size bytes of
+// fd and calls mark for every used block, including the boot block and all
+// blocks past the end of the filesystem (like the crypto footer of /data).
+// Returns 0 or one of the EXT4_USED_ errors, blocks may have been marked
+// before an error was found.
+int ext4_used_blocks(int fd, unsigned long long size, unsigned max_block_size, ext4_mark_used_t mark, void *cookie);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // EXT4_USED_H
@@ -27,7 +27,9 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
-#include "gui/rapidxml.hpp"
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include "fixPermissions.hpp"
 #include "twrp-functions.hpp"
 #include "twcommon.h"
@@ -39,121 +41,205 @@
 #endif
 
 using namespace std;
-using namespace rapidxml;
+
+#define FIX_PERMS_THREADS 4
 
 #ifdef HAVE_SELINUX
 struct selabel_handle *sehandle;
 struct selinux_opt selinux_options[] = {
 	{ SELABEL_OPT_PATH, "/file_contexts" }
 };
+static pthread_mutex_t selabel_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-int fixPermissions::restorecon(string entry, struct stat *sb) {
+// Sets the SELinux context of path to what file_contexts says it should be.
+// Directories are labeled through their open fd, other entries by path.
+void fixPermissions::fixContext(int fd, const string& path, mode_t mode) {
+#ifdef HAVE_SELINUX
 	char *oldcontext, *newcontext;
-	if (lgetfilecon(entry.c_str(), &oldcontext) < 0) {
-		LOGINFO("Couldn't get selinux context for %s\n", entry.c_str());
-		return -1;
+	int ret;
+
+	if (!fix_contexts)
+		return;
+	ret = (fd >= 0) ? fgetfilecon(fd, &oldcontext) : lgetfilecon(path.c_str(), &oldcontext);
+	if (ret < 0) {
+		LOGINFO("Couldn't get selinux context for %s\n", path.c_str());
+		return;
 	}
-	if (selabel_lookup(sehandle, &newcontext, entry.c_str(), sb->st_mode) < 0) {
-		LOGINFO("Couldn't lookup selinux context for %s\n", entry.c_str());
-		return -1;
+	pthread_mutex_lock(&selabel_lock);
+	ret = selabel_lookup(sehandle, &newcontext, path.c_str(), mode);
+	pthread_mutex_unlock(&selabel_lock);
+	if (ret < 0) {
+		LOGINFO("Couldn't lookup selinux context for %s\n", path.c_str());
+		freecon(oldcontext);
+		return;
 	}
 	if (strcmp(oldcontext, newcontext) != 0) {
-		LOGINFO("Relabeling %s from %s to %s\n", entry.c_str(), oldcontext, newcontext);
-		if (lsetfilecon(entry.c_str(), newcontext) < 0) {
-			LOGINFO("Couldn't label %s with %s: %s\n", entry.c_str(), newcontext, strerror(errno));
-		}
+		LOGINFO("Relabeling %s from %s to %s\n", path.c_str(), oldcontext, newcontext);
+		ret = (fd >= 0) ? fsetfilecon(fd, newcontext) : lsetfilecon(path.c_str(), newcontext);
+		if (ret < 0)
+			LOGINFO("Couldn't label %s with %s: %s\n", path.c_str(), newcontext, strerror(errno));
+		else
+			__sync_fetch_and_add(&changed_contexts, 1);
 	}
 	freecon(oldcontext);
 	freecon(newcontext);
-	return 0;
+#endif
 }
 
-int fixPermissions::fixDataDataContexts(void) {
-	string dir = "/data/data/";
-	sehandle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
-	if (!sehandle) {
-		LOGINFO("Unable to open /file_contexts\n");
-		return 0;
+// Only calls chown / chmod when the owner or mode is actually different
+int fixPermissions::fixOwnerMode(int dirfd, const char* name, const string& path, const struct stat& st, uid_t uid, gid_t gid, mode_t mode) {
+	int ret = 0;
+
+	if (st.st_uid != uid || st.st_gid != gid) {
+		if (debug)
+			LOGINFO("Fixing %s, uid: %d, gid: %d\n", path.c_str(), uid, gid);
+		if (fchownat(dirfd, name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0) {
+			LOGERR("Unable to chown '%s' %i %i\n", path.c_str(), uid, gid);
+			ret = -1;
+		} else {
+			__sync_fetch_and_add(&changed_owners, 1);
+		}
 	}
-	if (TWFunc::Path_Exists(dir)) {
-		fixContextsRecursively(dir, 0);
+	if ((st.st_mode & 07777) != mode) {
+		if (debug)
+			LOGINFO("Fixing %s, mode: %04o\n", path.c_str(), mode);
+		if (fchmodat(dirfd, name, mode, 0) != 0) {
+			LOGERR("Unable to chmod '%s' %04o\n", path.c_str(), mode);
+			ret = -1;
+		} else {
+			__sync_fetch_and_add(&changed_modes, 1);
+		}
 	}
-	selabel_close(sehandle);
-	return 0;
+	if (ret != 0)
+		__sync_fetch_and_add(&errors, 1);
+	return ret;
 }
 
-int fixPermissions::fixContextsRecursively(string name, int level) {
-	DIR *d;
-	struct dirent *de;
-	struct stat sb;
-	string path;
+int fixPermissions::fixPathOwnerMode(const string& path, uid_t uid, gid_t gid, mode_t mode) {
+	struct stat st;
 
-	if (!(d = opendir(name.c_str())))
-		return -1;
-	if (!(de = readdir(d)))
+	if (lstat(path.c_str(), &st) != 0) {
+		LOGERR("Unable to stat '%s'\n", path.c_str());
 		return -1;
+	}
+	__sync_fetch_and_add(&entries, 1);
+	return fixOwnerMode(AT_FDCWD, path.c_str(), path, st, uid, gid, mode);
+}
 
-	do {
-		if (de->d_type ==  DT_DIR) {
-			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
-				continue;
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
-			fixContextsRecursively(path, level + 1);
+// Walks the directory open on fd. Package data directories (pkg set, level 0)
+// get their owner and mode fixed along with the files directly inside them,
+// every entry gets its context fixed. Takes ownership of fd.
+void fixPermissions::fixTree(int fd, const string& path, int level, const packageList::entry* pkg, mode_t file_mode) {
+	DIR* d = fdopendir(fd);
+	struct dirent* de;
+	struct stat st;
+
+	if (d == NULL) {
+		LOGERR("Error opening '%s'\n", path.c_str());
+		close(fd);
+		__sync_fetch_and_add(&errors, 1);
+		return;
+	}
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		string entry = path + "/" + de->d_name;
+		if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			LOGINFO("Unable to stat '%s'\n", entry.c_str());
+			continue;
 		}
-		else {
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
+		__sync_fetch_and_add(&entries, 1);
+		if (S_ISDIR(st.st_mode)) {
+			mode_t child_file_mode = 0;
+			if (pkg && level == 0) {
+				uid_t uid = pkg->uid;
+				gid_t gid = pkg->uid;
+				mode_t dir_mode = 0771;
+				child_file_mode = 0755;
+				if (strcmp(de->d_name, "lib") == 0) {
+					uid = gid = 1000;
+					dir_mode = 0755;
+				} else if (strcmp(de->d_name, "shared_prefs") == 0 || strcmp(de->d_name, "databases") == 0) {
+					child_file_mode = 0660;
+				} else if (strcmp(de->d_name, "cache") == 0) {
+					child_file_mode = 0600;
+				}
+				fixOwnerMode(dirfd(d), de->d_name, entry, st, uid, gid, dir_mode);
+			}
+			if (!fix_contexts && !child_file_mode)
+				continue;
+			int child = openat(dirfd(d), de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+			if (child < 0) {
+				LOGINFO("Unable to open '%s'\n", entry.c_str());
+				continue;
+			}
+			fixContext(child, entry, st.st_mode);
+			fixTree(child, entry, level + 1, pkg, child_file_mode);
+		} else {
+			if (pkg && file_mode && S_ISREG(st.st_mode))
+				fixOwnerMode(dirfd(d), de->d_name, entry, st, pkg->uid, pkg->uid, file_mode);
+			fixContext(-1, entry, st.st_mode);
 		}
-	} while (de = readdir(d));
+	}
 	closedir(d);
-	return 0;
 }
 
 int fixPermissions::fixDataInternalContexts(void) {
+#ifdef HAVE_SELINUX
 	DIR *d;
 	struct dirent *de;
 	struct stat sb;
 	string dir, androiddir;
+	int fd;
+
 	sehandle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
 	if (!sehandle) {
 		LOGINFO("Unable to open /file_contexts\n");
 		return 0;
 	}
+	fix_contexts = true;
 	if (TWFunc::Path_Exists("/data/media/0"))
 		dir = "/data/media/0";
 	else
 		dir = "/data/media";
 	if (!TWFunc::Path_Exists(dir)) {
 		LOGINFO("fixDataInternalContexts: '%s' does not exist!\n", dir.c_str());
+		selabel_close(sehandle);
+		fix_contexts = false;
 		return 0;
 	}
 	LOGINFO("Fixing %s contexts\n", dir.c_str());
-	restorecon(dir, &sb);
+	if (lstat(dir.c_str(), &sb) == 0)
+		fixContext(-1, dir, sb.st_mode);
 	d = opendir(dir.c_str());
-
-	while (( de = readdir(d)) != NULL) {
-		stat(de->d_name, &sb);
-		string f;
-		f = dir + "/" + de->d_name;
-		restorecon(f, &sb);
+	if (d != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+				continue;
+			if (fstatat(dirfd(d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+				fixContext(-1, dir + "/" + de->d_name, sb.st_mode);
+		}
+		closedir(d);
 	}
-	closedir(d);
 
-	androiddir = dir + "/Android/";
-	if (TWFunc::Path_Exists(androiddir)) {
-		fixContextsRecursively(androiddir, 0);
-	}
+	androiddir = dir + "/Android";
+	fd = open(androiddir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+		fixTree(fd, androiddir, 1, NULL, 0);
 	selabel_close(sehandle);
+	fix_contexts = false;
+#endif
 	return 0;
 }
-#endif
 
 int fixPermissions::fixPerms(bool enable_debug, bool remove_data_for_missing_apps) {
 	packageFile = "/data/system/packages.xml";
 	debug = enable_debug;
 	remove_data = remove_data_for_missing_apps;
 	multi_user = TWFunc::Path_Exists("/data/user");
+	entries = changed_owners = changed_modes = changed_contexts = errors = 0;
+	fix_contexts = false;
 
 	if (!(TWFunc::Path_Exists(packageFile))) {
 		gui_print("Can't check permissions\n");
@@ -179,13 +265,22 @@ int fixPermissions::fixPerms(bool enable_debug, bool remove_data_for_missing_app
 		return -1;
 	}
 
+#ifdef HAVE_SELINUX
+	sehandle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
+	if (!sehandle)
+		LOGINFO("Unable to open /file_contexts\n");
+	else
+		fix_contexts = true;
+#endif
+
+	int ret = 0;
 	if (multi_user) {
 		DIR *d = opendir("/data/user");
 		string new_path, user_id;
 
 		if (d == NULL) {
 			LOGERR("Error opening '/data/user'\n");
-			return -1;
+			ret = -1;
 		}
 
 		if (d) {
@@ -219,155 +314,84 @@ int fixPermissions::fixPerms(bool enable_debug, bool remove_data_for_missing_app
 				}
 				gui_print("Fixing %s permissions...\n", new_path.c_str());
 				if ((fixDataData(new_path)) != 0) {
-					closedir(d);
-					return -1;
+					ret = -1;
+					break;
 				}
 			}
 			closedir(d);
 		}
 	} else {
 		gui_print("Fixing /data/data permissions...\n");
-		if ((fixDataData("/data/data/")) != 0) {
-			return -1;
+		if ((fixDataData("/data/data")) != 0) {
+			ret = -1;
 		}
 	}
-	#ifdef HAVE_SELINUX
-	gui_print("Fixing /data/data/ contexts.\n");
-	fixDataDataContexts();
+#ifdef HAVE_SELINUX
+	if (fix_contexts) {
+		selabel_close(sehandle);
+		fix_contexts = false;
+	}
 	fixDataInternalContexts();
-	#endif
+#endif
+	LOGINFO("Checked %lu entries, changed %lu owners, %lu modes and %lu contexts, %lu errors.\n", entries, changed_owners, changed_modes, changed_contexts, errors);
+	if (ret != 0)
+		return ret;
+	gui_print("Checked %lu entries, made %lu changes.\n", entries, changed_owners + changed_modes + changed_contexts);
 	gui_print("Done fixing permissions.\n");
 	return 0;
 }
 
-int fixPermissions::pchown(string fn, int puid, int pgid) {
-	LOGINFO("Fixing %s, uid: %d, gid: %d\n", fn.c_str(), puid, pgid);
-	if (chown(fn.c_str(), puid, pgid) != 0) {
-		LOGERR("Unable to chown '%s' %i %i\n", fn.c_str(), puid, pgid);
-		return -1;
-	}
-	return 0;
+// Directory holding the package's apk, or an empty string if codePath is missing
+static string appDir(const packageList::entry& pkg) {
+	if (pkg.codePath == NULL)
+		return "";
+	const char* slash = strrchr(pkg.codePath, '/');
+	if (slash == NULL)
+		return ".";
+	return string(pkg.codePath, slash - pkg.codePath);
 }
 
-int fixPermissions::pchmod(string fn, string mode) {
-	long mask = 0;
-	LOGINFO("Fixing %s, mode: %s\n", fn.c_str(), mode.c_str());
-	for ( std::string::size_type n = 0; n < mode.length(); ++n) {
-		if (n == 0) {
-			if (mode[n] == '0')
-				continue;
-			else if (mode[n] == '1')
-				mask = S_ISVTX;
-			else if (mode[n] == '2')
-				mask = S_ISGID;
-		}
-		else if (n == 1) {
-			if (mode[n] == '7') {
-				mask |= S_IRWXU;
-			}
-			if (mode[n] == '6') {
-				mask |= S_IRUSR;
-				mask |= S_IWUSR;
-			}
-			if (mode[n] == '5') {
-				mask |= S_IRUSR;
-				mask |= S_IXUSR;
-			}
-			if (mode[n] == '4')
-				mask |= S_IRUSR;
-			if (mode[n] == '3') {
-				mask |= S_IWUSR;
-				mask |= S_IRUSR;
-			}
-			if (mode[n] == '2')
-				mask |= S_IWUSR;
-			if (mode[n] == '1')
-				mask |= S_IXUSR;
-		}
-		else if (n == 2) {
-			if (mode[n] == '7') {
-				mask |= S_IRWXG;
-			}
-			if (mode[n] == '6') {
-				mask |= S_IRGRP;
-				mask |= S_IWGRP;
-			}
-			if (mode[n] == '5') {
-				mask |= S_IRGRP;
-				mask |= S_IXGRP;
-			}
-			if (mode[n] == '4')
-				mask |= S_IRGRP;
-			if (mode[n] == '3') {
-				mask |= S_IWGRP;
-				mask |= S_IXGRP;
-			}
-			if (mode[n] == '2')
-				mask |= S_IWGRP;
-			if (mode[n] == '1')
-				mask |= S_IXGRP;
-		}
-		else if (n == 3) {
-			if (mode[n] == '7') {
-				mask |= S_IRWXO;
-			}
-			if (mode[n] == '6') {
-				mask |= S_IROTH;
-				mask |= S_IWOTH;
-			}
-			if (mode[n] == '5') {
-				mask |= S_IROTH;
-				mask |= S_IXOTH;
-			}
-			if (mode[n] == '4')
-				mask |= S_IROTH;
-			if (mode[n] == '3') {
-				mask |= S_IWOTH;
-				mask |= S_IXOTH;
-			}
-			if (mode[n] == '2')
-				mask |= S_IWOTH;
-			if (mode[n] == '1')
-				mask |= S_IXOTH;
-		}
-	}
+static bool skipPackage(const packageList::entry& pkg) {
+	return pkg.codePath != NULL && (strcmp(pkg.codePath, "/system/framework/framework-res.apk") == 0 ||
+		strcmp(pkg.codePath, "/system/framework/com.htc.resources.apk") == 0);
+}
+
+// Removes the data directory of a package whose apk is gone
+int fixPermissions::removeMissingAppData(const packageList::entry& pkg, const string& dir) {
+	string dDir = pkg.name;
 
-	if (chmod(fn.c_str(), mask) != 0) {
-		LOGERR("Unable to chmod '%s' %l\n", fn.c_str(), mask);
+	if (!remove_data || !TWFunc::Path_Exists(dDir) || dir.size() < 9 || dir.substr(0, 9) == "/mnt/asec")
+		return 0;
+	if (debug)
+		LOGINFO("Looking at '%s', removing data dir: '%s', appDir: '%s'", pkg.codePath, dDir.c_str(), dir.c_str());
+	if (TWFunc::removeDir(dDir, false) != 0) {
+		LOGINFO("Unable to removeDir '%s'\n", dDir.c_str());
 		return -1;
 	}
-
 	return 0;
 }
 
 int fixPermissions::fixSystemApps() {
-	temp = head;
-	while (temp != NULL) {
-		if (TWFunc::Path_Exists(temp->codePath)) {
-			if (temp->appDir.compare("/system/app") == 0 || temp->appDir.compare("/system/priv-app") == 0) {
+	for (size_t i = 0; i < packages.size(); i++) {
+		const packageList::entry& pkg = packages.at(i);
+		string dir = appDir(pkg);
+
+		if (skipPackage(pkg))
+			continue;
+		if (pkg.codePath != NULL && TWFunc::Path_Exists(pkg.codePath)) {
+			if (dir == "/system/app" || dir == "/system/priv-app") {
 				if (debug)	{
-					LOGINFO("Looking at '%s'\n", temp->codePath.c_str());
-					LOGINFO("Fixing permissions on '%s'\n", temp->pkgName.c_str());
-					LOGINFO("Directory: '%s'\n", temp->appDir.c_str());
-					LOGINFO("Original package owner: %d, group: %d\n", temp->uid, temp->gid);
+					LOGINFO("Looking at '%s'\n", pkg.codePath);
+					LOGINFO("Fixing permissions on '%s'\n", pkg.name);
+					LOGINFO("Directory: '%s'\n", dir.c_str());
+					LOGINFO("Original package owner: %d, group: %d\n", pkg.uid, pkg.uid);
 				}
-				if (pchown(temp->codePath, 0, 0) != 0)
+				if (fixPathOwnerMode(pkg.codePath, 0, 0, 0644) != 0)
 					return -1;
-				if (pchmod(temp->codePath, "0644") != 0)
-					return -1;
-			}
-		} else {
-			//Remove data directory since app isn't installed
-			if (remove_data && TWFunc::Path_Exists(temp->dDir) && temp->appDir.size() >= 9 && temp->appDir.substr(0, 9) != "/mnt/asec") {
-				if (debug)
-					LOGINFO("Looking at '%s', removing data dir: '%s', appDir: '%s'", temp->codePath.c_str(), temp->dDir.c_str(), temp->appDir.c_str());
-				if (TWFunc::removeDir(temp->dDir, false) != 0) {
-					LOGINFO("Unable to removeDir '%s'\n", temp->dDir.c_str());
-					return -1;
-				}
 			}
+		} else if (removeMissingAppData(pkg, dir) != 0) {
+			return -1;
 		}
-		temp = temp->next;
 	}
 	return 0;
 }
@@ -375,308 +399,161 @@ int fixPermissions::fixSystemApps() {
 int fixPermissions::fixDataApps() {
 	bool fix = false;
 	int new_gid = 0;
-	string perms = "0000";
+	mode_t perms = 0;
+
+	for (size_t i = 0; i < packages.size(); i++) {
+		const packageList::entry& pkg = packages.at(i);
+		string dir = appDir(pkg);
 
-	temp = head;
-	while (temp != NULL) {
-		if (TWFunc::Path_Exists(temp->codePath)) {
-			if (temp->appDir.compare("/data/app") == 0 || temp->appDir.compare("/sd-ext/app") == 0) {
+		if (skipPackage(pkg))
+			continue;
+		if (pkg.codePath != NULL && TWFunc::Path_Exists(pkg.codePath)) {
+			if (dir == "/data/app" || dir == "/sd-ext/app") {
 				fix = true;
 				new_gid = 1000;
-				perms = "0644";
-			} else if (temp->appDir.compare("/data/app-private") == 0 || temp->appDir.compare("/sd-ext/app-private") == 0) {
+				perms = 0644;
+			} else if ((dir == "/data/app-private" || dir == "/sd-ext/app-private") && pkg.uid >= 0) {
 				fix = true;
-				new_gid = temp->gid;
-				perms = "0640";
+				new_gid = pkg.uid;
+				perms = 0640;
 			} else
 				fix = false;
 			if (fix) {
 				if (debug) {
-					LOGINFO("Looking at '%s'\n", temp->codePath.c_str());
-					LOGINFO("Fixing permissions on '%s'\n", temp->pkgName.c_str());
-					LOGINFO("Directory: '%s'\n", temp->appDir.c_str());
-					LOGINFO("Original package owner: %d, group: %d\n", temp->uid, temp->gid);
+					LOGINFO("Looking at '%s'\n", pkg.codePath);
+					LOGINFO("Fixing permissions on '%s'\n", pkg.name);
+					LOGINFO("Directory: '%s'\n", dir.c_str());
+					LOGINFO("Original package owner: %d, group: %d\n", pkg.uid, pkg.uid);
 				}
-				if (pchown(temp->codePath, 1000, new_gid) != 0)
-					return -1;
-				if (pchmod(temp->codePath, perms) != 0)
+				if (fixPathOwnerMode(pkg.codePath, 1000, new_gid, perms) != 0)
 					return -1;
 			}
-		} else {
-			//Remove data directory since app isn't installed
-			if (remove_data && TWFunc::Path_Exists(temp->dDir) && temp->appDir.size() >= 9 && temp->appDir.substr(0, 9) != "/mnt/asec") {
-				if (debug)
-					LOGINFO("Looking at '%s', removing data dir: '%s', appDir: '%s'", temp->codePath.c_str(), temp->dDir.c_str(), temp->appDir.c_str());
-				if (TWFunc::removeDir(temp->dDir, false) != 0) {
-					LOGINFO("Unable to removeDir '%s'\n", temp->dDir.c_str());
-					return -1;
-				}
-			}
+		} else if (removeMissingAppData(pkg, dir) != 0) {
+			return -1;
 		}
-		temp = temp->next;
 	}
 	return 0;
 }
 
-int fixPermissions::fixAllFiles(string directory, int gid, int uid, string file_perms) {
-	vector <string> files;
-	string file;
+struct fixDataDataJobs {
+	fixPermissions* perms;
+	int dirfd;                                // Open data directory
+	string dataDir;
+	vector<string> names;                     // Entries of the data directory
+	size_t next;                              // Next entry to be picked up by a worker
+	pthread_mutex_t lock;
+};
 
-	files = listAllFiles(directory);
-	for (unsigned i = 0; i < files.size(); ++i) {
-		file = directory + "/";
-		file.append(files.at(i));
-		if (debug)
-			LOGINFO("Looking at file '%s'\n", file.c_str());
-		if (pchmod(file, file_perms) != 0)
-			return -1;
-		if (pchown(file, uid, gid) != 0)
-			return -1;
-	}
-	return 0;
-}
+void* fixPermissions::fixDataDataThread(void* cookie) {
+	fixDataDataJobs* jobs = (fixDataDataJobs*) cookie;
+	fixPermissions* perms = jobs->perms;
+	struct stat st;
+	size_t index;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs->lock);
+		index = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+		if (index >= jobs->names.size())
+			break;
 
-int fixPermissions::fixDataData(string dataDir) {
-	string directory, dir;
-
-	temp = head;
-	while (temp != NULL) {
-		dir = dataDir + temp->dDir;
-		if (TWFunc::Path_Exists(dir)) {
-			vector <string> dataDataDirs = listAllDirectories(dir);
-			for (unsigned n = 0; n < dataDataDirs.size(); ++n) {
-				directory = dir + "/";
-				directory.append(dataDataDirs.at(n));
-				if (debug)
-					LOGINFO("Looking at data directory: '%s'\n", directory.c_str());
-				if (dataDataDirs.at(n) == ".") {
-					if (pchmod(directory, "0755") != 0)
-						return -1;
-					if (pchown(directory.c_str(), temp->uid, temp->gid) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0755") != 0)
-						return -1;
-				}
-				else if (dataDataDirs.at(n) == "..") {
-					if (debug)
-						LOGINFO("Skipping ..\n");
-					continue;
-				}
-				else if (dataDataDirs.at(n) == "lib") {
-					if (pchmod(directory.c_str(), "0755") != 0)
-						return -1;
-					if (pchown(directory.c_str(), 1000, 1000) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0755") != 0)
-						return -1;
-				}
-				else if (dataDataDirs.at(n) == "shared_prefs") {
-					if (pchmod(directory.c_str(), "0771") != 0)
-						return -1;
-					if (pchown(directory.c_str(), temp->uid, temp->gid) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0660") != 0)
-						return -1;
-				}
-				else if (dataDataDirs.at(n) == "databases") {
-					if (pchmod(directory.c_str(), "0771") != 0)
-						return -1;
-					if (pchown(directory.c_str(), temp->uid, temp->gid) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0660") != 0)
-						return -1;
-				}
-				else if (dataDataDirs.at(n) == "cache") {
-					if (pchmod(directory.c_str(), "0771") != 0)
-						return -1;
-					if (pchown(directory.c_str(), temp->uid, temp->gid) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0600") != 0)
-						return -1;
-				}
-				else {
-					if (pchmod(directory.c_str(), "0771") != 0)
-						return -1;
-					if (pchown(directory.c_str(), temp->uid, temp->gid) != 0)
-						return -1;
-					if (fixAllFiles(directory, temp->uid, temp->gid, "0755") != 0)
-						return -1;
-				}
-			}
+		const char* name = jobs->names[index].c_str();
+		string path = jobs->dataDir + "/" + name;
+		if (fstatat(jobs->dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode))
+			continue;
+		__sync_fetch_and_add(&perms->entries, 1);
+
+		// Directories of packages that are not in packages.xml only get their contexts fixed
+		const packageList::entry* pkg = perms->packages.findByName(name);
+		if (pkg != NULL && pkg->uid < 0)
+			pkg = NULL;
+		if (pkg == NULL && !perms->fix_contexts)
+			continue;
+		int fd = openat(jobs->dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		if (fd < 0) {
+			LOGERR("Error opening '%s'\n", path.c_str());
+			__sync_fetch_and_add(&perms->errors, 1);
+			continue;
+		}
+		if (pkg != NULL) {
+			if (perms->debug)
+				LOGINFO("Looking at data directory: '%s'\n", path.c_str());
+			perms->fixOwnerMode(jobs->dirfd, name, path, st, pkg->uid, pkg->uid, 0755);
+			perms->fixContext(fd, path, st.st_mode);
+			perms->fixTree(fd, path, 0, pkg, 0755);
+		} else {
+			perms->fixContext(fd, path, st.st_mode);
+			perms->fixTree(fd, path, 1, NULL, 0);
 		}
-		temp = temp->next;
 	}
-	return 0;
+	return NULL;
 }
 
-vector <string> fixPermissions::listAllDirectories(string path) {
-	DIR *dir = opendir(path.c_str());
-	vector <string> dirs;
-
-	if (dir == NULL) {
-		LOGERR("Error opening '%s'\n", path.c_str());
-		return dirs;
+// Fixes every package's data directory with a single walk per directory
+// that also fixes contexts, spread over a few threads
+int fixPermissions::fixDataData(string dataDir) {
+	fixDataDataJobs jobs;
+	pthread_t threads[FIX_PERMS_THREADS];
+	int thread_count = 0, i;
+	unsigned long start_errors = errors;
+	DIR* d;
+	struct dirent* de;
+
+	while (dataDir.size() > 1 && dataDir[dataDir.size() - 1] == '/')
+		dataDir.erase(dataDir.size() - 1);
+	jobs.perms = this;
+	jobs.dataDir = dataDir;
+	jobs.next = 0;
+	jobs.dirfd = open(dataDir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (jobs.dirfd < 0 || (d = fdopendir(dup(jobs.dirfd))) == NULL) {
+		LOGERR("Error opening '%s'\n", dataDir.c_str());
+		if (jobs.dirfd >= 0)
+			close(jobs.dirfd);
+		return -1;
 	}
-	struct dirent *entry = readdir(dir);
-	while (entry != NULL) {
-		if (entry->d_type == DT_DIR)
-			dirs.push_back(entry->d_name);
-		entry = readdir(dir);
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+			jobs.names.push_back(de->d_name);
 	}
-	closedir(dir);
-	return dirs;
-}
-
-vector <string> fixPermissions::listAllFiles(string path) {
-	DIR *dir = opendir(path.c_str());
-	vector <string> files;
+	closedir(d);
 
-	if (dir == NULL) {
-		LOGERR("Error opening '%s'\n", path.c_str());
-		return files;
-	}
-	struct dirent *entry = readdir(dir);
-	while (entry != NULL) {
-		if (entry->d_type == DT_REG)
-			files.push_back(entry->d_name);
-		entry = readdir(dir);
+	pthread_mutex_init(&jobs.lock, NULL);
+	while (thread_count < FIX_PERMS_THREADS && thread_count + 1 < (int) jobs.names.size()) {
+		if (pthread_create(&threads[thread_count], NULL, fixDataDataThread, &jobs) != 0)
+			break;
+		thread_count++;
 	}
-	closedir(dir);
-	return files;
+	fixDataDataThread(&jobs);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&jobs.lock);
+	close(jobs.dirfd);
+
+	return (errors != start_errors) ? -1 : 0;
 }
 
 int fixPermissions::getPackages() {
-	int len = 0;
-	bool skiploop = false;
-	vector <string> skip;
-	string name;
-	head = NULL;
-
-	skip.push_back("/system/framework/framework-res.apk");
-	skip.push_back("/system/framework/com.htc.resources.apk");
-
-	ifstream xmlFile(packageFile.c_str());
-	xmlFile.seekg(0, ios::end);
-	len = (int) xmlFile.tellg();
-	xmlFile.seekg(0, ios::beg);
-	char xmlBuf[len + 1];
-	xmlFile.read(&xmlBuf[0], len);
-	xmlBuf[len] = '\0';
-	xml_document<> pkgDoc;
-	LOGINFO("parsing package, %i...\n", len);
-	pkgDoc.parse<parse_full>(&xmlBuf[0]);
-
-	xml_node<> * pkgNode = pkgDoc.first_node("packages");
-	if (pkgNode == NULL) {
-		LOGERR("No packages found to fix.\n");
+	timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (packages.load(packageFile) != 0) {
+		LOGERR("Unable to parse '%s' (%s)\n", packageFile.c_str(), strerror(errno));
 		return -1;
 	}
-	xml_node <> * next = pkgNode->first_node("package");
-	if (next == NULL) {
-		LOGERR("No package found to fix.\n");
+	if (packages.size() == 0) {
+		LOGERR("No packages found to fix.\n");
 		return -1;
 	}
-
-	//Get packages
-	while (next->first_attribute("name") != NULL) {
-		package* temp = new package;
-		for (unsigned n = 0; n < skip.size(); ++n) {
-			if (skip.at(n).compare(next->first_attribute("codePath")->value()) == 0) {
-				skiploop = true;
-				break;
-			}
-		}
-
-		if (skiploop == true) {
-			if (debug)
-				LOGINFO("Skipping package %s\n", next->first_attribute("codePath")->value());
-			free(temp);
-			next = next->next_sibling();
-			skiploop = false;
-			continue;
-		}
-		name.append((next->first_attribute("name")->value()));
-		temp->pkgName = next->first_attribute("name")->value();
-		if (debug)
-			LOGINFO("Loading pkg: %s\n", next->first_attribute("name")->value());
-		if (next->first_attribute("codePath") == NULL) {
-			LOGINFO("Problem with codePath on %s\n", next->first_attribute("name")->value());
-		} else {
-			temp->codePath = next->first_attribute("codePath")->value();
-			temp->app = basename(next->first_attribute("codePath")->value());
-			temp->appDir = dirname(next->first_attribute("codePath")->value());
-		}
-		temp->dDir = name;
-		if ( next->first_attribute("sharedUserId") != NULL) {
-			temp->uid = atoi(next->first_attribute("sharedUserId")->value());
-			temp->gid = atoi(next->first_attribute("sharedUserId")->value());
-		}
-		else {
-			if (next->first_attribute("userId") == NULL) {
-				LOGINFO("Problem with userID on %s\n", next->first_attribute("name")->value());
-			} else {
-				temp->uid = atoi(next->first_attribute("userId")->value());
-				temp->gid = atoi(next->first_attribute("userId")->value());
-			}
-		}
-		temp->next = head;
-		head = temp;
-		if (next->next_sibling("package") == NULL)
-			break;
-		name.clear();
-		next = next->next_sibling("package");
-	}
-	//Get updated packages
-	next = pkgNode->first_node("updated-package");
-	if (next != NULL) {
-		while (next->first_attribute("name") != NULL) {
-			package* temp = new package;
-			for (unsigned n = 0; n < skip.size(); ++n) {
-				if (skip.at(n).compare(next->first_attribute("codePath")->value()) == 0) {
-					skiploop = true;
-					break;
-				}
-			}
-
-			if (skiploop == true) {
-				if (debug)
-					LOGINFO("Skipping package %s\n", next->first_attribute("codePath")->value());
-				free(temp);
-				next = next->next_sibling();
-				skiploop = false;
-				continue;
-			}
-			name.append((next->first_attribute("name")->value()));
-			temp->pkgName = next->first_attribute("name")->value();
-			if (debug)
-				LOGINFO("Loading pkg: %s\n", next->first_attribute("name")->value());
-			if (next->first_attribute("codePath") == NULL) {
-				LOGINFO("Problem with codePath on %s\n", next->first_attribute("name")->value());
-			} else {
-				temp->codePath = next->first_attribute("codePath")->value();
-				temp->app = basename(next->first_attribute("codePath")->value());
-				temp->appDir = dirname(next->first_attribute("codePath")->value());
-			}
-
-			temp->dDir = name;
-			if ( next->first_attribute("sharedUserId") != NULL) {
-				temp->uid = atoi(next->first_attribute("sharedUserId")->value());
-				temp->gid = atoi(next->first_attribute("sharedUserId")->value());
-			}
-			else {
-				if (next->first_attribute("userId") == NULL) {
-					LOGINFO("Problem with userID on %s\n", next->first_attribute("name")->value());
-				} else {
-					temp->uid = atoi(next->first_attribute("userId")->value());
-					temp->gid = atoi(next->first_attribute("userId")->value());
-				}
-			}
-			temp->next = head;
-			head = temp;
-			if (next->next_sibling("package") == NULL)
-				break;
-			name.clear();
-			next = next->next_sibling("package");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	LOGINFO("Loaded %lu packages in %ims\n", (unsigned long) packages.size(), TWFunc::timespec_diff_ms(start, end));
+	if (debug) {
+		for (size_t i = 0; i < packages.size(); i++) {
+			const packageList::entry& pkg = packages.at(i);
+			LOGINFO("Loading pkg: %s\n", pkg.name);
+			if (pkg.codePath == NULL)
+				LOGINFO("Problem with codePath on %s\n", pkg.name);
+			if (pkg.uid < 0)
+				LOGINFO("Problem with userID on %s\n", pkg.name);
 		}
 	}
 	return 0;
@@ -9,7 +9,7 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
-#include "gui/rapidxml.hpp"
+#include "packageList.hpp"
 #include "twrp-functions.hpp"
 
 using namespace std;
@@ -20,33 +20,27 @@ class fixPermissions {
 		int fixDataInternalContexts(void);
 
 	private:
-		int pchown(std::string fn, int puid, int pgid);
-		int pchmod(std::string fn, string mode);
-		vector <string> listAllDirectories(std::string path);
-		vector <string> listAllFiles(std::string path);
 		int getPackages();
 		int fixSystemApps();
 		int fixDataApps();
-		int fixAllFiles(string directory, int gid, int uid, string file_perms);
 		int fixDataData(string dataDir);
-		int restorecon(std::string entry, struct stat *sb);
-		int fixDataDataContexts(void);
-		int fixContextsRecursively(std::string path, int level);
+		static void* fixDataDataThread(void* cookie);
+		int removeMissingAppData(const packageList::entry& pkg, const string& dir);
+		void fixTree(int fd, const string& path, int level, const packageList::entry* pkg, mode_t file_mode);
+		int fixOwnerMode(int dirfd, const char* name, const string& path, const struct stat& st, uid_t uid, gid_t gid, mode_t mode);
+		int fixPathOwnerMode(const string& path, uid_t uid, gid_t gid, mode_t mode);
+		void fixContext(int fd, const string& path, mode_t mode);
 
-		struct package {
-			string pkgName;
-			string codePath;
-			string appDir;
-			string app;
-			string dDir;
-			int gid;
-			int uid;
-			package *next;
-		};
 		bool debug;
 		bool remove_data;
 		bool multi_user;
-		package* head;
-		package* temp;
 		string packageFile;
+		packageList packages;
+		bool fix_contexts;
+		// Statistics, updated atomically by the worker threads
+		unsigned long entries;
+		unsigned long changed_owners;
+		unsigned long changed_modes;
+		unsigned long changed_contexts;
+		unsigned long errors;
 };
@@ -25,7 +25,8 @@ LOCAL_SRC_FILES := \
     input.cpp \
     blanktimer.cpp \
     partitionlist.cpp \
-    mousecursor.cpp
+    mousecursor.cpp \
+    themecache.cpp
 
 ifneq ($(TWRP_CUSTOM_KEYBOARD),)
   LOCAL_SRC_FILES += $(TWRP_CUSTOM_KEYBOARD)
@@ -47,12 +48,18 @@ ifeq ($(TWRP_EVENT_LOGGING), true)
 LOCAL_CFLAGS += -D_EVENT_LOGGING
 endif
 
+ifneq ($(TW_BOARD_CUSTOM_GRAPHICS),)
+	LOCAL_CFLAGS += -DTW_THEME_CACHE_NO_FONTS
+endif
 ifneq ($(TW_NO_SCREEN_BLANK),)
 	LOCAL_CFLAGS += -DTW_NO_SCREEN_BLANK
 endif
 ifneq ($(TW_NO_SCREEN_TIMEOUT),)
 	LOCAL_CFLAGS += -DTW_NO_SCREEN_TIMEOUT
 endif
+ifneq ($(TW_LOG_LEVEL),)
+	LOCAL_CFLAGS += -DTW_LOG_LEVEL=$(TW_LOG_LEVEL)
+endif
 ifeq ($(HAVE_SELINUX), true)
 LOCAL_CFLAGS += -DHAVE_SELINUX
 endif
@@ -62,6 +69,10 @@ endif
 ifeq ($(TW_DISABLE_TTF), true)
     LOCAL_CFLAGS += -DTW_DISABLE_TTF
 endif
+# Frees decoded images the previous page did not draw on every page change
+ifeq ($(TW_EVICT_GUI_RESOURCES), true)
+    LOCAL_CFLAGS += -DTW_EVICT_GUI_RESOURCES
+endif
 
 ifeq ($(DEVICE_RESOLUTION),)
 $(warning ********************************************************************************)
@@ -85,6 +96,15 @@ LOCAL_C_INCLUDES += bionic external/stlport/stlport $(commands_recovery_local_pa
 
 include $(BUILD_STATIC_LIBRARY)
 
+# Build host tool that precompiles the theme into res/ui.xml.cache
+include $(CLEAR_VARS)
+LOCAL_MODULE := mkthemecache
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := mkthemecache.cpp
+LOCAL_C_INCLUDES := external/libpng external/zlib system/core/include
+LOCAL_STATIC_LIBRARIES := libpng libz
+include $(BUILD_HOST_EXECUTABLE)
+
 # Transfer in the resources for the device
 include $(CLEAR_VARS)
 LOCAL_MODULE := twrp
@@ -117,6 +137,13 @@ else
 endif
 
 TWRP_RES_GEN := $(intermediates)/twrp
+# The theme cache holds decoded images, which costs ramdisk space for a faster GUI start
+ifeq ($(TW_USE_THEME_CACHE), true)
+	TWRP_THEME_CACHE := $(HOST_OUT_EXECUTABLES)/mkthemecache $(TARGET_RECOVERY_ROOT_OUT)/res
+$(TWRP_RES_GEN): $(HOST_OUT_EXECUTABLES)/mkthemecache
+else
+	TWRP_THEME_CACHE := $(hide) echo "No theme cache"
+endif
 ifneq ($(TW_USE_TOOLBOX), true)
 	TWRP_SH_TARGET := /sbin/busybox
 else
@@ -129,6 +156,7 @@ $(TWRP_RES_GEN):
 	cp -fr $(TWRP_THEME_LOC)/* $(TARGET_RECOVERY_ROOT_OUT)/res/
 	$(TWRP_COMMON_XML)
 	$(TWRP_REMOVE_FONT)
+	$(TWRP_THEME_CACHE)
 	mkdir -p $(TARGET_RECOVERY_ROOT_OUT)/sbin/
 	ln -sf $(TWRP_SH_TARGET) $(TARGET_RECOVERY_ROOT_OUT)/sbin/sh
 	ln -sf /sbin/pigz $(TARGET_RECOVERY_ROOT_OUT)/sbin/gzip
@@ -343,6 +343,7 @@ void* GUIAction::thread_start(void *cookie)
 void GUIAction::operation_start(const string operation_name)
 {
 	time(&Start);
+	Log_Start = twlog_bytes();
 	DataManager::SetValue(TW_ACTION_BUSY, 1);
 	DataManager::SetValue("ui_progress", 0);
 	DataManager::SetValue("tw_operation", operation_name);
@@ -377,6 +378,7 @@ void GUIAction::operation_end(const int operation_status, const int simulate)
 	time(&Stop);
 	if ((int) difftime(Stop, Start) > 10)
 		DataManager::Vibrate("tw_action_vibrate");
+	LOGINFO("%s logged %llu bytes\n", DataManager::GetStrValue("tw_operation").c_str(), twlog_bytes() - Log_Start);
 }
 
 int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
@@ -829,6 +831,16 @@ int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
 		return TWFunc::Set_Brightness(arg);
 	}
 
+	if (function == "compressionlevel")
+	{
+		string Path;
+
+		DataManager::GetValue("tw_compression_partition", Path);
+		if (!Path.empty())
+			PartitionManager.Set_Compression_Level(Path, atoi(arg.c_str()));
+		return 0;
+	}
+
 	if (isThreaded)
 	{
 		if (function == "fileexists")
@@ -1282,7 +1294,7 @@ int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
 			} else {
 				int wipe_cache = 0;
 				int wipe_dalvik = 0;
-				string Sideload_File;
+				string Sideload_File, Package_File;
 
 				if (!PartitionManager.Mount_Current_Storage(false)) {
 					gui_print("Using RAM for sideload storage.\n");
@@ -1295,16 +1307,18 @@ int GUIAction::doAction(Action action, int isThreaded /* = 0 */)
 				}
 				gui_print("Starting ADB sideload feature...\n");
 				DataManager::GetValue("tw_wipe_dalvik", wipe_dalvik);
-				ret = apply_from_adb(Sideload_File.c_str());
+				ret = apply_from_adb(Sideload_File.c_str(), Package_File);
 				DataManager::SetValue("tw_has_cancel", 0); // Remove cancel button from gui now that the zip install is going to start
 				if (ret != 0) {
 					ret = 1; // failure
-				} else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
+				} else if (TWinstall_zip(Package_File.c_str(), &wipe_cache) == 0) {
+					finish_adb_sideload();
 					if (wipe_cache || DataManager::GetIntValue("tw_wipe_cache"))
 						PartitionManager.Wipe_By_Path("/cache");
 					if (wipe_dalvik)
 						PartitionManager.Wipe_Dalvik_Cache();
 				} else {
+					finish_adb_sideload();
 					ret = 1; // failure
 				}
 				if (DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
@@ -75,10 +75,10 @@ GUIAnimation::GUIAnimation(xml_node<>* node) : GUIObject(node)
 	}
 
 	// Fetch the render sizes
-	if (mAnimation && mAnimation->GetResource())
+	if (mAnimation && mAnimation->IsLoaded())
 	{
-		mRenderW = gr_get_width(mAnimation->GetResource());
-		mRenderH = gr_get_height(mAnimation->GetResource());
+		mRenderW = mAnimation->GetWidth();
+		mRenderH = mAnimation->GetHeight();
 
 		// Adjust for placement
 		if (mPlacement != TOP_LEFT && mPlacement != BOTTOM_LEFT)
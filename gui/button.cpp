@@ -223,10 +223,10 @@ int GUIButton::SetRenderPos(int x, int y, int w, int h)
 	}
 
 	mIconW = 0;	 mIconH = 0;
-	if (mButtonIcon && mButtonIcon->GetResource())
+	if (mButtonIcon && mButtonIcon->IsLoaded())
 	{
-		mIconW = gr_get_width(mButtonIcon->GetResource());
-		mIconH = gr_get_height(mButtonIcon->GetResource());
+		mIconW = mButtonIcon->GetWidth();
+		mIconH = mButtonIcon->GetHeight();
 	}
 
 	mTextH = 0;
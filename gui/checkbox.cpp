@@ -69,15 +69,15 @@ GUICheckbox::GUICheckbox(xml_node<>* node)
 	}
 
 	mCheckW = 0;	mCheckH = 0;
-	if (mChecked && mChecked->GetResource())
+	if (mChecked && mChecked->IsLoaded())
 	{
-		mCheckW = gr_get_width(mChecked->GetResource());
-		mCheckH = gr_get_height(mChecked->GetResource());
+		mCheckW = mChecked->GetWidth();
+		mCheckH = mChecked->GetHeight();
 	}
-	else if (mUnchecked && mUnchecked->GetResource())
+	else if (mUnchecked && mUnchecked->IsLoaded())
 	{
-		mCheckW = gr_get_width(mUnchecked->GetResource());
-		mCheckH = gr_get_height(mUnchecked->GetResource());
+		mCheckW = mUnchecked->GetWidth();
+		mCheckH = mUnchecked->GetHeight();
 	}
 
 	int x, y, w, h;
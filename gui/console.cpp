@@ -14,6 +14,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <string>
 
@@ -26,10 +27,26 @@ extern "C" {
 #include "objects.hpp"
 
 
-static std::vector<std::string> gConsole;
-static std::vector<std::string> gConsoleColor;
+// Most recent console lines, gConsole[n % CONSOLE_MAX_LINES] holds line n
+struct ConsoleLine
+{
+	std::string text;
+	std::string color;
+};
+
+static ConsoleLine gConsole[CONSOLE_MAX_LINES];
+static unsigned int gConsoleCount;      // Number of lines ever added
+static pthread_mutex_t gConsoleLock = PTHREAD_MUTEX_INITIALIZER;
 static FILE* ors_file;
 
+static void gui_add_line(const char *text, const char *color)
+{
+	ConsoleLine& line = gConsole[gConsoleCount % CONSOLE_MAX_LINES];
+	line.text = text;
+	line.color = color;
+	gConsoleCount++;
+}
+
 extern "C" void __gui_print(const char *color, char *buf)
 {
 	char *start, *next;
@@ -39,13 +56,13 @@ extern "C" void __gui_print(const char *color, char *buf)
 		return;
 	}
 
+	pthread_mutex_lock(&gConsoleLock);
 	for (start = next = buf; *next != '\0';)
 	{
 		if (*next == '\n')
 		{
 			*next = '\0';
-			gConsole.push_back(start);
-			gConsoleColor.push_back(color);
+			gui_add_line(start, color);
 
 			start = ++next;
 		}
@@ -54,10 +71,9 @@ extern "C" void __gui_print(const char *color, char *buf)
 	}
 
 	// The text after last \n (or whole string if there is no \n)
-	if(*start) {
-		gConsole.push_back(start);
-		gConsoleColor.push_back(color);
-	}
+	if(*start)
+		gui_add_line(start, color);
+	pthread_mutex_unlock(&gConsoleLock);
 	if (ors_file) {
 		fprintf(ors_file, "%s\n", buf);
 		fflush(ors_file);
@@ -73,7 +89,7 @@ extern "C" void gui_print(const char *fmt, ...)
 	vsnprintf(buf, 512, fmt, ap);
 	va_end(ap);
 
-	fputs(buf, stdout);
+	twlog_append(buf, strlen(buf));
 
 	__gui_print("normal", buf);
 	return;
@@ -88,7 +104,7 @@ extern "C" void gui_print_color(const char *color, const char *fmt, ...)
 	vsnprintf(buf, 512, fmt, ap);
 	va_end(ap);
 
-	fputs(buf, stdout);
+	twlog_append(buf, strlen(buf));
 
 	__gui_print(color, buf);
 	return;
@@ -169,10 +185,10 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIObject(node)
 			attr = child->first_attribute("resource");
 			if (attr)   mSlideoutImage = PageManager::FindResource(attr->value());
 
-			if (mSlideoutImage && mSlideoutImage->GetResource())
+			if (mSlideoutImage && mSlideoutImage->IsLoaded())
 			{
-				mSlideoutW = gr_get_width(mSlideoutImage->GetResource());
-				mSlideoutH = gr_get_height(mSlideoutImage->GetResource());
+				mSlideoutW = mSlideoutImage->GetWidth();
+				mSlideoutH = mSlideoutImage->GetHeight();
 			}
 		}
 	}
@@ -192,6 +208,54 @@ int GUIConsole::RenderSlideout(void)
 	return 0;
 }
 
+void GUIConsole::AddRow(const std::string& text, const COLOR& color)
+{
+	ConsoleRow row;
+
+	row.text = text;
+	row.color = color;
+	if (rConsole.size() < CONSOLE_MAX_ROWS)
+		rConsole.push_back(row);
+	else
+		rConsole[RenderCount % CONSOLE_MAX_ROWS] = row;
+	RenderCount++;
+}
+
+void GUIConsole::WrapNewLines(void* fontResource)
+{
+	std::vector<ConsoleLine> lines;
+
+	// Copy the new lines out so gui_print isn't blocked while we measure them
+	pthread_mutex_lock(&gConsoleLock);
+	if (gConsoleCount - mLastCount > CONSOLE_MAX_LINES)
+		mLastCount = gConsoleCount - CONSOLE_MAX_LINES;
+	for (; mLastCount < gConsoleCount; mLastCount++)
+		lines.push_back(gConsole[mLastCount % CONSOLE_MAX_LINES]);
+	pthread_mutex_unlock(&gConsoleLock);
+
+	// Word wrap each line once, as it arrives. Multiple consoles on different
+	// GUI pages may be different widths or use different fonts, so every
+	// console keeps its own wrapped rows.
+	for (std::vector<ConsoleLine>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		COLOR color = mForegroundColor;
+		if (it->color != "normal") {
+			ConvertStrToColor(it->color, &color);
+			color.alpha = 255;
+		}
+		std::string curr_line = it->text;
+		for(;;) {
+			unsigned int line_char_width = gr_maxExW(curr_line.c_str(), fontResource, mConsoleW);
+			if (line_char_width < curr_line.size()) {
+				AddRow(curr_line.substr(0, line_char_width), color);
+				curr_line = curr_line.substr(line_char_width);
+			} else {
+				AddRow(curr_line, color);
+				break;
+			}
+		}
+	}
+}
+
 int GUIConsole::RenderConsole(void)
 {
 	void* fontResource = NULL;
@@ -205,37 +269,16 @@ int GUIConsole::RenderConsole(void)
 	gr_color(mScrollColor.red, mScrollColor.green, mScrollColor.blue, mScrollColor.alpha);
 	gr_fill(mConsoleX + (mConsoleW * 9 / 10), mConsoleY, (mConsoleW / 10), mConsoleH);
 
-	// Don't try to continue to render without data
-	int prevCount = mLastCount;
-	mLastCount = gConsole.size();
+	WrapNewLines(fontResource);
 	mRender = false;
-	if (mLastCount == 0)
-		return (mSlideout ? RenderSlideout() : 0);
 
-	// Due to word wrap, figure out what / how the newly added text needs to be added to the render vector that is word wrapped
-	// Note, that multiple consoles on different GUI pages may be different widths or use different fonts, so the word wrapping
-	// may different in different console windows
-	for (int i = prevCount; i < mLastCount; i++) {
-		string curr_line = gConsole[i];
-		string curr_color = gConsoleColor[i];
-		int line_char_width;
-		for(;;) {
-			line_char_width = gr_maxExW(curr_line.c_str(), fontResource, mConsoleW);
-			if (line_char_width < curr_line.size()) {
-				rConsole.push_back(curr_line.substr(0, line_char_width));
-				rConsoleColor.push_back(curr_color);
-				curr_line = curr_line.substr(line_char_width);
-			} else {
-				rConsole.push_back(curr_line);
-				rConsoleColor.push_back(curr_color);
-				break;
-			}
-		}
-	}
-	RenderCount = rConsole.size();
+	// Don't try to continue to render without data
+	if (RenderCount == 0)
+		return (mSlideout ? RenderSlideout() : 0);
 
-	// Find the start point
+	// Find the start point, older rows than first have been dropped from the ring
 	int start;
+	int first = RenderCount > CONSOLE_MAX_ROWS ? (int) (RenderCount - CONSOLE_MAX_ROWS) : 0;
 	int curLine = mCurrentLine; // Thread-safing (Another thread updates this value)
 	if (curLine == -1)
 	{
@@ -247,23 +290,19 @@ int GUIConsole::RenderConsole(void)
 			curLine = (int) RenderCount;
 		if ((int) mMaxRows > curLine)
 			curLine = (int) mMaxRows;
+		if (curLine - (int) mMaxRows < first)
+			curLine = first + mMaxRows;
 		start = curLine - mMaxRows;
 	}
 
 	unsigned int line;
 	for (line = 0; line < mMaxRows; line++)
 	{
-		if ((start + (int) line) >= 0 && (start + (int) line) < (int) RenderCount) {
-			if (rConsoleColor[start + line] == "normal") {
-				gr_color(mForegroundColor.red, mForegroundColor.green, mForegroundColor.blue, mForegroundColor.alpha);
-			} else {
-				COLOR mFontColor;
-				std::string color = rConsoleColor[start + line];
-				ConvertStrToColor(color, &mFontColor);
-				mFontColor.alpha = 255;
-				gr_color(mFontColor.red, mFontColor.green, mFontColor.blue, mFontColor.alpha);
-			}
-			gr_textExW(mConsoleX, mStartY + (line * mFontHeight), rConsole[start + line].c_str(), fontResource, mConsoleW + mConsoleX);
+		int index = start + (int) line;
+		if (index >= first && index < (int) RenderCount) {
+			const ConsoleRow& row = rConsole[index % CONSOLE_MAX_ROWS];
+			gr_color(row.color.red, row.color.green, row.color.blue, row.color.alpha);
+			gr_textExW(mConsoleX, mStartY + (line * mFontHeight), row.text.c_str(), fontResource, mConsoleW + mConsoleX);
 		}
 	}
 	return (mSlideout ? RenderSlideout() : 0);
@@ -301,17 +340,21 @@ int GUIConsole::Update(void)
 		return 2;
 	}
 
-	if (mCurrentLine == -1 && mLastCount != gConsole.size())
+	// Drawing just the console would paint over an overlay page
+	if (PageManager::HasOverlay() && ((mCurrentLine == -1 && mLastCount != gConsoleCount) || mRender))
+		return 2;
+
+	if (mCurrentLine == -1 && mLastCount != gConsoleCount)
 	{
 		// We can use Render, and return for just a flip
 		Render();
-		return 2;
+		return 1;
 	}
 	else if (mRender)
 	{
 		// They're still touching, so re-render
 		Render();
-		return 2;
+		return 1;
 	}
 	return 0;
 }
@@ -396,10 +439,12 @@ int GUIConsole::NotifyTouch(TOUCH_STATE state, int x, int y)
 		if (x < mConsoleX || x > mConsoleX + mConsoleW || y < mConsoleY || y > mConsoleY + mConsoleH)
 			break; // touch is outside of the console area -- do nothing
 		if (y > mLastTouchY + mFontHeight) {
+			// Rows older than the ring holds can't be scrolled to
+			unsigned int first = RenderCount > CONSOLE_MAX_ROWS ? RenderCount - CONSOLE_MAX_ROWS : 0;
 			while (y > mLastTouchY + mFontHeight) {
 				if (mCurrentLine == -1)
 					mCurrentLine = RenderCount - 1;
-				else if (mCurrentLine > mMaxRows)
+				else if (mCurrentLine > (int) (first + mMaxRows))
 					mCurrentLine--;
 				mLastTouchY += mFontHeight;
 			}
@@ -337,29 +337,29 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIObject(node)
 	mLineHeight = mFontHeight;
 	mHeaderH = mFontHeight;
 
-	if (mFolderIcon && mFolderIcon->GetResource())
+	if (mFolderIcon && mFolderIcon->IsLoaded())
 	{
-		mFolderIconWidth = gr_get_width(mFolderIcon->GetResource());
-		mFolderIconHeight = gr_get_height(mFolderIcon->GetResource());
+		mFolderIconWidth = mFolderIcon->GetWidth();
+		mFolderIconHeight = mFolderIcon->GetHeight();
 		if (mFolderIconHeight > (int)mLineHeight)
 			mLineHeight = mFolderIconHeight;
 		mIconWidth = mFolderIconWidth;
 	}
 
-	if (mFileIcon && mFileIcon->GetResource())
+	if (mFileIcon && mFileIcon->IsLoaded())
 	{
-		mFileIconWidth = gr_get_width(mFileIcon->GetResource());
-		mFileIconHeight = gr_get_height(mFileIcon->GetResource());
+		mFileIconWidth = mFileIcon->GetWidth();
+		mFileIconHeight = mFileIcon->GetHeight();
 		if (mFileIconHeight > (int)mLineHeight)
 			mLineHeight = mFileIconHeight;
 		if (mFileIconWidth > mIconWidth)
 			mIconWidth = mFileIconWidth;
 	}
 
-	if (mHeaderIcon && mHeaderIcon->GetResource())
+	if (mHeaderIcon && mHeaderIcon->IsLoaded())
 	{
-		mHeaderIconWidth = gr_get_width(mHeaderIcon->GetResource());
-		mHeaderIconHeight = gr_get_height(mHeaderIcon->GetResource());
+		mHeaderIconWidth = mHeaderIcon->GetWidth();
+		mHeaderIconHeight = mHeaderIcon->GetHeight();
 		if (mHeaderIconHeight > mHeaderH)
 			mHeaderH = mHeaderIconHeight;
 		if (mHeaderIconWidth > mIconWidth)
@@ -374,10 +374,10 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIObject(node)
 	if (actualLineHeight / 3 > 6)
 		touchDebounce = actualLineHeight / 3;
 
-	if (mBackground && mBackground->GetResource())
+	if (mBackground && mBackground->IsLoaded())
 	{
-		mBackgroundW = gr_get_width(mBackground->GetResource());
-		mBackgroundH = gr_get_height(mBackground->GetResource());
+		mBackgroundW = mBackground->GetWidth();
+		mBackgroundH = mBackground->GetHeight();
 	}
 
 	// Fetch the file/folder list
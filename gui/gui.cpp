@@ -31,9 +31,13 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <vector>
 
 extern "C"
 {
@@ -437,81 +441,217 @@ static void * input_thread(void *cookie)
 	return NULL;
 }
 
-static void * command_thread(void *cookie)
+struct ors_client {
+	int fd;
+	string request;
+};
+
+static volatile int gOrsCommandRunning = 0;
+
+static void ors_reply(int fd, const char* text)
 {
-	int read_fd;
-	FILE* orsout;
-	char command[1024], result[512];
+	size_t len = strlen(text);
 
-	LOGINFO("Starting command line thread\n");
+	while (len > 0) {
+		ssize_t written = write(fd, text, len);
+		if (written <= 0)
+			return;
+		text += written;
+		len -= written;
+	}
+}
 
-	unlink(ORS_INPUT_FILE);
-	if (mkfifo(ORS_INPUT_FILE, 06660) != 0) {
-		LOGINFO("Unable to mkfifo %s\n", ORS_INPUT_FILE);
+static void ors_close(ors_client* client)
+{
+	close(client->fd);
+	delete client;
+}
+
+// Runs a request that modifies the device. Output goes to the client through
+// the console while the command thread keeps serving read-only queries.
+static void * ors_command_thread(void *cookie)
+{
+	ors_client* client = (ors_client*) cookie;
+	FILE* orsout = fdopen(client->fd, "w");
+
+	if (!orsout) {
+		LOGINFO("Unable to fdopen command socket\n");
+		ors_close(client);
+		gOrsCommandRunning = 0;
 		return 0;
 	}
-	unlink(ORS_OUTPUT_FILE);
-	if (mkfifo(ORS_OUTPUT_FILE, 06666) != 0) {
-		LOGINFO("Unable to mkfifo %s\n", ORS_OUTPUT_FILE);
-		unlink(ORS_INPUT_FILE);
-		return 0;
+	if (gui_console_only() == 0) {
+		LOGINFO("Console started successfully\n");
+		gui_set_FILE(orsout);
+		if (client->request.compare(0, 10, "runscript ") == 0) {
+			string filename = client->request.substr(10, client->request.find('\n') - 10);
+			if (OpenRecoveryScript::copy_script_file(filename) == 0) {
+				LOGERR("Unable to copy script file\n");
+			} else {
+				OpenRecoveryScript::run_script_file();
+			}
+		} else if (OpenRecoveryScript::Insert_ORS_Command(client->request)) {
+			OpenRecoveryScript::run_script_file();
+		}
+		gui_set_FILE(NULL);
+		gGuiConsoleTerminate = 1;
 	}
+	fclose(orsout);
+	delete client;
+	gOrsCommandRunning = 0;
+	return 0;
+}
+
+// A request holds one or more newline separated commands. get commands are
+// answered right away, anything else is run on its own thread, one request at
+// a time. A runscript command has to be the only command that is run.
+static void ors_handle_request(ors_client* client)
+{
+	vector<string> commands = TWFunc::split_string(client->request, '\n', true);
+	vector<string>::iterator cmd;
+	int run_count = 0;
+	bool runscript = false;
+	pthread_t t;
 
-	read_fd = open(ORS_INPUT_FILE, O_RDONLY);
-	if (read_fd < 0) {
-		LOGINFO("Unable to open %s\n", ORS_INPUT_FILE);
-		unlink(ORS_INPUT_FILE);
-		unlink(ORS_OUTPUT_FILE);
+	client->request.clear();
+	for (cmd = commands.begin(); cmd != commands.end(); cmd++) {
+		if (!cmd->empty() && (*cmd)[cmd->size() - 1] == '\r')
+			cmd->erase(cmd->size() - 1);
+		LOGINFO("Command '%s' received\n", cmd->c_str());
+		if (cmd->compare(0, 4, "get ") == 0) {
+			string varname = cmd->substr(4), value;
+			DataManager::GetValue(varname, value);
+			string line = varname + " = " + value + "\n";
+			ors_reply(client->fd, line.c_str());
+			continue;
+		}
+		if (cmd->compare(0, 10, "runscript ") == 0)
+			runscript = true;
+		client->request += *cmd + "\n";
+		run_count++;
+	}
+	if (run_count == 0) {
+		ors_close(client);
+		return;
+	}
+	if (runscript && run_count > 1) {
+		ors_reply(client->fd, "Failed, runscript cannot be combined with other commands\n");
+		LOGINFO("Rejected runscript combined with other commands.\n");
+		ors_close(client);
+		return;
+	}
+
+	if (gOrsCommandRunning || DataManager::GetIntValue("tw_busy") != 0) {
+		ors_reply(client->fd, "Failed, operation in progress\n");
+		LOGINFO("Command cannot be performed, operation in progress.\n");
+		ors_close(client);
+		return;
+	}
+	gOrsCommandRunning = 1;
+	if (pthread_create(&t, NULL, ors_command_thread, client) != 0) {
+		ors_reply(client->fd, "Failed, unable to start command\n");
+		ors_close(client);
+		gOrsCommandRunning = 0;
+		return;
+	}
+	pthread_detach(t);
+}
+
+static void * command_thread(void *cookie)
+{
+	int listen_fd;
+	struct sockaddr_un addr;
+	vector<ors_client*> clients;
+	char buf[4096];
+
+	LOGINFO("Starting command line thread\n");
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		LOGINFO("Unable to create command socket: %s\n", strerror(errno));
+		return 0;
+	}
+	fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, ORS_SOCKET_FILE, sizeof(addr.sun_path) - 1);
+	unlink(ORS_SOCKET_FILE);
+	if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, ORS_MAX_CLIENTS) != 0) {
+		LOGINFO("Unable to listen on %s: %s\n", ORS_SOCKET_FILE, strerror(errno));
+		close(listen_fd);
 		return 0;
 	}
+	chmod(ORS_SOCKET_FILE, 0660);
 
 	while (!gGuiRunning)
 		sleep(1);
 
 	for (;;) {
-		while (read(read_fd, &command, sizeof(command)) > 0) {
-			command[1022] = '\n';
-			command[1023] = '\0';
-			LOGINFO("Command '%s' received\n", command);
-			orsout = fopen(ORS_OUTPUT_FILE, "w");
-			if (!orsout) {
-				close(read_fd);
-				LOGINFO("Unable to fopen %s\n", ORS_OUTPUT_FILE);
-				unlink(ORS_INPUT_FILE);
-				unlink(ORS_OUTPUT_FILE);
-				return 0;
+		vector<struct pollfd> fds(clients.size() + 1);
+		size_t i, count = clients.size();
+
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < count; i++) {
+			fds[i + 1].fd = clients[i]->fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGINFO("Command socket poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		// Walk the clients backwards so erasing one keeps the others lined up with fds
+		for (i = count; i-- > 0;) {
+			if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			ors_client* client = clients[i];
+			ssize_t len = read(client->fd, buf, sizeof(buf));
+			bool complete = (len <= 0);
+			if (len > 0) {
+				// The client ends a request by shutting down its end of the
+				// socket or by sending a NUL
+				char* nul = (char*) memchr(buf, '\0', len);
+				if (nul) {
+					len = nul - buf;
+					complete = true;
+				}
+				client->request.append(buf, len);
+				if (client->request.size() > ORS_MAX_REQUEST) {
+					ors_reply(client->fd, "Failed, request too large\n");
+					clients.erase(clients.begin() + i);
+					ors_close(client);
+					continue;
+				}
 			}
-			if (DataManager::GetIntValue("tw_busy") != 0) {
-				strcpy(result, "Failed, operation in progress\n");
-				fprintf(orsout, "%s", result);
-				LOGINFO("Command cannot be performed, operation in progress.\n");
-			} else {
-				if (gui_console_only() == 0) {
-					LOGINFO("Console started successfully\n");
-					gui_set_FILE(orsout);
-					if (strlen(command) > 11 && strncmp(command, "runscript", 9) == 0) {
-						char* filename = command + 11;
-						if (OpenRecoveryScript::copy_script_file(filename) == 0) {
-							LOGERR("Unable to copy script file\n");
-						} else {
-							OpenRecoveryScript::run_script_file();
-						}
-					} else if (strlen(command) > 5 && strncmp(command, "get", 3) == 0) {
-						char* varname = command + 4;
-						string temp;
-						DataManager::GetValue(varname, temp);
-						gui_print("%s = %s\n", varname, temp.c_str());
-					} else if (OpenRecoveryScript::Insert_ORS_Command(command)) {
-						OpenRecoveryScript::run_script_file();
-					}
-					gui_set_FILE(NULL);
-					gGuiConsoleTerminate = 1;
+			if (complete) {
+				clients.erase(clients.begin() + i);
+				if (len < 0)
+					ors_close(client);
+				else
+					ors_handle_request(client);
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd >= 0) {
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+				if (clients.size() >= ORS_MAX_CLIENTS) {
+					ors_reply(fd, "Failed, too many connections\n");
+					close(fd);
+				} else {
+					ors_client* client = new ors_client;
+					client->fd = fd;
+					clients.push_back(client);
 				}
 			}
-			fclose(orsout);
 		}
 	}
-	close(read_fd);
+	close(listen_fd);
+	unlink(ORS_SOCKET_FILE);
 	LOGINFO("Command thread exiting\n");
 	return 0;
 }
@@ -581,6 +721,9 @@ static int runPages(void)
 			continue;
 		}
 
+		// Sizes computed in the background are published from this thread
+		PartitionManager.Publish_Folder_Sizes();
+
 		if (!gForceRender)
 		{
 			int ret;
@@ -51,10 +51,10 @@ GUIImage::GUIImage(xml_node<>* node) : GUIObject(node)
 	// Load the placement
 	LoadPlacement(node->first_node("placement"), &mRenderX, &mRenderY, NULL, NULL, &mPlacement);
 
-	if (mImage && mImage->GetResource())
+	if (mImage && mImage->IsLoaded())
 	{
-		mRenderW = gr_get_width(mImage->GetResource());
-		mRenderH = gr_get_height(mImage->GetResource());
+		mRenderW = mImage->GetWidth();
+		mRenderH = mImage->GetHeight();
 
 		// Adjust for placement
 		if (mPlacement != TOP_LEFT && mPlacement != BOTTOM_LEFT)
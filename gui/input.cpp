@@ -98,10 +98,10 @@ GUIInput::GUIInput(xml_node<>* node)
 			ConvertStrToColor(color, &mBackgroundColor);
 		}
 	}
-	if (mBackground && mBackground->GetResource())
+	if (mBackground && mBackground->IsLoaded())
 	{
-		mBackgroundW = gr_get_width(mBackground->GetResource());
-		mBackgroundH = gr_get_height(mBackground->GetResource());
+		mBackgroundW = mBackground->GetWidth();
+		mBackgroundH = mBackground->GetHeight();
 	}
 
 	// Load the cursor color
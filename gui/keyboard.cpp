@@ -110,10 +110,10 @@ GUIKeyboard::GUIKeyboard(xml_node<>* node)
 	}
 
 	// Check the first image to get height and width
-	if (keyboardImg[0] && keyboardImg[0]->GetResource())
+	if (keyboardImg[0] && keyboardImg[0]->IsLoaded())
 	{
-		KeyboardWidth = gr_get_width(keyboardImg[0]->GetResource());
-		KeyboardHeight = gr_get_height(keyboardImg[0]->GetResource());
+		KeyboardWidth = keyboardImg[0]->GetWidth();
+		KeyboardHeight = keyboardImg[0]->GetHeight();
 	}
 
 	// Load all of the layout maps
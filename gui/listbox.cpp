@@ -275,29 +275,29 @@ GUIListBox::GUIListBox(xml_node<>* node) : GUIObject(node)
 	mLineHeight = mFontHeight;
 	mHeaderH = mFontHeight;
 
-	if (mIconSelected && mIconSelected->GetResource())
+	if (mIconSelected && mIconSelected->IsLoaded())
 	{
-		mSelectedIconWidth = gr_get_width(mIconSelected->GetResource());
-		mSelectedIconHeight = gr_get_height(mIconSelected->GetResource());
+		mSelectedIconWidth = mIconSelected->GetWidth();
+		mSelectedIconHeight = mIconSelected->GetHeight();
 		if (mSelectedIconHeight > (int)mLineHeight)
 			mLineHeight = mSelectedIconHeight;
 		mIconWidth = mSelectedIconWidth;
 	}
 
-	if (mIconUnselected && mIconUnselected->GetResource())
+	if (mIconUnselected && mIconUnselected->IsLoaded())
 	{
-		mUnselectedIconWidth = gr_get_width(mIconUnselected->GetResource());
-		mUnselectedIconHeight = gr_get_height(mIconUnselected->GetResource());
+		mUnselectedIconWidth = mIconUnselected->GetWidth();
+		mUnselectedIconHeight = mIconUnselected->GetHeight();
 		if (mUnselectedIconHeight > (int)mLineHeight)
 			mLineHeight = mUnselectedIconHeight;
 		if (mUnselectedIconWidth > mIconWidth)
 			mIconWidth = mUnselectedIconWidth;
 	}
 
-	if (mHeaderIcon && mHeaderIcon->GetResource())
+	if (mHeaderIcon && mHeaderIcon->IsLoaded())
 	{
-		mHeaderIconWidth = gr_get_width(mHeaderIcon->GetResource());
-		mHeaderIconHeight = gr_get_height(mHeaderIcon->GetResource());
+		mHeaderIconWidth = mHeaderIcon->GetWidth();
+		mHeaderIconHeight = mHeaderIcon->GetHeight();
 		if (mHeaderIconHeight > mHeaderH)
 			mHeaderH = mHeaderIconHeight;
 		if (mHeaderIconWidth > mIconWidth)
@@ -312,10 +312,10 @@ GUIListBox::GUIListBox(xml_node<>* node) : GUIObject(node)
 	if (actualLineHeight / 3 > 6)
 		touchDebounce = actualLineHeight / 3;
 
-	if (mBackground && mBackground->GetResource())
+	if (mBackground && mBackground->IsLoaded())
 	{
-		mBackgroundW = gr_get_width(mBackground->GetResource());
-		mBackgroundH = gr_get_height(mBackground->GetResource());
+		mBackgroundW = mBackground->GetWidth();
+		mBackgroundH = mBackground->GetHeight();
 	}
 
 	// Get the currently selected value for the list
@@ -0,0 +1,444 @@
+// mkthemecache.cpp - Build host tool that precompiles a theme
+//
+// usage: mkthemecache <res dir> [device res path] [xml file]
+//
+// Reads <res dir>/ui.xml and everything it includes, decodes the PNG images,
+// animation frames and .dat fonts the theme uses and writes them all to
+// <res dir>/ui.xml.cache in the format described in themecache.hpp. The
+// device res path (default /res) is what the recovery will see <res dir> as.
+// JPG images and TTF fonts are not cached and still load at runtime.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <png.h>
+#include <pixelflinger/format.h>
+
+#include "rapidxml.hpp"
+using namespace rapidxml;
+#define THEME_CACHE_HOST
+#include "themecache.hpp"
+
+void rapidxml::parse_error_handler(const char *what, void *where)
+{
+	fprintf(stderr, "mkthemecache: XML parser error: %s\n", what);
+	exit(1);
+}
+
+static std::string gResDir;
+static std::string gDevicePath;
+
+static std::vector<ThemeCacheSource> gSources;
+static std::vector<ThemeCacheDoc> gDocs;
+static std::vector<ThemeCacheNode> gNodes;
+static std::vector<ThemeCacheAttr> gAttrs;
+static std::vector<ThemeCacheImage> gImages;
+static std::vector<ThemeCacheFont> gFonts;
+static std::vector<std::vector<unsigned char> > gImageData;
+static std::vector<std::vector<unsigned char> > gFontData;
+static std::string gStrings;
+static std::map<std::string, uint32_t> gStringIndex;
+
+static uint32_t AddString(const char* str, size_t len)
+{
+	std::string s(str, len);
+	std::map<std::string, uint32_t>::iterator it = gStringIndex.find(s);
+	if (it != gStringIndex.end())
+		return it->second;
+
+	uint32_t offset = gStrings.size();
+	gStrings.append(s);
+	gStrings.push_back('\0');
+	gStringIndex[s] = offset;
+	return offset;
+}
+
+static uint32_t AddString(const std::string& str)
+{
+	return AddString(str.data(), str.size());
+}
+
+// Reads a file below the res dir and records it as a source of the cache
+static bool ReadSource(const std::string& name, std::vector<unsigned char>* data)
+{
+	std::string path = gResDir + "/" + name;
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	data->clear();
+	unsigned char buf[65536];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data->insert(data->end(), buf, buf + len);
+	fclose(fp);
+
+	ThemeCacheSource source;
+	source.path = AddString(gDevicePath + "/" + name);
+	source.size = data->size();
+	source.hash = ThemeCacheHash(data->empty() ? NULL : &(*data)[0], data->size());
+	gSources.push_back(source);
+	return true;
+}
+
+static bool Exists(const std::string& name)
+{
+	struct stat st;
+	return stat((gResDir + "/" + name).c_str(), &st) == 0;
+}
+
+// Decodes a PNG the same way minuitwrp's res_create_surface_png does
+static bool AddImage(const std::string& name)
+{
+	for (size_t i = 0; i < gImages.size(); i++)
+		if (name == &gStrings[gImages[i].name])
+			return true;
+
+	std::string file = "images/" + name + ".png";
+	if (!Exists(file))
+		return false;
+
+	// Stays a source even if it can't be cached, so replacing it invalidates the cache
+	std::vector<unsigned char> png;
+	if (!ReadSource(file, &png))
+		return false;
+	if (png.size() < 8 || png_sig_cmp(&png[0], 0, 8))
+	{
+		fprintf(stderr, "mkthemecache: '%s' is not a PNG, skipping\n", file.c_str());
+		return false;
+	}
+
+	FILE* fp = fopen((gResDir + "/" + file).c_str(), "rb");
+	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		fprintf(stderr, "mkthemecache: unable to decode '%s'\n", file.c_str());
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		exit(1);
+	}
+	png_init_io(png_ptr, fp);
+	png_read_info(png_ptr, info_ptr);
+
+	size_t width = png_get_image_width(png_ptr, info_ptr);
+	size_t height = png_get_image_height(png_ptr, info_ptr);
+	int color_type = png_get_color_type(png_ptr, info_ptr);
+	int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+	int channels = png_get_channels(png_ptr, info_ptr);
+	if (!(bit_depth == 8 &&
+	      ((channels == 3 && color_type == PNG_COLOR_TYPE_RGB) ||
+	       (channels == 4 && color_type == PNG_COLOR_TYPE_RGBA) ||
+	       (channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE))))
+	{
+		// The recovery can't load it either, leave it to fail there
+		fprintf(stderr, "mkthemecache: unsupported PNG format in '%s', skipping\n", file.c_str());
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		return false;
+	}
+	if (color_type == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(png_ptr);
+
+	size_t stride = 4 * width;
+	std::vector<unsigned char> pixels(stride * height);
+	for (size_t y = 0; y < height; ++y)
+	{
+		unsigned char* pRow = &pixels[y * stride];
+		png_read_row(png_ptr, pRow, NULL);
+		if (channels < 4)
+		{
+			for (int x = width - 1; x >= 0; x--)
+			{
+				unsigned char r = pRow[x * 3], g = pRow[x * 3 + 1], b = pRow[x * 3 + 2];
+				pRow[x * 4] = r;
+				pRow[x * 4 + 1] = g;
+				pRow[x * 4 + 2] = b;
+				pRow[x * 4 + 3] = 0xff;
+			}
+		}
+	}
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	fclose(fp);
+
+	ThemeCacheImage image;
+	image.name = AddString(name);
+	image.width = width;
+	image.height = height;
+	image.stride = width;
+	image.format = (channels == 3) ? GGL_PIXEL_FORMAT_RGBX_8888 : GGL_PIXEL_FORMAT_RGBA_8888;
+	image.data = 0;
+	gImages.push_back(image);
+	gImageData.push_back(pixels);
+	return true;
+}
+
+// Expands a .dat font the same way minuitwrp's gr_loadFont does
+static bool AddFont(const std::string& name)
+{
+	for (size_t i = 0; i < gFonts.size(); i++)
+		if (name == &gStrings[gFonts[i].name])
+			return true;
+
+	std::string file = "fonts/" + name + ".dat";
+	std::vector<unsigned char> dat;
+	if (!Exists(file) || !ReadSource(file, &dat))
+		return false;
+
+	ThemeCacheFont font;
+	if (dat.size() < sizeof(uint32_t) * 98)
+	{
+		fprintf(stderr, "mkthemecache: '%s' is truncated\n", file.c_str());
+		exit(1);
+	}
+	memcpy(&font.width, &dat[0], sizeof(uint32_t));
+	memcpy(&font.height, &dat[4], sizeof(uint32_t));
+	memcpy(font.offset, &dat[8], sizeof(uint32_t) * 96);
+
+	size_t size = (size_t) font.width * font.height;
+	std::vector<unsigned char> bits(size);
+	size_t in = sizeof(uint32_t) * 98, pos = 0;
+	while (pos < size && in < dat.size())
+	{
+		unsigned char data = dat[in++];
+		for (int bit = 0; bit < 8 && pos < size; bit++)
+			bits[pos++] = (data & (1 << (7 - bit))) ? 255 : 0;
+	}
+
+	font.name = AddString(name);
+	font.data = 0;
+	gFonts.push_back(font);
+	gFontData.push_back(bits);
+	return true;
+}
+
+static void AddResources(xml_node<>* resources)
+{
+	for (xml_node<>* child = resources->first_node("resource"); child; child = child->next_sibling("resource"))
+	{
+		xml_attribute<>* type = child->first_attribute("type");
+		xml_attribute<>* filename = child->first_attribute("filename");
+		if (!type || !filename)
+			continue;
+
+		std::string file = filename->value();
+		if (strcmp(type->value(), "image") == 0)
+			AddImage(file);
+		else if (strcmp(type->value(), "animation") == 0)
+		{
+			for (int frame = 1; ; frame++)
+			{
+				char num[12];
+				snprintf(num, sizeof(num), "%03d", frame);
+				if (!AddImage(file + num))
+					break;
+			}
+		}
+		else if (strcmp(type->value(), "font") == 0)
+		{
+			// TTF fonts are rendered by freetype at runtime, only their .dat fallback is cached
+			if (file.size() >= 4 && file.compare(file.size() - 4, 4, ".ttf") == 0)
+			{
+				xml_attribute<>* fallback = child->first_attribute("fallback");
+				if (!fallback)
+					continue;
+				file = fallback->value();
+			}
+			AddFont(file);
+		}
+	}
+}
+
+static uint32_t AddNode(xml_node<>* node)
+{
+	uint32_t index = gNodes.size();
+	gNodes.push_back(ThemeCacheNode());
+
+	ThemeCacheNode n;
+	n.type = node->type();
+	n.name_size = node->name_size();
+	n.name = AddString(node->name(), node->name_size());
+	n.value_size = node->value_size();
+	n.value = AddString(node->value(), node->value_size());
+	n.first_attr = gAttrs.size();
+	n.attr_count = 0;
+	for (xml_attribute<>* attr = node->first_attribute(); attr; attr = attr->next_attribute())
+	{
+		ThemeCacheAttr a;
+		a.name_size = attr->name_size();
+		a.name = AddString(attr->name(), attr->name_size());
+		a.value_size = attr->value_size();
+		a.value = AddString(attr->value(), attr->value_size());
+		gAttrs.push_back(a);
+		n.attr_count++;
+	}
+	n.child_count = 0;
+	for (xml_node<>* child = node->first_node(); child; child = child->next_sibling())
+	{
+		AddNode(child);
+		n.child_count++;
+	}
+	gNodes[index] = n;
+	return index;
+}
+
+// Adds an XML file, its resources and, like PageSet::CheckInclude, its includes
+static void AddDocument(const std::string& name)
+{
+	for (size_t i = 0; i < gDocs.size(); i++)
+		if (name == &gStrings[gDocs[i].name])
+			return;
+
+	std::vector<unsigned char> data;
+	if (!ReadSource(name, &data))
+	{
+		fprintf(stderr, "mkthemecache: unable to read '%s/%s'\n", gResDir.c_str(), name.c_str());
+		exit(1);
+	}
+	// The document points into its buffer, which has to stay around
+	char* xml = (char*) malloc(data.size() + 1);
+	if (!data.empty())
+		memcpy(xml, &data[0], data.size());
+	xml[data.size()] = '\0';
+	xml_document<>* doc = new xml_document<>();
+	doc->parse<0>(xml);
+
+	ThemeCacheDoc d;
+	d.name = AddString(name);
+	d.first_node = gNodes.size();
+	for (xml_node<>* node = doc->first_node(); node; node = node->next_sibling())
+		AddNode(node);
+	d.node_count = 0;
+	for (xml_node<>* node = doc->first_node(); node; node = node->next_sibling())
+		d.node_count++;
+	gDocs.push_back(d);
+
+	xml_node<>* parent = doc->first_node("recovery");
+	if (!parent)
+		parent = doc->first_node("install");
+	if (!parent)
+		return;
+	if (parent->first_node("resources"))
+		AddResources(parent->first_node("resources"));
+
+	xml_node<>* include = parent->first_node("include");
+	if (!include)
+		return;
+	for (xml_node<>* file = include->first_node("xmlfile"); file; file = file->next_sibling("xmlfile"))
+	{
+		if (!file->first_attribute("name"))
+			break;
+		AddDocument(file->first_attribute("name")->value());
+	}
+}
+
+static uint32_t Align(uint32_t offset)
+{
+	return (offset + THEME_CACHE_ALIGN - 1) & ~(THEME_CACHE_ALIGN - 1);
+}
+
+template <class T>
+static void WriteTable(FILE* fp, uint32_t offset, const std::vector<T>& table)
+{
+	fseek(fp, offset, SEEK_SET);
+	if (!table.empty())
+		fwrite(&table[0], sizeof(T), table.size(), fp);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: mkthemecache <res dir> [device res path] [xml file]\n");
+		return 1;
+	}
+	gResDir = argv[1];
+	gDevicePath = argc > 2 ? argv[2] : "/res";
+	std::string xmlName = argc > 3 ? argv[3] : "ui.xml";
+
+	AddDocument(xmlName);
+
+	// Lay the file out: header, tables, strings, then the aligned pixel data
+	ThemeCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, THEME_CACHE_MAGIC, sizeof(header.magic));
+	header.version = THEME_CACHE_VERSION;
+	uint32_t offset = Align(sizeof(header));
+	header.source_count = gSources.size();
+	header.source_offset = offset;
+	offset = Align(offset + gSources.size() * sizeof(ThemeCacheSource));
+	header.doc_count = gDocs.size();
+	header.doc_offset = offset;
+	offset = Align(offset + gDocs.size() * sizeof(ThemeCacheDoc));
+	header.node_count = gNodes.size();
+	header.node_offset = offset;
+	offset = Align(offset + gNodes.size() * sizeof(ThemeCacheNode));
+	header.attr_count = gAttrs.size();
+	header.attr_offset = offset;
+	offset = Align(offset + gAttrs.size() * sizeof(ThemeCacheAttr));
+	header.image_count = gImages.size();
+	header.image_offset = offset;
+	offset = Align(offset + gImages.size() * sizeof(ThemeCacheImage));
+	header.font_count = gFonts.size();
+	header.font_offset = offset;
+	offset = Align(offset + gFonts.size() * sizeof(ThemeCacheFont));
+	header.string_offset = offset;
+	header.string_size = gStrings.size();
+	offset = Align(offset + gStrings.size());
+	for (size_t i = 0; i < gImages.size(); i++)
+	{
+		gImages[i].data = offset;
+		offset = Align(offset + gImageData[i].size());
+	}
+	for (size_t i = 0; i < gFonts.size(); i++)
+	{
+		gFonts[i].data = offset;
+		offset = Align(offset + gFontData[i].size());
+	}
+	header.file_size = offset;
+
+	std::string out = gResDir + "/" + xmlName + THEME_CACHE_EXT;
+	FILE* fp = fopen(out.c_str(), "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "mkthemecache: unable to create '%s'\n", out.c_str());
+		return 1;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	WriteTable(fp, header.source_offset, gSources);
+	WriteTable(fp, header.doc_offset, gDocs);
+	WriteTable(fp, header.node_offset, gNodes);
+	WriteTable(fp, header.attr_offset, gAttrs);
+	WriteTable(fp, header.image_offset, gImages);
+	WriteTable(fp, header.font_offset, gFonts);
+	fseek(fp, header.string_offset, SEEK_SET);
+	fwrite(gStrings.data(), 1, gStrings.size(), fp);
+	for (size_t i = 0; i < gImages.size(); i++)
+	{
+		fseek(fp, gImages[i].data, SEEK_SET);
+		fwrite(&gImageData[i][0], 1, gImageData[i].size(), fp);
+	}
+	for (size_t i = 0; i < gFonts.size(); i++)
+	{
+		fseek(fp, gFonts[i].data, SEEK_SET);
+		if (!gFontData[i].empty())
+			fwrite(&gFontData[i][0], 1, gFontData[i].size(), fp);
+	}
+	// Pad the last block so the file is exactly file_size long
+	fflush(fp);
+	if (ftruncate(fileno(fp), header.file_size) != 0 || fclose(fp) != 0)
+	{
+		fprintf(stderr, "mkthemecache: error writing '%s'\n", out.c_str());
+		return 1;
+	}
+	printf("mkthemecache: %s: %u files, %u nodes, %u images, %u fonts, %u bytes\n", out.c_str(),
+		header.source_count, (unsigned) gNodes.size(), header.image_count, header.font_count, header.file_size);
+	return 0;
+}
@@ -68,8 +68,8 @@ void MouseCursor::LoadData(xml_node<>* node)
 			m_image = PageManager::FindResource(attr->value());
 			if(m_image)
 			{
-				mRenderW = gr_get_width(m_image->GetResource());
-				mRenderH = gr_get_height(m_image->GetResource());
+				mRenderW = m_image->GetWidth();
+				mRenderH = m_image->GetHeight();
 			}
 		}
 	}
@@ -39,6 +39,7 @@ extern "C" {
 using namespace rapidxml;
 
 #include "../data.hpp"
+#include "themecache.hpp"
 #include "resources.hpp"
 #include "pages.hpp"
 #include "../partitions.hpp"
@@ -295,8 +296,12 @@ protected:
 	void operation_end(const int operation_status, const int simulate);
 	static void* command_thread(void *cookie);
 	time_t Start;
+	unsigned long long Log_Start;
 };
 
+#define CONSOLE_MAX_LINES 2048     // Lines kept by gui_print
+#define CONSOLE_MAX_ROWS 4096      // Word wrapped rows kept by each console
+
 class GUIConsole : public GUIObject, public RenderObject, public ActionObject
 {
 public:
@@ -332,6 +337,12 @@ protected:
 		request_show
 	};
 
+	struct ConsoleRow
+	{
+		std::string text;
+		COLOR color;
+	};
+
 	Resource* mFont;
 	Resource* mSlideoutImage;
 	COLOR mForegroundColor;
@@ -349,13 +360,14 @@ protected:
 	int mLastTouchX, mLastTouchY;
 	int mSlideout;
 	SlideoutState mSlideoutState;
-	std::vector<std::string> rConsole;
-	std::vector<std::string> rConsoleColor;
+	std::vector<ConsoleRow> rConsole;      // Ring of word wrapped rows, row n is at n % CONSOLE_MAX_ROWS
 	bool mRender;
 
 protected:
 	virtual int RenderSlideout(void);
 	virtual int RenderConsole(void);
+	void AddRow(const std::string& text, const COLOR& color);
+	void WrapNewLines(void* fontResource);
 };
 
 class GUIButton : public GUIObject, public RenderObject, public ActionObject
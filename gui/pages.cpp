@@ -542,6 +542,7 @@ PageSet::PageSet(char* xmlFile)
 	mResources = NULL;
 	mCurrentPage = NULL;
 	mOverlayPage = NULL;
+	mCache = NULL;
 
 	mXmlFile = xmlFile;
 	if (xmlFile)
@@ -550,6 +551,18 @@ PageSet::PageSet(char* xmlFile)
 		mCurrentPage = new Page(NULL);
 }
 
+PageSet::PageSet(ThemeCache* cache, std::string xmlName)
+{
+	mResources = NULL;
+	mCurrentPage = NULL;
+	mOverlayPage = NULL;
+	mXmlFile = NULL;
+	mCache = cache;
+
+	if (mCache->LoadDocument(xmlName, &mDoc))
+		LOGERR("Theme cache has no '%s'\n", xmlName.c_str());
+}
+
 PageSet::~PageSet()
 {
 	for (std::vector<Page*>::iterator itr = mPages.begin(); itr != mPages.end(); ++itr)
@@ -558,6 +571,8 @@ PageSet::~PageSet()
 		delete *itr2;
 
 	delete mResources;
+	// Cached images point into the cache, so it goes after the resources
+	delete mCache;
 	free(mXmlFile);
 }
 
@@ -572,12 +587,17 @@ int PageSet::Load(ZipArchive* package)
 	parent = mDoc.first_node("recovery");
 	if (!parent)
 		parent = mDoc.first_node("install");
+	if (!parent)
+	{
+		LOGERR("No recovery or install element found.\n");
+		return -1;
+	}
 
 	// Now, let's parse the XML
 	LOGINFO("Loading resources...\n");
 	child = parent->first_node("resources");
 	if (child)
-		mResources = new ResourceManager(child, package);
+		mResources = new ResourceManager(child, package, mCache);
 
 	LOGINFO("Loading variables...\n");
 	child = parent->first_node("variables");
@@ -636,8 +656,13 @@ int PageSet::CheckInclude(ZipArchive* package, xml_document<> *parentDoc)
 		if (!attr)
 			break;
 
-		LOGINFO("PageSet::CheckInclude loading filename: '%s'\n", filename.c_str());
-		if (!package) {
+		LOGINFO("PageSet::CheckInclude loading filename: '%s'\n", attr->value());
+		if (mCache) {
+			if (mCache->LoadDocument(attr->value(), &doc)) {
+				LOGERR("Theme cache has no '%s'\n", attr->value());
+				return -1;
+			}
+		} else if (!package) {
 			// We can try to load the XML directly...
 			filename = "/res/";
 			filename += attr->value();
@@ -679,7 +704,8 @@ int PageSet::CheckInclude(ZipArchive* package, xml_document<> *parentDoc)
 				return -1;
 			}
 		}
-		doc.parse<0>(xmlFile);
+		if (!mCache)
+			doc.parse<0>(xmlFile);
 
 		parent = doc.first_node("recovery");
 		if (!parent)
@@ -727,6 +753,8 @@ int PageSet::SetPage(std::string page)
 	if (tmp)
 	{
 		if (mCurrentPage)   mCurrentPage->SetPageFocus(0);
+		if (tmp != mCurrentPage)
+			SurfaceCache::PageChanged();
 		mCurrentPage = tmp;
 		mCurrentPage->SetPageFocus(1);
 		mCurrentPage->NotifyVarChange("", "");
@@ -917,11 +945,14 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 	long len;
 	char* xmlFile = NULL;
 	PageSet* pageSet = NULL;
+	ThemeCache* cache = NULL;
 	int ret;
 
 	// Open the XML file
 	LOGINFO("Loading package: %s (%s)\n", name.c_str(), package.c_str());
-	if (mzOpenZipArchive(package.c_str(), &zip))
+	// Use the precompiled theme if it matches the XML and images
+	cache = ThemeCache::Open(package + THEME_CACHE_EXT);
+	if (!cache && mzOpenZipArchive(package.c_str(), &zip))
 	{
 		// We can try to load the XML directly...
 		struct stat st;
@@ -940,7 +971,7 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 		read(fd, xmlFile, len);
 		close(fd);
 	}
-	else
+	else if (!cache)
 	{
 		pZip = &zip;
 		const ZipEntry* ui_xml = mzFindZipEntry(&zip, "ui.xml");
@@ -964,11 +995,15 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 	}
 
 	// NULL-terminate the string
-	xmlFile[len] = 0x00;
+	if (xmlFile)
+		xmlFile[len] = 0x00;
 
 	// Before loading, mCurrentSet must be the loading package so we can find resources
 	pageSet = mCurrentSet;
-	mCurrentSet = new PageSet(xmlFile);
+	if (cache)
+		mCurrentSet = new PageSet(cache, package.substr(package.find_last_of('/') + 1));
+	else
+		mCurrentSet = new PageSet(xmlFile);
 
 	ret = mCurrentSet->Load(pZip);
 	if (ret == 0)
@@ -1078,6 +1113,16 @@ int PageManager::ChangePage(std::string name)
 	return ret;
 }
 
+int PageSet::HasOverlay(void)
+{
+	return (mOverlayPage != NULL);
+}
+
+int PageManager::HasOverlay(void)
+{
+	return (mCurrentSet ? mCurrentSet->HasOverlay() : 0);
+}
+
 int PageManager::ChangeOverlay(std::string name)
 {
 	if (name.empty())
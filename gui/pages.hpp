@@ -31,6 +31,7 @@ class InputObject;
 class MouseCursor;
 class GUIObject;
 class HardwareKeyboard;
+class ThemeCache;
 
 class Page
 {
@@ -68,6 +69,7 @@ class PageSet
 {
 public:
 	PageSet(char* xmlFile);
+	PageSet(ThemeCache* cache, std::string xmlName);
 	virtual ~PageSet();
 
 public:
@@ -77,6 +79,7 @@ public:
 	Page* FindPage(std::string name);
 	int SetPage(std::string page);
 	int SetOverlay(Page* page);
+	int HasOverlay(void);
 	Resource* FindResource(std::string name);
 
 	// Helper routine for identifing if we're the current page
@@ -98,6 +101,7 @@ protected:
 protected:
 	char* mXmlFile;
 	xml_document<> mDoc;
+	ThemeCache* mCache;
 	ResourceManager* mResources;
 	std::vector<Page*> mPages;
 	std::vector<xml_node<>*> templates;
@@ -127,6 +131,9 @@ public:
 	// Helper to identify if a particular page is the active page
 	static int IsCurrentPage(Page* page);
 
+	// Helper to identify if an overlay, such as the lock screen, is shown
+	static int HasOverlay(void);
+
 	// These are routing routines
 	static int Render(void);
 	static int Update(void);
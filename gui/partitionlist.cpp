@@ -277,29 +277,29 @@ GUIPartitionList::GUIPartitionList(xml_node<>* node) : GUIObject(node)
 	mLineHeight = mFontHeight;
 	mHeaderH = mFontHeight;
 
-	if (mIconSelected && mIconSelected->GetResource())
+	if (mIconSelected && mIconSelected->IsLoaded())
 	{
-		mSelectedIconWidth = gr_get_width(mIconSelected->GetResource());
-		mSelectedIconHeight = gr_get_height(mIconSelected->GetResource());
+		mSelectedIconWidth = mIconSelected->GetWidth();
+		mSelectedIconHeight = mIconSelected->GetHeight();
 		if (mSelectedIconHeight > (int)mLineHeight)
 			mLineHeight = mSelectedIconHeight;
 		mIconWidth = mSelectedIconWidth;
 	}
 
-	if (mIconUnselected && mIconUnselected->GetResource())
+	if (mIconUnselected && mIconUnselected->IsLoaded())
 	{
-		mUnselectedIconWidth = gr_get_width(mIconUnselected->GetResource());
-		mUnselectedIconHeight = gr_get_height(mIconUnselected->GetResource());
+		mUnselectedIconWidth = mIconUnselected->GetWidth();
+		mUnselectedIconHeight = mIconUnselected->GetHeight();
 		if (mUnselectedIconHeight > (int)mLineHeight)
 			mLineHeight = mUnselectedIconHeight;
 		if (mUnselectedIconWidth > mIconWidth)
 			mIconWidth = mUnselectedIconWidth;
 	}
 
-	if (mHeaderIcon && mHeaderIcon->GetResource())
+	if (mHeaderIcon && mHeaderIcon->IsLoaded())
 	{
-		mHeaderIconWidth = gr_get_width(mHeaderIcon->GetResource());
-		mHeaderIconHeight = gr_get_height(mHeaderIcon->GetResource());
+		mHeaderIconWidth = mHeaderIcon->GetWidth();
+		mHeaderIconHeight = mHeaderIcon->GetHeight();
 		if (mHeaderIconHeight > mHeaderH)
 			mHeaderH = mHeaderIconHeight;
 		if (mHeaderIconWidth > mIconWidth)
@@ -314,10 +314,10 @@ GUIPartitionList::GUIPartitionList(xml_node<>* node) : GUIObject(node)
 	if (actualLineHeight / 3 > 6)
 		touchDebounce = actualLineHeight / 3;
 
-	if (mBackground && mBackground->GetResource())
+	if (mBackground && mBackground->IsLoaded())
 	{
-		mBackgroundW = gr_get_width(mBackground->GetResource());
-		mBackgroundH = gr_get_height(mBackground->GetResource());
+		mBackgroundW = mBackground->GetWidth();
+		mBackgroundH = mBackground->GetHeight();
 	}
 
 	child = node->first_node("listtype");
@@ -791,6 +791,13 @@ int GUIPartitionList::NotifyTouch(TOUCH_STATE state, int x, int y)
 
 						DataManager::SetValue(mVariable, str);
 					}
+				} else if (ListType == "compression") {
+					int i;
+					for (i=0; i<listSize; i++)
+						mList.at(i).selected = 0;
+					mList.at(actualSelection).selected = 1;
+					mUpdate = 1;
+					DataManager::SetValue(mVariable, mList.at(actualSelection).Mount_Point);
 				} else {
 					if (mList.at(actualSelection).selected)
 						mList.at(actualSelection).selected = 0;
@@ -844,6 +851,12 @@ int GUIPartitionList::NotifyVarChange(const std::string& varName, const std::str
 			mUpdate = 1;
 		}
 	}
+	if (ListType == "compression" && varName == "tw_compression_levels") {
+		// The display names show the level of each partition
+		updateList = true;
+		mUpdate = 1;
+		return 0;
+	}
 	if (varName == mVariable && !mUpdate)
 	{
 		if (ListType == "storage") {
@@ -869,7 +882,7 @@ int GUIPartitionList::NotifyVarChange(const std::string& varName, const std::str
 			}
 		} else if (ListType == "backup") {
 			MatchList();
-		} else if (ListType == "restore") {
+		} else if (ListType == "restore" || ListType == "compression") {
 			updateList = true;
 		}
 
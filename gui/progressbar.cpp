@@ -71,10 +71,10 @@ GUIProgressBar::GUIProgressBar(xml_node<>* node) : GUIObject(node)
 		if (attr)   mCurValVar = attr->value();
 	}
 
-	if (mEmptyBar && mEmptyBar->GetResource())
+	if (mEmptyBar && mEmptyBar->IsLoaded())
 	{
-		mRenderW = gr_get_width(mEmptyBar->GetResource());
-		mRenderH = gr_get_height(mEmptyBar->GetResource());
+		mRenderW = mEmptyBar->GetWidth();
+		mRenderH = mEmptyBar->GetHeight();
 	}
 
 	return;
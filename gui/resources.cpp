@@ -14,6 +14,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <string>
 #include <sstream>
@@ -30,6 +31,14 @@ extern "C" {
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
+std::map<std::string, FontResource::SharedFont> FontResource::mFonts;
+std::map<std::string, SurfaceCache::Entry*> SurfaceCache::mEntries;
+int SurfaceCache::mGeneration = 0;
+unsigned long SurfaceCache::mDecodedBytes = 0;
+unsigned long SurfaceCache::mPeakBytes = 0;
+unsigned SurfaceCache::mDecodes = 0;
+static pthread_mutex_t surfaceCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 Resource::Resource(xml_node<>* node, ZipArchive* pZip)
 {
 	if (node && node->first_attribute("name"))
@@ -61,7 +70,7 @@ int Resource::ExtractResource(ZipArchive* pZip, std::string folderName, std::str
 	return ret;
 }
 
-FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
+FontResource::FontResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache)
  : Resource(node, pZip)
 {
 	std::string file;
@@ -100,8 +109,14 @@ FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
 		}
 		else
 		{
+			std::ostringstream key;
+
 			file = std::string("/res/fonts/") + file;
+			key << file << ":" << size << ":" << dpi;
+			if (AcquireShared(key.str()))
+				return;
 			mFont = gr_ttf_loadFont(file.c_str(), size, dpi);
+			AddShared(key.str());
 		}
 	}
 	else
@@ -118,6 +133,9 @@ FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
 			file = attr->value();
 		}
 
+		if (cache && (mFont = cache->LoadFont(file)) != NULL)
+			return;
+
 		if (ExtractResource(pZip, "fonts", file, ".dat", TMP_RESOURCE_NAME) == 0)
 		{
 			mFont = gr_loadFont(TMP_RESOURCE_NAME);
@@ -125,13 +143,50 @@ FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
 		}
 		else
 		{
+			if (AcquireShared(file))
+				return;
 			mFont = gr_loadFont(file.c_str());
+			AddShared(file);
 		}
 	}
 }
 
+// Takes a reference on an already loaded font from the same file
+bool FontResource::AcquireShared(std::string key)
+{
+	std::map<std::string, SharedFont>::iterator it = mFonts.find(key);
+
+	if (it == mFonts.end() || it->second.type != m_type)
+		return false;
+	it->second.refs++;
+	mFont = it->second.font;
+	mKey = key;
+	return true;
+}
+
+void FontResource::AddShared(std::string key)
+{
+	if (!mFont)
+		return;
+
+	SharedFont shared;
+	shared.font = mFont;
+	shared.type = m_type;
+	shared.refs = 1;
+	mFonts[key] = shared;
+	mKey = key;
+}
+
 FontResource::~FontResource()
 {
+	if (!mKey.empty())
+	{
+		std::map<std::string, SharedFont>::iterator it = mFonts.find(mKey);
+		if (it != mFonts.end() && --it->second.refs > 0)
+			return;
+		if (it != mFonts.end())
+			mFonts.erase(it);
+	}
 	if(mFont)
 	{
 #ifndef TW_DISABLE_TTF
@@ -143,18 +198,180 @@ FontResource::~FontResource()
 	}
 }
 
-ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
+SurfaceCache::Entry* SurfaceCache::Acquire(std::string file)
+{
+	std::string path = file;
+	unsigned width, height;
+	Entry* entry;
+
+	// Same lookup as res_create_surface_png
+	if (access(path.c_str(), R_OK) != 0)
+		path = "/res/images/" + file + ".png";
+
+	pthread_mutex_lock(&surfaceCacheLock);
+	std::map<std::string, Entry*>::iterator it = mEntries.find(path);
+	if (it != mEntries.end())
+	{
+		it->second->refs++;
+		pthread_mutex_unlock(&surfaceCacheLock);
+		return it->second;
+	}
+	pthread_mutex_unlock(&surfaceCacheLock);
+
+	// JPGs and PNGs libpng would have to convert are decoded straight away
+	if (!ReadPngSize(path, &width, &height))
+		return NULL;
+
+	entry = new Entry;
+	entry->path = path;
+	entry->surface = NULL;
+	entry->width = width;
+	entry->height = height;
+	entry->refs = 1;
+	entry->lastUse = -1;
+	entry->failed = false;
+
+	pthread_mutex_lock(&surfaceCacheLock);
+	it = mEntries.find(path);
+	if (it != mEntries.end())
+	{
+		delete entry;
+		entry = it->second;
+		entry->refs++;
+	}
+	else
+		mEntries[path] = entry;
+	pthread_mutex_unlock(&surfaceCacheLock);
+	return entry;
+}
+
+void SurfaceCache::Release(SurfaceCache::Entry* entry)
+{
+	pthread_mutex_lock(&surfaceCacheLock);
+	if (--entry->refs == 0)
+	{
+		if (entry->surface)
+		{
+			res_free_surface(entry->surface);
+			mDecodedBytes -= entry->width * entry->height * 4;
+		}
+		mEntries.erase(entry->path);
+		delete entry;
+	}
+	pthread_mutex_unlock(&surfaceCacheLock);
+}
+
+gr_surface SurfaceCache::Get(SurfaceCache::Entry* entry)
+{
+	gr_surface surface;
+
+	pthread_mutex_lock(&surfaceCacheLock);
+	entry->lastUse = mGeneration;
+	if (!entry->surface && !entry->failed)
+	{
+		if (res_create_surface(entry->path.c_str(), &entry->surface) != 0 || !entry->surface)
+		{
+			LOGERR("Unable to load image '%s'\n", entry->path.c_str());
+			entry->surface = NULL;
+			entry->failed = true;
+		}
+		else
+		{
+			mDecodes++;
+			mDecodedBytes += entry->width * entry->height * 4;
+			if (mDecodedBytes > mPeakBytes)
+				mPeakBytes = mDecodedBytes;
+		}
+	}
+	surface = entry->surface;
+	pthread_mutex_unlock(&surfaceCacheLock);
+	return surface;
+}
+
+// Called on every page change. Without TW_EVICT_GUI_RESOURCES decoded
+// images stay in memory until their page set is unloaded.
+void SurfaceCache::PageChanged(void)
+{
+	pthread_mutex_lock(&surfaceCacheLock);
+#ifdef TW_EVICT_GUI_RESOURCES
+	unsigned long before = mDecodedBytes;
+	std::map<std::string, Entry*>::iterator it;
+
+	// Keep what the previous page drew, it is often shown again right away
+	for (it = mEntries.begin(); it != mEntries.end(); ++it)
+	{
+		Entry* entry = it->second;
+		if (entry->surface && entry->lastUse < mGeneration)
+		{
+			res_free_surface(entry->surface);
+			entry->surface = NULL;
+			mDecodedBytes -= entry->width * entry->height * 4;
+		}
+	}
+	if (before != mDecodedBytes)
+		LOGINFO("Freed %lu KB of images, %lu KB still decoded\n", (before - mDecodedBytes) / 1024, mDecodedBytes / 1024);
+#endif
+	mGeneration++;
+	pthread_mutex_unlock(&surfaceCacheLock);
+}
+
+void SurfaceCache::LogStats(void)
+{
+	unsigned long total = 0;
+	std::map<std::string, Entry*>::iterator it;
+
+	pthread_mutex_lock(&surfaceCacheLock);
+	for (it = mEntries.begin(); it != mEntries.end(); ++it)
+		total += it->second->width * it->second->height * 4;
+	LOGINFO("Images: %u shared, %lu KB of %lu KB decoded (peak %lu KB, %u decodes)\n",
+		(unsigned) mEntries.size(), mDecodedBytes / 1024, total / 1024, mPeakBytes / 1024, mDecodes);
+	pthread_mutex_unlock(&surfaceCacheLock);
+}
+
+// Reads the IHDR chunk and returns false for anything res_create_surface_png
+// would reject, so those keep failing at load time
+bool SurfaceCache::ReadPngSize(const std::string& path, unsigned* width, unsigned* height)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned char header[26];
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (read(fd, header, sizeof(header)) != (ssize_t) sizeof(header))
+	{
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	if (memcmp(header, signature, sizeof(signature)) != 0 || memcmp(header + 12, "IHDR", 4) != 0)
+		return false;
+	*width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	*height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	// 8 bit RGB, palette or RGBA
+	if (header[24] != 8 || (header[25] != 2 && header[25] != 3 && header[25] != 6))
+		return false;
+	return *width > 0 && *height > 0;
+}
+
+ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache)
  : Resource(node, pZip)
 {
 	std::string file;
 
 	mSurface = NULL;
+	mEntry = NULL;
 	if (!node)
 		return;
 
 	if (node->first_attribute("filename"))
 		file = node->first_attribute("filename")->value();
 
+	if (cache && (mSurface = cache->LoadImage(file)) != NULL)
+		return;
+
 	if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0)
 	{
 		res_create_surface(TMP_RESOURCE_NAME, &mSurface);
@@ -166,7 +383,7 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
 		res_create_surface(TMP_RESOURCE_NAME, &mSurface);
 		unlink(TMP_RESOURCE_NAME);
 	}
-	else
+	else if ((mEntry = SurfaceCache::Acquire(file)) == NULL)
 		res_create_surface(file.c_str(), &mSurface);
 }
 
@@ -174,9 +391,11 @@ ImageResource::~ImageResource()
 {
 	if (mSurface)
 		res_free_surface(mSurface);
+	if (mEntry)
+		SurfaceCache::Release(mEntry);
 }
 
-AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
+AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache)
  : Resource(node, pZip)
 {
 	std::string file;
@@ -204,8 +423,20 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
 
 			unlink(TMP_RESOURCE_NAME);
 		}
-		else
+		else if (!cache || (surface = cache->LoadImage(fileName.str())) == NULL)
 		{
+			// Frames are all loaded the same way, lazily if the first one can be
+			SurfaceCache::Entry* entry = NULL;
+			if (mSurfaces.empty())
+				entry = SurfaceCache::Acquire(fileName.str());
+			if (entry)
+			{
+				mFrames.push_back(entry);
+				fileNum++;
+				continue;
+			}
+			if (!mFrames.empty())
+				break;
 			if (res_create_surface(fileName.str().c_str(), &surface))
 				break;
 		}
@@ -217,11 +448,36 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
 AnimationResource::~AnimationResource()
 {
 	std::vector<gr_surface>::iterator it;
+	std::vector<SurfaceCache::Entry*>::iterator frame;
 
 	for (it = mSurfaces.begin(); it != mSurfaces.end(); ++it)
 		res_free_surface(*it);
+	for (frame = mFrames.begin(); frame != mFrames.end(); ++frame)
+		SurfaceCache::Release(*frame);
 
 	mSurfaces.clear();
+	mFrames.clear();
+}
+
+void* AnimationResource::GetResource(int entry)
+{
+	if (!mFrames.empty())
+		return SurfaceCache::Get(mFrames.at(entry));
+	return mSurfaces.at(entry);
+}
+
+unsigned AnimationResource::GetWidth(void)
+{
+	if (!mFrames.empty())
+		return mFrames[0]->width;
+	return mSurfaces.empty() ? 0 : gr_get_width(mSurfaces[0]);
+}
+
+unsigned AnimationResource::GetHeight(void)
+{
+	if (!mFrames.empty())
+		return mFrames[0]->height;
+	return mSurfaces.empty() ? 0 : gr_get_height(mSurfaces[0]);
 }
 
 Resource* ResourceManager::FindResource(std::string name)
@@ -236,9 +492,11 @@ Resource* ResourceManager::FindResource(std::string name)
 	return NULL;
 }
 
-ResourceManager::ResourceManager(xml_node<>* resList, ZipArchive* pZip)
+ResourceManager::ResourceManager(xml_node<>* resList, ZipArchive* pZip, ThemeCache* cache)
 {
+	mCache = cache;
 	LoadResources(resList, pZip);
+	SurfaceCache::LogStats();
 }
 
 void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip)
@@ -259,8 +517,8 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip)
 
 		if (type == "font")
 		{
-			FontResource* res = new FontResource(child, pZip);
-			if (res == NULL || res->GetResource() == NULL)
+			FontResource* res = new FontResource(child, pZip, mCache);
+			if (res == NULL || !res->IsLoaded())
 			{
 				xml_attribute<>* attr_name = child->first_attribute("name");
 
@@ -279,8 +537,8 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip)
 		}
 		else if (type == "image")
 		{
-			ImageResource* res = new ImageResource(child, pZip);
-			if (res == NULL || res->GetResource() == NULL)
+			ImageResource* res = new ImageResource(child, pZip, mCache);
+			if (res == NULL || !res->IsLoaded())
 			{
 				xml_attribute<>* attr_name = child->first_attribute("name");
 
@@ -299,8 +557,8 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip)
 		}
 		else if (type == "animation")
 		{
-			AnimationResource* res = new AnimationResource(child, pZip);
-			if (res == NULL || res->GetResource() == NULL)
+			AnimationResource* res = new AnimationResource(child, pZip, mCache);
+			if (res == NULL || !res->IsLoaded())
 			{
 				xml_attribute<>* attr_name = child->first_attribute("name");
 
@@ -9,6 +9,8 @@
 #include "../minzipold/Zip.h"
 #endif
 
+class ThemeCache;
+
 // Base Objects
 class Resource
 {
@@ -18,6 +20,9 @@ public:
 
 public:
 	virtual void* GetResource(void) = 0;
+	virtual bool IsLoaded(void) { return GetResource() != NULL; }
+	virtual unsigned GetWidth(void) { return 0; }
+	virtual unsigned GetHeight(void) { return 0; }
 	std::string GetName(void) { return mName; }
 
 private:
@@ -46,49 +51,100 @@ public:
 #endif
 	};
 
-	FontResource(xml_node<>* node, ZipArchive* pZip);
+	FontResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache = NULL);
 	virtual ~FontResource();
 
 public:
 	virtual void* GetResource(void) { return mFont; }
 
+protected:
+	bool AcquireShared(std::string key);
+	void AddShared(std::string key);
+
 protected:
 	void* mFont;
 	Type m_type;
+	std::string mKey;               // Set if the font is shared
+
+	// Fonts with the same file, size and dpi are loaded once
+	struct SharedFont { void* font; Type type; int refs; };
+	static std::map<std::string, SharedFont> mFonts;
+};
+
+// Image files shared by every resource that uses them. PNGs only have their
+// header read when acquired and are decoded on first use; with
+// TW_EVICT_GUI_RESOURCES the pixels of images no page has drawn since the
+// last page change are freed again.
+class SurfaceCache
+{
+public:
+	struct Entry
+	{
+		std::string path;
+		gr_surface surface;
+		unsigned width, height;
+		int refs;
+		int lastUse;                // Page generation the surface was last drawn in
+		bool failed;
+	};
+
+	static Entry* Acquire(std::string file);
+	static void Release(Entry* entry);
+	static gr_surface Get(Entry* entry);
+	static void PageChanged(void);
+	static void LogStats(void);
+
+protected:
+	static bool ReadPngSize(const std::string& path, unsigned* width, unsigned* height);
+
+protected:
+	static std::map<std::string, Entry*> mEntries;
+	static int mGeneration;
+	static unsigned long mDecodedBytes;
+	static unsigned long mPeakBytes;
+	static unsigned mDecodes;
 };
 
 class ImageResource : public Resource
 {
 public:
-	ImageResource(xml_node<>* node, ZipArchive* pZip);
+	ImageResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache = NULL);
 	virtual ~ImageResource();
 
 public:
-	virtual void* GetResource(void) { return mSurface; }
+	virtual void* GetResource(void) { return mEntry ? SurfaceCache::Get(mEntry) : mSurface; }
+	virtual bool IsLoaded(void) { return mEntry || mSurface; }
+	virtual unsigned GetWidth(void) { return mEntry ? mEntry->width : (mSurface ? gr_get_width(mSurface) : 0); }
+	virtual unsigned GetHeight(void) { return mEntry ? mEntry->height : (mSurface ? gr_get_height(mSurface) : 0); }
 
 protected:
-	gr_surface mSurface;
+	gr_surface mSurface;            // Loaded from a zip or the theme cache
+	SurfaceCache::Entry* mEntry;    // Loaded from a file on first use
 };
 
 class AnimationResource : public Resource
 {
 public:
-	AnimationResource(xml_node<>* node, ZipArchive* pZip);
+	AnimationResource(xml_node<>* node, ZipArchive* pZip, ThemeCache* cache = NULL);
 	virtual ~AnimationResource();
 
 public:
-	virtual void* GetResource(void) { return mSurfaces.at(0); }
-	virtual void* GetResource(int entry) { return mSurfaces.at(entry); }
-	virtual int GetResourceCount(void) { return mSurfaces.size(); }
+	virtual void* GetResource(void) { return GetResource(0); }
+	virtual void* GetResource(int entry);
+	virtual int GetResourceCount(void) { return mFrames.empty() ? mSurfaces.size() : mFrames.size(); }
+	virtual bool IsLoaded(void) { return GetResourceCount() > 0; }
+	virtual unsigned GetWidth(void);
+	virtual unsigned GetHeight(void);
 
 protected:
-	std::vector<gr_surface> mSurfaces;
+	std::vector<gr_surface> mSurfaces;              // Loaded from a zip or the theme cache
+	std::vector<SurfaceCache::Entry*> mFrames;      // Loaded from files on first use
 };
 
 class ResourceManager
 {
 public:
-	ResourceManager(xml_node<>* resList, ZipArchive* pZip);
+	ResourceManager(xml_node<>* resList, ZipArchive* pZip, ThemeCache* cache = NULL);
 	virtual ~ResourceManager();
 	void LoadResources(xml_node<>* resList, ZipArchive* pZip);
 
@@ -97,6 +153,7 @@ public:
 
 private:
 	std::vector<Resource*> mResources;
+	ThemeCache* mCache;
 };
 
 #endif  // _RESOURCE_HEADER
@@ -63,15 +63,15 @@ GUISlider::GUISlider(xml_node<>* node) : GUIObject(node)
 	// Load the placement
 	LoadPlacement(node->first_node("placement"), &mRenderX, &mRenderY);
 
-	if (sSlider && sSlider->GetResource())
+	if (sSlider && sSlider->IsLoaded())
 	{
-		mRenderW = gr_get_width(sSlider->GetResource());
-		mRenderH = gr_get_height(sSlider->GetResource());
+		mRenderW = sSlider->GetWidth();
+		mRenderH = sSlider->GetHeight();
 	}
-	if (sTouch && sTouch->GetResource())
+	if (sTouch && sTouch->IsLoaded())
 	{
-		sTouchW = gr_get_width(sTouch->GetResource());  // Width of the "touch image" that follows the touch (arrow)
-		sTouchH = gr_get_height(sTouch->GetResource()); // Height of the "touch image" that follows the touch (arrow)
+		sTouchW = sTouch->GetWidth();  // Width of the "touch image" that follows the touch (arrow)
+		sTouchH = sTouch->GetHeight(); // Height of the "touch image" that follows the touch (arrow)
 	}
 
 	//LOGINFO("mRenderW: %i mTouchW: %i\n", mRenderW, mTouchW);
@@ -0,0 +1,298 @@
+// themecache.cpp - Loads the precompiled theme cache
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <string>
+
+extern "C" {
+#include "../twcommon.h"
+#include "../minuitwrp/minui.h"
+}
+
+#include "rapidxml.hpp"
+using namespace rapidxml;
+#include "themecache.hpp"
+
+ThemeCache* ThemeCache::Open(std::string path)
+{
+	struct stat st;
+	void* data;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ThemeCacheHeader))
+	{
+		close(fd);
+		return NULL;
+	}
+	// Private writable mapping as the XML strings are handed out as char*
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		LOGINFO("Unable to map theme cache '%s'\n", path.c_str());
+		return NULL;
+	}
+
+	ThemeCache* cache = new ThemeCache((unsigned char*) data, st.st_size);
+	if (!cache->IsValid())
+	{
+		LOGINFO("Theme cache '%s' is damaged, loading XML\n", path.c_str());
+		delete cache;
+		return NULL;
+	}
+	if (!cache->IsCurrent())
+	{
+		LOGINFO("Theme cache '%s' is out of date, loading XML\n", path.c_str());
+		delete cache;
+		return NULL;
+	}
+	LOGINFO("Using theme cache '%s' (%i images, %i fonts)\n", path.c_str(), cache->mHeader->image_count, cache->mHeader->font_count);
+	return cache;
+}
+
+ThemeCache::ThemeCache(unsigned char* data, size_t size)
+{
+	mData = data;
+	mSize = size;
+	mHeader = (ThemeCacheHeader*) data;
+}
+
+ThemeCache::~ThemeCache()
+{
+	munmap(mData, mSize);
+}
+
+// Checks that a string and its size lie inside the string table
+bool ThemeCache::IsString(uint32_t offset, uint32_t size)
+{
+	// The table ends with a terminator, so any offset inside it is terminated
+	return offset < mHeader->string_size && size < mHeader->string_size - offset;
+}
+
+// Checks that every table lies inside the file and every index inside its
+// table, so a truncated or stale cache is rejected instead of read past
+bool ThemeCache::IsValid(void)
+{
+	ThemeCacheHeader* h = mHeader;
+	uint32_t i;
+
+	if (memcmp(h->magic, THEME_CACHE_MAGIC, sizeof(h->magic)) != 0 || h->version != THEME_CACHE_VERSION || h->file_size != mSize)
+		return false;
+	if (h->string_offset > mSize || h->string_size > mSize - h->string_offset || h->string_size == 0 || mData[h->string_offset + h->string_size - 1] != 0)
+		return false;
+	if (h->source_offset > mSize || h->source_count > (mSize - h->source_offset) / sizeof(ThemeCacheSource))
+		return false;
+	if (h->doc_offset > mSize || h->doc_count > (mSize - h->doc_offset) / sizeof(ThemeCacheDoc))
+		return false;
+	if (h->image_offset > mSize || h->image_count > (mSize - h->image_offset) / sizeof(ThemeCacheImage))
+		return false;
+	if (h->font_offset > mSize || h->font_count > (mSize - h->font_offset) / sizeof(ThemeCacheFont))
+		return false;
+	if (h->node_offset > mSize || h->node_count > (mSize - h->node_offset) / sizeof(ThemeCacheNode))
+		return false;
+	if (h->attr_offset > mSize || h->attr_count > (mSize - h->attr_offset) / sizeof(ThemeCacheAttr))
+		return false;
+
+	ThemeCacheSource* sources = (ThemeCacheSource*) (mData + h->source_offset);
+	for (i = 0; i < h->source_count; i++)
+	{
+		if (!IsString(sources[i].path))
+			return false;
+	}
+	ThemeCacheNode* nodes = (ThemeCacheNode*) (mData + h->node_offset);
+	ThemeCacheDoc* docs = (ThemeCacheDoc*) (mData + h->doc_offset);
+	for (i = 0; i < h->doc_count; i++)
+	{
+		if (!IsString(docs[i].name))
+			return false;
+		// Every top level node and the children it announces have to be in the table
+		uint32_t index = docs[i].first_node;
+		for (uint32_t top = 0; top < docs[i].node_count; top++)
+		{
+			uint64_t pending = 1;
+			while (pending)
+			{
+				if (index >= h->node_count)
+					return false;
+				pending += (uint64_t) nodes[index++].child_count - 1;
+			}
+		}
+	}
+	for (i = 0; i < h->node_count; i++)
+	{
+		if (nodes[i].type > node_pi || nodes[i].first_attr > h->attr_count || nodes[i].attr_count > h->attr_count - nodes[i].first_attr)
+			return false;
+		if ((nodes[i].name_size && !IsString(nodes[i].name, nodes[i].name_size)) || (nodes[i].value_size && !IsString(nodes[i].value, nodes[i].value_size)))
+			return false;
+	}
+	ThemeCacheAttr* attrs = (ThemeCacheAttr*) (mData + h->attr_offset);
+	for (i = 0; i < h->attr_count; i++)
+	{
+		if (!IsString(attrs[i].name, attrs[i].name_size) || !IsString(attrs[i].value, attrs[i].value_size))
+			return false;
+	}
+	ThemeCacheImage* images = (ThemeCacheImage*) (mData + h->image_offset);
+	for (i = 0; i < h->image_count; i++)
+	{
+		if (!IsString(images[i].name))
+			return false;
+	}
+	ThemeCacheFont* fonts = (ThemeCacheFont*) (mData + h->font_offset);
+	for (i = 0; i < h->font_count; i++)
+	{
+		if (!IsString(fonts[i].name))
+			return false;
+		for (uint32_t c = 0; c < 96; c++)
+		{
+			if (fonts[i].offset[c] > fonts[i].width)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Compares the size and hash of every file the cache was built from
+bool ThemeCache::IsCurrent(void)
+{
+	ThemeCacheSource* sources = (ThemeCacheSource*) (mData + mHeader->source_offset);
+
+	for (uint32_t i = 0; i < mHeader->source_count; i++)
+	{
+		const char* path = String(sources[i].path);
+		struct stat st;
+		bool match = false;
+
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			LOGINFO("Theme cache source '%s' is missing\n", path);
+			return false;
+		}
+		if (fstat(fd, &st) == 0 && st.st_size == (off_t) sources[i].size)
+		{
+			if (st.st_size == 0)
+				match = (sources[i].hash == ThemeCacheHash(NULL, 0));
+			else
+			{
+				void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED)
+				{
+					match = (ThemeCacheHash((const unsigned char*) data, st.st_size) == sources[i].hash);
+					munmap(data, st.st_size);
+				}
+			}
+		}
+		close(fd);
+		if (!match)
+		{
+			LOGINFO("Theme cache source '%s' has changed\n", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns NULL if the children run past the node table, IsValid checked that they do not
+xml_node<>* ThemeCache::LoadNode(xml_document<>* doc, uint32_t& index)
+{
+	if (index >= mHeader->node_count)
+		return NULL;
+
+	ThemeCacheNode* n = (ThemeCacheNode*) (mData + mHeader->node_offset) + index++;
+	ThemeCacheAttr* attrs = (ThemeCacheAttr*) (mData + mHeader->attr_offset);
+
+	xml_node<>* node = doc->allocate_node((node_type) n->type,
+		n->name_size ? String(n->name) : NULL, n->value_size ? String(n->value) : NULL,
+		n->name_size, n->value_size);
+	for (uint32_t a = n->first_attr; a < n->first_attr + n->attr_count; a++)
+	{
+		node->append_attribute(doc->allocate_attribute(String(attrs[a].name), String(attrs[a].value),
+			attrs[a].name_size, attrs[a].value_size));
+	}
+	for (uint32_t c = 0; c < n->child_count; c++)
+	{
+		xml_node<>* child = LoadNode(doc, index);
+		if (!child)
+			return NULL;
+		node->append_node(child);
+	}
+	return node;
+}
+
+// Rebuilds the DOM of the named XML file as rapidxml's parse<0> would have
+int ThemeCache::LoadDocument(std::string name, xml_document<>* doc)
+{
+	ThemeCacheDoc* docs = (ThemeCacheDoc*) (mData + mHeader->doc_offset);
+
+	for (uint32_t i = 0; i < mHeader->doc_count; i++)
+	{
+		if (name != String(docs[i].name))
+			continue;
+
+		uint32_t index = docs[i].first_node;
+		doc->clear();
+		for (uint32_t top = 0; top < docs[i].node_count; top++)
+		{
+			xml_node<>* node = LoadNode(doc, index);
+			if (!node)
+			{
+				LOGINFO("Theme cache document '%s' is damaged\n", name.c_str());
+				doc->clear();
+				return -1;
+			}
+			doc->append_node(node);
+		}
+		return 0;
+	}
+	return -1;
+}
+
+gr_surface ThemeCache::LoadImage(std::string name)
+{
+	ThemeCacheImage* images = (ThemeCacheImage*) (mData + mHeader->image_offset);
+	gr_surface surface;
+
+	for (uint32_t i = 0; i < mHeader->image_count; i++)
+	{
+		if (name != String(images[i].name))
+			continue;
+
+		if (images[i].data > mSize || (uint64_t) images[i].stride * images[i].height * 4 > mSize - images[i].data)
+			return NULL;
+		// The pixels stay in the mapping, which outlives the page set's resources
+		if (res_create_surface_data(images[i].width, images[i].height, images[i].stride, images[i].format, mData + images[i].data, &surface))
+			return NULL;
+		return surface;
+	}
+	return NULL;
+}
+
+void* ThemeCache::LoadFont(std::string name)
+{
+	ThemeCacheFont* fonts = (ThemeCacheFont*) (mData + mHeader->font_offset);
+
+	for (uint32_t i = 0; i < mHeader->font_count; i++)
+	{
+		if (name != String(fonts[i].name))
+			continue;
+		if (fonts[i].data > mSize || (uint64_t) fonts[i].width * fonts[i].height > mSize - fonts[i].data)
+			return NULL;
+#ifdef TW_THEME_CACHE_NO_FONTS
+		// Custom graphics do not provide gr_loadFontData, the .dat is loaded instead
+		return NULL;
+#else
+		return gr_loadFontData(fonts[i].width, fonts[i].height, fonts[i].offset, mData + fonts[i].data);
+#endif
+	}
+	return NULL;
+}
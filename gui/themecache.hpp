@@ -0,0 +1,126 @@
+// themecache.hpp - Precompiled theme cache
+//
+// The cache is generated at build time by mkthemecache from the final /res
+// directory and installed next to ui.xml. It holds the already parsed XML
+// trees of ui.xml and its includes, the decoded pixels of every PNG image
+// and animation frame and the expanded atlases of .dat fonts, so loading a
+// theme does not parse XML, inflate PNGs or read fonts byte by byte.
+// Every file the cache was built from is listed with its size and hash; if
+// any of them changed the cache is ignored and the theme loads from XML.
+//
+// All values are little endian, offsets are from the start of the file and
+// strings are NUL terminated entries of the string table.
+
+#ifndef _THEMECACHE_HEADER
+#define _THEMECACHE_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define THEME_CACHE_MAGIC       "TWTHEME"
+#define THEME_CACHE_VERSION     2
+#define THEME_CACHE_EXT         ".cache"
+#define THEME_CACHE_ALIGN       16
+
+struct ThemeCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t file_size;
+	uint32_t source_count, source_offset;   // ThemeCacheSource[]
+	uint32_t doc_count, doc_offset;         // ThemeCacheDoc[], ui.xml first
+	uint32_t node_count, node_offset;       // ThemeCacheNode[] of all documents
+	uint32_t attr_count, attr_offset;       // ThemeCacheAttr[] of all documents
+	uint32_t image_count, image_offset;     // ThemeCacheImage[]
+	uint32_t font_count, font_offset;       // ThemeCacheFont[]
+	uint32_t string_offset, string_size;
+};
+
+struct ThemeCacheSource
+{
+	uint32_t path;                          // Path on the device
+	uint32_t size;
+	uint64_t hash;
+};
+
+struct ThemeCacheDoc
+{
+	uint32_t name;                          // As used in <xmlfile name="...">
+	uint32_t first_node, node_count;        // node_count top level nodes, each followed by its children
+};
+
+// Nodes are stored in document order, each followed by its children
+struct ThemeCacheNode
+{
+	uint32_t type;                          // rapidxml::node_type
+	uint32_t name, name_size;
+	uint32_t value, value_size;
+	uint32_t first_attr, attr_count;
+	uint32_t child_count;
+};
+
+struct ThemeCacheAttr
+{
+	uint32_t name, name_size;
+	uint32_t value, value_size;
+};
+
+struct ThemeCacheImage
+{
+	uint32_t name;                          // filename attribute, with the frame number for animations
+	uint32_t width, height, stride;         // stride in pixels
+	uint32_t format;                        // GGL_PIXEL_FORMAT_RGBA_8888 or GGL_PIXEL_FORMAT_RGBX_8888
+	uint32_t data;
+};
+
+struct ThemeCacheFont
+{
+	uint32_t name;                          // .dat font name without extension
+	uint32_t width, height;
+	uint32_t offset[96];
+	uint32_t data;                          // width * height bytes of 8 bit alpha
+};
+
+// 64 bit FNV-1a, used to detect changed source files
+static inline uint64_t ThemeCacheHash(const unsigned char* data, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (len--)
+	{
+		hash ^= *data++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+#ifndef THEME_CACHE_HOST
+class ThemeCache
+{
+public:
+	// Returns NULL if the cache is missing, damaged or out of date
+	static ThemeCache* Open(std::string path);
+	virtual ~ThemeCache();
+
+public:
+	int LoadDocument(std::string name, xml_document<>* doc);
+	gr_surface LoadImage(std::string name);
+	void* LoadFont(std::string name);
+
+protected:
+	ThemeCache(unsigned char* data, size_t size);
+	bool IsCurrent(void);
+	bool IsValid(void);
+	bool IsString(uint32_t offset, uint32_t size = 0);
+	const char* String(uint32_t offset) { return (const char*) (mData + mHeader->string_offset + offset); }
+	xml_node<>* LoadNode(xml_document<>* doc, uint32_t& index);
+
+protected:
+	unsigned char* mData;
+	size_t mSize;
+	ThemeCacheHeader* mHeader;
+};
+#endif
+
+#endif  // _THEMECACHE_HEADER
@@ -37,3 +37,14 @@ ifeq ($(TWHAVE_SELINUX), true)
 endif
 
 include $(BUILD_STATIC_LIBRARY)
+
+# Build host static library for the host twrpTar
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtar_host
+LOCAL_MODULE_TAGS := eng optional
+LOCAL_CFLAGS := -D_GNU_SOURCE -DMAJOR_IN_SYSMACROS
+LOCAL_SRC_FILES = append.c block.c decode.c encode.c extract.c handle.c output.c util.c wrapper.c basename.c strmode.c libtar_hash.c libtar_list.c dirname.c strlcpy.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+
+include $(BUILD_HOST_STATIC_LIBRARY)
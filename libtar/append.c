@@ -55,9 +55,12 @@ tar_dev_free(tar_dev_t *tdp)
 }
 
 
-/* appends a file to the tar archive */
-int
-tar_append_file(TAR *t, char *realname, char *savename)
+/*
+** appends a file to the tar archive, if origname is set the file is
+** stored as a reference to the identical file saved under that name
+*/
+static int
+tar_append_internal(TAR *t, char *realname, char *savename, char *origname)
 {
 	struct stat s;
 	int i;
@@ -68,8 +71,8 @@ tar_append_file(TAR *t, char *realname, char *savename)
 
 #ifdef DEBUG
 	printf("==> tar_append_file(TAR=0x%lx (\"%s\"), realname=\"%s\", "
-	       "savename=\"%s\")\n", t, t->pathname, realname,
-	       (savename ? savename : "[NULL]"));
+	       "savename=\"%s\", origname=\"%s\")\n", t, t->pathname, realname,
+	       (savename ? savename : "[NULL]"), (origname ? origname : "[NULL]"));
 #endif
 
 	if (lstat(realname, &s) != 0)
@@ -104,7 +107,9 @@ tar_append_file(TAR *t, char *realname, char *savename)
 		security_context_t selinux_context = NULL;
 		if (lgetfilecon(realname, &selinux_context) >= 0) {
 			t->th_buf.selinux_context = strdup(selinux_context);
+#ifdef DEBUG
 			printf("setting selinux context: %s\n", selinux_context);
+#endif
 			freecon(selinux_context);
 		}
 		else
@@ -161,6 +166,18 @@ tar_append_file(TAR *t, char *realname, char *savename)
 		libtar_hash_add(td->td_h, ti);
 	}
 
+	/* check if it's a copy of a file already in the archive */
+	if (origname != NULL && !TH_ISLNK(t))
+	{
+#ifdef DEBUG
+		printf("    tar_append_file(): encoding \"%s\" as a copy "
+		       "of \"%s\"...\n", realname, origname);
+#endif
+		t->th_buf.typeflag = LNKTYPE;
+		th_set_link(t, origname);
+		t->th_buf.dedup = 1;
+	}
+
 	/* check if it's a symlink */
 	if (TH_ISSYM(t))
 	{
@@ -204,6 +221,22 @@ tar_append_file(TAR *t, char *realname, char *savename)
 }
 
 
+/* appends a file to the tar archive */
+int
+tar_append_file(TAR *t, char *realname, char *savename)
+{
+	return tar_append_internal(t, realname, savename, NULL);
+}
+
+
+/* appends a file identical to origname as a reference to it */
+int
+tar_append_dedup(TAR *t, char *realname, char *savename, char *origname)
+{
+	return tar_append_internal(t, realname, savename, origname);
+}
+
+
 /* write EOF indicator */
 int
 tar_append_eof(TAR *t)
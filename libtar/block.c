@@ -12,6 +12,7 @@
 
 #include <internal.h>
 
+#include <stdio.h>
 #include <errno.h>
 
 #ifdef STDC_HEADERS
@@ -26,6 +27,21 @@
 #define SELINUX_TAG "RHT.security.selinux="
 #define SELINUX_TAG_LEN 21
 
+// Marks a LNKTYPE entry that has to be restored as a copy of
+// its link target, written by tar_append_dedup().
+#define DEDUP_TAG "TWRP.dedup=1"
+#define DEDUP_TAG_LEN 12
+
+/* keep track of the position in the archive for indexes */
+ssize_t
+tar_block_advance(TAR *t, ssize_t i)
+{
+	if (i > 0)
+		t->offset += i;
+	return i;
+}
+
+
 /* read a header block */
 int
 th_read_internal(TAR *t)
@@ -212,7 +228,6 @@ th_read(TAR *t)
 		}
 	}
 
-#ifdef HAVE_SELINUX
 	if(TH_ISEXTHEADER(t))
 	{
 		sz = th_get_size(t);
@@ -237,6 +252,7 @@ th_read(TAR *t)
 			// To be sure
 			buf[T_BLOCKSIZE-1] = 0;
 
+#ifdef HAVE_SELINUX
 			int len = strlen(buf);
 			char *start = strstr(buf, SELINUX_TAG);
 			if(start && start+SELINUX_TAG_LEN < buf+len)
@@ -251,6 +267,14 @@ th_read(TAR *t)
 #endif
 				}
 			}
+#endif
+			if(strstr(buf, " "DEDUP_TAG"\n") != NULL)
+			{
+				t->th_buf.dedup = 1;
+#ifdef DEBUG
+				printf("    th_read(): entry is a copy of its link target\n");
+#endif
+			}
 		}
 
 		i = th_read_internal(t);
@@ -261,7 +285,6 @@ th_read(TAR *t)
 			return -1;
 		}
 	}
-#endif
 
 #if 0
 	/*
@@ -308,9 +331,10 @@ th_write(TAR *t)
 {
 	int i, j;
 	char type2;
-	size_t sz, sz2;
+	size_t sz, sz2, ext_len;
 	char *ptr;
 	char buf[T_BLOCKSIZE];
+	char ext[T_BLOCKSIZE];
 
 #ifdef DEBUG
 	printf("==> th_write(TAR=\"%s\")\n", t->pathname);
@@ -419,6 +443,9 @@ th_write(TAR *t)
 		th_set_size(t, sz2);
 	}
 
+	/* extended ('x') header for the selinux context and the dedup flag */
+	ext_len = 0;
+	memset(ext, 0, T_BLOCKSIZE);
 #ifdef HAVE_SELINUX
 	if((t->options & TAR_STORE_SELINUX) && t->th_buf.selinux_context != NULL)
 	{
@@ -426,13 +453,6 @@ th_write(TAR *t)
 		printf("th_write(): using selinux_context (\"%s\")\n",
 		       t->th_buf.selinux_context);
 #endif
-		/* save old size and type */
-		type2 = t->th_buf.typeflag;
-		sz2 = th_get_size(t);
-
-		/* write out initial header block with fake size and type */
-		t->th_buf.typeflag = TH_EXT_TYPE;
-
 		/* setup size - EXT header has format "*size of this whole tag as ascii numbers* *space* *content* *newline* */
 		//                                                       size   newline
 		sz = SELINUX_TAG_LEN + strlen(t->th_buf.selinux_context) + 3  +    1;
@@ -446,7 +466,34 @@ th_write(TAR *t)
 			return -1;
 		}
 
-		th_set_size(t, sz);
+		ext_len += snprintf(ext, T_BLOCKSIZE, "%d "SELINUX_TAG"%s\n", sz, t->th_buf.selinux_context);
+	}
+#endif
+	if (t->th_buf.dedup)
+	{
+#ifdef DEBUG
+		puts("th_write(): marking entry as a copy of its link target");
+#endif
+		//                          size   newline
+		sz = DEDUP_TAG_LEN + 3  +    1;
+		ext_len += snprintf(ext + ext_len, T_BLOCKSIZE - ext_len, "%d "DEDUP_TAG"\n", (int)sz);
+	}
+
+	if (ext_len > 0)
+	{
+		if (ext_len >= T_BLOCKSIZE)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		/* save old size and type */
+		type2 = t->th_buf.typeflag;
+		sz2 = th_get_size(t);
+
+		/* write out initial header block with fake size and type */
+		t->th_buf.typeflag = TH_EXT_TYPE;
+		th_set_size(t, ext_len);
 		th_finish(t);
 		i = tar_block_write(t, &(t->th_buf));
 		if (i != T_BLOCKSIZE)
@@ -456,9 +503,7 @@ th_write(TAR *t)
 			return -1;
 		}
 
-		memset(buf, 0, T_BLOCKSIZE);
-		snprintf(buf, T_BLOCKSIZE, "%d "SELINUX_TAG"%s\n", sz, t->th_buf.selinux_context);
-		i = tar_block_write(t, &buf);
+		i = tar_block_write(t, &ext);
 		if (i != T_BLOCKSIZE)
 		{
 			if (i != -1)
@@ -470,7 +515,6 @@ th_write(TAR *t)
 		t->th_buf.typeflag = type2;
 		th_set_size(t, sz2);
 	}
-#endif
 
 	th_finish(t);
 
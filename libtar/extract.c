@@ -22,6 +22,7 @@
 #define DEBUG
 #ifdef STDC_HEADERS
 # include <stdlib.h>
+# include <string.h>
 #endif
 
 #ifdef HAVE_UNISTD_H
@@ -121,7 +122,10 @@ tar_extract_file(TAR *t, char *realname, char *prefix, const int *progress_fd)
 	}
 	else if (TH_ISLNK(t)) {
 		printf("link\n");
-		i = tar_extract_hardlink(t, realname, prefix);
+		if (t->th_buf.dedup)
+			i = tar_extract_dedup(t, realname, prefix, progress_fd);
+		else
+			i = tar_extract_hardlink(t, realname, prefix);
 	}
 	else if (TH_ISSYM(t)) {
 		printf("sym\n");
@@ -369,6 +373,79 @@ tar_extract_hardlink(TAR * t, char *realname, char *prefix)
 }
 
 
+/* copy of a file extracted earlier */
+int
+tar_extract_dedup(TAR *t, char *realname, char *prefix, const int *progress_fd)
+{
+	char *filename;
+	char srcname[MAXPATHLEN];
+	char buf[T_BLOCKSIZE * 64];
+	int fdin, fdout;
+	ssize_t n;
+	unsigned long long copied = 0;
+
+	if (!TH_ISLNK(t) || !t->th_buf.dedup)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	filename = (realname ? realname : th_get_pathname(t));
+	if (mkdirhier(dirname(filename)) == -1)
+		return -1;
+	if (prefix != NULL)
+		snprintf(srcname, sizeof(srcname), "%s/%s", prefix, th_get_linkname(t));
+	else
+		snprintf(srcname, sizeof(srcname), "%s", th_get_linkname(t));
+#ifdef DEBUG
+	printf("  ==> extracting: %s (copy of %s)\n", filename, srcname);
+#endif
+	fdin = open(srcname, O_RDONLY
+#ifdef O_BINARY
+		    | O_BINARY
+#endif
+		   );
+	if (fdin == -1)
+	{
+#ifdef DEBUG
+		perror("open()");
+#endif
+		return -1;
+	}
+	fdout = open(filename, O_WRONLY | O_CREAT | O_TRUNC
+#ifdef O_BINARY
+		     | O_BINARY
+#endif
+		    , 0666);
+	if (fdout == -1)
+	{
+#ifdef DEBUG
+		perror("open()");
+#endif
+		close(fdin);
+		return -1;
+	}
+
+	while ((n = read(fdin, buf, sizeof(buf))) > 0)
+	{
+		if (write(fdout, buf, n) != n)
+		{
+			n = -1;
+			break;
+		}
+		copied += n;
+	}
+	close(fdin);
+	if (close(fdout) == -1 || n == -1)
+		return -1;
+
+	if (*progress_fd != 0)
+		write(*progress_fd, &copied, sizeof(copied));
+
+	return 0;
+}
+
+
 /* symlink */
 int
 tar_extract_symlink(TAR *t, char *realname)
@@ -63,6 +63,7 @@ struct tar_header
 #ifdef HAVE_SELINUX
 	char *selinux_context;
 #endif
+	int dedup;	/* LNKTYPE entry is a copy of linkname, not a link */
 };
 
 
@@ -91,6 +92,7 @@ typedef struct
 	int options;
 	struct tar_header th_buf;
 	libtar_hash_t *h;
+	unsigned long long offset;	/* position in the archive stream */
 }
 TAR;
 
@@ -141,6 +143,16 @@ void tar_dev_free(struct tar_dev *tdp);
  */
 int tar_append_file(TAR *t, char *realname, char *savename);
 
+/* Appends a file whose contents equal a file already in the archive.
+ * Only a header is stored, tar_extract_file() restores it as a copy.
+ * Arguments:
+ *    t        = TAR handle to append to
+ *    realname = path of file to append
+ *    savename = name to save the file under in the archive
+ *    origname = name the identical file was saved under
+ */
+int tar_append_dedup(TAR *t, char *realname, char *savename, char *origname);
+
 /* write EOF indicator */
 int tar_append_eof(TAR *t);
 
@@ -152,9 +164,12 @@ int tar_append_regfile(TAR *t, char *realname);
 
 /* macros for reading/writing tarchive blocks */
 #define tar_block_read(t, buf) \
-	(*((t)->type->readfunc))((t)->fd, (char *)(buf), T_BLOCKSIZE)
+	tar_block_advance((t), (*((t)->type->readfunc))((t)->fd, (char *)(buf), T_BLOCKSIZE))
 #define tar_block_write(t, buf) \
-	(*((t)->type->writefunc))((t)->fd, (char *)(buf), T_BLOCKSIZE)
+	tar_block_advance((t), (*((t)->type->writefunc))((t)->fd, (char *)(buf), T_BLOCKSIZE))
+
+/* adds the bytes read or written to t->offset, returns i */
+ssize_t tar_block_advance(TAR *t, ssize_t i);
 
 /* read/write a header block */
 int th_read(TAR *t);
@@ -231,6 +246,7 @@ int tar_extract_file(TAR *t, char *realname, char *prefix, const int *progress_f
 /* extract different file types */
 int tar_extract_dir(TAR *t, char *realname);
 int tar_extract_hardlink(TAR *t, char *realname, char *prefix);
+int tar_extract_dedup(TAR *t, char *realname, char *prefix, const int *progress_fd);
 int tar_extract_symlink(TAR *t, char *realname);
 int tar_extract_chardev(TAR *t, char *realname);
 int tar_extract_blockdev(TAR *t, char *realname);
@@ -13,6 +13,8 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
 	adb.c \
 	fdevent.c \
+	fuse_adb_provider.c \
+	fuse_sideload.c \
 	transport.c \
 	transport_usb.c \
 	sockets.c \
@@ -23,11 +25,41 @@ LOCAL_SRC_FILES := \
 
 LOCAL_CFLAGS := -O2 -g -DADB_HOST=0 -Wall -Wno-unused-parameter
 LOCAL_CFLAGS += -D_XOPEN_SOURCE -D_GNU_SOURCE
+LOCAL_CFLAGS += -D_FILE_OFFSET_BITS=64 -DFUSE_USE_VERSION=26
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../fuse/include $(LOCAL_PATH)/../libmincrypt/includes
 LOCAL_MODULE_TAGS := eng
 LOCAL_MODULE := libminadbd
 
-LOCAL_SHARED_LIBRARIES := libcutils libc
+LOCAL_STATIC_LIBRARIES := libfusetwrp libmincrypttwrp
+LOCAL_SHARED_LIBRARIES := libcutils libc libdl
 include $(BUILD_SHARED_LIBRARY)
 
 
 
+# minadbd loopback sideload benchmark
+# =========================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	adb.c \
+	fdevent.c \
+	fuse_adb_provider.c \
+	fuse_sideload.c \
+	transport.c \
+	transport_usb.c \
+	sockets.c \
+	services.c \
+	utils.c \
+	loopback_bench.c
+
+LOCAL_CFLAGS := -O2 -g -DADB_HOST=0 -Wall -Wno-unused-parameter
+LOCAL_CFLAGS += -D_XOPEN_SOURCE -D_GNU_SOURCE
+LOCAL_CFLAGS += -D_FILE_OFFSET_BITS=64 -DFUSE_USE_VERSION=26
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../fuse/include $(LOCAL_PATH)/../libmincrypt/includes
+LOCAL_MODULE_TAGS := tests
+LOCAL_MODULE := minadbd_loopback_bench
+
+LOCAL_STATIC_LIBRARIES := libfusetwrp libmincrypttwrp
+LOCAL_SHARED_LIBRARIES := libcutils libc libdl
+include $(BUILD_EXECUTABLE)
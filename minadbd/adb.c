@@ -128,16 +128,59 @@ void  adb_trace_init(void)
 }
 
 
+/* Packets have room for the largest payload, so instead of allocating
+** one per message they are kept on a free list.  A few are allocated up
+** front, more are allocated while the transport threads have many in
+** flight and freed again once the list holds APACKET_POOL_MAX.
+*/
+#define APACKET_POOL_PREALLOC 4
+#define APACKET_POOL_MAX 16
+
+ADB_MUTEX_DEFINE( apacket_lock );
+static apacket *apacket_pool = NULL;
+static int apacket_pool_count = 0;
+
+void init_apacket_pool(void)
+{
+    int i;
+
+    for(i = 0; i < APACKET_POOL_PREALLOC; i++) {
+        apacket *p = malloc(sizeof(apacket));
+        if(p == 0) fatal("failed to allocate an apacket");
+        put_apacket(p);
+    }
+}
+
 apacket *get_apacket(void)
 {
-    apacket *p = malloc(sizeof(apacket));
-    if(p == 0) fatal("failed to allocate an apacket");
+    apacket *p;
+
+    adb_mutex_lock(&apacket_lock);
+    p = apacket_pool;
+    if(p) {
+        apacket_pool = p->next;
+        apacket_pool_count--;
+    }
+    adb_mutex_unlock(&apacket_lock);
+
+    if(p == 0) {
+        p = malloc(sizeof(apacket));
+        if(p == 0) fatal("failed to allocate an apacket");
+    }
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
     return p;
 }
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&apacket_lock);
+    if(apacket_pool_count < APACKET_POOL_MAX) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        apacket_pool_count++;
+        p = 0;
+    }
+    adb_mutex_unlock(&apacket_lock);
     free(p);
 }
 
@@ -310,6 +353,9 @@ void handle_packet(apacket *p, atransport *t)
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
+            /* only send as much as the host accepts, older hosts take 4K */
+        t->max_payload = p->msg.arg1 < MAX_PAYLOAD ? p->msg.arg1 : MAX_PAYLOAD;
+        D("max payload %d\n", (int) t->max_payload);
         parse_banner((char*) p->data, t);
         handle_online();
         if(!HOST) send_connect(t);
@@ -382,6 +428,7 @@ int adb_main(const char* path)
 {
 	strcpy(ADB_SIDELOAD_FILENAME, path);
     atexit(adb_cleanup);
+    init_apacket_pool();
 #if defined(HAVE_FORKEXEC)
     // No SIGCHLD. Let the service subproc handle its children.
     signal(SIGPIPE, SIG_IGN);
@@ -22,7 +22,8 @@
 #include "transport.h"  /* readx(), writex() */
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+#define MAX_PAYLOAD_V1 4096         // Payload every host accepts
+#define MAX_PAYLOAD (256 * 1024)    // Largest payload offered in CNXN
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -187,6 +188,9 @@ struct atransport
     char *product;
     int adb_port; // Use for emulators (local transport)
 
+        /* payload the remote accepted in its CNXN, 0 until it connected */
+    size_t max_payload;
+
         /* a list of adisconnect callbacks called when the transport is kicked */
     int          kicked;
     adisconnect  disconnects;
@@ -285,8 +289,10 @@ char * get_log_file_path(const char * log_name);
 #endif
 
 /* packet allocator */
+void init_apacket_pool(void);
 apacket *get_apacket(void);
 void put_apacket(apacket *p);
+size_t get_max_payload(atransport *t);
 
 int check_header(apacket *p);
 int check_data(apacket *p);
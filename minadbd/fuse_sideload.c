@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A read only fuse file system holding a single file whose blocks are
+// fetched from a provider (e.g. the host running "adb sideload") only when
+// they are read.  Recently used blocks are kept in a small cache so the
+// kernel reading a block in pieces does not fetch it several times.
+//
+// The package is verified and then read again while installing, so the
+// provider could try to send different data the second time.  The SHA-256
+// of every block is kept from its first fetch and a block that comes back
+// different fails the read with EIO.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <fuse.h>
+#include "mincrypt/sha256.h"
+#include "fuse_sideload.h"
+
+#define PACKAGE_FILE_ID "/" FUSE_SIDELOAD_HOST_FILENAME
+#define EXIT_FLAG_ID "/" FUSE_SIDELOAD_HOST_EXIT_FLAG
+
+// Bytes of blocks kept in the cache, at least two blocks are kept
+#define CACHE_BYTES (4 * 1024 * 1024)
+
+struct cache_slot {
+    unsigned int block;
+    unsigned int last_use;
+    int valid;
+    unsigned char* data;
+};
+
+struct fuse_data {
+    struct provider_vtab* vtab;
+    void* cookie;
+
+    unsigned long long file_size;
+    unsigned int block_size;
+    unsigned int file_blocks;
+
+    uint8_t* hashes;            // SHA-256 of each block as first fetched
+    unsigned char* hashed;      // Set for blocks with a hash
+
+    struct cache_slot* slots;
+    unsigned int slot_count;
+    unsigned int use_count;
+
+    unsigned long long fetched_bytes;
+    unsigned int refetches;
+};
+
+static struct fuse_data* get_data(void) {
+    return (struct fuse_data*) fuse_get_context()->private_data;
+}
+
+// Returns the contents of block, or NULL if it could not be fetched
+static const unsigned char* fetch_block(struct fuse_data* fd, unsigned int block) {
+    struct cache_slot* slot = NULL;
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    unsigned int fetch_size, i;
+
+    for (i = 0; i < fd->slot_count; ++i) {
+        if (fd->slots[i].valid && fd->slots[i].block == block) {
+            fd->slots[i].last_use = ++fd->use_count;
+            return fd->slots[i].data;
+        }
+        if (slot == NULL || !fd->slots[i].valid ||
+            (slot->valid && fd->slots[i].last_use < slot->last_use)) {
+            slot = &fd->slots[i];
+        }
+    }
+
+    fetch_size = fd->block_size;
+    if (block == fd->file_blocks - 1 && fd->file_size % fd->block_size)
+        fetch_size = fd->file_size % fd->block_size;
+
+    slot->valid = 0;
+    if (fd->vtab->read_block(fd->cookie, block, slot->data, fetch_size) != 0) {
+        fprintf(stderr, "failed to fetch block %u\n", block);
+        return NULL;
+    }
+    if (fetch_size < fd->block_size)
+        memset(slot->data + fetch_size, 0, fd->block_size - fetch_size);
+    fd->fetched_bytes += fetch_size;
+
+    SHA256_hash(slot->data, fetch_size, hash);
+    if (fd->hashed[block]) {
+        ++fd->refetches;
+        if (memcmp(fd->hashes + block * SHA256_DIGEST_SIZE, hash, SHA256_DIGEST_SIZE) != 0) {
+            fprintf(stderr, "block %u changed since it was first read\n", block);
+            return NULL;
+        }
+    } else {
+        memcpy(fd->hashes + block * SHA256_DIGEST_SIZE, hash, SHA256_DIGEST_SIZE);
+        fd->hashed[block] = 1;
+    }
+
+    slot->block = block;
+    slot->last_use = ++fd->use_count;
+    slot->valid = 1;
+    return slot->data;
+}
+
+static int sideload_getattr(const char* path, struct stat* st) {
+    struct fuse_data* fd = get_data();
+
+    memset(st, 0, sizeof(*st));
+    if (strcmp(path, "/") == 0) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    }
+    if (strcmp(path, PACKAGE_FILE_ID) == 0) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        st->st_size = fd->file_size;
+        st->st_blksize = fd->block_size;
+        st->st_blocks = (fd->file_size + 511) / 512;
+        return 0;
+    }
+    if (strcmp(path, EXIT_FLAG_ID) == 0) {
+        // Looking up the exit flag ends fuse_loop after this request
+        fuse_exit(fuse_get_context()->fuse);
+    }
+    return -ENOENT;
+}
+
+static int sideload_open(const char* path, struct fuse_file_info* fi) {
+    if (strcmp(path, PACKAGE_FILE_ID) != 0)
+        return -ENOENT;
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EACCES;
+    // The contents never change, so keep the page cache between opens
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int sideload_read(const char* path, char* buf, size_t size, off64_t offset,
+                         struct fuse_file_info* fi) {
+    struct fuse_data* fd = get_data();
+    size_t done = 0;
+
+    if (strcmp(path, PACKAGE_FILE_ID) != 0)
+        return -ENOENT;
+    if (offset < 0)
+        return -EINVAL;
+    if ((unsigned long long) offset >= fd->file_size)
+        return 0;
+    if (size > fd->file_size - offset)
+        size = fd->file_size - offset;
+
+    while (done < size) {
+        unsigned long long pos = offset + done;
+        unsigned int block = pos / fd->block_size;
+        unsigned int block_offset = pos % fd->block_size;
+        size_t len = fd->block_size - block_offset;
+        const unsigned char* data = fetch_block(fd, block);
+
+        if (data == NULL)
+            return done ? (int) done : -EIO;
+        if (len > size - done)
+            len = size - done;
+        memcpy(buf + done, data + block_offset, len);
+        done += len;
+    }
+    return done;
+}
+
+static int sideload_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
+                            off64_t offset, struct fuse_file_info* fi) {
+    if (strcmp(path, "/") != 0)
+        return -ENOENT;
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    filler(buf, FUSE_SIDELOAD_HOST_FILENAME, NULL, 0);
+    return 0;
+}
+
+int run_fuse_sideload(struct provider_vtab* vtab, void* cookie,
+                      unsigned long long file_size, unsigned int block_size) {
+    struct fuse_operations ops;
+    struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
+    struct fuse_chan* ch = NULL;
+    struct fuse* fuse = NULL;
+    struct fuse_data fd;
+    unsigned int i;
+    int result = -1;
+
+    if (block_size < 1024 || block_size > (1 << 22)) {
+        fprintf(stderr, "invalid block size %u\n", block_size);
+        return -1;
+    }
+    if (file_size == 0 || (file_size + block_size - 1) / block_size > 0xffffffffULL) {
+        fprintf(stderr, "invalid file size %llu\n", file_size);
+        return -1;
+    }
+
+    memset(&fd, 0, sizeof(fd));
+    fd.vtab = vtab;
+    fd.cookie = cookie;
+    fd.file_size = file_size;
+    fd.block_size = block_size;
+    fd.file_blocks = (file_size + block_size - 1) / block_size;
+    fd.slot_count = CACHE_BYTES / block_size;
+    if (fd.slot_count < 2)
+        fd.slot_count = 2;
+
+    fd.hashes = (uint8_t*) malloc((size_t) fd.file_blocks * SHA256_DIGEST_SIZE);
+    fd.hashed = (unsigned char*) calloc(fd.file_blocks, 1);
+    fd.slots = (struct cache_slot*) calloc(fd.slot_count, sizeof(struct cache_slot));
+    if (fd.hashes == NULL || fd.hashed == NULL || fd.slots == NULL) {
+        fprintf(stderr, "failed to allocate block tables\n");
+        goto done;
+    }
+    for (i = 0; i < fd.slot_count; ++i) {
+        fd.slots[i].data = (unsigned char*) malloc(block_size);
+        if (fd.slots[i].data == NULL) {
+            fprintf(stderr, "failed to allocate block cache\n");
+            goto done;
+        }
+    }
+
+    memset(&ops, 0, sizeof(ops));
+    ops.getattr = sideload_getattr;
+    ops.open = sideload_open;
+    ops.read = sideload_read;
+    ops.readdir = sideload_readdir;
+
+    if (mkdir(FUSE_SIDELOAD_HOST_MOUNTPOINT, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "failed to create %s: %s\n", FUSE_SIDELOAD_HOST_MOUNTPOINT, strerror(errno));
+        goto done;
+    }
+    fuse_opt_add_arg(&args, "sideload");
+    fuse_opt_add_arg(&args, "-oro");
+    ch = fuse_mount(FUSE_SIDELOAD_HOST_MOUNTPOINT, &args);
+    if (ch == NULL) {
+        fprintf(stderr, "failed to mount %s\n", FUSE_SIDELOAD_HOST_MOUNTPOINT);
+        goto done;
+    }
+    fuse = fuse_new(ch, &args, &ops, sizeof(ops), &fd);
+    if (fuse == NULL) {
+        fprintf(stderr, "failed to start fuse\n");
+        fuse_unmount(FUSE_SIDELOAD_HOST_MOUNTPOINT, ch);
+        goto done;
+    }
+
+    fprintf(stderr, "serving %llu bytes in %u blocks of %u bytes\n", file_size, fd.file_blocks, block_size);
+    result = fuse_loop(fuse);
+    fuse_unmount(FUSE_SIDELOAD_HOST_MOUNTPOINT, ch);
+    fuse_destroy(fuse);
+    fprintf(stderr, "fetched %llu bytes of %llu, %u blocks fetched again\n",
+            fd.fetched_bytes, file_size, fd.refetches);
+
+done:
+    vtab->close(cookie);
+    fuse_opt_free_args(&args);
+    if (fd.slots) {
+        for (i = 0; i < fd.slot_count; ++i)
+            free(fd.slots[i].data);
+    }
+    free(fd.slots);
+    free(fd.hashed);
+    free(fd.hashes);
+    return result;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FUSE_SIDELOAD_H
+#define __FUSE_SIDELOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The package is served as a read only file in this directory while the
+// host is connected.  Looking up FUSE_SIDELOAD_HOST_EXIT_PATHNAME
+// unmounts it again.
+#define FUSE_SIDELOAD_HOST_MOUNTPOINT "/sideload"
+#define FUSE_SIDELOAD_HOST_FILENAME "package.zip"
+#define FUSE_SIDELOAD_HOST_PATHNAME (FUSE_SIDELOAD_HOST_MOUNTPOINT "/" FUSE_SIDELOAD_HOST_FILENAME)
+#define FUSE_SIDELOAD_HOST_EXIT_FLAG "exit"
+#define FUSE_SIDELOAD_HOST_EXIT_PATHNAME (FUSE_SIDELOAD_HOST_MOUNTPOINT "/" FUSE_SIDELOAD_HOST_EXIT_FLAG)
+
+struct provider_vtab {
+    // Fills buffer with fetch_size bytes of block number block.  Returns 0
+    // on success.
+    int (*read_block)(void* cookie, unsigned int block, unsigned char* buffer, unsigned int fetch_size);
+
+    // Called once after the file system was unmounted.
+    void (*close)(void* cookie);
+};
+
+// Serves a file of file_size bytes read from vtab in blocks of block_size
+// bytes until the exit flag is looked up.  Blocks are only requested when
+// they are read, so the file is never copied as a whole.  Returns 0 on a
+// clean exit.
+int run_fuse_sideload(struct provider_vtab* vtab, void* cookie,
+                      unsigned long long file_size, unsigned int block_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Measures sideload throughput of minadbd without a USB gadget.  The usb
+** handle is one end of a socketpair and a thread plays the adb host on the
+** other end: it connects offering the given payload size, opens
+** "sideload:<size>" and sends the package the way "adb sideload" does,
+** waiting for OKAY after every packet.  The package goes to /dev/null.
+**
+** usage: minadbd_loopback_bench [MB] [payload sizes...]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "sysdeps.h"
+
+#define  TRACE_TAG  TRACE_USB
+#include "adb.h"
+
+struct usb_handle
+{
+    int fd;
+};
+
+struct bench
+{
+    int fd;
+    unsigned total;
+    unsigned payload;
+};
+
+/* The usb transport reads and writes whole messages on the socketpair */
+void usb_init() { }
+void usb_cleanup() { }
+int usb_write(usb_handle *h, const void *data, int len) { return writex(h->fd, data, len); }
+int usb_read(usb_handle *h, void *data, int len) { return readx(h->fd, data, len); }
+int usb_close(usb_handle *h) { return adb_close(h->fd); }
+void usb_kick(usb_handle *h) { adb_shutdown(h->fd); }
+
+/* The tcp transport is not used */
+int init_socket_transport(atransport *t, int s, int port, int local) { return -1; }
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int send_msg(int fd, unsigned command, unsigned arg0, unsigned arg1,
+                    const unsigned char *data, unsigned len)
+{
+    amessage msg;
+    unsigned i, sum = 0;
+
+    for(i = 0; i < len; i++)
+        sum += data[i];
+    msg.command = command;
+    msg.arg0 = arg0;
+    msg.arg1 = arg1;
+    msg.data_length = len;
+    msg.data_check = sum;
+    msg.magic = command ^ 0xffffffff;
+    if(writex(fd, &msg, sizeof(msg)))
+        return -1;
+    return len ? writex(fd, data, len) : 0;
+}
+
+static int recv_msg(int fd, amessage *msg, unsigned char *data)
+{
+    if(readx(fd, msg, sizeof(*msg)) || msg->data_length > MAX_PAYLOAD)
+        return -1;
+    return msg->data_length ? readx(fd, data, msg->data_length) : 0;
+}
+
+static int recv_cmd(int fd, unsigned command, amessage *msg, unsigned char *data)
+{
+    do {
+        if(recv_msg(fd, msg, data))
+            return -1;
+    } while(msg->command != command);
+    return 0;
+}
+
+static void *host_thread(void *x)
+{
+    struct bench *b = x;
+    unsigned char *data = malloc(MAX_PAYLOAD);
+    char name[64];
+    amessage msg;
+    unsigned remote, max_payload, sent = 0, packets = 0;
+    double start;
+
+    if(data == 0) fatal("cannot allocate host buffer");
+    memset(data, 0x5a, MAX_PAYLOAD);
+
+    strcpy((char*) data, "host::");
+    if(send_msg(b->fd, A_CNXN, A_VERSION, b->payload, data, strlen((char*) data) + 1) ||
+       recv_cmd(b->fd, A_CNXN, &msg, data))
+        fatal("connect failed");
+    max_payload = msg.arg1 < b->payload ? msg.arg1 : b->payload;
+
+    snprintf(name, sizeof(name), "sideload:%u", b->total);
+    if(send_msg(b->fd, A_OPEN, 1, 0, (unsigned char*) name, strlen(name) + 1) ||
+       recv_cmd(b->fd, A_OKAY, &msg, data))
+        fatal("open failed");
+    remote = msg.arg0;
+
+    memset(data, 0x5a, MAX_PAYLOAD);
+    start = now_ms();
+    while(sent < b->total) {
+        unsigned len = b->total - sent > max_payload ? max_payload : b->total - sent;
+        if(send_msg(b->fd, A_WRTE, 1, remote, data, len) ||
+           recv_cmd(b->fd, A_OKAY, &msg, data))
+            fatal("write failed after %u bytes", sent);
+        sent += len;
+        packets++;
+    }
+    if(recv_cmd(b->fd, A_WRTE, &msg, data) || msg.data_length != 4 ||
+       memcmp(data, "OKAY", 4) != 0)
+        fatal("sideload was not acknowledged");
+
+    double ms = now_ms() - start;
+    printf("payload %7u: %6u packets %8.1f ms %8.1f MB/s\n", max_payload, packets,
+           ms, b->total / 1048576.0 / (ms / 1000.0));
+    fflush(stdout);
+    return 0;
+}
+
+static int run(unsigned total, unsigned payload)
+{
+    usb_handle h;
+    struct bench b;
+    adb_thread_t tid;
+    int s[2];
+
+    if(adb_socketpair(s))
+        fatal_errno("cannot create socketpair");
+    strcpy(ADB_SIDELOAD_FILENAME, "/dev/null");
+    init_apacket_pool();
+    init_transport_registration();
+
+    h.fd = s[0];
+    register_usb_transport(&h, "loopback", 1);
+
+    b.fd = s[1];
+    b.total = total;
+    b.payload = payload;
+    if(adb_thread_create(&tid, host_thread, &b))
+        fatal_errno("cannot create host thread");
+
+    /* the sideload service exits once the package was received */
+    fdevent_loop();
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned total = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    unsigned default_payloads[] = { MAX_PAYLOAD_V1, 64 * 1024, MAX_PAYLOAD };
+    int i, count = argc > 2 ? argc - 2 : 3, failed = 0;
+
+    for(i = 0; i < count; i++) {
+        unsigned payload = argc > 2 ? (unsigned) atoi(argv[i + 2]) : default_payloads[i];
+        int status;
+        pid_t pid = fork();
+
+        if(pid == 0)
+            exit(run(total, payload));
+        if(pid < 0 || waitpid(pid, &status, 0) != pid ||
+           !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("payload %7u: FAILED\n", payload);
+            failed = 1;
+        }
+    }
+    return failed;
+}
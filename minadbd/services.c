@@ -25,6 +25,7 @@
 
 #define  TRACE_TAG  TRACE_SERVICES
 #include "adb.h"
+#include "fuse_adb_provider.h"
 
 typedef struct stinfo stinfo;
 
@@ -45,21 +46,26 @@ void *service_bootstrap_func(void *x)
 
 static void sideload_service(int s, void *cookie)
 {
-    unsigned char buf[4096];
+    unsigned char *buf;
     unsigned count = (unsigned) cookie;
     int fd;
 
     fprintf(stderr, "sideload_service invoked\n");
 
+    // Read whole packets at a time once the host sends large payloads
+    buf = malloc(MAX_PAYLOAD);
+    if(buf == 0) fatal("cannot allocate sideload buffer");
+
     fd = adb_creat(ADB_SIDELOAD_FILENAME, 0644);
     if(fd < 0) {
         fprintf(stderr, "failed to create %s\n", ADB_SIDELOAD_FILENAME);
+        free(buf);
         adb_close(s);
         return;
     }
 
     while(count > 0) {
-        unsigned xfer = (count > 4096) ? 4096 : count;
+        unsigned xfer = (count > MAX_PAYLOAD) ? MAX_PAYLOAD : count;
         if(readx(s, buf, xfer)) break;
         if(writex(fd, buf, xfer)) break;
         count -= xfer;
@@ -70,6 +76,7 @@ static void sideload_service(int s, void *cookie)
     } else {
         writex(s, "FAIL", 4);
     }
+    free(buf);
     adb_close(fd);
     adb_close(s);
 
@@ -80,6 +87,31 @@ static void sideload_service(int s, void *cookie)
     }
 }
 
+// "adb sideload" of hosts that know the sideload-host service offers the
+// package as "<size>:<block size>" and sends blocks when asked, so it is
+// installed straight from the host instead of being copied first.
+static void sideload_host_service(int sfd, void* cookie)
+{
+    char* arg = (char*) cookie;
+    unsigned long long file_size;
+    unsigned int block_size;
+    int result;
+
+    if (sscanf(arg, "%llu:%u", &file_size, &block_size) != 2) {
+        fprintf(stderr, "bad sideload-host arguments: %s\n", arg);
+        free(arg);
+        adb_close(sfd);
+        return;
+    }
+    free(arg);
+
+    fprintf(stderr, "sideload-host file size %llu block size %u\n", file_size, block_size);
+    result = run_adb_fuse(sfd, file_size, block_size);
+    adb_close(sfd);
+
+    fprintf(stderr, "sideload-host finished with %d, adbd exiting\n", result);
+    exit(result == 0 ? 0 : 1);
+}
 
 #if 0
 static void echo_service(int fd, void *cookie)
@@ -150,6 +182,8 @@ int service_to_fd(const char *name)
 
     if (!strncmp(name, "sideload:", 9)) {
         ret = create_service_thread(sideload_service, (void*) atoi(name + 9));
+    } else if (!strncmp(name, "sideload-host:", 14)) {
+        ret = create_service_thread(sideload_host_service, strdup(name + 14));
 #if 0
     } else if(!strncmp(name, "echo:", 5)){
         ret = create_service_thread(echo_service, 0);
@@ -789,6 +789,13 @@ int writex(int fd, const void *ptr, size_t len)
     return 0;
 }
 
+size_t get_max_payload(atransport *t)
+{
+    if(t == 0 || t->max_payload == 0)
+        return MAX_PAYLOAD_V1;
+    return t->max_payload;
+}
+
 int check_header(apacket *p)
 {
     if(p->msg.magic != (p->msg.command ^ 0xffffffff)) {
@@ -34,6 +34,15 @@
 #define MAX_PACKET_SIZE_FS	64
 #define MAX_PACKET_SIZE_HS	512
 
+/* The android_adb driver rejects reads larger than its 4K request buffer
+** and older functionfs kernels kmalloc a buffer for the whole transfer, so
+** large payloads are moved in pieces.  The pieces are multiples of the
+** packet size and do not end the host's transfer early.
+*/
+#define USB_ADB_MAX_READ	4096
+#define USB_FFS_MAX_READ	16384
+#define USB_FFS_MAX_WRITE	16384
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
@@ -201,14 +210,20 @@ static int usb_adb_write(usb_handle *h, const void *data, int len)
 
 static int usb_adb_read(usb_handle *h, void *data, int len)
 {
-    int n;
+    char *buf = data;
+    int n, xfer;
 
     D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        xfer = (len > USB_ADB_MAX_READ) ? USB_ADB_MAX_READ : len;
+        n = adb_read(h->fd, buf, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -351,7 +366,10 @@ static int bulk_write(int bulk_in, const char *buf, size_t length)
     int ret;
 
     do {
-        ret = adb_write(bulk_in, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_WRITE)
+            xfer = USB_FFS_MAX_WRITE;
+        ret = adb_write(bulk_in, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR)
                 return ret;
@@ -385,7 +403,10 @@ static int bulk_read(int bulk_out, char *buf, size_t length)
     int ret;
 
     do {
-        ret = adb_read(bulk_out, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_READ)
+            xfer = USB_FFS_MAX_READ;
+        ret = adb_read(bulk_out, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR) {
                 D("[ bulk_read failed fd=%d length=%d count=%d ]\n",
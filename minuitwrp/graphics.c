@@ -16,6 +16,7 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <errno.h>
@@ -680,6 +681,37 @@ void* gr_loadFont(const char* fontName)
     return (void*) font;
 }
 
+// Builds a font from an already expanded 8 bit alpha texture, as stored in
+// the theme cache. offsets holds the 96 character offsets of a .dat font.
+void* gr_loadFontData(unsigned width, unsigned height, const unsigned* offsets, const unsigned char* bits)
+{
+    GRFont *font;
+    GGLSurface *ftex;
+
+    font = calloc(sizeof(*font), 1);
+    if (!font)
+        return NULL;
+    ftex = &font->texture;
+    ftex->data = malloc(width * height);
+    if (!ftex->data) {
+        free(font);
+        return NULL;
+    }
+    memcpy(ftex->data, bits, width * height);
+    memcpy(font->offset, offsets, sizeof(unsigned) * 96);
+    font->offset[96] = width;
+
+    ftex->version = sizeof(*ftex);
+    ftex->width = width;
+    ftex->height = height;
+    ftex->stride = width;
+    ftex->format = GGL_PIXEL_FORMAT_A_8;
+    font->type = FONT_TYPE_TWRP;
+    font->cheight = height;
+    font->ascent = height - 2;
+    return (void*) font;
+}
+
 void gr_freeFont(void *font)
 {
     GRFont *f = font;
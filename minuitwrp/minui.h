@@ -49,6 +49,7 @@ int gr_maxExW(const char *s, void* font, int max_width);
 int gr_getMaxFontHeight(void *font);
 
 void* gr_loadFont(const char* fontName);
+void* gr_loadFontData(unsigned width, unsigned height, const unsigned* offsets, const unsigned char* bits);
 void gr_freeFont(void *font);
 
 #ifndef TW_DISABLE_TTF
@@ -82,6 +83,8 @@ int ev_has_mouse(void);
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+// Wraps already decoded pixels, data must outlive the surface.
+int res_create_surface_data(unsigned width, unsigned height, unsigned stride, int format, void* data, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 
 // Needed for AOSP:
@@ -278,6 +278,21 @@ int res_create_surface(const char* name, gr_surface* pSurface) {
     return ret;
 }
 
+int res_create_surface_data(unsigned width, unsigned height, unsigned stride, int format, void* data, gr_surface* pSurface) {
+    GGLSurface* surface = malloc(sizeof(GGLSurface));
+    if (surface == NULL)
+        return -8;
+
+    surface->version = sizeof(GGLSurface);
+    surface->width = width;
+    surface->height = height;
+    surface->stride = stride;
+    surface->data = data;
+    surface->format = format;
+    *pSurface = (gr_surface) surface;
+    return 0;
+}
+
 void res_free_surface(gr_surface surface) {
     GGLSurface* pSurface = (GGLSurface*) surface;
     if (pSurface) {
@@ -68,3 +68,19 @@ LOCAL_SRC_FILES = \
     node.cpp
 LOCAL_SHARED_LIBRARIES += libz libc libusbhost libstdc++ libstlport libdl libcutils libutils
 include $(BUILD_EXECUTABLE)
+
+# Build mtp_btree_test stress test for the node tree / handle index
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := mtp_btree_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS = -D_FILE_OFFSET_BITS=64
+LOCAL_C_INCLUDES += $(LOCAL_PATH) bionic external/stlport/stlport frameworks/base/include system/core/include bionic/libc/private/
+LOCAL_SRC_FILES = \
+    btree_test.cpp \
+    btree.cpp \
+    MtpDebug.cpp \
+    node.cpp
+LOCAL_SHARED_LIBRARIES += libc libstdc++ libstlport libcutils libutils
+include $(BUILD_EXECUTABLE)
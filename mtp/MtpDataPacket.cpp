@@ -27,11 +27,18 @@
 #include "MtpStringBuffer.h"
 #include "MtpDebug.h"
 
-#define MTP_BUFFER_SIZE 16384
+// largest single read the f_mtp driver accepts (MTP_BULK_BUFFER_SIZE)
+#define MTP_READ_SIZE 16384
+// The data packet of a server lives for the whole session and is reused
+// for every transaction, so start with a buffer large enough for typical
+// property lists and keep it. Buffers grown beyond MTP_BUFFER_MAX_SIZE by
+// huge responses are given back on the next reset.
+#define MTP_BUFFER_SIZE (256 * 1024)
+#define MTP_BUFFER_MAX_SIZE (4 * 1024 * 1024)
 
 
 MtpDataPacket::MtpDataPacket()
-	:   MtpPacket(MTP_BUFFER_SIZE),   // MAX_USBFS_BUFFER_SIZE
+	:   MtpPacket(MTP_BUFFER_SIZE),
 		mOffset(MTP_CONTAINER_HEADER_SIZE)
 {
 }
@@ -41,6 +48,7 @@ MtpDataPacket::~MtpDataPacket() {
 
 void MtpDataPacket::reset() {
 	MtpPacket::reset();
+	trim(MTP_BUFFER_SIZE, MTP_BUFFER_MAX_SIZE);
 	mOffset = MTP_CONTAINER_HEADER_SIZE;
 }
 
@@ -193,6 +201,13 @@ void MtpDataPacket::putInt32(int32_t value) {
 		mPacketSize = mOffset;
 }
 
+void MtpDataPacket::putUInt32At(uint32_t offset, uint32_t value) {
+	allocate(offset + 4);
+	MtpPacket::putUInt32(offset, value);
+	if (mPacketSize < offset + 4)
+		mPacketSize = offset + 4;
+}
+
 void MtpDataPacket::putUInt32(uint32_t value) {
 	allocate(mOffset + 4);
 	mBuffer[mOffset++] = (uint8_t)(value & 0xFF);
@@ -348,7 +363,7 @@ void MtpDataPacket::putString(const uint16_t* string) {
 
 #ifdef MTP_DEVICE 
 int MtpDataPacket::read(int fd) {
-	int ret = ::read(fd, mBuffer, MTP_BUFFER_SIZE);
+	int ret = ::read(fd, mBuffer, MTP_READ_SIZE);
 	if (ret < MTP_CONTAINER_HEADER_SIZE)
 		return -1;
 	mPacketSize = ret;
@@ -364,9 +379,10 @@ int MtpDataPacket::write(int fd) {
 }
 
 int MtpDataPacket::writeData(int fd, void* data, uint32_t length) {
-	allocate(length);
+	allocate(length + MTP_CONTAINER_HEADER_SIZE);
 	memcpy(mBuffer + MTP_CONTAINER_HEADER_SIZE, data, length);
 	length += MTP_CONTAINER_HEADER_SIZE;
+	mPacketSize = length;
 	MtpPacket::putUInt32(MTP_CONTAINER_LENGTH_OFFSET, length);
 	MtpPacket::putUInt16(MTP_CONTAINER_TYPE_OFFSET, MTP_CONTAINER_TYPE_DATA);
 	int ret = ::write(fd, mBuffer, length);
@@ -94,6 +94,12 @@ public:
     inline void         putEmptyString() { putUInt8(0); }
     inline void         putEmptyArray() { putUInt32(0); }
 
+    // current put/get offset, e.g. to fill in a count later with putUInt32At()
+    inline uint32_t     getOffset() const { return mOffset; }
+    void                putUInt32At(uint32_t offset, uint32_t value);
+    // make sure the buffer can take at least length more bytes
+    inline void         reserve(int length) { allocate(mOffset + length); }
+
 
 #ifdef MTP_DEVICE
     // fill our buffer with data from the given file descriptor
@@ -22,7 +22,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdio.h>
+#include <string.h>
 
 #include <usbhost/usbhost.h>
 
@@ -46,20 +46,35 @@ MtpPacket::~MtpPacket() {
 }
 
 void MtpPacket::reset() {
-	allocate(MTP_CONTAINER_HEADER_SIZE);
+	// only the part of the buffer used since the last reset can be dirty,
+	// clearing all of it gets expensive once the buffer has grown large
+	int used = MTP_CONTAINER_PARAMETER_OFFSET + 5 * sizeof(uint32_t);
+	if (used < (int)mPacketSize)
+		used = mPacketSize;
+	allocate(used);
+	memset(mBuffer, 0, used);
 	mPacketSize = MTP_CONTAINER_HEADER_SIZE;
-	memset(mBuffer, 0, mBufferSize);
 }
 
-void MtpPacket::allocate(int length) {
-	if (length > mBufferSize) {
-		int newLength = length + mAllocationIncrement;
-		mBuffer = (uint8_t *)realloc(mBuffer, newLength);
-		if (!mBuffer) {
-			MTPE("out of memory!");
-			abort();
-		}
-		mBufferSize = newLength;
+void MtpPacket::grow(int length) {
+	// grow geometrically so that building a multi-MB packet does not
+	// realloc and copy the buffer every mAllocationIncrement bytes
+	int newLength = length + (mBufferSize > mAllocationIncrement ? mBufferSize : mAllocationIncrement);
+	mBuffer = (uint8_t *)realloc(mBuffer, newLength);
+	if (!mBuffer) {
+		MTPE("out of memory!");
+		abort();
+	}
+	mBufferSize = newLength;
+}
+
+void MtpPacket::trim(int size, int maxSize) {
+	if (mBufferSize <= maxSize || (int)mPacketSize > size)
+		return;
+	uint8_t* buffer = (uint8_t *)realloc(mBuffer, size);
+	if (buffer) {
+		mBuffer = buffer;
+		mBufferSize = size;
 	}
 }
 
@@ -42,7 +42,9 @@ public:
     // sets packet size to the default container size and sets buffer to zero
     virtual void        reset();
 
-    void                allocate(int length);
+    // makes sure the buffer can hold at least length bytes
+    inline void         allocate(int length) { if (length > mBufferSize) grow(length); }
+    inline unsigned     getPacketSize() const { return mPacketSize; }
     void                dump();
     void                copyFrom(const MtpPacket& src);
 
@@ -62,6 +64,10 @@ public:
 #endif
 
 protected:
+    void                grow(int length);
+    // shrinks the buffer back to size if it has grown beyond maxSize
+    void                trim(int size, int maxSize);
+
     uint16_t            getUInt16(int offset) const;
     uint32_t            getUInt32(int offset) const;
     void                putUInt16(int offset, uint16_t value);
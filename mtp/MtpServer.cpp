@@ -107,7 +107,8 @@ MtpServer::MtpServer(int fd, MtpDatabase* database, bool ptp,
 		mSessionOpen(false),
 		mSendObjectHandle(kInvalidObjectHandle),
 		mSendObjectFormat(0),
-		mSendObjectFileSize(0)
+		mSendObjectFileSize(0),
+		mFileBytes(0)
 {
 }
 
@@ -176,6 +177,9 @@ void MtpServer::run() {
 		}
 		MtpOperationCode operation = mRequest.getOperationCode();
 		MtpTransactionID transaction = mRequest.getTransactionID();
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		mFileBytes = 0;
 
 		MTPD("operation: %s", MtpDebug::getOperationCodeName(operation));
 		mRequest.dump();
@@ -221,6 +225,7 @@ void MtpServer::run() {
 			mResponse.setTransactionID(transaction);
 			MTPD("sending response %04X\n", mResponse.getResponseCode());
 			ret = mResponse.write(fd);
+			logThroughput(operation, mFileBytes + (mData.hasData() ? mData.getPacketSize() : 0), start);
 			MTPD("ret: %d\n", ret);
 			mResponse.dump();
 			if (ret < 0) {
@@ -251,6 +256,21 @@ void MtpServer::run() {
 	mFD = -1;
 }
 
+void MtpServer::logThroughput(MtpOperationCode operation, uint64_t bytes, const struct timespec& start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	uint64_t usec = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+	OpStats& stats = mOpStats[operation];
+	stats.count++;
+	stats.bytes += bytes;
+	stats.usec += usec;
+	// bytes per usec == MB/s
+	MTPD("throughput %s: %llu bytes in %llu us (%llu KB/s), total %u ops %llu bytes (%llu KB/s)\n",
+			MtpDebug::getOperationCodeName(operation), bytes, usec,
+			usec ? bytes * 1000 / usec : 0, stats.count, stats.bytes,
+			stats.usec ? stats.bytes * 1000 / stats.usec : 0);
+}
+
 void MtpServer::sendObjectAdded(MtpObjectHandle handle) {
 	MTPD("sendObjectAdded %d\n", handle);
 	sendEvent(MTP_EVENT_OBJECT_ADDED, handle);
@@ -829,6 +849,8 @@ MtpResponseCode MtpServer::doGetObject() {
 	int ret = ioctl(mFD, MTP_SEND_FILE_WITH_HEADER, (unsigned long)&mfr);
 	MTPD("MTP_SEND_FILE_WITH_HEADER returned %d\n", ret);
 	close(mfr.fd);
+	if (ret >= 0)
+		mFileBytes = mfr.length;
 	if (ret < 0) {
 		if (errno == ECANCELED)
 			return MTP_RESPONSE_TRANSACTION_CANCELLED;
@@ -901,6 +923,8 @@ MtpResponseCode MtpServer::doGetPartialObject(MtpOperationCode operation) {
 	int ret = ioctl(mFD, MTP_SEND_FILE_WITH_HEADER, (unsigned long)&mfr);
 	MTPD("MTP_SEND_FILE_WITH_HEADER returned %d\n", ret);
 	close(mfr.fd);
+	if (ret >= 0)
+		mFileBytes = mfr.length;
 	if (ret < 0) {
 		if (errno == ECANCELED)
 			return MTP_RESPONSE_TRANSACTION_CANCELLED;
@@ -1056,10 +1080,18 @@ MtpResponseCode MtpServer::doSendObject() {
 	fchmod(mfr.fd, mFilePermission);
 	umask(mask);
 
-	if (initialData > 0)
+	// The driver hands us the first bulk packet of the data phase together
+	// with the container header; everything after it goes straight from
+	// the USB endpoint into the file through MTP_RECEIVE_FILE.
+	if (initialData > 0) {
 		ret = write(mfr.fd, mData.getData(), initialData);
+		if (ret != initialData) {
+			MTPE("writing initial data failed\n");
+			ret = -1;
+		}
+	}
 
-	if (mSendObjectFileSize - initialData > 0) {
+	if (ret >= 0 && mSendObjectFileSize - initialData > 0) {
 		mfr.offset = initialData;
 		if (mSendObjectFileSize == 0xFFFFFFFF) {
 			// tell driver to read until it receives a short packet
@@ -1072,6 +1104,11 @@ MtpResponseCode MtpServer::doSendObject() {
 		// transfer the file
 		ret = ioctl(mFD, MTP_RECEIVE_FILE, (unsigned long)&mfr);
 	}
+	if (ret >= 0) {
+		struct stat st;
+		if (fstat(mfr.fd, &st) == 0)
+			mFileBytes = st.st_size;
+	}
 	close(mfr.fd);
 
 	if (ret < 0) {
@@ -1249,7 +1286,12 @@ MtpResponseCode MtpServer::doSendPartialObject() {
 	int initialData = ret - MTP_CONTAINER_HEADER_SIZE;
 
 	if (initialData > 0) {
-		ret = write(edit->mFD, mData.getData(), initialData);
+		ret = pwrite(edit->mFD, mData.getData(), initialData, offset);
+		if (ret != initialData) {
+			MTPE("writing initial data failed in doSendPartialObject\n");
+			mResponse.setParameter(1, 0);
+			return MTP_RESPONSE_GENERAL_ERROR;
+		}
 		offset += initialData;
 		length -= initialData;
 	}
@@ -1274,6 +1316,7 @@ MtpResponseCode MtpServer::doSendPartialObject() {
 
 	// reset so we don't attempt to send this back
 	mData.reset();
+	mFileBytes = initialData + length;
 	mResponse.setParameter(1, length);
 	uint64_t end = offset + length;
 	if (end > edit->mSize) {
@@ -21,6 +21,8 @@
 
 #include <utils/threads.h>
 #include <utils/Vector.h>
+#include <map>
+#include <time.h>
 #include "MtpRequestPacket.h"
 #include "MtpDatabase.h"
 #include "MtpDataPacket.h"
@@ -70,6 +72,18 @@ private:
 
 	pthread_mutex_t mtpMutex;
 
+    // file payload moved by the current operation through the MTP_*_FILE
+    // ioctls, i.e. without passing through mData
+    uint64_t            mFileBytes;
+    // running per-operation totals for the throughput debug log
+    struct OpStats {
+        uint32_t        count;
+        uint64_t        bytes;
+        uint64_t        usec;
+        OpStats() : count(0), bytes(0), usec(0) {}
+    };
+    std::map<MtpOperationCode, OpStats> mOpStats;
+
     // represents an MTP object that is being edited using the android extensions
     // for direct editing (BeginEditObject, SendPartialObject, TruncateObject and EndEditObject)
     class ObjectEdit {
@@ -120,6 +134,7 @@ private:
     void                commitEdit(ObjectEdit* edit);
 
     bool                handleRequest();
+    void                logThroughput(MtpOperationCode operation, uint64_t bytes, const struct timespec& start);
 
     MtpResponseCode     doGetDeviceInfo();
     MtpResponseCode     doOpenSession();
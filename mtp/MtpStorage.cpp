@@ -22,6 +22,7 @@
 #include "MtpServer.h"
 #include "MtpEventPacket.h"
 #include "MtpDatabase.h"
+#include "MtpUtils.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -39,6 +40,14 @@
 
 #define WATCH_FLAGS ( IN_CREATE | IN_DELETE | IN_MOVE | IN_MODIFY )
 
+// number of background stat workers and directory entries per stat job
+#define STAT_WORKERS 2
+#define STAT_BATCH_SIZE 256
+
+// approximate bytes per GetObjectPropList element, used to size the packet
+#define PROPLIST_ENTRY_SIZE 48
+#define PROPLIST_ALL_PROPERTIES_SIZE 600
+
 MtpStorage::MtpStorage(MtpStorageID id, const char* filePath,
 		const char* description, uint64_t reserveSpace,
 		bool removable, uint64_t maxFileSize, MtpServer* refserver)
@@ -64,10 +73,22 @@ MtpStorage::MtpStorage(MtpStorageID id, const char* filePath,
 		MTPE("Failed to init inMutex\n");
 		use_mutex = false;
 	}
-	
+	statStop = false;
+	pthread_mutex_init(&statMutex, NULL);
+	pthread_cond_init(&statCond, NULL);
 }
 
 MtpStorage::~MtpStorage() {
+	pthread_mutex_lock(&statMutex);
+	statStop = true;
+	pthread_cond_broadcast(&statCond);
+	pthread_mutex_unlock(&statMutex);
+	for (size_t i = 0; i < statThreads.size(); ++i)
+		pthread_join(statThreads[i], NULL);
+	for (std::deque<StatJob*>::iterator it = statJobs.begin(); it != statJobs.end(); ++it)
+		delete *it;
+	pthread_cond_destroy(&statCond);
+	pthread_mutex_destroy(&statMutex);
 	if (inotify_thread) {
 		// TODO: what does this do? manpage says it does not kill the thread
 		pthread_kill(inotify_thread, 0);
@@ -153,6 +174,7 @@ MtpObjectHandleList* MtpStorage::getObjectList(MtpStorageID storageID, MtpObject
 		return list;
 	}
 
+	applyStatResults();
 	Tree* tree = mtpmap[parent];
 	if (!tree->wasAlreadyRead())
 	{
@@ -238,7 +260,7 @@ void MtpStorage::endSendObject(const char* path, MtpObjectHandle handle, MtpObje
 	if (!node)
 		return;	// just ignore if this is for another storage
 
-	node->addProperties(path, mStorageID);
+	node->addProperties(path);
 	handleCurrentlySending = 0;
 	// TODO: are we supposed to send an event about an upload by the initiator?
 	if (sendEvents)
@@ -268,7 +290,6 @@ int MtpStorage::getObjectFilePath(MtpObjectHandle handle, MtpString& outFilePath
 int MtpStorage::readDir(const std::string& path, Tree* tree)
 {
 	struct dirent *de;
-	int storageID = getStorageID();
 	MtpObjectHandle parent = tree->Mtpid();
 
 	DIR *d = opendir(path.c_str());
@@ -277,34 +298,166 @@ int MtpStorage::readDir(const std::string& path, Tree* tree)
 		MTPE("error opening '%s' -- error: %s\n", path.c_str(), strerror(errno));
 		return -1;
 	}
+	StatJob* job = NULL;
 	// TODO: for refreshing dirs: capture old entries here
 	while ((de = readdir(d)) != NULL) {
-		// Because exfat-fuse causes issues with dirent, we will use stat
-		// for some things that dirent should be able to do
-		std::string item = path + "/" + de->d_name;
-		struct stat st;
-		if (lstat(item.c_str(), &st)) {
-			MTPE("Error running lstat on '%s'\n", item.c_str());
-			return -1;
-		}
-		// TODO: if we want to use this for refreshing dirs too, first find existing name and overwrite
 		if (strcmp(de->d_name, ".") == 0)
 			continue;
 		if (strcmp(de->d_name, "..") == 0)
 			continue;
-		Node* node = addNewNode(st.st_mode & S_IFDIR, tree, de->d_name);
-		node->addProperties(item, storageID);
+		// Because exfat-fuse causes issues with dirent, fall back to stat
+		// when the file system does not fill in d_type
+		bool isDir = de->d_type == DT_DIR;
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat st;
+			if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+				isDir = S_ISDIR(st.st_mode);
+			else
+				MTPE("Error running lstat on '%s/%s'\n", path.c_str(), de->d_name);
+		}
+		// TODO: if we want to use this for refreshing dirs too, first find existing name and overwrite
+		Node* node = addNewNode(isDir, tree, de->d_name);
+		// size and date are filled in later, see statWorker
+		node->setNeedsStat();
+		if (!job) {
+			job = new StatJob;
+			job->dir = path;
+		}
+		job->entries.push_back(std::make_pair(node->Mtpid(), std::string(de->d_name)));
+		if (job->entries.size() >= STAT_BATCH_SIZE) {
+			queueStat(job);
+			job = NULL;
+		}
 		//if (sendEvents)
 		//	mServer->sendObjectAdded(node->Mtpid());
 		//	sending events here makes simple-mtpfs very slow, and it is probably the wrong thing to do anyway
 	}
 	closedir(d);
+	if (job)
+		queueStat(job);
 	// TODO: for refreshing dirs: remove entries that no longer exist (with their nodes)
 	tree->setAlreadyRead(true);
 	addInotify(tree);
 	return 0;
 }
 
+void MtpStorage::queueStat(StatJob* job) {
+	pthread_mutex_lock(&statMutex);
+	if (statThreads.empty()) {
+		for (int i = 0; i < STAT_WORKERS; ++i) {
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, statWorker, this) == 0)
+				statThreads.push_back(thread);
+			else
+				MTPE("Failed to start stat worker\n");
+		}
+	}
+	if (statThreads.empty()) {
+		// no workers, the entries will be stat'ed on demand
+		pthread_mutex_unlock(&statMutex);
+		delete job;
+		return;
+	}
+	statJobs.push_back(job);
+	pthread_cond_signal(&statCond);
+	pthread_mutex_unlock(&statMutex);
+}
+
+void* MtpStorage::statWorker(void* cookie) {
+	MtpStorage* storage = (MtpStorage*) cookie;
+	std::vector<StatResult> results;
+
+	pthread_mutex_lock(&storage->statMutex);
+	while (true) {
+		while (!storage->statStop && storage->statJobs.empty())
+			pthread_cond_wait(&storage->statCond, &storage->statMutex);
+		if (storage->statStop)
+			break;
+		StatJob* job = storage->statJobs.front();
+		storage->statJobs.pop_front();
+		pthread_mutex_unlock(&storage->statMutex);
+
+		results.clear();
+		int dfd = open(job->dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (dfd < 0)
+			MTPE("stat worker: error opening '%s' -- error: %s\n", job->dir.c_str(), strerror(errno));
+		for (size_t i = 0; dfd >= 0 && i < job->entries.size(); ++i) {
+			struct stat st;
+			// failed entries stay pending and are retried on demand
+			if (fstatat(dfd, job->entries[i].second.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			StatResult r;
+			r.handle = job->entries[i].first;
+			r.size = st.st_size;
+			r.mtime = st.st_mtime;
+			results.push_back(r);
+		}
+		if (dfd >= 0)
+			close(dfd);
+		delete job;
+
+		pthread_mutex_lock(&storage->statMutex);
+		storage->statResults.insert(storage->statResults.end(), results.begin(), results.end());
+	}
+	pthread_mutex_unlock(&storage->statMutex);
+	return NULL;
+}
+
+void MtpStorage::applyStatResults() {
+	std::vector<StatResult> results;
+	pthread_mutex_lock(&statMutex);
+	results.swap(statResults);
+	pthread_mutex_unlock(&statMutex);
+	for (size_t i = 0; i < results.size(); ++i) {
+		Node* node = nodes.find(results[i].handle);
+		// the node may have been deleted or refreshed in the meantime
+		if (node && node->needsStat())
+			node->setStat(results[i].size, results[i].mtime);
+	}
+}
+
+void MtpStorage::ensureStat(Node* node) {
+	if (!node->needsStat())
+		return;
+	applyStatResults();
+	if (node->needsStat())
+		node->addProperties(getNodePath(node));
+}
+
+void MtpStorage::statTree(Tree* tree) {
+	// fill in everything still pending in one pass over the directory
+	// before its entries get serialized
+	bool applied = false;
+	int dfd = -1;
+	for (Tree::const_iterator it = tree->begin(); it != tree->end(); ++it) {
+		Node* node = it->second;
+		if (!node->needsStat())
+			continue;
+		if (!applied) {
+			applyStatResults();
+			applied = true;
+			if (!node->needsStat())
+				continue;
+		}
+		if (dfd < 0) {
+			dfd = open(getNodePath(tree).c_str(), O_RDONLY | O_DIRECTORY);
+			if (dfd < 0) {
+				MTPE("statTree: error opening '%s' -- error: %s\n", getNodePath(tree).c_str(), strerror(errno));
+				return;
+			}
+		}
+		struct stat st;
+		if (fstatat(dfd, node->getName().c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+			node->setStat(st.st_size, st.st_mtime);
+		} else {
+			MTPE("Error running lstat on '%s'\n", node->getName().c_str());
+			node->setStat(0, 0);
+		}
+	}
+	if (dfd >= 0)
+		close(dfd);
+}
+
 int MtpStorage::deleteFile(MtpObjectHandle handle) {
 	MTPD("MtpStorage::deleteFile handle: %u\n", handle);
 	Node* node = findNode(handle);
@@ -318,10 +471,7 @@ int MtpStorage::deleteFile(MtpObjectHandle handle) {
 		MTPE("parent tree for handle %u not found\n", parent);
 		return -1;
 	}
-	if (node->isDir()) {
-		MTPD("deleting tree from mtpmap: %u\n", handle);
-		mtpmap.erase(handle);
-	}
+	removeFromIndex(node);
 
 	MTPD("deleting handle: %u\n", handle);
 	tree->deleteNode(handle);
@@ -329,182 +479,149 @@ int MtpStorage::deleteFile(MtpObjectHandle handle) {
 	return 0;
 }
 
-void MtpStorage::queryNodeProperties(std::vector<MtpStorage::PropEntry>& results, Node* node, uint32_t property, int groupCode, MtpStorageID storageID)
+void MtpStorage::putNodeProperty(Node* node, MtpObjectProperty property, MtpDataPacket& packet, uint32_t& count)
 {
-	MTPD("queryNodeProperties handle %u, path: %s\n", node->Mtpid(), getNodePath(node).c_str());
-	PropEntry pe;
-	pe.handle = node->Mtpid();
-	pe.property = property;
-
-	if (property == 0xffffffff)
-	{
-		// add all properties
-		MTPD("MtpStorage::queryNodeProperties for all properties\n");
-		std::vector<Node::mtpProperty> mtpprop = node->getMtpProps();
-		for (size_t i = 0; i < mtpprop.size(); ++i) {
-			pe.property = mtpprop[i].property;
-			pe.datatype = mtpprop[i].dataType;
-			pe.intvalue = mtpprop[i].valueInt;
-			pe.strvalue = mtpprop[i].valueStr;
-			results.push_back(pe);
-		}
+	Node::mtpProperty prop = node->getProperty(property, mStorageID);
+	if (prop.property != property) {
+		MTPD("putNodeProperty: unknown property %x\n", property);
 		return;
 	}
-	else if (property == 0)
-	{
-		// TODO: use groupCode
-	}
-
-	// single property
-	// TODO: this should probably be moved to the Node class and/or merged with getObjectPropertyValue
+	packet.putUInt32(node->Mtpid());
+	packet.putUInt16(property);
 	switch (property) {
-//		case MTP_PROPERTY_OBJECT_FORMAT:
-//			pe.datatype = MTP_TYPE_UINT16;
-//			pe.intvalue = node->getIntProperty(MTP_PROPERTY_OBJECT_FORMAT);
-//			break;
-
-		case MTP_PROPERTY_STORAGE_ID:
-			pe.datatype = MTP_TYPE_UINT32;
-			pe.intvalue = storageID;
-			break;
-
-		case MTP_PROPERTY_PROTECTION_STATUS:
-			pe.datatype = MTP_TYPE_UINT16;
-			pe.intvalue = 0;
+		// date properties are strings to MTP but stored internally as a uint64
+		case MTP_PROPERTY_DATE_MODIFIED:
+		case MTP_PROPERTY_DATE_ADDED:
+		{
+			char date[20];
+			formatDateTime(prop.valueInt, date, sizeof(date));
+			packet.putUInt16(MTP_TYPE_STR);
+			packet.putString(date);
 			break;
-
-		case MTP_PROPERTY_OBJECT_SIZE:
+		}
+		// release date is stored internally as just the year
+		case MTP_PROPERTY_ORIGINAL_RELEASE_DATE:
 		{
-			pe.datatype = MTP_TYPE_UINT64;
-			struct stat st;
-			pe.intvalue = 0;
-			if (lstat(getNodePath(node).c_str(), &st) == 0)
-				pe.intvalue = st.st_size;
+			char date[20];
+			snprintf(date, sizeof(date), "%04lld0101T000000", prop.valueInt);
+			packet.putUInt16(MTP_TYPE_STR);
+			packet.putString(date);
 			break;
 		}
-
 		default:
-		{
-			const Node::mtpProperty& prop = node->getProperty(property);
-			if (prop.property != property)
-			{
-				MTPD("queryNodeProperties: unknown property %x\n", property);
-				return;
+			packet.putUInt16(prop.dataType);
+			switch (prop.dataType) {
+				case MTP_TYPE_INT8:
+					packet.putInt8(prop.valueInt);
+					break;
+				case MTP_TYPE_UINT8:
+					packet.putUInt8(prop.valueInt);
+					break;
+				case MTP_TYPE_INT16:
+					packet.putInt16(prop.valueInt);
+					break;
+				case MTP_TYPE_UINT16:
+					packet.putUInt16(prop.valueInt);
+					break;
+				case MTP_TYPE_INT32:
+					packet.putInt32(prop.valueInt);
+					break;
+				case MTP_TYPE_UINT32:
+					packet.putUInt32(prop.valueInt);
+					break;
+				case MTP_TYPE_INT64:
+					packet.putInt64(prop.valueInt);
+					break;
+				case MTP_TYPE_UINT64:
+					packet.putUInt64(prop.valueInt);
+					break;
+				case MTP_TYPE_INT128:
+					packet.putInt128(prop.valueInt);
+					break;
+				case MTP_TYPE_UINT128:
+					packet.putUInt128(prop.valueInt);
+					break;
+				case MTP_TYPE_STR:
+					packet.putString(prop.valueStr.c_str());
+					break;
+				default:
+					MTPE("bad or unsupported data type: %x in MtpStorage::putNodeProperty\n", prop.dataType);
+					break;
 			}
-			pe.datatype = prop.dataType;
-			pe.intvalue = prop.valueInt;
-			pe.strvalue = prop.valueStr;
-			// TODO: all the special case stuff in MyMtpDatabase::getObjectPropertyValue is missing here
-		}
+	}
+	++count;
+}
 
+void MtpStorage::putNodeProperties(Node* node, uint32_t format, uint32_t property, MtpDataPacket& packet, uint32_t& count)
+{
+	if (format != 0 && node->getFormat() != format)
+		return;
+	if (property == 0xffffffff) {
+		// all properties
+		for (size_t i = 0; i < Node::getPropertyCount(); ++i)
+			putNodeProperty(node, Node::getPropertyCode(i), packet, count);
+	} else {
+		putNodeProperty(node, property, packet, count);
 	}
-	results.push_back(pe);
 }
 
-int MtpStorage::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet) {
-	MTPD("MtpStorage::getObjectPropertyList handle: %u, format: %x, property: %x\n", handle, format, property);
-	if (groupCode != 0)
-	{
-		MTPE("getObjectPropertyList: groupCode unsupported\n");
-		return -1; // TODO: RESPONSE_SPECIFICATION_BY_GROUP_UNSUPPORTED
+void MtpStorage::putTreeProperties(Tree* tree, uint32_t format, uint32_t property, uint32_t depth, MtpDataPacket& packet, uint32_t& count)
+{
+	if (!tree->wasAlreadyRead()) {
+		std::string path = getNodePath(tree);
+		MTPD("reading directory on demand for tree %p (%u), path: %s\n", tree, tree->Mtpid(), path.c_str());
+		readDir(path, tree);
+	}
+	if (property == 0xffffffff || property == MTP_PROPERTY_OBJECT_SIZE
+			|| property == MTP_PROPERTY_DATE_MODIFIED || property == MTP_PROPERTY_DATE_ADDED)
+		statTree(tree);
+	// grow the packet once per directory instead of once per few entries
+	int entrySize = property == 0xffffffff ? PROPLIST_ALL_PROPERTIES_SIZE : PROPLIST_ENTRY_SIZE;
+	packet.reserve(tree->getCount() * entrySize);
+	for (Tree::const_iterator it = tree->begin(); it != tree->end(); ++it) {
+		Node* node = it->second;
+		putNodeProperties(node, format, property, packet, count);
+		if (depth > 1 && node->isDir())
+			putTreeProperties(static_cast<Tree*>(node), format, property, depth == 0xffffffff ? depth : depth - 1, packet, count);
 	}
-	// TODO: support all the special stuff, like:
-	// handle == 0 -> all objects at the root level
-	// handle == 0xffffffff -> all objects (on all storages? how could we support that?)
+}
+
+int MtpStorage::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, uint32_t depth, MtpDataPacket& packet, uint32_t& count) {
+	MTPD("MtpStorage::getObjectPropertyList handle: %u, format: %x, property: %x, depth: %u\n", handle, format, property, depth);
+	// Entries are written straight into the packet; the caller puts the
+	// element count in front of them once all storages have been queried.
 	// format == 0 -> all formats, otherwise filter by ObjectFormatCode
-	// property == 0xffffffff -> all properties except those with group code 0xffffffff
-	// if property == 0 then use groupCode
-	//   groupCode == 0 -> return Specification_By_Group_Unsupported
-	// depth == 0xffffffff -> all objects incl. and below handle
+	// property == 0xffffffff -> all properties
+	// depth == 0 -> only the object itself; depth n > 0 -> its descendants
+	// up to n levels below it, not including the object itself (as the
+	// Android framework does); depth == 0xffffffff -> the whole subtree
+	uint32_t start = count;
 
-	std::vector<PropEntry> results;
+	applyStatResults();
 
 	if (handle == 0xffffffff) {
-		// TODO: all object on all storages (needs a different design, result packet needs to be built by server instead of storage)
-	} else if (handle == 0)	{
-		// all objects at the root level
-		Tree* root = mtpmap[0];
-		MtpObjectHandleList list;
-		root->getmtpids(&list);
-		for (MtpObjectHandleList::iterator it = list.begin(); it != list.end(); ++it) {
-			Node* node = root->findNode(*it);
-			if (!node) {
-				MTPE("BUG: node not found for root entry with handle %u\n", *it);
-				break;
-			}
-			queryNodeProperties(results, node, property, groupCode, mStorageID);
-		}
+		// all objects on this storage
+		handle = 0;
+		depth = 0xffffffff;
+	}
+	if (handle == 0) {
+		// the storage root is not an object, so always start below it
+		putTreeProperties(mtpmap[0], format, property, depth ? depth : 1, packet, count);
 	} else {
-		// single object
 		Node* node = findNode(handle);
 		if (!node) {
 			// Item is not on this storage device
 			return -1;
 		}
-		queryNodeProperties(results, node, property, groupCode, mStorageID);
-	}
-
-	MTPD("count: %u\n", results.size());
-	packet.putUInt32(results.size());
-
-	for (size_t i = 0; i < results.size(); ++i) {
-		PropEntry& p = results[i];
-		MTPD("handle: %u, propertyCode: %x = %s, datatype: %x, value: %llu\n",
-				p.handle, p.property, MtpDebug::getObjectPropCodeName(p.property),
-				p.datatype, p.intvalue);
-		packet.putUInt32(p.handle);
-		packet.putUInt16(p.property);
-		packet.putUInt16(p.datatype);
-		switch (p.datatype) {
-			case MTP_TYPE_INT8:
-				MTPD("MTP_TYPE_INT8\n");
-				packet.putInt8(p.intvalue);
-				break;
-			case MTP_TYPE_UINT8:
-				MTPD("MTP_TYPE_UINT8\n");
-				packet.putUInt8(p.intvalue);
-				break;
-			case MTP_TYPE_INT16:
-				MTPD("MTP_TYPE_INT16\n");
-				packet.putInt16(p.intvalue);
-				break;
-			case MTP_TYPE_UINT16:
-				MTPD("MTP_TYPE_UINT16\n");
-				packet.putUInt16(p.intvalue);
-				break;
-			case MTP_TYPE_INT32:
-				MTPD("MTP_TYPE_INT32\n");
-				packet.putInt32(p.intvalue);
-				break;
-			case MTP_TYPE_UINT32:
-				MTPD("MTP_TYPE_UINT32\n");
-				packet.putUInt32(p.intvalue);
-				break;
-			case MTP_TYPE_INT64:
-				MTPD("MTP_TYPE_INT64\n");
-				packet.putInt64(p.intvalue);
-				break;
-			case MTP_TYPE_UINT64:
-				MTPD("MTP_TYPE_UINT64\n");
-				packet.putUInt64(p.intvalue);
-				break;
-			case MTP_TYPE_INT128:
-				MTPD("MTP_TYPE_INT128\n");
-				packet.putInt128(p.intvalue);
-				break;
-			case MTP_TYPE_UINT128:
-				MTPD("MTP_TYPE_UINT128\n");
-				packet.putUInt128(p.intvalue);
-				break;
-			case MTP_TYPE_STR:
-				MTPD("MTP_TYPE_STR: %s\n", p.strvalue.c_str());
-				packet.putString(p.strvalue.c_str());
-				break;
-			default:
-				MTPE("bad or unsupported data type: %x in MyMtpDatabase::getObjectPropertyList", p.datatype);
-				break;
+		if (depth == 0) {
+			ensureStat(node);
+			putNodeProperties(node, format, property, packet, count);
 		}
+		else if (node->isDir())
+			putTreeProperties(static_cast<Tree*>(node), format, property, depth, packet, count);
 	}
+
+	MTPD("count: %u\n", count - start);
 	return 0;
 }
 
@@ -514,20 +631,22 @@ int MtpStorage::renameObject(MtpObjectHandle handle, std::string newName) {
 		MTPE("parent == MTP_PARENT_ROOT, cannot rename root\n");
 		return -1;
 	} else {
-		for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-			Node* node = i->second->findNode(handle);
-			if (node != NULL) {
-				std::string oldName = getNodePath(node);
-				std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
-				std::string newFullName = parentdir + "/" + newName;
-				MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
-				if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
+		Node* node = findNode(handle);
+		if (node != NULL) {
+			std::string oldName = getNodePath(node);
+			std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
+			std::string newFullName = parentdir + "/" + newName;
+			MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
+			if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
+				iter it = mtpmap.find(node->getMtpParentId());
+				if (it != mtpmap.end())
+					it->second->renameEntry(node, newName);
+				else
 					node->rename(newName);
-					return 0;
-				} else {
-					MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
-					return -1;
-				}
+				return 0;
+			} else {
+				MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
+				return -1;
 			}
 		}
 	}
@@ -536,22 +655,20 @@ int MtpStorage::renameObject(MtpObjectHandle handle, std::string newName) {
 }
 
 int MtpStorage::getObjectPropertyValue(MtpObjectHandle handle, MtpObjectProperty property, MtpStorage::PropEntry& pe) {
-	Node *node;
-	for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-		node = i->second->findNode(handle);
-		if (node != NULL) {
-			const Node::mtpProperty& prop = node->getProperty(property);
-			if (prop.property != property) {
-				MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
-				return -1;
-			}
-			pe.datatype = prop.dataType;
-			pe.intvalue = prop.valueInt;
-			pe.strvalue = prop.valueStr;
-			pe.handle = handle;
-			pe.property = property;
-			return 0;
+	Node *node = findNode(handle);
+	if (node != NULL) {
+		ensureStat(node);
+		Node::mtpProperty prop = node->getProperty(property, mStorageID);
+		if (prop.property != property) {
+			MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
+			return -1;
 		}
+		pe.datatype = prop.dataType;
+		pe.intvalue = prop.valueInt;
+		pe.strvalue = prop.valueStr;
+		pe.handle = handle;
+		pe.property = property;
+		return 0;
 	}
 	// handle not found on this storage
 	return -1;
@@ -600,7 +717,7 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 		if (node == NULL) {
 			node = addNewNode(event->mask & IN_ISDIR, tree, event->name);
 			std::string item = getNodePath(tree) + "/" + event->name;
-			node->addProperties(item, getStorageID());
+			node->addProperties(item);
 			mServer->sendObjectAdded(node->Mtpid());
 		} else {
 			MTPD("inotify_t item already exists.\n");
@@ -636,14 +753,15 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 	} else if (event->mask & IN_MODIFY) {
 		MTPD("inotify_t item %s modified.\n", event->name);
 		if (node != NULL) {
-			uint64_t orig_size = node->getProperty(MTP_PROPERTY_OBJECT_SIZE).valueInt;
+			ensureStat(node);
+			uint64_t orig_size = node->getSize();
 			struct stat st;
 			uint64_t new_size = 0;
 			if (lstat(getNodePath(node).c_str(), &st) == 0)
 				new_size = (uint64_t)st.st_size;
 			if (orig_size != new_size) {
 				MTPD("size changed from %llu to %llu on mtpid: %u\n", orig_size, new_size, node->Mtpid());
-				node->updateProperty(MTP_PROPERTY_OBJECT_SIZE, new_size, "", MTP_TYPE_UINT64);
+				node->setSize(new_size);
 				mServer->sendObjectUpdated(node->Mtpid());
 			}
 		} else {
@@ -752,26 +870,42 @@ Node* MtpStorage::addNewNode(bool isDir, Tree* tree, const std::string& name)
 	else
 		node = new Node(mtpid, parent, name);
 	tree->addEntry(node);
+	nodes.insert(node);
 	return node;
 }
 
 Node* MtpStorage::findNode(MtpObjectHandle handle) {
-	for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-		Node* node = i->second->findNode(handle);
-		if (node != NULL) {
-			MTPD("findNode: found node %p for handle %u, name: %s\n", node, handle, node->getName().c_str());
-			if (node->Mtpid() != handle)
-			{
-				MTPE("BUG: entry for handle %u points to node with handle %u\n", handle, node->Mtpid());
-			}
-			return node;
+	Node* node = nodes.find(handle);
+	if (node != NULL) {
+		MTPD("findNode: found node %p for handle %u, name: %s\n", node, handle, node->getName().c_str());
+		if (node->Mtpid() != handle)
+		{
+			MTPE("BUG: entry for handle %u points to node with handle %u\n", handle, node->Mtpid());
 		}
+		return node;
 	}
 	// Item is not on this storage device
-	MTPD("MtpStorage::findNode: no node found for handle %u on storage %u, searched %u trees\n", handle, mStorageID, mtpmap.size());
+	MTPD("MtpStorage::findNode: no node found for handle %u on storage %u, %u nodes indexed\n", handle, mStorageID, nodes.size());
 	return NULL;
 }
 
+void MtpStorage::removeFromIndex(Node* node) {
+	// the node and all of its descendants are about to be deleted
+	if (node->isDir()) {
+		Tree* tree = static_cast<Tree*>(node);
+		MtpObjectHandleList list;
+		tree->getmtpids(&list);
+		for (MtpObjectHandleList::iterator it = list.begin(); it != list.end(); ++it) {
+			Node* child = tree->findNode(*it);
+			if (child)
+				removeFromIndex(child);
+		}
+		MTPD("deleting tree from mtpmap: %u\n", node->Mtpid());
+		mtpmap.erase(node->Mtpid());
+	}
+	nodes.erase(node->Mtpid());
+}
+
 std::string MtpStorage::getNodePath(Node* node) {
 	std::string path;
 	MTPD("getNodePath: node %p, handle %u\n", node, node->Mtpid());
@@ -24,6 +24,7 @@
 #include <string>
 #include <deque>
 #include <map>
+#include <vector>
 #include <libgen.h>
 #include <pthread.h>
 #include "btree.hpp"
@@ -47,6 +48,7 @@ private:
     typedef std::map<int, Tree*> maptree;
     typedef maptree::iterator iter;
     maptree mtpmap;
+	NodeIndex nodes;	// all nodes on this storage, by handle
 	std::string mtpstorageparent;
 	android::Mutex           mMutex;
 
@@ -81,7 +83,7 @@ public:
 	int getObjectInfo(MtpObjectHandle handle, MtpObjectInfo& info);
 	MtpObjectHandle beginSendObject(const char* path, MtpObjectFormat format, MtpObjectHandle parent, uint64_t size, time_t modified);
 	void endSendObject(const char* path, MtpObjectHandle handle, MtpObjectFormat format, bool succeeded);
-	int getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet);
+	int getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, uint32_t depth, MtpDataPacket& packet, uint32_t& count);
 	int getObjectFilePath(MtpObjectHandle handle, MtpString& outFilePath, int64_t& outFileLength, MtpObjectFormat& outFormat);
 	int deleteFile(MtpObjectHandle handle);
 	int renameObject(MtpObjectHandle handle, std::string newName);
@@ -105,14 +107,42 @@ private:
 
 	Node* addNewNode(bool isDir, Tree* tree, const std::string& name);
 	Node* findNode(MtpObjectHandle handle);
+	void removeFromIndex(Node* node);
 	Node* findNodeByPath(const std::string& path);
 	std::string getNodePath(Node* node);
 
-	void queryNodeProperties(std::vector<PropEntry>& results, Node* node, uint32_t property, int groupCode, MtpStorageID storageID);
+	void putNodeProperty(Node* node, MtpObjectProperty property, MtpDataPacket& packet, uint32_t& count);
+	void putNodeProperties(Node* node, uint32_t format, uint32_t property, MtpDataPacket& packet, uint32_t& count);
+	void putTreeProperties(Tree* tree, uint32_t format, uint32_t property, uint32_t depth, MtpDataPacket& packet, uint32_t& count);
 
 	bool use_mutex;
 	pthread_mutex_t inMutex; // inotify mutex
 	pthread_mutex_t mtpMutex; // main mtp mutex
+
+	// Directory entries are published by readDir right away, their size
+	// and date are filled in by a pool of stat workers. Workers only see
+	// paths and handles; their results are applied to the nodes by the
+	// thread that holds the storage mutex.
+	struct StatJob {
+		std::string dir;
+		std::vector<std::pair<MtpObjectHandle, std::string> > entries;
+	};
+	struct StatResult {
+		MtpObjectHandle handle;
+		uint64_t size;
+		uint64_t mtime;
+	};
+	std::deque<StatJob*> statJobs;
+	std::vector<StatResult> statResults;
+	std::vector<pthread_t> statThreads;
+	pthread_mutex_t statMutex;
+	pthread_cond_t statCond;
+	bool statStop;
+	static void* statWorker(void* cookie);
+	void queueStat(StatJob* job);
+	void applyStatResults();
+	void ensureStat(Node* node);
+	void statTree(Tree* tree);
 };
 
 #endif // _MTP_STORAGE_H
@@ -18,10 +18,12 @@
 #include <utils/threads.h>
 #include "btree.hpp"
 #include "MtpDebug.h"
+#include "mtp.h"
 
 // Constructor
 Tree::Tree(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name)
 	: Node(handle, parent, name), alreadyRead(false) {
+	setFormat(MTP_FORMAT_ASSOCIATION);
 }
 
 // Destructor
@@ -46,18 +48,31 @@ void Tree::addEntry(Node* node) {
 		return;
 	}
 	entries[node->Mtpid()] = node;
+	addName(node);
 }
 
-Node* Tree::findEntryByName(std::string name) {
-	for (std::map<MtpObjectHandle, Node*>::iterator it = entries.begin(); it != entries.end(); ++it)
-	{
-		Node* node = it->second;
-		if (node->getName().compare(name) == 0 && node->Mtpid() > 0)
-			return node;
-	}
+Node* Tree::findEntryByName(const std::string& name) {
+	std::map<const char*, Node*, NameLess>::iterator it = names.find(name.c_str());
+	if (it != names.end() && it->second->Mtpid() > 0)
+		return it->second;
 	return NULL;
 }
 
+void Tree::renameEntry(Node* node, const std::string& newName) {
+	std::map<const char*, Node*, NameLess>::iterator it = names.find(node->getName().c_str());
+	if (it != names.end() && it->second == node)
+		names.erase(it);
+	node->rename(newName);
+	addName(node);
+}
+
+void Tree::addName(Node* node) {
+	// replace the whole entry, as the key of an existing one points into
+	// the name of the node it was inserted for
+	names.erase(node->getName().c_str());
+	names.insert(std::make_pair(node->getName().c_str(), node));
+}
+
 Node* Tree::findNode(MtpObjectHandle handle) {
 	std::map<MtpObjectHandle, Node*>::iterator it = entries.find(handle);	
 	if (it != entries.end())
@@ -73,7 +88,90 @@ void Tree::getmtpids(MtpObjectHandleList* mtpids) {
 void Tree::deleteNode(MtpObjectHandle handle) {
 	std::map<MtpObjectHandle, Node*>::iterator it = entries.find(handle);	
 	if (it != entries.end()) {
+		std::map<const char*, Node*, NameLess>::iterator nit = names.find(it->second->getName().c_str());
+		if (nit != names.end() && nit->second == it->second)
+			names.erase(nit);
 		delete it->second;
 		entries.erase(it);
 	}
 }
+
+NodeIndex::NodeIndex() : slots(1024), count(0), shift(22) {
+}
+
+size_t NodeIndex::home(MtpObjectHandle handle) const {
+	// Fibonacci hashing: handles are allocated sequentially, so take the
+	// high bits of the product to keep them from forming one long cluster
+	return (uint32_t)(handle * 2654435769u) >> shift;
+}
+
+void NodeIndex::grow() {
+	std::vector<Slot> old(slots.size() * 2);
+	old.swap(slots);
+	--shift;
+	count = 0;
+	for (size_t i = 0; i < old.size(); ++i)
+		if (old[i].handle != 0)
+			insert(old[i].node);
+}
+
+void NodeIndex::insert(Node* node) {
+	MtpObjectHandle handle = node->Mtpid();
+	if (handle == 0)
+		return;
+	// keep the load factor below 1/2 so probe sequences stay short
+	if ((count + 1) * 2 > slots.size())
+		grow();
+	size_t i = home(handle);
+	while (slots[i].handle != 0 && slots[i].handle != handle)
+		i = (i + 1) & mask();
+	if (slots[i].handle == 0)
+		++count;
+	slots[i].handle = handle;
+	slots[i].node = node;
+}
+
+Node* NodeIndex::find(MtpObjectHandle handle) const {
+	if (handle == 0)
+		return NULL;
+	size_t i = home(handle);
+	while (slots[i].handle != 0) {
+		if (slots[i].handle == handle)
+			return slots[i].node;
+		i = (i + 1) & mask();
+	}
+	return NULL;
+}
+
+void NodeIndex::erase(MtpObjectHandle handle) {
+	if (handle == 0)
+		return;
+	size_t i = home(handle);
+	while (slots[i].handle != handle) {
+		if (slots[i].handle == 0)
+			return;
+		i = (i + 1) & mask();
+	}
+	// backward-shift deletion: move later entries of the cluster into the
+	// hole if their home slot does not lie between the hole and themselves
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask();
+		if (slots[j].handle == 0)
+			break;
+		size_t h = home(slots[j].handle);
+		if (((j - h) & mask()) >= ((j - i) & mask())) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i].handle = 0;
+	slots[i].node = NULL;
+	--count;
+}
+
+void NodeIndex::clear() {
+	std::vector<Slot>(1024).swap(slots);
+	count = 0;
+	shift = 22;
+}
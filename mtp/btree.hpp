@@ -19,12 +19,20 @@
 
 #include <vector>
 #include <map>
+#include <string>
+#include <string.h>
 #include "MtpTypes.h"
 
 // A directory entry
+// Only the fields that vary per object are stored; all other MTP object
+// properties are derived from them on demand when they are serialized.
 class Node {
 	MtpObjectHandle handle;
 	MtpObjectHandle parent;
+	uint16_t format;	// MTP_FORMAT_ASSOCIATION or MTP_FORMAT_UNDEFINED
+	bool statPending;	// size and mtime not filled in yet
+	uint64_t size;
+	uint64_t mtime;
 	std::string name;	// name only without path
 
 public:
@@ -39,10 +47,16 @@ public:
 	MtpObjectHandle getMtpParentId() const;
 	const std::string& getName() const;
 
-	void addProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType);
-	void updateProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType);
-	void addProperties(const std::string& path, int storageID);
-	uint64_t getIntProperty(MtpPropertyCode property);
+	void addProperties(const std::string& path);
+	void setStat(uint64_t newSize, uint64_t newMtime);
+	bool needsStat() const { return statPending; }
+	void setNeedsStat() { statPending = true; }
+	uint16_t getFormat() const { return format; }
+	void setFormat(uint16_t newFormat) { format = newFormat; }
+	uint64_t getSize() const { return size; }
+	void setSize(uint64_t newSize) { size = newSize; }
+	uint64_t getModified() const { return mtime; }
+
 	struct mtpProperty {
 		MtpPropertyCode property;
 		MtpDataType dataType;
@@ -50,21 +64,34 @@ public:
 		std::string valueStr;
 		mtpProperty() : property(0), dataType(0), valueInt(0) {}
 	};
-	std::vector<mtpProperty>& getMtpProps();
-	std::vector<mtpProperty> mtpProp;
-	const mtpProperty& getProperty(MtpPropertyCode property);
+	// returns a property with code 0 if the property is not supported
+	mtpProperty getProperty(MtpPropertyCode property, MtpStorageID storageID) const;
+	// enumerates all property codes supported by getProperty
+	static size_t getPropertyCount();
+	static MtpPropertyCode getPropertyCode(size_t index);
 };
 
 // A directory
 class Tree : public Node {
 	std::map<MtpObjectHandle, Node*> entries;
+	struct NameLess {
+		bool operator()(const char* a, const char* b) const { return strcmp(a, b) < 0; }
+	};
+	// name -> entry, for lookups by name; keys point into the entries' names
+	std::map<const char*, Node*, NameLess> names;
 	bool alreadyRead;
+
+	void addName(Node* node);
 public:
 	Tree(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name);
 	~Tree();
 
 	virtual bool isDir() const { return true; }
 
+	typedef std::map<MtpObjectHandle, Node*>::const_iterator const_iterator;
+	const_iterator begin() const { return entries.begin(); }
+	const_iterator end() const { return entries.end(); }
+
 	void addEntry(Node* node);
 	Node* findNode(MtpObjectHandle handle);
 	void getmtpids(MtpObjectHandleList* mtpids);
@@ -72,10 +99,36 @@ public:
 	std::string getPath(Node* node);
 	int getMtpParentId() { return Node::getMtpParentId(); }
 	int getMtpParentId(Node* node);
-	Node* findEntryByName(std::string name);
+	Node* findEntryByName(const std::string& name);
+	void renameEntry(Node* node, const std::string& newName);
 	int getCount();
 	bool wasAlreadyRead() const { return alreadyRead; }
 	void setAlreadyRead(bool b) { alreadyRead = b; }
 };
 
+// Hash table of all nodes of a storage, keyed by object handle.
+// Uses open addressing with linear probing; handle 0 (the storage root)
+// is never stored and marks empty slots.
+class NodeIndex {
+	struct Slot {
+		MtpObjectHandle handle;
+		Node* node;
+	};
+	std::vector<Slot> slots;
+	size_t count;
+	unsigned shift;	// 32 - log2(slots.size())
+
+	size_t mask() const { return slots.size() - 1; }
+	size_t home(MtpObjectHandle handle) const;
+	void grow();
+public:
+	NodeIndex();
+
+	void insert(Node* node);
+	Node* find(MtpObjectHandle handle) const;
+	void erase(MtpObjectHandle handle);
+	void clear();
+	size_t size() const { return count; }
+};
+
 #endif
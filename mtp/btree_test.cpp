@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 TeamWin - bigbiff and Dees_Troy mtp database conversion to C++
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stress test for the MTP node tree: populates a synthetic storage with
+// many directories and files and measures lookup, rename and delete latency.
+//
+// usage: mtp_btree_test [dirs] [files per dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include <string>
+#include "btree.hpp"
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static std::string entryName(const char* prefix, unsigned n) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%s%05u.jpg", prefix, n);
+	return buf;
+}
+
+static void report(const char* op, unsigned count, double start) {
+	double elapsed = now_us() - start;
+	printf("%-20s %8u ops %10.0f us total %8.3f us/op\n", op, count, elapsed, count ? elapsed / count : 0.0);
+}
+
+int main(int argc, char** argv) {
+	unsigned dirs = argc > 1 ? atoi(argv[1]) : 500;
+	unsigned files = argc > 2 ? atoi(argv[2]) : 100;
+	int failures = 0;
+
+	Tree* root = new Tree(0, 0, "");
+	std::map<MtpObjectHandle, Tree*> trees;
+	NodeIndex index;
+	std::vector<MtpObjectHandle> fileHandles;
+	MtpObjectHandle mtpid = 0;
+
+	printf("populating %u dirs with %u files each\n", dirs, files);
+	double start = now_us();
+	for (unsigned d = 0; d < dirs; ++d) {
+		Tree* tree = new Tree(++mtpid, 0, entryName("DIR", d));
+		root->addEntry(tree);
+		index.insert(tree);
+		trees[tree->Mtpid()] = tree;
+		for (unsigned f = 0; f < files; ++f) {
+			Node* node = new Node(++mtpid, tree->Mtpid(), entryName("IMG_", f));
+			tree->addEntry(node);
+			index.insert(node);
+			fileHandles.push_back(node->Mtpid());
+		}
+	}
+	report("populate", mtpid, start);
+
+	// random handle lookups, as done by GetObjectInfo / GetObjectPropValue
+	unsigned lookups = fileHandles.size();
+	srand(1);
+	start = now_us();
+	for (unsigned i = 0; i < lookups; ++i) {
+		MtpObjectHandle handle = fileHandles[rand() % fileHandles.size()];
+		Node* node = index.find(handle);
+		if (!node || node->Mtpid() != handle) {
+			printf("FAIL: handle %u not found\n", handle);
+			++failures;
+			break;
+		}
+	}
+	report("findNode", lookups, start);
+
+	// name lookups, as done for every inotify event
+	start = now_us();
+	for (unsigned i = 0; i < lookups; ++i) {
+		Tree* tree = trees[1 + (rand() % dirs) * (files + 1)];
+		std::string name = entryName("IMG_", rand() % files);
+		Node* node = tree->findEntryByName(name);
+		if (!node || node->getName() != name) {
+			printf("FAIL: %s not found in %s\n", name.c_str(), tree->getName().c_str());
+			++failures;
+			break;
+		}
+	}
+	report("findEntryByName", lookups, start);
+
+	// rename every file of the first directory
+	Tree* first = trees[1];
+	start = now_us();
+	for (unsigned f = 0; f < files; ++f) {
+		Node* node = first->findEntryByName(entryName("IMG_", f));
+		first->renameEntry(node, entryName("REN_", f));
+	}
+	report("renameEntry", files, start);
+	for (unsigned f = 0; f < files; ++f) {
+		if (first->findEntryByName(entryName("IMG_", f)) || !first->findEntryByName(entryName("REN_", f))) {
+			printf("FAIL: rename of %u not reflected in name index\n", f);
+			++failures;
+			break;
+		}
+	}
+
+	// delete every other file
+	start = now_us();
+	unsigned deleted = 0;
+	for (size_t i = 0; i < fileHandles.size(); i += 2) {
+		Node* node = index.find(fileHandles[i]);
+		index.erase(fileHandles[i]);
+		trees[node->getMtpParentId()]->deleteNode(fileHandles[i]);
+		++deleted;
+	}
+	report("deleteNode", deleted, start);
+	for (size_t i = 0; i < fileHandles.size(); ++i) {
+		bool found = index.find(fileHandles[i]) != NULL;
+		if (found != (i % 2 == 1)) {
+			printf("FAIL: handle %u %s after deletes\n", fileHandles[i], found ? "still present" : "missing");
+			++failures;
+			break;
+		}
+	}
+	if (index.size() != mtpid - deleted) {
+		printf("FAIL: index holds %u nodes, expected %u\n", (unsigned)index.size(), mtpid - deleted);
+		++failures;
+	}
+
+	delete root;
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -630,16 +630,42 @@ MtpResponseCode MyMtpDatabase::resetDeviceProperty(MtpDeviceProperty property) {
 MtpResponseCode MyMtpDatabase::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet) {
 	MTPD("getObjectPropertyList()\n");
 	MTPD("property: %x\n", property);
+	int type;
+	if (property == 0) {
+		// property 0 means the properties are specified by groupCode
+		MTPE("MyMtpDatabase::getObjectPropertyList groupCode %d unsupported\n", groupCode);
+		return MTP_RESPONSE_SPECIFICATION_BY_GROUP_UNSUPPORTED;
+	}
+	if (property != 0xffffffff && !getObjectPropertyInfo(property, type)) {
+		MTPE("MyMtpDatabase::getObjectPropertyList returning MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED\n");
+		return MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED;
+	}
+
+	// the number of elements comes first, fill it in after all storages
+	// have streamed their entries into the packet
+	uint32_t countOffset = packet.getOffset();
+	uint32_t count = 0;
+	bool found = false;
+	packet.putUInt32(0);
+
 	std::map<int, MtpStorage*>::iterator storit;
 	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
 		MTPD("MyMtpDatabase::getObjectPropertyList calling getObjectPropertyList\n");
-		if (storit->second->getObjectPropertyList(handle, format, property, groupCode, depth, packet) == 0) {
-			MTPD("MTP_RESPONSE_OK\n");
-   			return MTP_RESPONSE_OK;
+		if (storit->second->getObjectPropertyList(handle, format, property, depth, packet, count) == 0) {
+			found = true;
+			// the root and all objects are on every storage; anything else on one only
+			if (handle != 0 && handle != 0xffffffff)
+				break;
 		}
 	}
-	MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPOSNE_INVALID_OBJECT_HANDLE %i\n", handle);
-	return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+	if (!found) {
+		MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPOSNE_INVALID_OBJECT_HANDLE %i\n", handle);
+		packet.reset();	// don't send a data phase with just the count
+		return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+	}
+	packet.putUInt32At(countOffset, count);
+	MTPD("MTP_RESPONSE_OK, %u elements\n", count);
+	return MTP_RESPONSE_OK;
 }
 
 MtpResponseCode MyMtpDatabase::getObjectInfo(MtpObjectHandle handle, MtpObjectInfo& info) {
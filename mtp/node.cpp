@@ -16,7 +16,6 @@
 
 #include <iostream>
 #include <vector>
-#include <sstream>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <sys/types.h>
@@ -26,6 +25,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <libgen.h>
 
 #include "btree.hpp"
@@ -33,116 +33,139 @@
 #include "MtpDebug.h"
 
 
+// property codes and data types of all object properties, in the order
+// they are reported for "all properties" queries
+static const struct {
+	MtpPropertyCode property;
+	MtpDataType dataType;
+} nodeProperties[] = {
+	{ MTP_PROPERTY_STORAGE_ID, MTP_TYPE_UINT32 },
+	{ MTP_PROPERTY_OBJECT_FORMAT, MTP_TYPE_UINT16 },
+	{ MTP_PROPERTY_PROTECTION_STATUS, MTP_TYPE_UINT16 },
+	{ MTP_PROPERTY_OBJECT_SIZE, MTP_TYPE_UINT64 },
+	{ MTP_PROPERTY_OBJECT_FILE_NAME, MTP_TYPE_STR },
+	{ MTP_PROPERTY_DATE_MODIFIED, MTP_TYPE_UINT64 },
+	{ MTP_PROPERTY_PARENT_OBJECT, MTP_TYPE_UINT32 },
+	{ MTP_PROPERTY_PERSISTENT_UID, MTP_TYPE_UINT128 },
+	{ MTP_PROPERTY_NAME, MTP_TYPE_STR },
+	{ MTP_PROPERTY_DISPLAY_NAME, MTP_TYPE_STR },
+	{ MTP_PROPERTY_DATE_ADDED, MTP_TYPE_UINT64 },
+	{ MTP_PROPERTY_DESCRIPTION, MTP_TYPE_STR },
+	{ MTP_PROPERTY_ARTIST, MTP_TYPE_STR },
+	{ MTP_PROPERTY_ALBUM_NAME, MTP_TYPE_STR },
+	{ MTP_PROPERTY_ALBUM_ARTIST, MTP_TYPE_STR },
+	{ MTP_PROPERTY_TRACK, MTP_TYPE_UINT16 },
+	{ MTP_PROPERTY_ORIGINAL_RELEASE_DATE, MTP_TYPE_UINT64 },
+	{ MTP_PROPERTY_DURATION, MTP_TYPE_UINT32 },
+	{ MTP_PROPERTY_GENRE, MTP_TYPE_STR },
+	{ MTP_PROPERTY_COMPOSER, MTP_TYPE_STR },
+};
+
+#define NODE_PROPERTY_COUNT (sizeof(nodeProperties) / sizeof(nodeProperties[0]))
+
 Node::Node()
-	: handle(-1), parent(0), name("")
+	: handle(-1), parent(0), format(MTP_FORMAT_UNDEFINED), statPending(false), size(0), mtime(0), name("")
 {
 }
 
 Node::Node(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name)
-	: handle(handle), parent(parent), name(name)
+	: handle(handle), parent(parent), format(MTP_FORMAT_UNDEFINED), statPending(false), size(0), mtime(0), name(name)
 {
 }
 
+void Node::setStat(uint64_t newSize, uint64_t newMtime) {
+	size = newSize;
+	mtime = newMtime;
+	statPending = false;
+}
+
 void Node::rename(const std::string& newName) {
 	name = newName;
-	updateProperty(MTP_PROPERTY_OBJECT_FILE_NAME, 0, name.c_str(), MTP_TYPE_STR);
-	updateProperty(MTP_PROPERTY_NAME, 0, name.c_str(), MTP_TYPE_STR);
-	updateProperty(MTP_PROPERTY_DISPLAY_NAME, 0, name.c_str(), MTP_TYPE_STR);
 }
 
 MtpObjectHandle Node::Mtpid() const { return handle; }
 MtpObjectHandle Node::getMtpParentId() const { return parent; }
 const std::string& Node::getName() const { return name; }
 
-uint64_t Node::getIntProperty(MtpPropertyCode property) {
-	for (unsigned index = 0; index < mtpProp.size(); ++index) {
-		if (mtpProp[index].property == property)
-			return mtpProp[index].valueInt;
-	}
-	MTPE("Node::getIntProperty failed to find property %x, returning -1\n", (unsigned)property);
-	return -1;
+size_t Node::getPropertyCount() {
+	return NODE_PROPERTY_COUNT;
 }
 
-const Node::mtpProperty& Node::getProperty(MtpPropertyCode property) {
-	static const mtpProperty dummyProp;
-	for (size_t i = 0; i < mtpProp.size(); ++i) {
-		if (mtpProp[i].property == property)
-			return mtpProp[i];
-	}
-	MTPE("Node::getProperty failed to find property %x, returning dummy property\n", (unsigned)property);
-	return dummyProp;
+MtpPropertyCode Node::getPropertyCode(size_t index) {
+	return nodeProperties[index].property;
 }
 
-void Node::addProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType) {
-//	MTPD("adding property: %lld, valueInt: %lld, valueStr: %s, dataType: %d\n", property, valueInt, valueStr.c_str(), dataType);
-	struct mtpProperty prop;
+Node::mtpProperty Node::getProperty(MtpPropertyCode property, MtpStorageID storageID) const {
+	mtpProperty prop;
+	size_t i;
+	for (i = 0; i < NODE_PROPERTY_COUNT; ++i) {
+		if (nodeProperties[i].property == property)
+			break;
+	}
+	if (i == NODE_PROPERTY_COUNT) {
+		MTPE("Node::getProperty failed to find property %x, returning dummy property\n", (unsigned)property);
+		return prop;
+	}
 	prop.property = property;
-	prop.valueInt = valueInt;
-	prop.valueStr = valueStr;
-	prop.dataType = dataType;
-	mtpProp.push_back(prop);
-}
+	prop.dataType = nodeProperties[i].dataType;
 
-void Node::updateProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType) {
-	for (unsigned i = 0; i < mtpProp.size(); i++) {
-		if (mtpProp[i].property == property) {
-			mtpProp[i].valueInt = valueInt;
-			mtpProp[i].valueStr = valueStr;
-			mtpProp[i].dataType = dataType;
-			return;
+	switch (property) {
+		case MTP_PROPERTY_STORAGE_ID:
+			prop.valueInt = storageID;
+			break;
+		case MTP_PROPERTY_OBJECT_FORMAT:
+			prop.valueInt = format;
+			break;
+		case MTP_PROPERTY_OBJECT_SIZE:
+			prop.valueInt = size;
+			break;
+		case MTP_PROPERTY_OBJECT_FILE_NAME:
+		case MTP_PROPERTY_NAME:
+		case MTP_PROPERTY_DISPLAY_NAME:
+			prop.valueStr = name;
+			break;
+		case MTP_PROPERTY_DATE_MODIFIED:
+		case MTP_PROPERTY_DATE_ADDED:
+			prop.valueInt = mtime;
+			break;
+		case MTP_PROPERTY_PARENT_OBJECT:
+			prop.valueInt = parent;
+			break;
+		case MTP_PROPERTY_PERSISTENT_UID:
+		{
+			// TODO: we can't really support persistent UIDs without a persistent DB.
+			// probably a combination of volume UUID + st_ino would come close.
+			// doesn't help for fs with no native inodes numbers like fat though...
+			char puidStr[24];
+			snprintf(puidStr, sizeof(puidStr), "%u%u", storageID, handle);
+			errno = 0;
+			prop.valueInt = strtoull(puidStr, NULL, 10);
+			if (errno)
+				prop.valueInt = 0;
+			break;
 		}
+		case MTP_PROPERTY_ORIGINAL_RELEASE_DATE:
+			prop.valueInt = 2014;	// TODO: extract year from mtime?
+			break;
+		default:
+			// everything else is constant 0 or empty
+			break;
 	}
-	addProperty(property, valueInt, valueStr, dataType);
-}
-
-std::vector<Node::mtpProperty>& Node::getMtpProps() {
-	return mtpProp;
+	return prop;
 }
 
-void Node::addProperties(const std::string& path, int storageID) {
+void Node::addProperties(const std::string& path) {
 	MTPD("addProperties: handle: %u, filename: '%s'\n", handle, getName().c_str());
 	struct stat st;
-	int mFormat = 0;
-	uint64_t puid;
-	off_t file_size = 0;
-
-	std::string mtpidStr = static_cast<std::ostringstream*>( &(std::ostringstream() << handle) )->str();
-	std::string storageIDStr = static_cast<std::ostringstream*>( &(std::ostringstream() << storageID) )->str();
-	std::string puidStr = storageIDStr + mtpidStr;
-	if ( ! (std::istringstream(puidStr) >> puid) ) puid = 0;
-	mFormat = MTP_FORMAT_UNDEFINED;   // file
+
+	format = MTP_FORMAT_UNDEFINED;   // file
+	size = 0;
+	mtime = 0;
+	statPending = false;
 	if (lstat(path.c_str(), &st) == 0) {
-		file_size = st.st_size;
+		size = st.st_size;
+		mtime = st.st_mtime;
 		if (S_ISDIR(st.st_mode))
-			mFormat = MTP_FORMAT_ASSOCIATION; // folder
+			format = MTP_FORMAT_ASSOCIATION; // folder
 	}
-
-	// TODO: don't store properties with constant values at all, add them at query time instead
-	addProperty(MTP_PROPERTY_STORAGE_ID, storageID, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_OBJECT_FORMAT, mFormat, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_PROTECTION_STATUS, 0, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_OBJECT_SIZE, file_size, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_OBJECT_FILE_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DATE_MODIFIED, st.st_mtime, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_PARENT_OBJECT, parent, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_PERSISTENT_UID, puid, "", MTP_TYPE_UINT128);
-		// TODO: we can't really support persistent UIDs without a persistent DB.
-		// probably a combination of volume UUID + st_ino would come close.
-		// doesn't help for fs with no native inodes numbers like fat though...
-	addProperty(MTP_PROPERTY_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DISPLAY_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DATE_ADDED, st.st_mtime, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_DESCRIPTION, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_NAME, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_TRACK, 0, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_ORIGINAL_RELEASE_DATE, 2014, "", MTP_TYPE_UINT64);	// TODO: extract year from st.st_mtime?
-	addProperty(MTP_PROPERTY_DURATION, 0, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_GENRE, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_COMPOSER, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_NAME, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DURATION, 0, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_DESCRIPTION, 0, "", MTP_TYPE_STR);
 }
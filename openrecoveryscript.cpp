@@ -81,6 +81,7 @@ int OpenRecoveryScript::run_script_file(void) {
 		 value[SCRIPT_COMMAND_SIZE], mount[SCRIPT_COMMAND_SIZE],
 		 value1[SCRIPT_COMMAND_SIZE], value2[SCRIPT_COMMAND_SIZE];
 	char *val_start, *tok;
+	unsigned long long log_start = twlog_bytes();
 
 	if (fp != NULL) {
 		DataManager::SetValue(TW_SIMULATE_ACTIONS, 0);
@@ -195,35 +196,13 @@ int OpenRecoveryScript::run_script_file(void) {
 				LOGINFO("Restore folder is: '%s' and partitions: '%s'\n", folder_path, partitions);
 				gui_print("Restoring '%s'\n", folder_path);
 
-				if (folder_path[0] != '/') {
-					char backup_folder[512];
-					string folder_var;
-					std::vector<PartitionList> Storage_List;
-
-					PartitionManager.Get_Partition_List("storage", &Storage_List);
-					int listSize = Storage_List.size();
-					for (int i = 0; i < listSize; i++) {
-						if (PartitionManager.Is_Mounted_By_Path(Storage_List.at(i).Mount_Point)) {
-							DataManager::SetValue("tw_storage_path", Storage_List.at(i).Mount_Point);
-							DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
-							sprintf(backup_folder, "%s/%s", folder_var.c_str(), folder_path);
-							if (TWFunc::Path_Exists(backup_folder)) {
-								strcpy(folder_path, backup_folder);
-								break;
-							}
-						}
-					}
-				} else {
-					if (folder_path[strlen(folder_path) - 1] == '/')
-						strcat(folder_path, ".");
-					else
-						strcat(folder_path, "/.");
-				}
-				if (!TWFunc::Path_Exists(folder_path)) {
+				restore_folder = Locate_Backup_Folder(folder_path);
+				if (restore_folder.empty()) {
 					gui_print("Unable to locate backup '%s'\n", folder_path);
 					ret_val = 1;
 					continue;
 				}
+				strcpy(folder_path, restore_folder.c_str());
 				DataManager::SetValue("tw_restore", folder_path);
 
 				PartitionManager.Set_Restore_Files(folder_path);
@@ -282,6 +261,11 @@ int OpenRecoveryScript::run_script_file(void) {
 					ret_val = 1;
 				else
 					gui_print("Restore complete!\n");
+			} else if (strcmp(command, "restorefiles") == 0) {
+				// Restore single files and folders of a partition
+				DataManager::SetValue("tw_action_text2", "Restoring");
+				PartitionManager.Mount_All_Storage();
+				ret_val = Restore_Files_Command(value);
 			} else if (strcmp(command, "mount") == 0) {
 				// Mount
 				DataManager::SetValue("tw_action_text2", "Mounting");
@@ -344,7 +328,7 @@ int OpenRecoveryScript::run_script_file(void) {
 				install_cmd = -1;
 
 				int wipe_cache = 0;
-				string result, Sideload_File;
+				string result, Sideload_File, Package_File;
 
 				if (!PartitionManager.Mount_Current_Storage(true)) {
 					ret_val = 1; // failure
@@ -356,14 +340,16 @@ int OpenRecoveryScript::run_script_file(void) {
 					gui_print("Starting ADB sideload feature...\n");
 					DataManager::SetValue("tw_has_cancel", 1);
 					DataManager::SetValue("tw_cancel_action", "adbsideloadcancel");
-					ret_val = apply_from_adb(Sideload_File.c_str());
+					ret_val = apply_from_adb(Sideload_File.c_str(), Package_File);
 					DataManager::SetValue("tw_has_cancel", 0);
 					if (ret_val != 0)
 						ret_val = 1; // failure
-					else if (TWinstall_zip(Sideload_File.c_str(), &wipe_cache) == 0) {
+					else if (TWinstall_zip(Package_File.c_str(), &wipe_cache) == 0) {
+						finish_adb_sideload();
 						if (wipe_cache)
 							PartitionManager.Wipe_By_Path("/cache");
 					} else {
+						finish_adb_sideload();
 						ret_val = 1; // failure
 					}
 					sideload = 1; // Causes device to go to the home screen afterwards
@@ -389,6 +375,7 @@ int OpenRecoveryScript::run_script_file(void) {
 		}
 		fclose(fp);
 		gui_print("Done processing script file\n");
+		LOGINFO("Script logged %llu bytes\n", twlog_bytes() - log_start);
 	} else {
 		LOGERR("Error opening script file '%s'\n", SCRIPT_FILE_TMP);
 		return 1;
@@ -491,6 +478,73 @@ string OpenRecoveryScript::Locate_Zip_File(string Zip, string Storage_Root) {
 	return "";
 }
 
+string OpenRecoveryScript::Locate_Backup_Folder(string Folder) {
+	string Backup_Folder;
+
+	if (Folder.empty())
+		return "";
+	if (Folder[0] != '/') {
+		string folder_var;
+		std::vector<PartitionList> Storage_List;
+
+		PartitionManager.Get_Partition_List("storage", &Storage_List);
+		for (size_t i = 0; i < Storage_List.size(); i++) {
+			if (PartitionManager.Is_Mounted_By_Path(Storage_List.at(i).Mount_Point)) {
+				DataManager::SetValue("tw_storage_path", Storage_List.at(i).Mount_Point);
+				DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
+				Backup_Folder = folder_var + "/" + Folder;
+				if (TWFunc::Path_Exists(Backup_Folder))
+					return Backup_Folder;
+			}
+		}
+		return "";
+	}
+	if (Folder[Folder.size() - 1] == '/')
+		Backup_Folder = Folder + ".";
+	else
+		Backup_Folder = Folder + "/.";
+	if (!TWFunc::Path_Exists(Backup_Folder))
+		return "";
+	return Backup_Folder;
+}
+
+int OpenRecoveryScript::Restore_Files_Command(string Options) {
+	vector<string> args = TWFunc::split_string(Options, ' ', true);
+	vector<string> Paths;
+	string Restore_Folder, Partition;
+	size_t i;
+
+	// restorefiles <backup folder> <partition> <path> [<path> ...]
+	if (args.size() < 3) {
+		LOGERR("restorefiles needs a backup folder, a partition and the files to restore\n");
+		return 1;
+	}
+	Restore_Folder = Locate_Backup_Folder(args[0]);
+	if (Restore_Folder.empty()) {
+		gui_print("Unable to locate backup '%s'\n", args[0].c_str());
+		return 1;
+	}
+	Partition = args[1];
+	if (Partition[0] != '/')
+		Partition = "/" + Partition;
+	for (i = 2; i < args.size(); i++) {
+		if (args[i][args[i].size() - 1] == '\r')
+			args[i].resize(args[i].size() - 1);
+		if (!args[i].empty())
+			Paths.push_back(args[i]);
+	}
+	DataManager::SetValue("tw_restore", Restore_Folder);
+	PartitionManager.Set_Restore_Files(Restore_Folder);
+	if (DataManager::GetIntValue("tw_restore_encrypted") != 0) {
+		LOGERR("Unable to use OpenRecoveryScript to restore an encrypted backup.\n");
+		return 1;
+	}
+	if (!PartitionManager.Restore_Paths(Restore_Folder, Partition, Paths))
+		return 1;
+	gui_print("Restore complete!\n");
+	return 0;
+}
+
 int OpenRecoveryScript::Backup_Command(string Options) {
 	char value1[SCRIPT_COMMAND_SIZE];
 	int line_len, i;
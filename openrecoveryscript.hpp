@@ -34,6 +34,8 @@ public:
 	static int Install_Command(string Zip);                                        // Installs a zip
 	static string Locate_Zip_File(string Path, string File);                       // Attempts to locate the zip file in storage
 	static int Backup_Command(string Options);                                     // Runs a backup
+	static string Locate_Backup_Folder(string Folder);                             // Returns the path of a backup folder, empty if it does not exist
+	static int Restore_Files_Command(string Options);                              // Restores single files and folders of a partition
 	static void Run_OpenRecoveryScript();                                          // Starts the GUI Page for running OpenRecoveryScript
 };
 
@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "orscmd.h"
 #include "../variables.h"
@@ -40,12 +42,44 @@ void print_usage(void) {
 	printf("  set variable value\n");
 	printf("  get variable\n");
 	printf("  decrypt password\n");
+	printf("\nUse - as the only argument to read commands, one per line, from stdin.\n");
 	printf("\nSee more documentation at http://teamw.in/openrecoveryscript\n");
 }
 
+static int connect_socket(void) {
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, ORS_SOCKET_FILE, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int write_all(int fd, const char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written <= 0)
+			return -1;
+		buf += written;
+		len -= written;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv) {
-	int read_fd, write_fd, index;
-	char command[1024], result[512];
+	int sock_fd, index;
+	size_t len = 0;
+	ssize_t ret;
+	static char command[ORS_MAX_REQUEST];
+	char result[512];
 
 	if (argc < 2 || strcmp(argv[1], "help") == 0 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "?") == 0 || strcmp(argv[1], "-h") == 0) {
 		print_usage();
@@ -56,36 +90,40 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
-	sprintf(command, "%s", argv[1]);
-	for (index = 2; index < argc; index++) {
-		sprintf(command, "%s %s", command, argv[index]);
+	if (argc == 2 && strcmp(argv[1], "-") == 0) {
+		while (len < sizeof(command) && (ret = read(STDIN_FILENO, command + len, sizeof(command) - len)) > 0)
+			len += ret;
+		if (len == sizeof(command)) {
+			printf("Too many commands, the limit is %i bytes.\n", ORS_MAX_REQUEST - 1);
+			return -1;
+		}
+	} else {
+		for (index = 1; index < argc; index++) {
+			ret = snprintf(command + len, sizeof(command) - len, "%s%s", index > 1 ? " " : "", argv[index]);
+			if (ret < 0 || (size_t)ret >= sizeof(command) - len) {
+				printf("Command is too long.\n");
+				return -1;
+			}
+			len += ret;
+		}
 	}
 
-	write_fd = open(ORS_INPUT_FILE, O_WRONLY);
-	if (write_fd < 0) {
+	sock_fd = connect_socket();
+	if (sock_fd < 0) {
 		printf("TWRP does not appear to be running. Waiting for TWRP to start . . .\n");
 		printf("Press CTRL + C to quit.\n");
-		while (write_fd < 0)
-			write_fd = open(ORS_INPUT_FILE, O_WRONLY);
+		while (sock_fd < 0) {
+			sleep(1);
+			sock_fd = connect_socket();
+		}
 	}
-	if (write(write_fd, command, sizeof(command)) != sizeof(command)) {
+	if (write_all(sock_fd, command, len) != 0 || shutdown(sock_fd, SHUT_WR) != 0) {
 		printf("Error sending command.\n");
-		close(write_fd);
+		close(sock_fd);
 		return -1;
 	}
-	read_fd = open(ORS_OUTPUT_FILE, O_RDONLY);
-	if (read_fd < 0) {
-		printf("Unable to open %s for read.\n", ORS_OUTPUT_FILE);
-		return -1;
-	}
-	memset(&result, 0, sizeof(result));
-	while (read(read_fd, &result, sizeof(result)) > 0) {
-		result[510] = '\n';
-		result[511] = '\0';
-		printf("%s", result);
-		memset(&result, 0, sizeof(result));
-	}
-	close(write_fd);
-	close(read_fd);
+	while ((ret = read(sock_fd, result, sizeof(result))) > 0)
+		fwrite(result, 1, ret, stdout);
+	close(sock_fd);
 	return 0;
 }
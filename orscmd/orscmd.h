@@ -16,7 +16,11 @@
 #ifndef __ORSCMD_H
 #define __ORSCMD_H
 
-#define ORS_INPUT_FILE "/sbin/orsin"
-#define ORS_OUTPUT_FILE "/sbin/orsout"
+// Unix socket served by the GUI command thread. A client writes one or more
+// newline separated commands, ends the request with a NUL or by shutting down
+// its side of the socket, and reads the output until the socket closes.
+#define ORS_SOCKET_FILE "/sbin/orscmd_socket"
+#define ORS_MAX_CLIENTS 8
+#define ORS_MAX_REQUEST 65536
 
 #endif //__ORSCMD_H
@@ -0,0 +1,345 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "packageList.hpp"
+
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Finds the n byte string s in [p, end)
+static char* findStr(char* p, char* end, const char* s, size_t n) {
+	while (end - p >= (ssize_t) n) {
+		p = (char*) memchr(p, s[0], end - p - n + 1);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p, s, n) == 0)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+// Replaces the predefined and numeric character references in place
+static char* decodeValue(char* value) {
+	char* in = strchr(value, '&');
+	char* out;
+
+	if (in == NULL)
+		return value;
+	out = in;
+	while (*in) {
+		if (*in != '&') {
+			*out++ = *in++;
+			continue;
+		}
+		if (strncmp(in, "&amp;", 5) == 0) {
+			*out++ = '&';
+			in += 5;
+		} else if (strncmp(in, "&lt;", 4) == 0) {
+			*out++ = '<';
+			in += 4;
+		} else if (strncmp(in, "&gt;", 4) == 0) {
+			*out++ = '>';
+			in += 4;
+		} else if (strncmp(in, "&quot;", 6) == 0) {
+			*out++ = '"';
+			in += 6;
+		} else if (strncmp(in, "&apos;", 6) == 0) {
+			*out++ = '\'';
+			in += 6;
+		} else if (in[1] == '#') {
+			char* semi;
+			long c = (in[2] == 'x') ? strtol(in + 3, &semi, 16) : strtol(in + 2, &semi, 10);
+			if (*semi == ';' && c > 0 && c < 0x80) {
+				*out++ = (char) c;
+				in = semi + 1;
+			} else {
+				*out++ = *in++;
+			}
+		} else {
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+	return value;
+}
+
+packageList::packageList() {
+	map_addr = NULL;
+	map_len = 0;
+	in_packages = false;
+}
+
+packageList::~packageList() {
+	clear();
+}
+
+void packageList::clear() {
+	entries.clear();
+	nameIndex.clear();
+	uidIndex.clear();
+	if (map_addr != NULL) {
+		munmap(map_addr, map_len);
+		map_addr = NULL;
+		map_len = 0;
+	}
+}
+
+int packageList::load(const string& path) {
+	struct stat st;
+	void* addr;
+	int fd;
+
+	clear();
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	// Private writable mapping so values can be terminated without touching the file
+	addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -1;
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	map_addr = (char*) addr;
+	map_len = st.st_size;
+	return parse(map_addr, map_len);
+}
+
+int packageList::parse(char* xml, size_t len) {
+	char* p = xml;
+	char* end = xml + len;
+	int depth = 0;
+	bool seen_packages = false, closed;
+
+	entries.clear();
+	in_packages = false;
+	while (p < end) {
+		p = (char*) memchr(p, '<', end - p);
+		if (p == NULL)
+			break;
+		if (++p >= end)
+			return -1;
+		if (*p == '!') {
+			if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+				p = findStr(p + 3, end, "-->", 3);
+				if (p == NULL)
+					return -1;
+				p += 3;
+			} else if (end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0) {
+				p = findStr(p + 8, end, "]]>", 3);
+				if (p == NULL)
+					return -1;
+				p += 3;
+			} else {
+				p = (char*) memchr(p, '>', end - p);
+				if (p == NULL)
+					return -1;
+				p++;
+			}
+		} else if (*p == '?') {
+			p = findStr(p + 1, end, "?>", 2);
+			if (p == NULL)
+				return -1;
+			p += 2;
+		} else if (*p == '/') {
+			if (--depth < 0)
+				return -1;
+			if (depth == 0)
+				in_packages = false;
+			p = (char*) memchr(p, '>', end - p);
+			if (p == NULL)
+				return -1;
+			p++;
+		} else {
+			p = parseTag(p, end, depth, &closed);
+			if (p == NULL)
+				return -1;
+			if (in_packages)
+				seen_packages = true;
+			if (!closed)
+				depth++;
+		}
+	}
+	buildIndex();
+	if (!seen_packages) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+// Parses the start tag beginning at p (just past the '<') and returns the
+// position after its '>', or NULL if the tag is malformed
+char* packageList::parseTag(char* p, char* end, int depth, bool* closed) {
+	char* name = p;
+	size_t name_len;
+	bool root = false, wanted = false, updated = false;
+	int userId = -1, sharedUserId = -1;
+	entry e;
+
+	while (p < end && !isSpace(*p) && *p != '/' && *p != '>')
+		p++;
+	name_len = p - name;
+	if (depth == 0 && name_len == 8 && memcmp(name, "packages", 8) == 0) {
+		root = true;
+	} else if (depth == 1 && in_packages) {
+		if (name_len == 7 && memcmp(name, "package", 7) == 0)
+			wanted = true;
+		else if (name_len == 15 && memcmp(name, "updated-package", 15) == 0)
+			wanted = updated = true;
+	}
+	e.name = NULL;
+	e.codePath = NULL;
+	e.uid = -1;
+	e.updated = updated;
+
+	for (;;) {
+		while (p < end && isSpace(*p))
+			p++;
+		if (p >= end)
+			return NULL;
+		if (*p == '>') {
+			*closed = false;
+			p++;
+			break;
+		}
+		if (*p == '/') {
+			if (p + 1 >= end || p[1] != '>')
+				return NULL;
+			*closed = true;
+			p += 2;
+			break;
+		}
+
+		char* attr = p;
+		while (p < end && *p != '=' && !isSpace(*p) && *p != '>' && *p != '/')
+			p++;
+		size_t attr_len = p - attr;
+		while (p < end && isSpace(*p))
+			p++;
+		if (p >= end || *p != '=')
+			return NULL;
+		p++;
+		while (p < end && isSpace(*p))
+			p++;
+		if (p >= end || (*p != '"' && *p != '\''))
+			return NULL;
+		char* value = ++p;
+		p = (char*) memchr(p, p[-1], end - p);
+		if (p == NULL)
+			return NULL;
+		if (wanted) {
+			*p = '\0';
+			if (attr_len == 4 && memcmp(attr, "name", 4) == 0)
+				e.name = decodeValue(value);
+			else if (attr_len == 8 && memcmp(attr, "codePath", 8) == 0)
+				e.codePath = decodeValue(value);
+			else if (attr_len == 6 && memcmp(attr, "userId", 6) == 0)
+				userId = atoi(value);
+			else if (attr_len == 12 && memcmp(attr, "sharedUserId", 12) == 0)
+				sharedUserId = atoi(value);
+		}
+		p++;
+	}
+
+	if (root)
+		in_packages = !*closed;
+	if (wanted && e.name != NULL) {
+		e.uid = (sharedUserId >= 0) ? sharedUserId : userId;
+		entries.push_back(e);
+	}
+	return p;
+}
+
+// FNV-1a
+unsigned packageList::hashName(const char* name) {
+	unsigned hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void packageList::buildIndex() {
+	size_t size = 16, mask, i, slot;
+
+	while (size < entries.size() * 2)
+		size <<= 1;
+	mask = size - 1;
+	nameIndex.assign(size, -1);
+	uidIndex.assign(size, -1);
+	for (i = 0; i < entries.size(); i++) {
+		const entry& e = entries[i];
+
+		for (slot = hashName(e.name) & mask; nameIndex[slot] >= 0; slot = (slot + 1) & mask) {
+			if (strcmp(entries[nameIndex[slot]].name, e.name) == 0)
+				break;
+		}
+		if (nameIndex[slot] < 0 || (entries[nameIndex[slot]].updated && !e.updated))
+			nameIndex[slot] = i;
+
+		if (e.uid < 0)
+			continue;
+		for (slot = ((unsigned) e.uid * 2654435761u) & mask; uidIndex[slot] >= 0; slot = (slot + 1) & mask) {
+			if (entries[uidIndex[slot]].uid == e.uid)
+				break;
+		}
+		if (uidIndex[slot] < 0)
+			uidIndex[slot] = i;
+	}
+}
+
+const packageList::entry* packageList::findByName(const char* name) const {
+	size_t mask = nameIndex.size() - 1, slot;
+
+	if (nameIndex.empty())
+		return NULL;
+	for (slot = hashName(name) & mask; nameIndex[slot] >= 0; slot = (slot + 1) & mask) {
+		if (strcmp(entries[nameIndex[slot]].name, name) == 0)
+			return &entries[nameIndex[slot]];
+	}
+	return NULL;
+}
+
+const packageList::entry* packageList::findByUid(int uid) const {
+	size_t mask = uidIndex.size() - 1, slot;
+
+	if (uidIndex.empty() || uid < 0)
+		return NULL;
+	for (slot = ((unsigned) uid * 2654435761u) & mask; uidIndex[slot] >= 0; slot = (slot + 1) & mask) {
+		if (entries[uidIndex[slot]].uid == uid)
+			return &entries[uidIndex[slot]];
+	}
+	return NULL;
+}
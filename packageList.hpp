@@ -0,0 +1,66 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKAGELIST_HPP
+#define PACKAGELIST_HPP
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Streaming reader for /data/system/packages.xml. Only the package and
+// updated-package elements directly below <packages> are looked at and
+// only their name, codePath, userId and sharedUserId attributes are kept.
+// The file is mapped copy-on-write and the attribute values are terminated
+// in place, so the entries point straight into the mapping.
+class packageList {
+public:
+	struct entry {
+		const char* name;
+		const char* codePath;                     // NULL if missing
+		int uid;                                  // sharedUserId or userId, -1 if missing
+		bool updated;                             // From an <updated-package> element
+	};
+
+	packageList();
+	~packageList();
+	int load(const string& path);                 // Maps and parses path, returns 0 on success
+	int parse(char* xml, size_t len);             // Parses xml in place, xml must outlive the entries
+	void clear();
+	size_t size() const { return entries.size(); }
+	const entry& at(size_t index) const { return entries[index]; }
+	const entry* findByName(const char* name) const; // The <package> wins over an <updated-package>
+	const entry* findByUid(int uid) const;        // First package using uid
+
+private:
+	char* parseTag(char* p, char* end, int depth, bool* closed);
+	void addEntry(const entry& e);
+	void buildIndex();
+	static unsigned hashName(const char* name);
+
+	vector<entry> entries;
+	vector<int> nameIndex;                        // Open addressing tables of entry indexes, -1 is empty
+	vector<int> uidIndex;
+	char* map_addr;
+	size_t map_len;
+	bool in_packages;
+};
+
+#endif // PACKAGELIST_HPP
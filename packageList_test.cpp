@@ -0,0 +1,218 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark for the packages.xml reader: writes a synthetic packages.xml
+// of the requested size and compares packageList against building a full
+// rapidxml DOM, which is what fixPermissions used to do.
+//
+// usage: packagelist_test [MB] [file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include "packageList.hpp"
+#include "gui/rapidxml.hpp"
+
+using namespace rapidxml;
+
+void rapidxml::parse_error_handler(const char *what, void *where) {
+	printf("rapidxml parser error: %s\n", what);
+	exit(1);
+}
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Writes packages in the layout of a KitKat packages.xml until the file
+// reaches size bytes, returns the number of package elements written
+static unsigned writePackages(const char* file, size_t size) {
+	FILE* fp = fopen(file, "w");
+	unsigned count = 0;
+
+	if (fp == NULL)
+		return 0;
+	fprintf(fp, "<?xml version='1.0' encoding='utf-8' standalone='yes' ?>\n<packages>\n");
+	fprintf(fp, "<last-platform-version internal=\"19\" external=\"19\" />\n");
+	fprintf(fp, "<permission-trees />\n<permissions>\n");
+	for (unsigned i = 0; i < 100; i++)
+		fprintf(fp, "<item name=\"android.permission.PERM_%u\" package=\"android\" protection=\"2\" />\n", i);
+	fprintf(fp, "</permissions>\n");
+	while ((size_t) ftell(fp) < size) {
+		bool system = (count % 4) == 0;
+		fprintf(fp, "<package name=\"com.example.app%u\" codePath=\"%s/com.example.app%u-1.apk\" "
+			"nativeLibraryPath=\"/data/app-lib/com.example.app%u-1\" flags=\"%u\" "
+			"ft=\"1449c8a6b18\" it=\"1449c8a6f58\" ut=\"1449c8a6f58\" version=\"%u\" ",
+			count, system ? "/system/app" : "/data/app", count, count, system ? 1 : 0, count);
+		if (count % 10 == 0)
+			fprintf(fp, "sharedUserId=\"%u\">\n", 1000 + count % 7);
+		else
+			fprintf(fp, "userId=\"%u\">\n", 10000 + count);
+		fprintf(fp, "<sigs count=\"1\">\n<cert index=\"%u\" key=\"", count % 20);
+		for (unsigned k = 0; k < 16; k++)
+			fprintf(fp, "3082%08x", count * 31 + k);
+		fprintf(fp, "\" />\n</sigs>\n<perms>\n");
+		for (unsigned k = 0; k < 8; k++)
+			fprintf(fp, "<item name=\"android.permission.PERM_%u\" />\n", (count + k) % 100);
+		fprintf(fp, "</perms>\n<signing-keyset identifier=\"%u\" />\n</package>\n", count + 1);
+		if (system && count % 8 == 0) {
+			fprintf(fp, "<updated-package name=\"com.example.app%u\" codePath=\"/system/app/com.example.app%u.apk\" "
+				"nativeLibraryPath=\"/data/app-lib/com.example.app%u\" ft=\"1449c8a6b18\" userId=\"%u\" />\n",
+				count, count, count, 10000 + count);
+		}
+		count++;
+	}
+	fprintf(fp, "<shared-user name=\"android.uid.system\" userId=\"1000\">\n<sigs count=\"1\">\n<cert index=\"0\" />\n</sigs>\n</shared-user>\n");
+	fprintf(fp, "</packages>\n");
+	fclose(fp);
+	return count;
+}
+
+// The old fixPermissions approach: read everything and build a DOM
+static unsigned parseDom(const char* file, size_t* bytes) {
+	FILE* fp = fopen(file, "r");
+	unsigned count = 0;
+
+	if (fp == NULL)
+		return 0;
+	fseek(fp, 0, SEEK_END);
+	size_t len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	std::vector<char> buf(len + 1);
+	if (fread(&buf[0], 1, len, fp) != len) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	buf[len] = '\0';
+	*bytes = len;
+
+	xml_document<> doc;
+	doc.parse<parse_full>(&buf[0]);
+	xml_node<>* packages = doc.first_node("packages");
+	if (packages == NULL)
+		return 0;
+	const char* names[] = { "package", "updated-package" };
+	for (int n = 0; n < 2; n++) {
+		for (xml_node<>* node = packages->first_node(names[n]); node != NULL; node = node->next_sibling(names[n])) {
+			if (node->first_attribute("name") == NULL)
+				continue;
+			xml_attribute<>* uid = node->first_attribute("sharedUserId");
+			if (uid == NULL)
+				uid = node->first_attribute("userId");
+			if (uid != NULL && atoi(uid->value()) >= 0 && node->first_attribute("codePath") != NULL)
+				count++;
+		}
+	}
+	return count;
+}
+
+int main(int argc, char** argv) {
+	unsigned mb = argc > 1 ? atoi(argv[1]) : 10;
+	const char* file = argc > 2 ? argv[2] : "/tmp/packages_test.xml";
+	unsigned iterations = 5, count, updated, expected, i;
+	int failures = 0;
+	double start, dom_ms = 0, stream_ms = 0;
+	size_t bytes = 0;
+	char name[64];
+
+	printf("writing %uMB synthetic packages.xml to %s\n", mb, file);
+	count = writePackages(file, (size_t) mb * 1024 * 1024);
+	if (count == 0) {
+		printf("FAIL: unable to write %s\n", file);
+		return 1;
+	}
+	updated = (count + 7) / 8;
+	expected = count + updated;
+
+	for (i = 0; i < iterations; i++) {
+		start = now_ms();
+		unsigned found = parseDom(file, &bytes);
+		dom_ms += now_ms() - start;
+		if (found != expected) {
+			printf("FAIL: rapidxml found %u packages, expected %u\n", found, expected);
+			++failures;
+		}
+
+		packageList packages;
+		start = now_ms();
+		if (packages.load(file) != 0) {
+			printf("FAIL: packageList could not parse %s\n", file);
+			++failures;
+			break;
+		}
+		stream_ms += now_ms() - start;
+		if (packages.size() != expected) {
+			printf("FAIL: packageList found %u packages, expected %u\n", (unsigned) packages.size(), expected);
+			++failures;
+		}
+	}
+	printf("%-12s %8.1f ms/parse %8.1f MB/s\n", "rapidxml", dom_ms / iterations, bytes / 1048.576 / (dom_ms / iterations));
+	printf("%-12s %8.1f ms/parse %8.1f MB/s\n", "packageList", stream_ms / iterations, bytes / 1048.576 / (stream_ms / iterations));
+
+	// Lookups as done by fixDataData for every data directory
+	packageList packages;
+	if (packages.load(file) != 0) {
+		printf("FAIL: packageList could not parse %s\n", file);
+		return 1;
+	}
+	start = now_ms();
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "com.example.app%u", i);
+		const packageList::entry* pkg = packages.findByName(name);
+		if (pkg == NULL || strcmp(pkg->name, name) != 0 || pkg->updated) {
+			printf("FAIL: %s not found\n", name);
+			++failures;
+			break;
+		}
+		int uid = (i % 10 == 0) ? (int) (1000 + i % 7) : (int) (10000 + i);
+		if (pkg->uid != uid) {
+			printf("FAIL: %s has uid %i, expected %i\n", name, pkg->uid, uid);
+			++failures;
+			break;
+		}
+	}
+	printf("%-12s %8.3f us/lookup\n", "findByName", (now_ms() - start) * 1000 / count);
+	start = now_ms();
+	for (i = 1; i < count; i++) {
+		if (i % 10 == 0)
+			continue;
+		const packageList::entry* pkg = packages.findByUid(10000 + i);
+		snprintf(name, sizeof(name), "com.example.app%u", i);
+		if (pkg == NULL || strcmp(pkg->name, name) != 0) {
+			printf("FAIL: uid %u not found\n", 10000 + i);
+			++failures;
+			break;
+		}
+	}
+	printf("%-12s %8.3f us/lookup\n", "findByUid", (now_ms() - start) * 1000 / count);
+	if (packages.findByName("com.example.missing") != NULL || packages.findByUid(99999999) != NULL) {
+		printf("FAIL: found a package that does not exist\n");
+		++failures;
+	}
+
+	unlink(file);
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
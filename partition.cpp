@@ -40,6 +40,9 @@
 #include "twrpDigest.hpp"
 #include "twrpTar.hpp"
 #include "twrpDU.hpp"
+#include "twrpSparse.hpp"
+#include "twrpWipe.hpp"
+#include "twrpThroughput.hpp"
 #include "fixPermissions.hpp"
 #include "infomanager.hpp"
 extern "C" {
@@ -113,6 +116,8 @@ TWPartition::TWPartition() {
 	Can_Be_Wiped = false;
 	Can_Be_Backed_Up = false;
 	Use_Rm_Rf = false;
+	Wipe_Discard = false;
+	Wipe_Secure_Discard = false;
 	Wipe_During_Factory_Reset = false;
 	Wipe_Available_in_GUI = false;
 	Is_SubPartition = false;
@@ -157,6 +162,7 @@ TWPartition::TWPartition() {
 	Format_Block_Size = 0;
 	Ignore_Blkid = false;
 	Retain_Layout_Version = false;
+	Folder_Size_Pending = false;
 #ifdef TW_INCLUDE_CRYPTO_SAMSUNG
 	EcryptFS_Password = "";
 #endif
@@ -493,12 +499,21 @@ bool TWPartition::Process_Flags(string Flags, bool Display_Error) {
 			Can_Be_Wiped = true;
 		} else if (strcmp(ptr, "usermrf") == 0) {
 			Use_Rm_Rf = true;
+		} else if (strcmp(ptr, "wipediscard") == 0) {
+			Wipe_Discard = true;
+		} else if (strcmp(ptr, "wipesecdiscard") == 0) {
+			Wipe_Discard = true;
+			Wipe_Secure_Discard = true;
 		} else if (ptr_len > 7 && strncmp(ptr, "backup=", 7) == 0) {
 			ptr += 7;
 			if (*ptr == '1' || *ptr == 'y' || *ptr == 'Y')
 				Can_Be_Backed_Up = true;
 			else
 				Can_Be_Backed_Up = false;
+		} else if (strcmp(ptr, "imagebackup") == 0) {
+			// Only used while the file system is ext4, see Backup_Ext4_Image
+			if (Backup_Method == FILES)
+				Backup_Method = EXT4_IMAGE;
 		} else if (strcmp(ptr, "wipeingui") == 0) {
 			Can_Be_Wiped = true;
 			Wipe_Available_in_GUI = true;
@@ -1301,14 +1316,23 @@ bool TWPartition::Repair() {
 }
 
 bool TWPartition::Backup(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size) {
+	bool ret;
+
+	Throughput.Start_Job(Backup_Name);
 	if (Backup_Method == FILES)
-		return Backup_Tar(backup_folder, overall_size, other_backups_size);
+		ret = Backup_Tar(backup_folder, overall_size, other_backups_size);
 	else if (Backup_Method == DD)
-		return Backup_DD(backup_folder);
+		ret = Backup_DD(backup_folder);
 	else if (Backup_Method == FLASH_UTILS)
-		return Backup_Dump_Image(backup_folder);
-	LOGERR("Unknown backup method for '%s'\n", Mount_Point.c_str());
-	return false;
+		ret = Backup_Dump_Image(backup_folder);
+	else if (Backup_Method == EXT4_IMAGE)
+		ret = Backup_Ext4_Image(backup_folder, overall_size, other_backups_size);
+	else {
+		LOGERR("Unknown backup method for '%s'\n", Mount_Point.c_str());
+		ret = false;
+	}
+	Throughput.Finish_Job(Backup_Name, ret);
+	return ret;
 }
 
 bool TWPartition::Check_MD5(string restore_folder) {
@@ -1363,24 +1387,55 @@ bool TWPartition::Check_MD5(string restore_folder) {
 
 bool TWPartition::Restore(string restore_folder, const unsigned long long *total_restore_size, unsigned long long *already_restored_size) {
 	string Restore_File_System;
+	bool ret = false;
 
 	TWFunc::GUI_Operation_Text(TW_RESTORE_TEXT, Display_Name, "Restoring");
 	LOGINFO("Restore filename is: %s\n", Backup_FileName.c_str());
 
 	Restore_File_System = Get_Restore_File_System(restore_folder);
 
-	if (Is_File_System(Restore_File_System))
-		return Restore_Tar(restore_folder, Restore_File_System, total_restore_size, already_restored_size);
+	Throughput.Start_Job(Backup_Name);
+	if (Is_File_System(Restore_File_System) && twrpSparse::Is_Sparse(restore_folder + "/" + Backup_FileName))
+		ret = Restore_Ext4_Image(restore_folder, Restore_File_System, total_restore_size, already_restored_size);
+	else if (Is_File_System(Restore_File_System))
+		ret = Restore_Tar(restore_folder, Restore_File_System, total_restore_size, already_restored_size);
 	else if (Is_Image(Restore_File_System)) {
 		*already_restored_size += TWFunc::Get_File_Size(Backup_Name);
 		if (Restore_File_System == "emmc")
-			return Restore_DD(restore_folder, total_restore_size, already_restored_size);
+			ret = Restore_DD(restore_folder, total_restore_size, already_restored_size);
 		else if (Restore_File_System == "mtd" || Restore_File_System == "bml")
-			return Restore_Flash_Image(restore_folder, total_restore_size, already_restored_size);
+			ret = Restore_Flash_Image(restore_folder, total_restore_size, already_restored_size);
+		else
+			LOGERR("Unknown restore method for '%s'\n", Mount_Point.c_str());
+	} else
+		LOGERR("Unknown restore method for '%s'\n", Mount_Point.c_str());
+	Throughput.Finish_Job(Backup_Name, ret);
+	return ret;
+}
+
+bool TWPartition::Restore_Paths(string restore_folder, const vector<string>& Paths) {
+	string Restore_File_System = Get_Restore_File_System(restore_folder);
+	string Full_FileName = restore_folder + "/" + Backup_FileName;
+
+	if (!Is_File_System(Restore_File_System) || twrpSparse::Is_Sparse(Full_FileName)) {
+		LOGERR("Single files can only be restored from a tar backup of '%s'\n", Mount_Point.c_str());
+		return false;
 	}
+	if (!Mount(true))
+		return false;
 
-	LOGERR("Unknown restore method for '%s'\n", Mount_Point.c_str());
-	return false;
+	twrpTar tar;
+	tar.setdir(Backup_Path);
+	tar.setfn(Full_FileName);
+	tar.backup_name = Backup_Name;
+#ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
+	string Password;
+	DataManager::GetValue("tw_restore_password", Password);
+	if (!Password.empty())
+		tar.setpassword(Password);
+#endif
+	tar.partition_name = Backup_Name;
+	return tar.extractPaths(Paths) == 0;
 }
 
 string TWPartition::Get_Restore_File_System(string restore_folder) {
@@ -1413,6 +1468,8 @@ string TWPartition::Backup_Method_By_Name() {
 		return "dd";
 	else if (Backup_Method == FLASH_UTILS)
 		return "flash_utils";
+	else if (Backup_Method == EXT4_IMAGE)
+		return "ext4_image";
 	else
 		return "undefined";
 	return "ERROR!";
@@ -1491,6 +1548,7 @@ bool TWPartition::Wipe_EXT23(string File_System) {
 
 		gui_print("Formatting %s using mke2fs...\n", Display_Name.c_str());
 		Find_Actual_Block_Device();
+		Discard_Block_Device();
 		command = "mke2fs -t " + File_System + " -m 0 " + Actual_Block_Device;
 		LOGINFO("mke2fs command: %s\n", command.c_str());
 		if (TWFunc::Exec_Cmd(command) == 0) {
@@ -1522,6 +1580,7 @@ bool TWPartition::Wipe_EXT4() {
 	char *secontext = NULL;
 
 	gui_print("Formatting %s using make_ext4fs function.\n", Display_Name.c_str());
+	Discard_Block_Device();
 
 	if (!selinux_handle || selabel_lookup(selinux_handle, &secontext, Mount_Point.c_str(), S_IFDIR) < 0) {
 		LOGINFO("Cannot lookup security context for '%s'\n", Mount_Point.c_str());
@@ -1545,6 +1604,7 @@ bool TWPartition::Wipe_EXT4() {
 
 		gui_print("Formatting %s using make_ext4fs...\n", Display_Name.c_str());
 		Find_Actual_Block_Device();
+		Discard_Block_Device();
 		Command = "make_ext4fs";
 		if (!Is_Decrypted && Length != 0) {
 			// Only use length if we're not decrypted
@@ -1663,7 +1723,9 @@ bool TWPartition::Wipe_RMRF() {
 		return false;
 
 	gui_print("Removing all files under '%s'\n", Mount_Point.c_str());
-	TWFunc::removeDir(Mount_Point, true);
+	twrpWipe wipe;
+	wipe.Add(Mount_Point, true);
+	wipe.Run(Mount_Point);
 	Recreate_AndSec_Folder();
 	return true;
 }
@@ -1677,6 +1739,7 @@ bool TWPartition::Wipe_F2FS() {
 
 		gui_print("Formatting %s using mkfs.f2fs...\n", Display_Name.c_str());
 		Find_Actual_Block_Device();
+		Discard_Block_Device();
 		command = "mkfs.f2fs " + Actual_Block_Device;
 		if (TWFunc::Exec_Cmd(command) == 0) {
 			Recreate_AndSec_Folder();
@@ -1694,15 +1757,21 @@ bool TWPartition::Wipe_F2FS() {
 	return false;
 }
 
+void TWPartition::Discard_Block_Device() {
+	if (!Wipe_Discard || Is_Decrypted)
+		return;
+
+	gui_print("Discarding %s...\n", Display_Name.c_str());
+	if (twrpWipe::Discard(Actual_Block_Device, Length, Wipe_Secure_Discard) != 0)
+		LOGINFO("Formatting '%s' without discarding it first.\n", Mount_Point.c_str());
+}
+
 bool TWPartition::Wipe_Data_Without_Wiping_Media() {
 #ifdef TW_OEM_BUILD
 	// In an OEM Build we want to do a full format
 	return Wipe_Encryption();
 #else
-	string dir;
-	#ifdef HAVE_SELINUX
-	fixPermissions perms;
-	#endif
+	twrpWipe wipe;
 
 	// This handles wiping data on devices with "sdcard" in /data/media
 	if (!Mount(true))
@@ -1719,20 +1788,14 @@ bool TWPartition::Wipe_Data_Without_Wiping_Media() {
 			// The media folder is the "internal sdcard"
 			// The .layout_version file is responsible for determining whether 4.2 decides up upgrade
 			// the media folder for multi-user.
-			//TODO: convert this to use twrpDU.cpp
 			if (strcmp(de->d_name, "media") == 0 || strcmp(de->d_name, ".layout_version") == 0)   continue;
 
-			dir = "/data/";
-			dir.append(de->d_name);
-			if (de->d_type == DT_DIR) {
-				TWFunc::removeDir(dir, false);
-			} else if (de->d_type == DT_REG || de->d_type == DT_LNK || de->d_type == DT_FIFO || de->d_type == DT_SOCK) {
-				if (!unlink(dir.c_str()))
-					LOGINFO("Unable to unlink '%s'\n", dir.c_str());
-			}
+			wipe.Add(string("/data/") + de->d_name, false);
 		}
 		closedir(d);
 
+		// Top level folders are wiped concurrently
+		wipe.Run("/data");
 		gui_print("Done.\n");
 		return true;
 	}
@@ -1741,6 +1804,24 @@ bool TWPartition::Wipe_Data_Without_Wiping_Media() {
 #endif // ifdef TW_OEM_BUILD
 }
 
+int TWPartition::Get_Compression_Level() {
+	string Levels;
+	int Level;
+	size_t pos;
+
+	// tw_compression_levels holds "backupname=level;" entries
+	DataManager::GetValue(TW_COMPRESSION_LEVELS_VAR, Levels);
+	Levels = ";" + Levels;
+	pos = Levels.find(";" + Backup_Name + "=");
+	if (pos != string::npos)
+		Level = atoi(Levels.c_str() + pos + Backup_Name.size() + 2);
+	else
+		DataManager::GetValue(TW_COMPRESSION_LEVEL_VAR, Level);
+	if (Level < 0 || Level > 9)
+		Level = 6;
+	return Level;
+}
+
 bool TWPartition::Backup_Tar(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size) {
 	char back_name[255], split_index[5];
 	string Full_FileName, Split_FileName, Tar_Args, Command;
@@ -1758,6 +1839,11 @@ bool TWPartition::Backup_Tar(string backup_folder, const unsigned long long *ove
 
 	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
 	tar.use_compression = use_compression;
+	if (use_compression) {
+		tar.compression_level = Get_Compression_Level();
+		DataManager::GetValue(TW_ADAPTIVE_COMPRESSION_VAR, tar.adaptive_compression);
+	}
+	DataManager::GetValue(TW_BACKUP_DEDUP_VAR, tar.dedup);
 
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
 	DataManager::GetValue("tw_encrypt_backup", use_encryption);
@@ -1791,7 +1877,7 @@ bool TWPartition::Backup_Tar(string backup_folder, const unsigned long long *ove
 bool TWPartition::Backup_DD(string backup_folder) {
 	char back_name[255], backup_size[32];
 	string Full_FileName, Command, DD_BS;
-	int use_compression;
+	int use_compression, use_sparse = 0;
 
 	sprintf(backup_size, "%llu", Backup_Size);
 	DD_BS = backup_size;
@@ -1804,6 +1890,14 @@ bool TWPartition::Backup_DD(string backup_folder) {
 
 	Full_FileName = backup_folder + "/" + Backup_FileName;
 
+	DataManager::GetValue(TW_SPARSE_IMAGES_VAR, use_sparse);
+	if (use_sparse && Backup_Size % SPARSE_BLOCK_SIZE == 0) {
+		twrpSparse sparse;
+
+		LOGINFO("Backing up '%s' as a sparse image\n", Actual_Block_Device.c_str());
+		return sparse.Backup(Actual_Block_Device, Full_FileName, Backup_Size) == 0;
+	}
+
 	Command = "dd if=" + Actual_Block_Device + " of='" + Full_FileName + "'" + " bs=" + DD_BS + "c count=1";
 	LOGINFO("Backup command: '%s'\n", Command.c_str());
 	TWFunc::Exec_Cmd(Command);
@@ -1814,6 +1908,39 @@ bool TWPartition::Backup_DD(string backup_folder) {
 	return true;
 }
 
+bool TWPartition::Backup_Ext4_Image(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size) {
+	char back_name[255];
+	string Full_FileName;
+	twrpSparse sparse;
+
+	// Storage and android secure share the file system with other data
+	if (Current_File_System != "ext4" || Has_Data_Media || Has_Android_Secure || Is_Storage) {
+		LOGINFO("Unable to image %s with file system '%s', backing up files instead\n", Mount_Point.c_str(), Current_File_System.c_str());
+		return Backup_Tar(backup_folder, overall_size, other_backups_size);
+	}
+	if (!Find_Partition_Size() || Size % SPARSE_BLOCK_SIZE != 0) {
+		LOGINFO("Unable to image %s with a size of %llu bytes, backing up files instead\n", Mount_Point.c_str(), Size);
+		return Backup_Tar(backup_folder, overall_size, other_backups_size);
+	}
+
+	TWFunc::GUI_Operation_Text(TW_BACKUP_TEXT, Backup_Display_Name, "Backing Up");
+	gui_print("Backing up %s...\n", Backup_Display_Name.c_str());
+
+	// The block bitmaps are only complete once the file system is unmounted
+	if (!UnMount(true))
+		return false;
+
+	sprintf(back_name, "%s.%s.win", Backup_Name.c_str(), Current_File_System.c_str());
+	Backup_FileName = back_name;
+	Full_FileName = backup_folder + "/" + Backup_FileName;
+
+	if (sparse.Backup(Actual_Block_Device, Full_FileName, Size) != 0)
+		return false;
+	gui_print("Imaged %lluMB of data, skipped %lluMB of free space.\n",
+		(sparse.Raw_Bytes + sparse.Fill_Bytes) / 1048576, sparse.Dont_Care_Bytes / 1048576);
+	return true;
+}
+
 bool TWPartition::Backup_Dump_Image(string backup_folder) {
 	char back_name[255];
 	string Full_FileName, Command;
@@ -1838,6 +1965,22 @@ bool TWPartition::Backup_Dump_Image(string backup_folder) {
 	return true;
 }
 
+bool TWPartition::Is_Compressed_Backup(string restore_folder) {
+	string Full_FileName = restore_folder + "/" + Backup_FileName;
+	int type, backup_type = 0;
+
+	if (!TWFunc::Path_Exists(Full_FileName))
+		Full_FileName += "000";
+	type = TWFunc::Get_File_Type(Full_FileName);
+	if (type == 2) {
+		// Encrypted archives hide their contents, the info file has the type
+		InfoManager restore_info(restore_folder + "/" + Backup_Name + ".info");
+		if (restore_info.LoadValues() == 0 && restore_info.GetValue("backup_type", backup_type) == 0)
+			return backup_type == 3;
+	}
+	return type == 1;
+}
+
 unsigned long long TWPartition::Get_Restore_Size(string restore_folder) {
 	InfoManager restore_info(restore_folder + "/" + Backup_Name + ".info");
 	if (restore_info.LoadValues() == 0) {
@@ -1850,7 +1993,7 @@ unsigned long long TWPartition::Get_Restore_Size(string restore_folder) {
 
 	Full_FileName = restore_folder + "/" + Backup_FileName;
 
-	if (Is_Image(Restore_File_System)) {
+	if (Is_Image(Restore_File_System) || twrpSparse::Is_Sparse(Full_FileName)) {
 		Restore_Size = TWFunc::Get_File_Size(Full_FileName);
 		return Restore_Size;
 	}
@@ -1909,6 +2052,7 @@ bool TWPartition::Restore_Tar(string restore_folder, string Restore_File_System,
 	if (!Password.empty())
 		tar.setpassword(Password);
 #endif
+	tar.partition_name = Backup_Name;
 	if (tar.extractTarFork(total_restore_size, already_restored_size) != 0)
 		ret = false;
 	else
@@ -1947,23 +2091,66 @@ bool TWPartition::Restore_DD(string restore_folder, const unsigned long long *to
 		LOGERR("Unable to find partition size for '%s'\n", Mount_Point.c_str());
 		return false;
 	}
-	unsigned long long backup_size = TWFunc::Get_File_Size(Full_FileName);
-	if (backup_size > Size) {
-		LOGERR("Size (%iMB) of backup '%s' is larger than target device '%s' (%iMB)\n",
-			(int)(backup_size / 1048576LLU), Full_FileName.c_str(),
-			Actual_Block_Device.c_str(), (int)(Size / 1048576LLU));
+	if (twrpSparse::Is_Sparse(Full_FileName)) {
+		// Sparse images are checked against the partition size when they are read
+		twrpSparse sparse;
+
+		gui_print("Restoring %s...\n", Display_Name.c_str());
+		if (sparse.Restore(Full_FileName, Actual_Block_Device, Size) != 0)
+			return false;
+	} else {
+		unsigned long long backup_size = TWFunc::Get_File_Size(Full_FileName);
+		if (backup_size > Size) {
+			LOGERR("Size (%iMB) of backup '%s' is larger than target device '%s' (%iMB)\n",
+				(int)(backup_size / 1048576LLU), Full_FileName.c_str(),
+				Actual_Block_Device.c_str(), (int)(Size / 1048576LLU));
+			return false;
+		}
+
+		gui_print("Restoring %s...\n", Display_Name.c_str());
+		Command = "dd bs=4096 if='" + Full_FileName + "' of=" + Actual_Block_Device;
+		LOGINFO("Restore command: '%s'\n", Command.c_str());
+		TWFunc::Exec_Cmd(Command);
+	}
+	if (!Throughput.Is_Tracking(Backup_Name)) {
+		display_percent = (double)(Restore_Size + *already_restored_size) / (double)(*total_restore_size) * 100;
+		sprintf(size_progress, "%lluMB of %lluMB, %i%%", (Restore_Size + *already_restored_size) / 1048576, *total_restore_size / 1048576, (int)(display_percent));
+		DataManager::SetValue("tw_size_progress", size_progress);
+		progress_percent = (display_percent / 100);
+		DataManager::SetProgress((float)(progress_percent));
+	}
+	*already_restored_size += Restore_Size;
+	return true;
+}
+
+bool TWPartition::Restore_Ext4_Image(string restore_folder, string Restore_File_System, const unsigned long long *total_restore_size, unsigned long long *already_restored_size) {
+	string Full_FileName;
+	double display_percent, progress_percent;
+	char size_progress[1024];
+	twrpSparse sparse;
+
+	TWFunc::GUI_Operation_Text(TW_RESTORE_TEXT, Backup_Display_Name, "Restoring");
+	gui_print("Restoring %s...\n", Backup_Display_Name.c_str());
+	Full_FileName = restore_folder + "/" + Backup_FileName;
+
+	if (!UnMount(true))
+		return false;
+	if (!Find_Partition_Size()) {
+		LOGERR("Unable to find partition size for '%s'\n", Mount_Point.c_str());
 		return false;
 	}
+	// Replaces the whole file system, so no wipe is needed
+	if (sparse.Restore(Full_FileName, Actual_Block_Device, Size) != 0)
+		return false;
+	Current_File_System = Restore_File_System;
 
-	gui_print("Restoring %s...\n", Display_Name.c_str());
-	Command = "dd bs=4096 if='" + Full_FileName + "' of=" + Actual_Block_Device;
-	LOGINFO("Restore command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
-	display_percent = (double)(Restore_Size + *already_restored_size) / (double)(*total_restore_size) * 100;
-	sprintf(size_progress, "%lluMB of %lluMB, %i%%", (Restore_Size + *already_restored_size) / 1048576, *total_restore_size / 1048576, (int)(display_percent));
-	DataManager::SetValue("tw_size_progress", size_progress);
-	progress_percent = (display_percent / 100);
-	DataManager::SetProgress((float)(progress_percent));
+	if (!Throughput.Is_Tracking(Backup_Name)) {
+		display_percent = (double)(Restore_Size + *already_restored_size) / (double)(*total_restore_size) * 100;
+		sprintf(size_progress, "%lluMB of %lluMB, %i%%", (Restore_Size + *already_restored_size) / 1048576, *total_restore_size / 1048576, (int)(display_percent));
+		DataManager::SetValue("tw_size_progress", size_progress);
+		progress_percent = (display_percent / 100);
+		DataManager::SetProgress((float)(progress_percent));
+	}
 	*already_restored_size += Restore_Size;
 	return true;
 }
@@ -1982,16 +2169,18 @@ bool TWPartition::Restore_Flash_Image(string restore_folder, const unsigned long
 	Command = "flash_image " + MTD_Name + " '" + Full_FileName + "'";
 	LOGINFO("Restore command: '%s'\n", Command.c_str());
 	TWFunc::Exec_Cmd(Command);
-	display_percent = (double)(Restore_Size + *already_restored_size) / (double)(*total_restore_size) * 100;
-	sprintf(size_progress, "%lluMB of %lluMB, %i%%", (Restore_Size + *already_restored_size) / 1048576, *total_restore_size / 1048576, (int)(display_percent));
-	DataManager::SetValue("tw_size_progress", size_progress);
-	progress_percent = (display_percent / 100);
-	DataManager::SetProgress((float)(progress_percent));
+	if (!Throughput.Is_Tracking(Backup_Name)) {
+		display_percent = (double)(Restore_Size + *already_restored_size) / (double)(*total_restore_size) * 100;
+		sprintf(size_progress, "%lluMB of %lluMB, %i%%", (Restore_Size + *already_restored_size) / 1048576, *total_restore_size / 1048576, (int)(display_percent));
+		DataManager::SetValue("tw_size_progress", size_progress);
+		progress_percent = (display_percent / 100);
+		DataManager::SetProgress((float)(progress_percent));
+	}
 	*already_restored_size += Restore_Size;
 	return true;
 }
 
-bool TWPartition::Update_Size(bool Display_Error) {
+bool TWPartition::Update_Size(bool Display_Error, bool Defer_Folder_Size) {
 	bool ret = false, Was_Already_Mounted = false;
 
 	if (!Can_Be_Mounted && !Is_Encrypted)
@@ -2013,28 +2202,41 @@ bool TWPartition::Update_Size(bool Display_Error) {
 		}
 	}
 
-	if (Has_Data_Media) {
-		if (Mount(Display_Error)) {
-			unsigned long long data_media_used, actual_data;
-			Used = du.Get_Folder_Size("/data");
-			Backup_Size = Used;
-			int bak = (int)(Used / 1048576LLU);
-			int fre = (int)(Free / 1048576LLU);
-			LOGINFO("Data backup size is %iMB, free: %iMB.\n", bak, fre);
-		} else {
+	if (Has_Data_Media || Has_Android_Secure) {
+		if (Defer_Folder_Size) {
+			// Walking the whole file system is by far the slowest part of
+			// sizing, Update_Folder_Size will fill in the backup size later
+			if (Has_Data_Media)
+				Backup_Size = Used;
+			Folder_Size_Pending = true;
+		} else if (!Update_Folder_Size(Display_Error)) {
 			if (!Was_Already_Mounted)
 				UnMount(false);
 			return false;
 		}
+	}
+	if (!Was_Already_Mounted)
+		UnMount(false);
+	return true;
+}
+
+bool TWPartition::Update_Folder_Size(bool Display_Error, bool Allow_Mount) {
+	bool Was_Already_Mounted = Is_Mounted();
+
+	if (!Was_Already_Mounted && (!Allow_Mount || !Mount(Display_Error)))
+		return false;
+
+	if (Has_Data_Media) {
+		Used = du.Get_Folder_Size("/data");
+		Backup_Size = Used;
+		int bak = (int)(Used / 1048576LLU);
+		int fre = (int)(Free / 1048576LLU);
+		LOGINFO("Data backup size is %iMB, free: %iMB.\n", bak, fre);
 	} else if (Has_Android_Secure) {
-		if (Mount(Display_Error))
-			Backup_Size = du.Get_Folder_Size(Backup_Path);
-		else {
-			if (!Was_Already_Mounted)
-				UnMount(false);
-			return false;
-		}
+		Backup_Size = du.Get_Folder_Size(Backup_Path);
 	}
+	// Only now is Backup_Size final
+	Folder_Size_Pending = false;
 	if (!Was_Already_Mounted)
 		UnMount(false);
 	return true;
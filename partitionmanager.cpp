@@ -30,6 +30,7 @@
 #include <iostream>
 #include <iomanip>
 #include <sys/wait.h>
+#include <pthread.h>
 #include "variables.h"
 #include "twcommon.h"
 #include "partitions.hpp"
@@ -38,6 +39,8 @@
 #include "fixPermissions.hpp"
 #include "twrpDigest.hpp"
 #include "twrpDU.hpp"
+#include "twrpWipe.hpp"
+#include "twrpThroughput.hpp"
 
 #ifdef TW_HAS_MTP
 #include "mtp/mtp_MtpServer.hpp"
@@ -60,6 +63,10 @@ extern bool datamedia;
 
 TWPartitionManager::TWPartitionManager(void) {
 	mtp_was_enabled = false;
+	folder_sizes_running = false;
+	folder_sizes_publish = false;
+	pthread_mutex_init(&folder_sizes_lock, NULL);
+	pthread_cond_init(&folder_sizes_done, NULL);
 }
 
 int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error) {
@@ -137,7 +144,9 @@ int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error)
 	if (settings_partition) {
 		Setup_Settings_Storage_Partition(settings_partition);
 	}
-	Update_System_Details();
+	// Sizing /data/media and .android_secure requires walking the entire
+	// file system, let the GUI come up while that happens in the background
+	Update_System_Details(true);
 	UnMount_Main_Partitions();
 	return true;
 }
@@ -322,6 +331,8 @@ int TWPartitionManager::UnMount_By_Path(string Path, bool Display_Error) {
 	// Iterate through all partitions
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if ((*iter)->Mount_Point == Local_Path || (!(*iter)->Symlink_Mount_Point.empty() && (*iter)->Symlink_Mount_Point == Local_Path)) {
+			if ((*iter)->Folder_Size_Pending)
+				Wait_For_Sizes();
 			ret = (*iter)->UnMount(Display_Error);
 			found = true;
 		} else if ((*iter)->Is_SubPartition && (*iter)->SubPartition_Of == Local_Path) {
@@ -481,106 +492,134 @@ bool TWPartitionManager::Make_MD5(bool generate_md5, string Backup_Folder, strin
 	return true;
 }
 
-bool TWPartitionManager::Backup_Partition(TWPartition* Part, string Backup_Folder, bool generate_md5, unsigned long long* img_bytes_remaining, unsigned long long* file_bytes_remaining, unsigned long *img_time, unsigned long *file_time, unsigned long long *img_bytes, unsigned long long *file_bytes) {
-	time_t start, stop;
-	int img_bps;
-	unsigned long long file_bps;
-	unsigned long total_time, remain_time, section_time;
-	int use_compression, backup_time;
-	float pos;
-	unsigned long long total_size, current_size;
-
+bool TWPartitionManager::Backup_Partition(TWPartition* Part, string Backup_Folder, bool generate_md5, const unsigned long long *total_size, const unsigned long long *done_size) {
 	if (Part == NULL)
 		return true;
 
-	DataManager::GetValue(TW_BACKUP_AVG_IMG_RATE, img_bps);
-
-	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
-	if (use_compression)
-		DataManager::GetValue(TW_BACKUP_AVG_FILE_COMP_RATE, file_bps);
-	else
-		DataManager::GetValue(TW_BACKUP_AVG_FILE_RATE, file_bps);
-
-	// We know the speed for both, how far into the whole backup are we, based on time
-	total_time = (*img_bytes / (unsigned long)img_bps) + (*file_bytes / (unsigned long)file_bps);
-	remain_time = (*img_bytes_remaining / (unsigned long)img_bps) + (*file_bytes_remaining / (unsigned long)file_bps);
+	if (!Part->Backup(Backup_Folder, total_size, done_size))
+		return false;
+	if (Part->Has_SubPartition) {
+		std::vector<TWPartition*>::iterator subpart;
 
-	//pos = (total_time - remain_time) / (float) total_time;
-	total_size = *file_bytes + *img_bytes;
-	current_size = *file_bytes + *img_bytes - *file_bytes_remaining - *img_bytes_remaining;
-	pos = ((float)(current_size) / (float)(total_size));
-	DataManager::SetProgress(pos);
+		for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
+			if ((*subpart)->Can_Be_Backed_Up && (*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == Part->Mount_Point) {
+				if (!(*subpart)->Backup(Backup_Folder, total_size, done_size))
+					return false;
+				sync();
+				sync();
+				if (!Make_MD5(generate_md5, Backup_Folder, (*subpart)->Backup_FileName))
+					return false;
+			}
+		}
+	}
+	return Make_MD5(generate_md5, Backup_Folder, Part->Backup_FileName);
+}
 
-	LOGINFO("Estimated total time: %lu\nEstimated remaining time: %lu\n", total_time, remain_time);
+// A partition and its subpartitions are backed up by one job.  Image backups
+// are limited by the storage I/O and file backups by the CPU (compression,
+// encryption), so up to TW_BACKUP_IO_JOBS_VAR image and TW_BACKUP_CPU_JOBS_VAR
+// file backups run at the same time.  A budget of 0 makes that kind of backup
+// run alone.  Jobs never read the same block device at the same time.
+struct Backup_Job {
+	TWPartition* Part;
+	std::vector<string> Devices;                                              // Block devices read by the job
+	unsigned long long Size;                                                  // Backup size including subpartitions
+	bool Is_Image;
+	bool Started;
+	bool Done;
+	bool Success;
+	bool Joined;
+	int Time;                                                                 // Seconds spent on the job
+	pthread_t Thread;
+};
+
+struct Backup_Schedule {
+	TWPartitionManager* Manager;
+	std::vector<Backup_Job> Jobs;
+	string Backup_Folder;
+	bool Generate_MD5;
+	unsigned long long Total_Size;
+	unsigned long long Done_Size;                                             // Bytes of finished jobs, shown by running file backups
+	int Running_Images, Running_Files;
+	pthread_mutex_t Lock;
+	pthread_cond_t Job_Done;
+};
+
+struct Backup_Thread_Data {
+	Backup_Schedule* Schedule;
+	size_t Index;
+};
+
+void* TWPartitionManager::Backup_Thread(void* cookie) {
+	Backup_Thread_Data* data = (Backup_Thread_Data*)cookie;
+	Backup_Schedule* schedule = data->Schedule;
+	Backup_Job* job = &schedule->Jobs[data->Index];
+	time_t start, stop;
+	bool ret;
 
-	// And get the time
-	if (Part->Backup_Method == 1)
-		section_time = Part->Backup_Size / file_bps;
+	delete data;
+	time(&start);
+	ret = schedule->Manager->Backup_Partition(job->Part, schedule->Backup_Folder, schedule->Generate_MD5, &schedule->Total_Size, &schedule->Done_Size);
+	time(&stop);
+
+	pthread_mutex_lock(&schedule->Lock);
+	job->Time = (int) difftime(stop, start);
+	job->Success = ret;
+	job->Done = true;
+	if (ret)
+		schedule->Done_Size += job->Size;
+	if (job->Is_Image)
+		schedule->Running_Images--;
 	else
-		section_time = Part->Backup_Size / img_bps;
+		schedule->Running_Files--;
+	pthread_cond_signal(&schedule->Job_Done);
+	pthread_mutex_unlock(&schedule->Lock);
+	LOGINFO("Partition Backup time: %s %d\n", job->Part->Backup_Display_Name.c_str(), job->Time);
+	return NULL;
+}
 
-	// Set the position
-	pos = section_time / (float) total_time;
-	//DataManager::ShowProgress(pos, section_time);
+// Returns true if job may start next to the jobs that are already running,
+// called with the schedule locked
+static bool Backup_Job_Can_Start(Backup_Schedule* schedule, size_t index, int Image_Budget, int File_Budget) {
+	Backup_Job* job = &schedule->Jobs[index];
+	int running = schedule->Running_Images + schedule->Running_Files;
+	size_t i, j, k;
 
-	TWFunc::SetPerformanceMode(true);
-	time(&start);
+	if (running > 0) {
+		// A job with a budget of 0 runs alone
+		if ((job->Is_Image ? Image_Budget : File_Budget) == 0)
+			return false;
+		if ((schedule->Running_Images > 0 && Image_Budget == 0) || (schedule->Running_Files > 0 && File_Budget == 0))
+			return false;
+		if (job->Is_Image ? schedule->Running_Images >= Image_Budget : schedule->Running_Files >= File_Budget)
+			return false;
+	}
+	for (i = 0; i < schedule->Jobs.size(); i++) {
+		Backup_Job* other = &schedule->Jobs[i];
 
-	if (Part->Backup(Backup_Folder, &total_size, &current_size)) {
-		bool md5Success = false;
-		current_size += Part->Backup_Size;
-		pos = (float)((float)(current_size) / (float)(total_size));
-		DataManager::SetProgress(pos);
-		if (Part->Has_SubPartition) {
-			std::vector<TWPartition*>::iterator subpart;
-
-			for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
-				if ((*subpart)->Can_Be_Backed_Up && (*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == Part->Mount_Point) {
-					if (!(*subpart)->Backup(Backup_Folder, &total_size, &current_size)) {
-						TWFunc::SetPerformanceMode(false);
-						return false;
-					}
-					sync();
-					sync();
-					if (!Make_MD5(generate_md5, Backup_Folder, (*subpart)->Backup_FileName)) {
-						TWFunc::SetPerformanceMode(false);
-						return false;
-					}
-					if (Part->Backup_Method == 1) {
-						*file_bytes_remaining -= (*subpart)->Backup_Size;
-					} else {
-						*img_bytes_remaining -= (*subpart)->Backup_Size;
-					}
-					current_size += Part->Backup_Size;
-					pos = (float)(current_size / total_size);
-					DataManager::SetProgress(pos);
-				}
+		if (i == index || !other->Started || other->Done)
+			continue;
+		for (j = 0; j < job->Devices.size(); j++) {
+			for (k = 0; k < other->Devices.size(); k++) {
+				if (job->Devices[j] == other->Devices[k])
+					return false;
 			}
 		}
-		time(&stop);
-		backup_time = (int) difftime(stop, start);
-		LOGINFO("Partition Backup time: %d\n", backup_time);
-		if (Part->Backup_Method == 1) {
-			*file_bytes_remaining -= Part->Backup_Size;
-			*file_time += backup_time;
-		} else {
-			*img_bytes_remaining -= Part->Backup_Size;
-			*img_time += backup_time;
-		}
-
-		md5Success = Make_MD5(generate_md5, Backup_Folder, Part->Backup_FileName);
-		TWFunc::SetPerformanceMode(false);
-		return md5Success;
-	} else {
-		TWFunc::SetPerformanceMode(false);
-		return false;
 	}
+	return true;
+}
+
+// Name of the rate the throughput monitor learns for a partition
+static string Throughput_Method(bool Files, bool Compressed) {
+	if (!Files)
+		return "image";
+	return Compressed ? "files_gz" : "files";
 }
 
 int TWPartitionManager::Run_Backup(void) {
-	int check, do_md5, partition_count = 0;
+	int check, do_md5, use_compression, partition_count = 0;
 	string Backup_Folder, Backup_Name, Full_Backup_Path, Backup_List, backup_path;
-	unsigned long long total_bytes = 0, file_bytes = 0, img_bytes = 0, free_space = 0, img_bytes_remaining, file_bytes_remaining, subpart_size;
+	unsigned long long total_bytes = 0, file_bytes = 0, img_bytes = 0, free_space = 0, subpart_size;
 	unsigned long img_time = 0, file_time = 0;
 	TWPartition* backup_part = NULL;
 	TWPartition* storage = NULL;
@@ -670,8 +709,6 @@ int TWPartitionManager::Run_Backup(void) {
 		LOGERR("Not enough free space on storage.\n");
 		return false;
 	}
-	img_bytes_remaining = img_bytes;
-	file_bytes_remaining = file_bytes;
 
 	gui_print("\n[BACKUP STARTED]\n");
 	gui_print(" * Backup Folder: %s\n", Full_Backup_Path.c_str());
@@ -682,14 +719,46 @@ int TWPartitionManager::Run_Backup(void) {
 
 	DataManager::SetProgress(0.0);
 
+	Backup_Schedule schedule;
+	int Image_Budget, File_Budget, running;
+	size_t i;
+	bool failed = false;
+
+	schedule.Manager = this;
+	schedule.Backup_Folder = Full_Backup_Path;
+	schedule.Generate_MD5 = do_md5;
+	schedule.Total_Size = total_bytes;
+	schedule.Done_Size = 0;
+	schedule.Running_Images = 0;
+	schedule.Running_Files = 0;
+
+	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
+	Throughput.Start("backup");
 	start_pos = 0;
 	end_pos = Backup_List.find(";", start_pos);
 	while (end_pos != string::npos && start_pos < Backup_List.size()) {
 		backup_path = Backup_List.substr(start_pos, end_pos - start_pos);
 		backup_part = Find_Partition_By_Path(backup_path);
 		if (backup_part != NULL) {
-			if (!Backup_Partition(backup_part, Full_Backup_Path, do_md5, &img_bytes_remaining, &file_bytes_remaining, &img_time, &file_time, &img_bytes, &file_bytes))
-				return false;
+			Backup_Job job;
+
+			job.Part = backup_part;
+			job.Size = backup_part->Backup_Size;
+			job.Is_Image = backup_part->Backup_Method != 1;
+			job.Started = job.Done = job.Success = job.Joined = false;
+			job.Time = 0;
+			job.Devices.push_back(backup_part->Actual_Block_Device.empty() ? backup_part->Mount_Point : backup_part->Actual_Block_Device);
+			Throughput.Add_Job(backup_part->Backup_Name, Throughput_Method(backup_part->Backup_Method == 1, use_compression), backup_part->Backup_Size);
+			if (backup_part->Has_SubPartition) {
+				for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
+					if ((*subpart)->Can_Be_Backed_Up && (*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == backup_part->Mount_Point) {
+						job.Size += (*subpart)->Backup_Size;
+						Throughput.Add_Job((*subpart)->Backup_Name, Throughput_Method((*subpart)->Backup_Method == 1, use_compression), (*subpart)->Backup_Size);
+						job.Devices.push_back((*subpart)->Actual_Block_Device.empty() ? (*subpart)->Mount_Point : (*subpart)->Actual_Block_Device);
+					}
+				}
+			}
+			schedule.Jobs.push_back(job);
 		} else {
 			LOGERR("Unable to locate '%s' partition for backup process.\n", backup_path.c_str());
 		}
@@ -697,6 +766,71 @@ int TWPartitionManager::Run_Backup(void) {
 		end_pos = Backup_List.find(";", start_pos);
 	}
 
+	DataManager::GetValue(TW_BACKUP_IO_JOBS_VAR, Image_Budget);
+	DataManager::GetValue(TW_BACKUP_CPU_JOBS_VAR, File_Budget);
+	if (Image_Budget < 0)
+		Image_Budget = 0;
+	if (File_Budget < 0)
+		File_Budget = 0;
+	LOGINFO("Backing up with %i image and %i file jobs at a time\n", Image_Budget, File_Budget);
+
+	pthread_mutex_init(&schedule.Lock, NULL);
+	pthread_cond_init(&schedule.Job_Done, NULL);
+	TWFunc::SetPerformanceMode(true);
+	pthread_mutex_lock(&schedule.Lock);
+	for (;;) {
+		// Jobs are started in the order of the backup list as far as the
+		// budgets and block devices allow
+		for (i = 0; i < schedule.Jobs.size() && !failed; i++) {
+			if (schedule.Jobs[i].Started || !Backup_Job_Can_Start(&schedule, i, Image_Budget, File_Budget))
+				continue;
+			Backup_Thread_Data* data = new Backup_Thread_Data;
+			data->Schedule = &schedule;
+			data->Index = i;
+			schedule.Jobs[i].Started = true;
+			if (schedule.Jobs[i].Is_Image)
+				schedule.Running_Images++;
+			else
+				schedule.Running_Files++;
+			if (pthread_create(&schedule.Jobs[i].Thread, NULL, Backup_Thread, data) != 0) {
+				LOGERR("Unable to start backup of %s\n", schedule.Jobs[i].Part->Backup_Display_Name.c_str());
+				delete data;
+				schedule.Jobs[i].Done = schedule.Jobs[i].Joined = true;
+				if (schedule.Jobs[i].Is_Image)
+					schedule.Running_Images--;
+				else
+					schedule.Running_Files--;
+				failed = true;
+			}
+		}
+		running = schedule.Running_Images + schedule.Running_Files;
+		if (running == 0)
+			break;
+		pthread_cond_wait(&schedule.Job_Done, &schedule.Lock);
+
+		for (i = 0; i < schedule.Jobs.size(); i++) {
+			Backup_Job* job = &schedule.Jobs[i];
+
+			if (!job->Done || job->Joined)
+				continue;
+			pthread_join(job->Thread, NULL);
+			job->Joined = true;
+			if (!job->Success)
+				failed = true;
+			else if (job->Is_Image)
+				img_time += job->Time;
+			else
+				file_time += job->Time;
+		}
+	}
+	pthread_mutex_unlock(&schedule.Lock);
+	Throughput.Stop();
+	TWFunc::SetPerformanceMode(false);
+	pthread_cond_destroy(&schedule.Job_Done);
+	pthread_mutex_destroy(&schedule.Lock);
+	if (failed)
+		return false;
+
 	// Average BPS
 	if (img_time == 0)
 		img_time = 1;
@@ -713,13 +847,12 @@ int TWPartitionManager::Run_Backup(void) {
 	uint64_t actual_backup_size = du.Get_Folder_Size(Full_Backup_Path);
 	actual_backup_size /= (1024LLU * 1024LLU);
 
-	int prev_img_bps, use_compression;
+	int prev_img_bps;
 	unsigned long long prev_file_bps;
 	DataManager::GetValue(TW_BACKUP_AVG_IMG_RATE, prev_img_bps);
 	img_bps += (prev_img_bps * 4);
 	img_bps /= 5;
 
-	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
 	if (use_compression)
 		DataManager::GetValue(TW_BACKUP_AVG_FILE_COMP_RATE, prev_file_bps);
 	else
@@ -777,7 +910,10 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 	string Restore_List, restore_path;
 	size_t start_pos = 0, end_pos;
 	unsigned long long total_restore_size = 0, already_restored_size = 0;
+	std::vector<TWPartition*> restore_parts;
+	size_t i;
 
+	Wait_For_Sizes();
 	gui_print("\n[RESTORE STARTED]\n\n");
 	gui_print("Restore folder: '%s'\n", Restore_Name.c_str());
 
@@ -804,6 +940,7 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 				if (check_md5 > 0 && !restore_part->Check_MD5(Restore_Name))
 					return false;
 				total_restore_size += restore_part->Get_Restore_Size(Restore_Name);
+				restore_parts.push_back(restore_part);
 				if (restore_part->Has_SubPartition) {
 					std::vector<TWPartition*>::iterator subpart;
 
@@ -812,6 +949,7 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 							if (check_md5 > 0 && !(*subpart)->Check_MD5(Restore_Name))
 								return false;
 							total_restore_size += (*subpart)->Get_Restore_Size(Restore_Name);
+							restore_parts.push_back(*subpart);
 						}
 					}
 				}
@@ -831,6 +969,12 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 	gui_print("Restoring %i partitions...\n", partition_count);
 	gui_print("Total restore size is %lluMB\n", total_restore_size / 1048576);
 	DataManager::SetProgress(0.0);
+	Throughput.Start("restore");
+	for (i = 0; i < restore_parts.size(); i++) {
+		bool files = restore_parts[i]->Backup_Method == 1;
+
+		Throughput.Add_Job(restore_parts[i]->Backup_Name, Throughput_Method(files, files && restore_parts[i]->Is_Compressed_Backup(Restore_Name)), restore_parts[i]->Restore_Size);
+	}
 
 	start_pos = 0;
 	if (!Restore_List.empty()) {
@@ -840,8 +984,10 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 			restore_part = Find_Partition_By_Path(restore_path);
 			if (restore_part != NULL) {
 				partition_count++;
-				if (!Restore_Partition(restore_part, Restore_Name, partition_count, &total_restore_size, &already_restored_size))
+				if (!Restore_Partition(restore_part, Restore_Name, partition_count, &total_restore_size, &already_restored_size)) {
+					Throughput.Stop();
 					return false;
+				}
 			} else {
 				LOGERR("Unable to locate '%s' partition for restoring.\n", restore_path.c_str());
 			}
@@ -849,6 +995,7 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 			end_pos = Restore_List.find(";", start_pos);
 		}
 	}
+	Throughput.Stop();
 	TWFunc::GUI_Operation_Text(TW_UPDATE_SYSTEM_DETAILS_TEXT, "Updating System Details");
 	Update_System_Details();
 	UnMount_Main_Partitions();
@@ -858,6 +1005,28 @@ int TWPartitionManager::Run_Restore(string Restore_Name) {
 	return true;
 }
 
+bool TWPartitionManager::Restore_Paths(string Restore_Name, string Partition_Path, const vector<string>& Paths) {
+	TWPartition* Part = Find_Partition_By_Path(Partition_Path);
+	int check_md5;
+	size_t i;
+
+	if (Part == NULL) {
+		LOGERR("Unable to locate '%s' partition for restoring.\n", Partition_Path.c_str());
+		return false;
+	}
+	if (Part->Backup_FileName.empty()) {
+		LOGERR("'%s' has no backup of '%s'\n", Restore_Name.c_str(), Partition_Path.c_str());
+		return false;
+	}
+	DataManager::GetValue(TW_SKIP_MD5_CHECK_VAR, check_md5);
+	if (check_md5 > 0 && !Part->Check_MD5(Restore_Name))
+		return false;
+	gui_print("Restoring from %s:\n", Part->Backup_Display_Name.c_str());
+	for (i = 0; i < Paths.size(); i++)
+		gui_print("%s\n", Paths[i].c_str());
+	return Part->Restore_Paths(Restore_Name, Paths);
+}
+
 void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 	// Start with the default values
 	string Restore_List;
@@ -961,6 +1130,8 @@ int TWPartitionManager::Wipe_By_Path(string Path) {
 	bool found = false;
 	string Local_Path = TWFunc::Get_Root_Path(Path);
 
+	Wait_For_Sizes();
+
 	// Iterate through all partitions
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if ((*iter)->Mount_Point == Local_Path || (!(*iter)->Symlink_Mount_Point.empty() && (*iter)->Symlink_Mount_Point == Local_Path)) {
@@ -986,6 +1157,8 @@ int TWPartitionManager::Wipe_By_Path(string Path, string New_File_System) {
 	bool found = false;
 	string Local_Path = TWFunc::Get_Root_Path(Path);
 
+	Wait_For_Sizes();
+
 	// Iterate through all partitions
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if ((*iter)->Mount_Point == Local_Path || (!(*iter)->Symlink_Mount_Point.empty() && (*iter)->Symlink_Mount_Point == Local_Path)) {
@@ -1009,6 +1182,7 @@ int TWPartitionManager::Factory_Reset(void) {
 	std::vector<TWPartition*>::iterator iter;
 	int ret = true;
 
+	Wait_For_Sizes();
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if ((*iter)->Wipe_During_Factory_Reset && (*iter)->Is_Present) {
 			if (!(*iter)->Wipe())
@@ -1024,6 +1198,7 @@ int TWPartitionManager::Factory_Reset(void) {
 int TWPartitionManager::Wipe_Dalvik_Cache(void) {
 	struct stat st;
 	vector <string> dir;
+	twrpWipe wipe;
 
 	if (!Mount_By_Path("/data", true))
 		return false;
@@ -1034,22 +1209,20 @@ int TWPartitionManager::Wipe_Dalvik_Cache(void) {
 	dir.push_back("/data/dalvik-cache");
 	dir.push_back("/cache/dalvik-cache");
 	dir.push_back("/cache/dc");
-	gui_print("\nWiping Dalvik Cache Directories...\n");
-	for (unsigned i = 0; i < dir.size(); ++i) {
-		if (stat(dir.at(i).c_str(), &st) == 0) {
-			TWFunc::removeDir(dir.at(i), false);
-			gui_print("Cleaned: %s...\n", dir.at(i).c_str());
-		}
-	}
 	TWPartition* sdext = Find_Partition_By_Path("/sd-ext");
 	if (sdext && sdext->Is_Present && sdext->Mount(false))
-	{
-		if (stat("/sd-ext/dalvik-cache", &st) == 0)
-		{
-			TWFunc::removeDir("/sd-ext/dalvik-cache", false);
-			gui_print("Cleaned: /sd-ext/dalvik-cache...\n");
-		}
+		dir.push_back("/sd-ext/dalvik-cache");
+	gui_print("\nWiping Dalvik Cache Directories...\n");
+	for (unsigned i = 0; i < dir.size(); ++i) {
+		if (stat(dir.at(i).c_str(), &st) == 0)
+			wipe.Add(dir.at(i), false);
+		else
+			dir.erase(dir.begin() + i--);
 	}
+	// The folders are on different partitions, so they are wiped concurrently
+	wipe.Run("dalvik cache");
+	for (unsigned i = 0; i < dir.size(); ++i)
+		gui_print("Cleaned: %s...\n", dir.at(i).c_str());
 	gui_print("-- Dalvik Cache Directories Wipe Complete!\n\n");
 	return true;
 }
@@ -1102,6 +1275,7 @@ int TWPartitionManager::Wipe_Android_Secure(void) {
 int TWPartitionManager::Format_Data(void) {
 	TWPartition* dat = Find_Partition_By_Path("/data");
 
+	Wait_For_Sizes();
 	if (dat != NULL) {
 		if (!dat->UnMount(true))
 			return false;
@@ -1117,6 +1291,7 @@ int TWPartitionManager::Format_Data(void) {
 int TWPartitionManager::Wipe_Media_From_Data(void) {
 	TWPartition* dat = Find_Partition_By_Path("/data");
 
+	Wait_For_Sizes();
 	if (dat != NULL) {
 		if (!dat->Has_Data_Media) {
 			LOGERR("This device does not have /data/media\n");
@@ -1181,14 +1356,105 @@ int TWPartitionManager::Repair_By_Path(string Path, bool Display_Error) {
 	return false;
 }
 
-void TWPartitionManager::Update_System_Details(void) {
+#define SIZE_THREADS 4
+
+struct Size_Pool {
+	std::vector<TWPartition*> Parts;
+	std::vector<int32_t> Times;                                               // Time in ms spent on each partition
+	size_t Next;                                                              // Next partition to be picked up by a worker
+	bool Defer_Folder_Sizes;
+	pthread_mutex_t Lock;
+};
+
+static void* Size_Worker(void* cookie) {
+	Size_Pool* pool = (Size_Pool*)cookie;
+	timespec start, end;
+	size_t index;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->Lock);
+		index = pool->Next++;
+		pthread_mutex_unlock(&pool->Lock);
+		if (index >= pool->Parts.size())
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pool->Parts[index]->Update_Size(true, pool->Defer_Folder_Sizes);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		pool->Times[index] = TWFunc::timespec_diff_ms(start, end);
+	}
+	return NULL;
+}
+
+void TWPartitionManager::Update_Partition_Sizes(bool Defer_Folder_Sizes) {
+	std::vector<TWPartition*>::iterator iter, other;
+	std::vector<TWPartition*> Serial;
+	Size_Pool pool;
+	pthread_t threads[SIZE_THREADS];
+	int thread_count = 0, i;
+	timespec start, end, part_start, part_end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pool.Next = 0;
+	pool.Defer_Folder_Sizes = Defer_Folder_Sizes;
+	pthread_mutex_init(&pool.Lock, NULL);
+
+	// Mounting, probing with blkid and statfs are independent per partition,
+	// except when a partition (or its symlink) mounts inside another partition.
+	// Unmounting storage toggles MTP, which is not thread safe, so storage
+	// partitions are sized on this thread as well.
+	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+		if (!(*iter)->Can_Be_Mounted)
+			continue;
+		bool nested = (*iter)->Is_Storage;
+		for (other = Partitions.begin(); other != Partitions.end() && !nested; other++) {
+			if (*other == *iter || !(*other)->Can_Be_Mounted)
+				continue;
+			string Parent = (*other)->Mount_Point + "/";
+			if ((*iter)->Mount_Point.find(Parent) == 0 || (*iter)->Symlink_Mount_Point == (*other)->Mount_Point || (*iter)->Symlink_Mount_Point.find(Parent) == 0)
+				nested = true;
+		}
+		if (nested)
+			Serial.push_back(*iter);
+		else
+			pool.Parts.push_back(*iter);
+	}
+	pool.Times.resize(pool.Parts.size(), 0);
+
+	while (thread_count < SIZE_THREADS && thread_count + 1 < (int)pool.Parts.size()) {
+		if (pthread_create(&threads[thread_count], NULL, Size_Worker, &pool) != 0)
+			break;
+		thread_count++;
+	}
+	// The calling thread works through the list too, so this completes even
+	// if no threads could be started
+	Size_Worker(&pool);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.Lock);
+
+	for (iter = Serial.begin(); iter != Serial.end(); iter++) {
+		clock_gettime(CLOCK_MONOTONIC, &part_start);
+		(*iter)->Update_Size(true, Defer_Folder_Sizes);
+		clock_gettime(CLOCK_MONOTONIC, &part_end);
+		pool.Parts.push_back(*iter);
+		pool.Times.push_back(TWFunc::timespec_diff_ms(part_start, part_end));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	LOGINFO("Partition sizes updated in %ims using %i threads:\n", TWFunc::timespec_diff_ms(start, end), thread_count + 1);
+	for (i = 0; i < (int)pool.Parts.size(); i++)
+		LOGINFO("  %s: %ims%s\n", pool.Parts[i]->Mount_Point.c_str(), pool.Times[i], pool.Parts[i]->Folder_Size_Pending ? " (backup size deferred)" : "");
+}
+
+void TWPartitionManager::Update_Size_Variables(void) {
 	std::vector<TWPartition*>::iterator iter;
 	int data_size = 0;
 
-	gui_print("Updating partition details...\n");
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
-		if ((*iter)->Can_Be_Mounted) {
-			(*iter)->Update_Size(true);
+		if ((*iter)->Folder_Size_Pending) {
+			// Published by Folder_Size_Thread once the size is known
+			continue;
+		} else if ((*iter)->Can_Be_Mounted) {
 			if ((*iter)->Mount_Point == "/system") {
 				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
 				DataManager::SetValue(TW_BACKUP_SYSTEM_SIZE, backup_display_size);
@@ -1281,8 +1547,18 @@ void TWPartitionManager::Update_System_Details(void) {
 #endif
 		}
 	}
-	gui_print("...done\n");
 	DataManager::SetValue(TW_BACKUP_DATA_SIZE, data_size);
+}
+
+void TWPartitionManager::Update_System_Details(bool Defer_Folder_Sizes) {
+	std::vector<TWPartition*>::iterator iter;
+	bool pending = false;
+
+	Wait_For_Sizes();
+	gui_print("Updating partition details...\n");
+	Update_Partition_Sizes(Defer_Folder_Sizes);
+	Update_Size_Variables();
+	gui_print("...done\n");
 	string current_storage_path = DataManager::GetCurrentStoragePath();
 	TWPartition* FreeStorage = Find_Partition_By_Path(current_storage_path);
 	if (FreeStorage != NULL) {
@@ -1324,15 +1600,97 @@ void TWPartitionManager::Update_System_Details(void) {
 	}
 	if (!Write_Fstab())
 		LOGERR("Error creating fstab\n");
+
+	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+		if ((*iter)->Folder_Size_Pending)
+			pending = true;
+	}
+	if (pending) {
+		pthread_t thread;
+
+		folder_sizes_running = true;
+		if (pthread_create(&thread, NULL, Folder_Size_Thread, this) == 0) {
+			pthread_detach(thread);
+		} else {
+			LOGINFO("Unable to start background sizing thread, sizing now.\n");
+			Folder_Size_Thread(this);
+		}
+	}
 	return;
 }
 
+void* TWPartitionManager::Folder_Size_Thread(void* cookie) {
+	TWPartitionManager* Manager = (TWPartitionManager*)cookie;
+	std::vector<TWPartition*>::iterator iter;
+	timespec start, end;
+
+	for (iter = Manager->Partitions.begin(); iter != Manager->Partitions.end(); iter++) {
+		if (!(*iter)->Folder_Size_Pending)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		// Mounting here could race a wipe or MTP on the GUI thread, an
+		// unmounted partition is left for Wait_For_Sizes
+		if (!(*iter)->Update_Folder_Size(false, false)) {
+			LOGINFO("'%s' is not mounted, backup size deferred.\n", (*iter)->Mount_Point.c_str());
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		LOGINFO("Backup size of '%s' computed in %ims.\n", (*iter)->Mount_Point.c_str(), TWFunc::timespec_diff_ms(start, end));
+	}
+
+	// The data manager is updated by Publish_Folder_Sizes on the GUI thread
+	pthread_mutex_lock(&Manager->folder_sizes_lock);
+	Manager->folder_sizes_running = false;
+	Manager->folder_sizes_publish = true;
+	pthread_cond_broadcast(&Manager->folder_sizes_done);
+	pthread_mutex_unlock(&Manager->folder_sizes_lock);
+	return NULL;
+}
+
+void TWPartitionManager::Wait_For_Sizes(void) {
+	pthread_mutex_lock(&folder_sizes_lock);
+	if (folder_sizes_running)
+		LOGINFO("Waiting for backup sizes to be calculated...\n");
+	while (folder_sizes_running)
+		pthread_cond_wait(&folder_sizes_done, &folder_sizes_lock);
+	pthread_mutex_unlock(&folder_sizes_lock);
+
+	std::vector<TWPartition*>::iterator iter;
+	bool sized = false;
+
+	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+		if ((*iter)->Folder_Size_Pending) {
+			// Skipped by Folder_Size_Thread as it was not mounted, this thread may mount it
+			if (!(*iter)->Update_Folder_Size(false)) {
+				LOGINFO("Unable to compute the backup size of '%s'.\n", (*iter)->Mount_Point.c_str());
+				(*iter)->Folder_Size_Pending = false;
+			}
+			sized = true;
+		}
+	}
+	if (sized)
+		Update_Size_Variables();
+	Publish_Folder_Sizes();
+}
+
+void TWPartitionManager::Publish_Folder_Sizes(void) {
+	bool publish;
+
+	pthread_mutex_lock(&folder_sizes_lock);
+	publish = folder_sizes_publish;
+	folder_sizes_publish = false;
+	pthread_mutex_unlock(&folder_sizes_lock);
+	if (publish)
+		Update_Size_Variables();
+}
+
 int TWPartitionManager::Decrypt_Device(string Password) {
 #ifdef TW_INCLUDE_CRYPTO
 	int ret_val, password_len;
 	char crypto_blkdev[255], cPassword[255];
 	size_t result;
 
+	Wait_For_Sizes();
 	property_set("ro.crypto.state", "encrypted");
 #ifdef TW_INCLUDE_JB_CRYPTO
 	// No extra flags needed
@@ -1516,6 +1874,7 @@ int TWPartitionManager::usb_storage_enable(void) {
 	char lun_file[255];
 	bool has_multiple_lun = false;
 
+	Wait_For_Sizes();
 	DataManager::GetValue(TW_HAS_DATA_MEDIA, has_data_media);
 	string Lun_File_str = CUSTOM_LUN_FILE;
 	size_t found = Lun_File_str.find("%");
@@ -1628,6 +1987,7 @@ int TWPartitionManager::Partition_SDCard(void) {
 	int ext, swap, total_size = 0, fat_size;
 	FILE* fp;
 
+	Wait_For_Sizes();
 	gui_print("Partitioning SD Card...\n");
 #ifdef TW_EXTERNAL_STORAGE_PATH
 	TWPartition* SDCard = Find_Partition_By_Path(EXPAND(TW_EXTERNAL_STORAGE_PATH));
@@ -1821,6 +2181,21 @@ void TWPartitionManager::Get_Partition_List(string ListType, std::vector<Partiti
 				Partition_List->push_back(part);
 			}
 		}
+	} else if (ListType == "compression") {
+		char level[32];
+		string Current_Partition;
+		DataManager::GetValue("tw_compression_partition", Current_Partition);
+		for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+			if ((*iter)->Can_Be_Backed_Up && !(*iter)->Is_SubPartition && (*iter)->Is_Present &&
+				((*iter)->Backup_Method == TWPartition::FILES || (*iter)->Backup_Method == TWPartition::EXT4_IMAGE)) {
+				struct PartitionList part;
+				sprintf(level, " (level %i)", (*iter)->Get_Compression_Level());
+				part.Display_Name = (*iter)->Backup_Display_Name + level;
+				part.Mount_Point = (*iter)->Backup_Path;
+				part.selected = (part.Mount_Point == Current_Partition);
+				Partition_List->push_back(part);
+			}
+		}
 	} else if (ListType == "restore") {
 		string Restore_List, restore_path;
 		TWPartition* restore_part = NULL;
@@ -1924,6 +2299,32 @@ TWPartition *TWPartitionManager::Get_Default_Storage_Partition()
 	return res;
 }
 
+void TWPartitionManager::Set_Compression_Level(string Path, int Level) {
+	TWPartition* Part = Find_Partition_By_Path(Path);
+	string Levels, New_Levels, Entry;
+	size_t start_pos = 0, end_pos;
+	char level_str[16];
+
+	if (Part == NULL) {
+		LOGERR("Unable to locate '%s' to set the compression level.\n", Path.c_str());
+		return;
+	}
+	if (Level < 0 || Level > 9)
+		Level = 6;
+	// Replace the entry of the partition in the "backupname=level;" list
+	DataManager::GetValue(TW_COMPRESSION_LEVELS_VAR, Levels);
+	while ((end_pos = Levels.find(";", start_pos)) != string::npos) {
+		Entry = Levels.substr(start_pos, end_pos - start_pos);
+		if (!Entry.empty() && Entry.find(Part->Backup_Name + "=") != 0)
+			New_Levels += Entry + ";";
+		start_pos = end_pos + 1;
+	}
+	sprintf(level_str, "%i", Level);
+	New_Levels += Part->Backup_Name + "=" + level_str + ";";
+	DataManager::SetValue(TW_COMPRESSION_LEVELS_VAR, New_Levels);
+	LOGINFO("Compression level of %s set to %i\n", Part->Backup_Display_Name.c_str(), Level);
+}
+
 bool TWPartitionManager::Enable_MTP(void) {
 #ifdef TW_HAS_MTP
 	if (mtppid) {
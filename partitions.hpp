@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <string>
+#include <pthread.h>
 #include "twrpDU.hpp"
 
 #define MAX_FSTAB_LINE_LENGTH 2048
@@ -42,6 +43,7 @@ public:
 		FILES = 1,
 		DD = 2,
 		FLASH_UTILS = 3,
+		EXT4_IMAGE = 4,
 	};
 
 public:
@@ -60,13 +62,17 @@ public:
 	bool Backup(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size); // Backs up the partition to the folder specified
 	bool Check_MD5(string restore_folder);                                    // Checks MD5 of a backup
 	bool Restore(string restore_folder, const unsigned long long *total_restore_size, unsigned long long *already_restored_size); // Restores the partition using the backup folder provided
+	bool Restore_Paths(string restore_folder, const vector<string>& Paths);  // Restores only these files and folders from a tar backup, without wiping
 	unsigned long long Get_Restore_Size(string restore_folder);               // Returns the overall restore size of the backup
+	bool Is_Compressed_Backup(string restore_folder);                         // Returns true if the archives of the backup are compressed
 	string Backup_Method_By_Name();                                           // Returns a string of the backup method for human readable output
 	bool Decrypt(string Password);                                            // Decrypts the partition, return 0 for failure and -1 for success
 	bool Wipe_Encryption();                                                   // Ignores wipe commands for /data/media devices and formats the original block device
 	void Check_FS_Type();                                                     // Checks the fs type using blkid, does not do anything on MTD / yaffs2 because this crashes on some devices
-	bool Update_Size(bool Display_Error);                                     // Updates size information
+	bool Update_Size(bool Display_Error, bool Defer_Folder_Size = false);     // Updates size information, optionally leaving the du based backup size for later
+	bool Update_Folder_Size(bool Display_Error, bool Allow_Mount = true);     // Computes the du based backup size for /data/media and .android_secure, without Allow_Mount only if already mounted
 	void Recreate_Media_Folder();                                             // Recreates the /data/media folder
+	int Get_Compression_Level();                                              // Returns the compression level chosen for this partition or the default level
 
 public:
 	string Current_File_System;                                               // Current file system
@@ -100,13 +106,16 @@ private:
 	bool Wipe_RMRF();                                                         // Uses rm -rf to wipe
 	bool Wipe_F2FS();                                                         // Uses mkfs.f2fs to wipe
 	bool Wipe_Data_Without_Wiping_Media();                                    // Uses rm -rf to wipe but does not wipe /data/media
+	void Discard_Block_Device();                                              // Discards the block device before a format if the fstab allows it
 	bool Backup_Tar(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size); // Backs up using tar for file systems
 	bool Backup_DD(string backup_folder);                                     // Backs up using dd for emmc memory types
 	bool Backup_Dump_Image(string backup_folder);                             // Backs up using dump_image for MTD memory types
+	bool Backup_Ext4_Image(string backup_folder, const unsigned long long *overall_size, const unsigned long long *other_backups_size); // Backs up the used blocks of ext4 file systems as a sparse image
 	string Get_Restore_File_System(string restore_folder);                    // Returns the file system that was in place at the time of the backup
 	bool Restore_Tar(string restore_folder, string Restore_File_System, const unsigned long long *total_restore_size, unsigned long long *already_restored_size); // Restore using tar for file systems
 	bool Restore_DD(string restore_folder, const unsigned long long *total_restore_size, unsigned long long *already_restored_size); // Restore using dd for emmc memory types
 	bool Restore_Flash_Image(string restore_folder, const unsigned long long *total_restore_size, unsigned long long *already_restored_size); // Restore using flash_image for MTD memory types
+	bool Restore_Ext4_Image(string restore_folder, string Restore_File_System, const unsigned long long *total_restore_size, unsigned long long *already_restored_size); // Restore a sparse image of a file system
 	bool Get_Size_Via_statfs(bool Display_Error);                             // Get Partition size, used, and free space using statfs
 	bool Get_Size_Via_df(bool Display_Error);                                 // Get Partition size, used, and free space using df command
 	bool Make_Dir(string Path, bool Display_Error);                           // Creates a directory if it doesn't already exist
@@ -119,6 +128,8 @@ private:
 	bool Can_Be_Wiped;                                                        // Indicates that the partition can be wiped
 	bool Can_Be_Backed_Up;                                                    // Indicates that the partition will show up in the backup list
 	bool Use_Rm_Rf;                                                           // Indicates that the partition will always be formatted w/ "rm -rf *"
+	bool Wipe_Discard;                                                        // Indicates that the block device is discarded before a format
+	bool Wipe_Secure_Discard;                                                 // Indicates that the block device is securely discarded before a format
 	bool Wipe_During_Factory_Reset;                                           // Indicates that this partition is wiped during a factory reset
 	bool Wipe_Available_in_GUI;                                               // Inidcates that the wipe can be user initiated in the GUI system
 	bool Is_SubPartition;                                                     // Indicates that this partition is a sub-partition of another partition (e.g. datadata is a sub-partition of data)
@@ -159,6 +170,7 @@ private:
 	int Format_Block_Size;                                                    // Block size for formatting
 	bool Ignore_Blkid;                                                        // Ignore blkid results due to superblocks lying to us on certain devices / partitions
 	bool Retain_Layout_Version;                                               // Retains the .layout_version file during a wipe (needed on devices like Sony Xperia T where /data and /data/media are separate partitions)
+	bool Folder_Size_Pending;                                                 // Backup size still has to be computed by Update_Folder_Size
 #ifdef TW_INCLUDE_CRYPTO_SAMSUNG
 	string EcryptFS_Password;                                                 // Have to store the encryption password to remount
 #endif
@@ -188,6 +200,7 @@ public:
 	int Check_Backup_Name(bool Display_Error);                                // Checks the current backup name to ensure that it is valid
 	int Run_Backup();                                                         // Initiates a backup in the current storage
 	int Run_Restore(string Restore_Name);                                     // Restores a backup
+	bool Restore_Paths(string Restore_Name, string Partition_Path, const vector<string>& Paths); // Restores single files and folders of a partition from a backup
 	void Set_Restore_Files(string Restore_Name);                              // Used to gather a list of available backup partitions for the user to select for a restore
 	int Wipe_By_Path(string Path);                                            // Wipes a partition based on path
 	int Wipe_By_Path(string Path, string New_File_System);                    // Wipes a partition based on path
@@ -199,7 +212,9 @@ public:
 	int Format_Data();                                                        // Really formats data on /data/media devices -- also removes encryption
 	int Wipe_Media_From_Data();                                               // Removes and recreates the media folder on /data/media devices
 	int Repair_By_Path(string Path, bool Display_Error);                      // Repairs a partition based on path
-	void Update_System_Details();                                             // Updates fstab, file systems, sizes, etc.
+	void Update_System_Details(bool Defer_Folder_Sizes = false);              // Updates fstab, file systems, sizes, etc.
+	void Wait_For_Sizes();                                                    // Waits for any background backup size calculation to finish and sizes what it skipped
+	void Publish_Folder_Sizes();                                              // Copies sizes finished by Folder_Size_Thread into the data manager, call from the GUI or action thread
 	int Decrypt_Device(string Password);                                      // Attempt to decrypt any encrypted partitions
 	int usb_storage_enable(void);                                             // Enable USB storage mode
 	int usb_storage_disable(void);                                            // Disable USB storage mode
@@ -207,6 +222,7 @@ public:
 	void UnMount_Main_Partitions(void);                                       // Unmounts system and data if not data/media and boot if boot is mountable
 	int Partition_SDCard(void);                                               // Repartitions the sdcard
 	TWPartition *Get_Default_Storage_Partition();                             // Returns a pointer to a default storage partition
+	void Set_Compression_Level(string Path, int Level);                       // Sets the compression level used for backups of a partition
 
 	int Fix_Permissions();
 	void Get_Partition_List(string ListType, std::vector<PartitionList> *Partition_List);
@@ -219,13 +235,21 @@ private:
 	void Setup_Settings_Storage_Partition(TWPartition* Part);                 // Sets up settings storage
 	void Setup_Android_Secure_Location(TWPartition* Part);                    // Sets up .android_secure if needed
 	bool Make_MD5(bool generate_md5, string Backup_Folder, string Backup_Filename); // Generates an MD5 after a backup is made
-	bool Backup_Partition(TWPartition* Part, string Backup_Folder, bool generate_md5, unsigned long long* img_bytes_remaining, unsigned long long* file_bytes_remaining, unsigned long *img_time, unsigned long *file_time, unsigned long long *img_bytes, unsigned long long *file_bytes);
+	bool Backup_Partition(TWPartition* Part, string Backup_Folder, bool generate_md5, const unsigned long long *total_size, const unsigned long long *done_size);
+	static void* Backup_Thread(void* cookie);                                 // Backs up one partition of a Run_Backup schedule
 	bool Restore_Partition(TWPartition* Part, string Restore_Name, int partition_count, const unsigned long long *total_restore_size, unsigned long long *already_restored_size);
 	void Output_Partition(TWPartition* Part);
 	TWPartition* Find_Next_Storage(string Path, string Exclude);
 	int Open_Lun_File(string Partition_Path, string Lun_File);
+	void Update_Partition_Sizes(bool Defer_Folder_Sizes);                     // Probes and sizes all mountable partitions using a pool of threads
+	void Update_Size_Variables();                                             // Copies partition backup sizes into the data manager
+	static void* Folder_Size_Thread(void* cookie);                            // Computes deferred du based backup sizes in the background
 	pid_t mtppid;
 	bool mtp_was_enabled;
+	bool folder_sizes_running;                                                // Folder_Size_Thread is still running
+	bool folder_sizes_publish;                                                // Folder_Size_Thread finished, the size variables are stale
+	pthread_mutex_t folder_sizes_lock;
+	pthread_cond_t folder_sizes_done;
 
 private:
 	std::vector<TWPartition*> Partitions;                                     // Vector list of all partitions
@@ -17,6 +17,10 @@
 */
 
 #include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "libtar/libtar.h"
 #include "twcommon.h"
 
@@ -7,11 +7,14 @@ extern "C" {
 
 #ifndef BUILD_TWRPTAR_MAIN
 #include "gui/gui.h"
+#include "twlog.h"
 #define LOGERR(...) gui_print_color("error", "E:" __VA_ARGS__)
-#define LOGINFO(...) fprintf(stdout, "I:" __VA_ARGS__)
+#define LOGINFO(...) twlog_print(TWLOG_INFO, "I:" __VA_ARGS__)
 #else
 #define LOGERR(...) printf("E:" __VA_ARGS__)
 #define LOGINFO(...) printf("I:" __VA_ARGS__)
+#define LOGDEBUG(...) do { } while (0)
+#define LOGTRACE(...) do { } while (0)
 #define gui_print(...) printf( __VA_ARGS__ )
 #endif
 
@@ -0,0 +1,252 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "twlog.h"
+
+// Messages are queued in a ring of fixed size slots. Writers reserve a slot
+// with an atomic increment and publish it by bumping the slot's sequence
+// number, so logging from hot paths never takes a lock. A single background
+// thread drains the ring into stdout (the tmp log) in large writes and sleeps
+// on a condition when the ring is empty. Longer messages take several
+// consecutive slots.
+#define TWLOG_SLOTS 1024                  // Must be a power of 2
+#define TWLOG_SLOT_SIZE 512
+#define TWLOG_MAX_SLOTS 16                // Longer messages are written directly
+#define TWLOG_WRITE_SIZE (64 * 1024)
+#define TWLOG_TRACE_PER_SEC 50
+
+struct twlog_slot {
+	volatile unsigned seq;                // == position when free, position + 1 when filled
+	unsigned len;
+	char text[TWLOG_SLOT_SIZE];
+};
+
+int twlog_level = TWLOG_INFO;
+
+static struct twlog_slot ring[TWLOG_SLOTS];
+static volatile unsigned ring_head;       // Next position to reserve
+static volatile unsigned ring_tail;       // Next position to copy out of the ring
+static volatile unsigned ring_written;    // Positions before this are written and flushed
+static volatile int writer_running;
+static volatile int writer_sleeping;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static volatile unsigned long long log_bytes;
+static volatile unsigned trace_second, trace_count, trace_dropped;
+
+static void* twlog_writer(void *cookie) {
+	static char out[TWLOG_WRITE_SIZE];
+	struct twlog_slot *slot;
+	size_t used;
+
+	for (;;) {
+		used = 0;
+		while (used + TWLOG_SLOT_SIZE <= sizeof(out)) {
+			slot = &ring[ring_tail & (TWLOG_SLOTS - 1)];
+			if (slot->seq != ring_tail + 1)
+				break;
+			__sync_synchronize();
+			memcpy(out + used, slot->text, slot->len);
+			used += slot->len;
+			__sync_synchronize();
+			slot->seq = ring_tail + TWLOG_SLOTS;
+			ring_tail++;
+		}
+		if (used) {
+			// Held until flushed, a fork never sees half a batch in the buffer
+			flockfile(stdout);
+			fwrite(out, 1, used, stdout);
+			fflush(stdout);
+			funlockfile(stdout);
+			__sync_synchronize();
+			ring_written = ring_tail;
+			continue;
+		}
+		// Writers check writer_sleeping after publishing a slot, so one of
+		// both sides always sees the other
+		pthread_mutex_lock(&writer_lock);
+		writer_sleeping = 1;
+		__sync_synchronize();
+		while (ring[ring_tail & (TWLOG_SLOTS - 1)].seq != ring_tail + 1)
+			pthread_cond_wait(&writer_wake, &writer_lock);
+		writer_sleeping = 0;
+		pthread_mutex_unlock(&writer_lock);
+	}
+	return NULL;
+}
+
+static void twlog_wake_writer(void) {
+	__sync_synchronize();
+	if (writer_sleeping) {
+		pthread_mutex_lock(&writer_lock);
+		pthread_cond_signal(&writer_wake);
+		pthread_mutex_unlock(&writer_lock);
+	}
+}
+
+// stdout is held across fork() so a child never inherits it locked by the
+// writer thread in the middle of a write
+static void twlog_atfork_prepare(void) {
+	flockfile(stdout);
+}
+
+static void twlog_atfork_parent(void) {
+	funlockfile(stdout);
+}
+
+// Forked children (e.g. the tar processes) do not have the writer thread,
+// so they write their messages directly
+static void twlog_atfork_child(void) {
+	writer_running = 0;
+	funlockfile(stdout);
+}
+
+void twlog_start(void) {
+	pthread_t thread;
+	unsigned i;
+
+	if (writer_running)
+		return;
+	for (i = 0; i < TWLOG_SLOTS; i++)
+		ring[i].seq = i;
+	ring_head = ring_tail = ring_written = 0;
+	pthread_atfork(twlog_atfork_prepare, twlog_atfork_parent, twlog_atfork_child);
+	if (pthread_create(&thread, NULL, twlog_writer, NULL) != 0) {
+		printf("Unable to start log writer thread, logging directly.\n");
+		return;
+	}
+	pthread_detach(thread);
+	writer_running = 1;
+}
+
+void twlog_flush(void) {
+	unsigned head = ring_head;
+
+	// ring_tail moves before the batch is written, wait for the write itself
+	while (writer_running && (int)(head - ring_written) > 0)
+		usleep(1000);
+}
+
+void twlog_append(const char *text, size_t len) {
+	struct twlog_slot *slot;
+	unsigned pos, count, i;
+	size_t part;
+
+	__sync_fetch_and_add(&log_bytes, (unsigned long long)len);
+	count = (len + TWLOG_SLOT_SIZE - 1) / TWLOG_SLOT_SIZE;
+	if (count > TWLOG_MAX_SLOTS && writer_running) {
+		// Queued messages go first, stdout keeps this one in one piece
+		twlog_flush();
+	}
+	if (!writer_running || count > TWLOG_MAX_SLOTS) {
+		fwrite(text, 1, len, stdout);
+		return;
+	}
+	if (count == 0)
+		return;
+
+	// Consecutive slots keep the parts of a long message together
+	pos = __sync_fetch_and_add(&ring_head, count);
+	for (i = 0; i < count; i++, pos++) {
+		part = len > TWLOG_SLOT_SIZE ? TWLOG_SLOT_SIZE : len;
+		slot = &ring[pos & (TWLOG_SLOTS - 1)];
+		// The ring is full, wait for the writer to catch up
+		while (slot->seq != pos)
+			usleep(1000);
+		memcpy(slot->text, text, part);
+		slot->len = part;
+		__sync_synchronize();
+		slot->seq = pos + 1;
+		text += part;
+		len -= part;
+	}
+	twlog_wake_writer();
+}
+
+static void twlog_vprint(const char *fmt, va_list ap) {
+	char buf[TWLOG_SLOT_SIZE];
+	char *text = buf;
+	va_list copy;
+	int len;
+
+	va_copy(copy, ap);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	if (len >= (int)sizeof(buf)) {
+		text = (char*)malloc(len + 1);
+		if (text != NULL) {
+			len = vsnprintf(text, len + 1, fmt, copy);
+		} else {
+			text = buf;
+			len = sizeof(buf) - 1;
+		}
+	}
+	va_end(copy);
+	if (len < 0) {
+		if (text != buf)
+			free(text);
+		return;
+	}
+	twlog_append(text, len);
+	if (text != buf)
+		free(text);
+}
+
+void twlog_print(int level, const char *fmt, ...) {
+	va_list ap;
+
+	if (level > twlog_level)
+		return;
+	va_start(ap, fmt);
+	twlog_vprint(fmt, ap);
+	va_end(ap);
+}
+
+// Per-file messages are limited to TWLOG_TRACE_PER_SEC per second so that
+// enabling tracing during a large backup does not turn into a log flood
+void twlog_trace(const char *fmt, ...) {
+	struct timespec now;
+	unsigned dropped;
+	va_list ap;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((unsigned)now.tv_sec != trace_second) {
+		trace_second = now.tv_sec;
+		trace_count = 0;
+		dropped = __sync_lock_test_and_set(&trace_dropped, 0);
+		if (dropped)
+			twlog_print(TWLOG_TRACE, "T:%u trace messages suppressed\n", dropped);
+	}
+	if (__sync_add_and_fetch(&trace_count, 1) > TWLOG_TRACE_PER_SEC) {
+		__sync_fetch_and_add(&trace_dropped, 1);
+		return;
+	}
+	va_start(ap, fmt);
+	twlog_vprint(fmt, ap);
+	va_end(ap);
+}
+
+unsigned long long twlog_bytes(void) {
+	return __sync_fetch_and_add(&log_bytes, 0ULL);
+}
@@ -0,0 +1,55 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWLOG_H
+#define TWLOG_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Log levels, lower is more important
+#define TWLOG_ERROR 0
+#define TWLOG_INFO  1
+#define TWLOG_DEBUG 2
+#define TWLOG_TRACE 3                // Per-file messages, rate limited
+
+// Highest level compiled in, set TW_LOG_LEVEL in BoardConfig to strip more
+#ifndef TW_LOG_LEVEL
+#define TW_LOG_LEVEL TWLOG_TRACE
+#endif
+
+extern int twlog_level;              // Highest level written at runtime (tw_log_level)
+
+void twlog_start(void);              // Starts the background writer, until then messages are written directly
+void twlog_flush(void);              // Waits until all queued messages have been written to the log
+void twlog_print(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void twlog_trace(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void twlog_append(const char *text, size_t len); // Queues already formatted text
+unsigned long long twlog_bytes(void); // Total bytes logged since startup
+
+#define LOGDEBUG(...) do { if (TWLOG_DEBUG <= TW_LOG_LEVEL && twlog_level >= TWLOG_DEBUG) twlog_print(TWLOG_DEBUG, "D:" __VA_ARGS__); } while (0)
+#define LOGTRACE(...) do { if (TWLOG_TRACE <= TW_LOG_LEVEL && twlog_level >= TWLOG_TRACE) twlog_trace("T:" __VA_ARGS__); } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TWLOG_H
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -51,9 +52,15 @@
 	#include "openaes/inc/oaes_lib.h"
 #endif
 
+#ifdef TWRPTAR_HOST
+// The host twrpTar links against glibc, which has no bionic __popen
+#define __popen popen
+#define __pclose pclose
+#else
 extern "C" {
 	#include "libcrecovery/common.h"
 }
+#endif
 
 /* Execute a command */
 int TWFunc::Exec_Cmd(const string& cmd, string &result) {
@@ -440,6 +447,7 @@ void TWFunc::GUI_Operation_Text(string Read_Value, string Partition_Name, string
 }
 
 void TWFunc::Copy_Log(string Source, string Destination) {
+	twlog_flush();
 	PartitionManager.Mount_By_Path(Destination, false);
 	FILE *destination_log = fopen(Destination.c_str(), "a");
 	if (destination_log == NULL) {
@@ -448,9 +456,10 @@ void TWFunc::Copy_Log(string Source, string Destination) {
 		FILE *source_log = fopen(Source.c_str(), "r");
 		if (source_log != NULL) {
 			fseek(source_log, Log_Offset, SEEK_SET);
-			char buffer[4096];
-			while (fgets(buffer, sizeof(buffer), source_log))
-				fputs(buffer, destination_log); // Buffered write of log file
+			char buffer[65536];
+			size_t len;
+			while ((len = fread(buffer, 1, sizeof(buffer), source_log)) > 0)
+				fwrite(buffer, 1, len, destination_log);
 			Log_Offset = ftell(source_log);
 			fflush(source_log);
 			fclose(source_log);
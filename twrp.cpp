@@ -43,6 +43,7 @@ extern "C" {
 #include "openrecoveryscript.hpp"
 #include "variables.h"
 #include "twrpDU.hpp"
+#include "twrpThroughput.hpp"
 
 #ifdef HAVE_SELINUX
 #include "selinux/label.h"
@@ -53,6 +54,7 @@ TWPartitionManager PartitionManager;
 int Log_Offset;
 bool datamedia;
 twrpDU du;
+twrpThroughput Throughput;
 
 static void Print_Prop(const char *key, const char *name, void *cookie) {
 	printf("%s=%s\n", key, name);
@@ -70,6 +72,7 @@ int main(int argc, char **argv) {
 	setbuf(stdout, NULL);
 	freopen(TMP_LOG_FILE, "a", stderr);
 	setbuf(stderr, NULL);
+	twlog_start();
 
 	// Handle ADB sideload
 	if (argc == 3 && strcmp(argv[1], "--adbd") == 0) {
@@ -92,11 +95,14 @@ int main(int argc, char **argv) {
 
 	time_t StartupTime = time(NULL);
 	printf("Starting TWRP %s on %s", TW_VERSION_STR, ctime(&StartupTime));
+	timespec boot_start, gui_init_done, fstab_done, resources_done, boot_done;
+	clock_gettime(CLOCK_MONOTONIC, &boot_start);
 
 	// Load default values to set DataManager constants and handle ifdefs
 	DataManager::SetDefaultValues();
 	printf("Starting the UI...");
 	gui_init();
+	clock_gettime(CLOCK_MONOTONIC, &gui_init_done);
 	printf("=> Linking mtab\n");
 	symlink("/proc/mounts", "/etc/mtab");
 	if (TWFunc::Path_Exists("/etc/twrp.fstab")) {
@@ -112,9 +118,11 @@ int main(int argc, char **argv) {
 		LOGERR("Failing out of recovery due to problem with recovery.fstab.\n");
 		return -1;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &fstab_done);
 	PartitionManager.Output_Partition_Logging();
 	// Load up all the resources
 	gui_loadResources();
+	clock_gettime(CLOCK_MONOTONIC, &resources_done);
 
 #ifdef HAVE_SELINUX
 	if (TWFunc::Path_Exists("/prebuilt_file_contexts")) {
@@ -321,6 +329,12 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	clock_gettime(CLOCK_MONOTONIC, &boot_done);
+	LOGINFO("Boot time breakdown: gui init %ims, fstab and partition details %ims, resources %ims, startup tasks %ims, total %ims\n",
+		TWFunc::timespec_diff_ms(boot_start, gui_init_done), TWFunc::timespec_diff_ms(gui_init_done, fstab_done),
+		TWFunc::timespec_diff_ms(fstab_done, resources_done), TWFunc::timespec_diff_ms(resources_done, boot_done),
+		TWFunc::timespec_diff_ms(boot_start, boot_done));
+
 	// Launch the main GUI
 	gui_start();
 
@@ -0,0 +1,539 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <zlib.h>
+#include "twcommon.h"
+#include "twrpGzip.hpp"
+
+#define GZIP_CHUNK_SIZE (128 * 1024)
+#define GZIP_DICT_SIZE 32768
+#define GZIP_MAX_THREADS 8
+// Distance between chunks that start without a dictionary
+#define GZIP_RESTART_SIZE (4 * 1024 * 1024)
+#define GUNZIP_BUFFER_SIZE (64 * 1024)
+
+// Files smaller than this are deflated without looking at them
+#define GZIP_PROBE_MIN_SIZE (64 * 1024)
+#define GZIP_PROBE_SIZE (16 * 1024)
+// A sample that does not shrink below this percentage is stored
+#define GZIP_PROBE_PERCENT 95
+
+twrpGzip::twrpGzip() {
+	Deflated_In = Deflated_Out = Stored_In = Stored_Out = 0;
+	out_fd = -1;
+	level = Z_DEFAULT_COMPRESSION;
+	error = 0;
+	running = false;
+	crc = 0;
+	length = 0;
+	out_length = 0;
+	submitted = 0;
+	next_restart = 0;
+	current = NULL;
+	dict_len = 0;
+	threads = NULL;
+	thread_count = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+}
+
+twrpGzip::~twrpGzip() {
+	int i;
+
+	if (running) {
+		pthread_mutex_lock(&lock);
+		running = false;
+		pthread_cond_broadcast(&work_cond);
+		pthread_mutex_unlock(&lock);
+		for (i = 0; i < thread_count; i++)
+			pthread_join(threads[i], NULL);
+	}
+	delete [] threads;
+	while (!ordered.empty()) {
+		chunk* c = ordered.front();
+		ordered.pop_front();
+		free(c->in);
+		free(c->out);
+		delete c;
+	}
+	if (current) {
+		free(current->in);
+		free(current->out);
+		delete current;
+	}
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&lock);
+}
+
+int twrpGzip::Open(int fd, int new_level, int max_threads) {
+	// No name, no modification time, unix
+	static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	long cores;
+
+	out_fd = fd;
+	Set_Level(new_level);
+	crc = crc32(0L, Z_NULL, 0);
+	if (Write_All(header, sizeof(header)) != 0)
+		return -1;
+
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1)
+		cores = 1;
+	if (cores > GZIP_MAX_THREADS)
+		cores = GZIP_MAX_THREADS;
+	if (max_threads > 0 && cores > max_threads)
+		cores = max_threads;
+	threads = new pthread_t[cores];
+	running = true;
+	for (thread_count = 0; thread_count < cores; thread_count++) {
+		if (pthread_create(&threads[thread_count], NULL, Thread, this) != 0)
+			break;
+	}
+	if (thread_count == 0) {
+		LOGERR("twrpGzip unable to start a thread\n");
+		running = false;
+		error = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void twrpGzip::Set_Level(int new_level) {
+	if (new_level < 0 || new_level > 9)
+		new_level = Z_DEFAULT_COMPRESSION;
+	if (new_level == level)
+		return;
+	// The new level starts with a new chunk
+	if (current && current->in_len > 0)
+		Submit();
+	level = new_level;
+	if (current)
+		current->level = level;
+}
+
+twrpGzip::chunk* twrpGzip::New_Chunk() {
+	chunk* c = new chunk;
+
+	c->in = (unsigned char*) malloc(GZIP_DICT_SIZE + GZIP_CHUNK_SIZE);
+	c->out = (unsigned char*) malloc(compressBound(GZIP_CHUNK_SIZE) + 64);
+	if (c->in == NULL || c->out == NULL) {
+		LOGERR("twrpGzip unable to allocate buffers\n");
+		free(c->in);
+		free(c->out);
+		delete c;
+		return NULL;
+	}
+	if (submitted >= next_restart) {
+		// Costs one dictionary of compression, but a reader can start here
+		c->dict_len = 0;
+		c->restart = true;
+		next_restart = submitted + GZIP_RESTART_SIZE;
+	} else {
+		memcpy(c->in, dict, dict_len);
+		c->dict_len = dict_len;
+		c->restart = false;
+	}
+	c->in_len = 0;
+	c->out_len = 0;
+	c->level = level;
+	c->crc = 0;
+	c->done = false;
+	c->failed = false;
+	return c;
+}
+
+ssize_t twrpGzip::Write(const void* buffer, size_t size) {
+	const unsigned char* data = (const unsigned char*) buffer;
+	size_t done = 0;
+
+	while (done < size && error == 0) {
+		if (current == NULL && (current = New_Chunk()) == NULL) {
+			error = -1;
+			break;
+		}
+		size_t len = GZIP_CHUNK_SIZE - current->in_len;
+		if (len > size - done)
+			len = size - done;
+		memcpy(current->in + current->dict_len + current->in_len, data + done, len);
+		current->in_len += len;
+		done += len;
+		if (current->in_len == GZIP_CHUNK_SIZE)
+			Submit();
+	}
+	if (error != 0)
+		return -1;
+	return size;
+}
+
+// Hands the current chunk to the threads
+int twrpGzip::Submit() {
+	chunk* c = current;
+	size_t keep;
+
+	if (c == NULL || c->in_len == 0 || error != 0)
+		return error;
+	current = NULL;
+	submitted += c->in_len;
+
+	// The last 32K of input primes the next chunk
+	if (c->in_len >= GZIP_DICT_SIZE) {
+		memcpy(dict, c->in + c->dict_len + c->in_len - GZIP_DICT_SIZE, GZIP_DICT_SIZE);
+		dict_len = GZIP_DICT_SIZE;
+	} else {
+		keep = GZIP_DICT_SIZE - c->in_len;
+		if (keep > dict_len)
+			keep = dict_len;
+		memmove(dict, dict + dict_len - keep, keep);
+		memcpy(dict + keep, c->in + c->dict_len, c->in_len);
+		dict_len = keep + c->in_len;
+	}
+
+	// Limit the memory used by chunks that were not written yet
+	while (error == 0 && ordered.size() >= (size_t) thread_count * 2)
+		Write_Oldest();
+	pthread_mutex_lock(&lock);
+	ordered.push_back(c);
+	pending.push_back(c);
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	// Write whatever is ready without waiting
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		bool ready = !ordered.empty() && ordered.front()->done;
+		pthread_mutex_unlock(&lock);
+		if (!ready || error != 0)
+			break;
+		Write_Oldest();
+	}
+	return error;
+}
+
+int twrpGzip::Write_Oldest() {
+	chunk* c;
+
+	pthread_mutex_lock(&lock);
+	c = ordered.front();
+	while (!c->done)
+		pthread_cond_wait(&done_cond, &lock);
+	ordered.pop_front();
+	pthread_mutex_unlock(&lock);
+
+	if (c->failed) {
+		LOGERR("twrpGzip failed to deflate\n");
+		error = -1;
+	} else if (error == 0) {
+		if (c->restart) {
+			Restart_Point r;
+
+			r.In = length;
+			r.Out = out_length;
+			Restarts.push_back(r);
+		}
+		if (Write_All(c->out, c->out_len) == 0) {
+			crc = crc32_combine(crc, c->crc, c->in_len);
+			length += c->in_len;
+			if (c->level == 0) {
+				Stored_In += c->in_len;
+				Stored_Out += c->out_len;
+			} else {
+				Deflated_In += c->in_len;
+				Deflated_Out += c->out_len;
+			}
+		}
+	}
+	free(c->in);
+	free(c->out);
+	delete c;
+	return error;
+}
+
+int twrpGzip::Write_All(const void* buffer, size_t size) {
+	const char* data = (const char*) buffer;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(out_fd, data, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			LOGERR("twrpGzip write error: %s\n", strerror(errno));
+			error = -1;
+			return -1;
+		}
+		data += ret;
+		size -= ret;
+		out_length += ret;
+	}
+	return 0;
+}
+
+void* twrpGzip::Thread(void* cookie) {
+	((twrpGzip*) cookie)->Work();
+	return NULL;
+}
+
+void twrpGzip::Work() {
+	chunk* c;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (running && pending.empty())
+			pthread_cond_wait(&work_cond, &lock);
+		if (pending.empty()) {
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		c = pending.front();
+		pending.pop_front();
+		pthread_mutex_unlock(&lock);
+
+		Compress(c);
+
+		pthread_mutex_lock(&lock);
+		c->done = true;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+// Deflates one chunk as raw deflate ending on a byte boundary, so the
+// chunks can simply be written one after another
+void twrpGzip::Compress(chunk* c) {
+	z_stream strm;
+
+	c->crc = crc32(crc32(0L, Z_NULL, 0), c->in + c->dict_len, c->in_len);
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, c->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		c->failed = true;
+		return;
+	}
+	if (c->dict_len > 0 && c->level != 0)
+		deflateSetDictionary(&strm, c->in, c->dict_len);
+	strm.next_in = c->in + c->dict_len;
+	strm.avail_in = c->in_len;
+	strm.next_out = c->out;
+	strm.avail_out = compressBound(GZIP_CHUNK_SIZE) + 64;
+	if (deflate(&strm, Z_SYNC_FLUSH) != Z_OK || strm.avail_in != 0 || strm.avail_out == 0)
+		c->failed = true;
+	c->out_len = strm.total_out;
+	deflateEnd(&strm);
+}
+
+int twrpGzip::Close() {
+	// An empty final block, then CRC and length of the input
+	unsigned char trailer[10] = { 3, 0 };
+	int i;
+
+	Submit();
+	while (!ordered.empty())
+		Write_Oldest();
+
+	pthread_mutex_lock(&lock);
+	running = false;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	thread_count = 0;
+
+	for (i = 0; i < 4; i++) {
+		trailer[2 + i] = (crc >> (8 * i)) & 0xff;
+		trailer[6 + i] = (length >> (8 * i)) & 0xff;
+	}
+	if (error == 0)
+		Write_All(trailer, sizeof(trailer));
+	return error;
+}
+
+static bool Has_Incompressible_Extension(const string& path) {
+	static const char* extensions[] = {
+		"jpg", "jpeg", "png", "gif", "webp", "heic",
+		"mp3", "m4a", "aac", "ogg", "oga", "opus", "flac", "amr",
+		"mp4", "m4v", "3gp", "3g2", "mkv", "webm", "avi", "mov",
+		"apk", "obb", "zip", "jar", "gz", "tgz", "bz2", "xz", "7z", "rar", "lz4", "zst",
+		NULL
+	};
+	size_t dot = path.find_last_of("./");
+	string ext;
+	int i;
+
+	if (dot == string::npos || path[dot] != '.')
+		return false;
+	ext = path.substr(dot + 1);
+	for (i = 0; i < (int)ext.size(); i++)
+		ext[i] = tolower(ext[i]);
+	for (i = 0; extensions[i] != NULL; i++) {
+		if (ext == extensions[i])
+			return true;
+	}
+	return false;
+}
+
+static bool Has_Incompressible_Magic(const unsigned char* m, size_t len) {
+	if (len < 12)
+		return false;
+	if (memcmp(m, "PK\3\4", 4) == 0 ||                             // zip, apk, jar
+		(m[0] == 0x1f && m[1] == 0x8b) ||                          // gzip
+		(m[0] == 0xff && m[1] == 0xd8 && m[2] == 0xff) ||          // jpeg
+		memcmp(m, "\x89PNG", 4) == 0 ||
+		memcmp(m, "GIF8", 4) == 0 ||
+		(memcmp(m, "RIFF", 4) == 0 && memcmp(m + 8, "WEBP", 4) == 0) ||
+		memcmp(m + 4, "ftyp", 4) == 0 ||                           // mp4, 3gp, m4a
+		memcmp(m, "OggS", 4) == 0 ||
+		memcmp(m, "ID3", 3) == 0 ||                                // mp3
+		memcmp(m, "fLaC", 4) == 0 ||
+		memcmp(m, "\x1a\x45\xdf\xa3", 4) == 0 ||                   // mkv, webm
+		memcmp(m, "BZh", 3) == 0 ||
+		memcmp(m, "\xfd" "7zXZ", 5) == 0 ||
+		memcmp(m, "7z\xbc\xaf\x27\x1c", 6) == 0 ||
+		memcmp(m, "Rar!", 4) == 0 ||
+		memcmp(m, "\x28\xb5\x2f\xfd", 4) == 0 ||                   // zstd
+		memcmp(m, "\x04\x22\x4d\x18", 4) == 0)                     // lz4
+		return true;
+	return false;
+}
+
+bool twrpGzip::Is_Compressible(const string& path, unsigned long long size) {
+	unsigned char magic[12], *sample, *out;
+	uLongf out_len;
+	ssize_t len;
+	off64_t offset;
+	bool ret = true;
+	int fd;
+
+	if (size < GZIP_PROBE_MIN_SIZE)
+		return true;
+	if (Has_Incompressible_Extension(path))
+		return false;
+
+	fd = open(path.c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return true;
+	len = pread64(fd, magic, sizeof(magic), 0);
+	if (len > 0 && Has_Incompressible_Magic(magic, len)) {
+		close(fd);
+		return false;
+	}
+
+	// Deflate a sample from the middle of the file at the fastest level
+	sample = (unsigned char*) malloc(GZIP_PROBE_SIZE);
+	out = (unsigned char*) malloc(compressBound(GZIP_PROBE_SIZE));
+	offset = (size / 2) & ~((off64_t) 4095);
+	if (sample && out && (len = pread64(fd, sample, GZIP_PROBE_SIZE, offset)) > 0) {
+		out_len = compressBound(GZIP_PROBE_SIZE);
+		if (compress2(out, &out_len, sample, len, 1) == Z_OK &&
+			out_len * 100 >= (uLongf) len * GZIP_PROBE_PERCENT)
+			ret = false;
+	}
+	free(sample);
+	free(out);
+	close(fd);
+	return ret;
+}
+
+twrpGunzip::twrpGunzip() {
+	in_fd = -1;
+	strm = NULL;
+	in = NULL;
+	ended = false;
+}
+
+twrpGunzip::~twrpGunzip() {
+	Close();
+}
+
+int twrpGunzip::Open(int fd, unsigned long long offset) {
+	Close();
+	if (lseek64(fd, offset, SEEK_SET) < 0) {
+		LOGERR("twrpGunzip unable to seek: %s\n", strerror(errno));
+		return -1;
+	}
+	strm = new z_stream;
+	memset(strm, 0, sizeof(*strm));
+	in = (unsigned char*) malloc(GUNZIP_BUFFER_SIZE);
+	// Restart points are raw deflate without a dictionary
+	if (in == NULL || inflateInit2(strm, -15) != Z_OK) {
+		LOGERR("twrpGunzip unable to start inflating\n");
+		free(in);
+		in = NULL;
+		delete strm;
+		strm = NULL;
+		return -1;
+	}
+	in_fd = fd;
+	ended = false;
+	return 0;
+}
+
+ssize_t twrpGunzip::Read(void* buffer, size_t size) {
+	ssize_t len;
+	int ret;
+
+	if (strm == NULL)
+		return -1;
+	strm->next_out = (Bytef*) buffer;
+	strm->avail_out = size;
+	while (strm->avail_out > 0 && !ended) {
+		if (strm->avail_in == 0) {
+			len = read(in_fd, in, GUNZIP_BUFFER_SIZE);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0) {
+				LOGERR("twrpGunzip unexpected end of file\n");
+				return -1;
+			}
+			strm->next_in = in;
+			strm->avail_in = len;
+		}
+		ret = inflate(strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			ended = true;
+		else if (ret != Z_OK) {
+			LOGERR("twrpGunzip inflate error %i\n", ret);
+			return -1;
+		}
+	}
+	return size - strm->avail_out;
+}
+
+void twrpGunzip::Close() {
+	if (strm != NULL) {
+		inflateEnd(strm);
+		delete strm;
+		strm = NULL;
+	}
+	free(in);
+	in = NULL;
+	in_fd = -1;
+}
+
+bool twrpGunzip::Is_Open() const {
+	return strm != NULL;
+}
@@ -0,0 +1,119 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPGZIP_HPP
+#define TWRPGZIP_HPP
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+// Writes a single gzip stream like pigz does: the input is cut into chunks
+// that are deflated on several threads, each primed with the end of the
+// previous chunk, and written in order.  The level can change between
+// chunks, level 0 writes stored blocks, so data that does not compress
+// costs no CPU time and the result is still one gzip member that any
+// gunzip or pigz can read.  Every few MB a chunk starts without a
+// dictionary, twrpGunzip can start inflating there.
+class twrpGzip {
+public:
+	twrpGzip();
+	~twrpGzip();
+	int Open(int fd, int level, int max_threads = 0); // Writes the gzip header to fd, returns 0 on success, 0 threads is one per core
+	ssize_t Write(const void* buffer, size_t size);
+	void Set_Level(int level);                     // Level for data written from now on
+	int Close();                                   // Writes what is left and the trailer, fd stays open
+	static bool Is_Compressible(const string& path, unsigned long long size); // Guesses by extension, magic and a sample if a file is worth deflating
+
+	unsigned long long Deflated_In;                // Statistics of the stream
+	unsigned long long Deflated_Out;
+	unsigned long long Stored_In;
+	unsigned long long Stored_Out;
+
+	struct Restart_Point {
+		unsigned long long In;                     // Offset in the uncompressed data
+		unsigned long long Out;                    // Offset in the gzip file where inflating can start
+	};
+	vector<Restart_Point> Restarts;                // Filled while writing, one every few MB
+
+private:
+	struct chunk {
+		unsigned char* in;
+		size_t in_len;
+		size_t dict_len;                           // The first dict_len bytes of in are the dictionary
+		unsigned char* out;
+		size_t out_len;
+		int level;
+		unsigned long crc;
+		bool restart;                              // Has no dictionary, inflating can start here
+		bool done;
+		bool failed;
+	};
+
+	static void* Thread(void* cookie);
+	void Work();
+	void Compress(chunk* c);
+	chunk* New_Chunk();
+	int Submit();
+	int Write_Oldest();
+	int Write_All(const void* buffer, size_t size);
+
+	int out_fd;
+	int level;
+	int error;
+	bool running;
+	unsigned long crc;
+	unsigned long long length;
+	unsigned long long out_length;                 // Bytes written to out_fd
+	unsigned long long submitted;                  // Input handed to the threads
+	unsigned long long next_restart;
+
+	chunk* current;                                // Chunk being filled by Write
+	unsigned char dict[32768];                     // Last input bytes, primes the next chunk
+	size_t dict_len;
+	deque<chunk*> pending;                         // Chunks waiting for a thread
+	deque<chunk*> ordered;                         // All chunks in stream order, written once done
+	pthread_t* threads;
+	int thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+};
+
+// Reads a twrpGzip stream starting at one of its restart points
+class twrpGunzip {
+public:
+	twrpGunzip();
+	~twrpGunzip();
+	int Open(int fd, unsigned long long offset);   // offset is the Out of a restart point, returns 0 on success
+	ssize_t Read(void* buffer, size_t size);       // Fills buffer unless the stream ends, returns -1 on errors
+	void Close();                                  // fd stays open
+	bool Is_Open() const;
+
+private:
+	int in_fd;
+	struct z_stream_s* strm;
+	unsigned char* in;
+	bool ended;
+};
+
+#endif // TWRPGZIP_HPP
@@ -0,0 +1,411 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "twcommon.h"
+#include "twrpSparse.hpp"
+#include "ext4_used.h"
+
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12,119)
+#endif
+#ifndef BLKZEROOUT
+#define BLKZEROOUT _IO(0x12,127)
+#endif
+
+#define SPARSE_BUFFER_BLOCKS    256             // 1MB reads and writes
+
+static int readFully(int fd, void* buf, size_t len, off64_t offset) {
+	char* p = (char*) buf;
+
+	while (len > 0) {
+		ssize_t ret = pread64(fd, p, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret == 0)
+			errno = ENODATA;                    // Short file
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+static int writeFully(int fd, const void* buf, size_t len) {
+	const char* p = (const char*) buf;
+
+	while (len > 0) {
+		ssize_t ret = write(fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+twrpSparse::twrpSparse() {
+	Use_Fs_Bitmap = true;
+	Raw_Bytes = Fill_Bytes = Dont_Care_Bytes = 0;
+	pending_type = 0;
+	pending_blocks = pending_value = chunks = 0;
+}
+
+bool twrpSparse::Is_Sparse(const string& file) {
+	uint32_t magic;
+	int fd = open(file.c_str(), O_RDONLY);
+	bool ret;
+
+	if (fd < 0)
+		return false;
+	ret = (readFully(fd, &magic, sizeof(magic), 0) == 0 && magic == SPARSE_HEADER_MAGIC);
+	close(fd);
+	return ret;
+}
+
+void twrpSparse::Mark_Used(void* cookie, unsigned long long fs_block, unsigned long long count, unsigned fs_block_size) {
+	vector<bool>& used = ((twrpSparse*) cookie)->used;
+	unsigned long long start = fs_block * fs_block_size / SPARSE_BLOCK_SIZE;
+	unsigned long long end = ((fs_block + count) * fs_block_size + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+
+	for (; start < end && start < used.size(); start++)
+		used[start] = true;
+}
+
+// Fills used from the block bitmaps of an ext4 filesystem on fd. Returns
+// false and leaves used empty if fd does not hold a cleanly unmounted ext4
+// filesystem whose bitmaps can be trusted.
+bool twrpSparse::Load_Ext4_Bitmap(int fd, unsigned long long size) {
+	int ret;
+
+	used.assign(size / SPARSE_BLOCK_SIZE, false);
+	ret = ext4_used_blocks(fd, size, SPARSE_BLOCK_SIZE, Mark_Used, this);
+	if (ret == 0)
+		return true;
+	used.clear();
+	if (ret == EXT4_USED_UNCLEAN)
+		LOGINFO("ext4 filesystem was not cleanly unmounted, imaging every block\n");
+	else if (ret == EXT4_USED_CORRUPT)
+		LOGINFO("ext4 filesystem has an invalid group descriptor, imaging every block\n");
+	return false;
+}
+
+int twrpSparse::Write_Chunk(int fd, uint16_t type, uint32_t blocks, const void* data, size_t data_len) {
+	chunk_header chunk;
+
+	chunk.chunk_type = type;
+	chunk.reserved1 = 0;
+	chunk.chunk_sz = blocks;
+	chunk.total_sz = sizeof(chunk) + data_len;
+	if (writeFully(fd, &chunk, sizeof(chunk)) != 0 || (data_len && writeFully(fd, data, data_len) != 0))
+		return -1;
+	chunks++;
+	return 0;
+}
+
+int twrpSparse::Flush_Pending(int fd) {
+	int ret = 0;
+
+	if (pending_blocks == 0)
+		return 0;
+	if (pending_type == CHUNK_TYPE_FILL) {
+		ret = Write_Chunk(fd, CHUNK_TYPE_FILL, pending_blocks, &pending_value, sizeof(pending_value));
+		Fill_Bytes += (unsigned long long) pending_blocks * SPARSE_BLOCK_SIZE;
+	} else {
+		ret = Write_Chunk(fd, CHUNK_TYPE_DONT_CARE, pending_blocks, NULL, 0);
+		Dont_Care_Bytes += (unsigned long long) pending_blocks * SPARSE_BLOCK_SIZE;
+	}
+	pending_blocks = 0;
+	return ret;
+}
+
+int twrpSparse::Backup(const string& device, const string& file, unsigned long long size) {
+	sparse_header header;
+	unsigned long long total_blocks, block, i;
+	unsigned char* buf;
+	int in_fd, out_fd, ret = -1;
+
+	Raw_Bytes = Fill_Bytes = Dont_Care_Bytes = 0;
+	pending_blocks = chunks = 0;
+	if (size % SPARSE_BLOCK_SIZE != 0 || size / SPARSE_BLOCK_SIZE > 0xFFFFFFFFULL) {
+		LOGERR("Size of '%s' can not be stored in a sparse image\n", device.c_str());
+		return -1;
+	}
+	total_blocks = size / SPARSE_BLOCK_SIZE;
+
+	in_fd = open(device.c_str(), O_RDONLY);
+	if (in_fd < 0) {
+		LOGERR("Unable to open '%s' for reading: %s\n", device.c_str(), strerror(errno));
+		return -1;
+	}
+	out_fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		LOGERR("Unable to create '%s': %s\n", file.c_str(), strerror(errno));
+		close(in_fd);
+		return -1;
+	}
+	buf = (unsigned char*) malloc(SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE);
+	if (buf == NULL) {
+		LOGERR("Unable to allocate sparse image buffer\n");
+		goto exit;
+	}
+
+	if (!Use_Fs_Bitmap || !Load_Ext4_Bitmap(in_fd, size))
+		used.clear();
+	else
+		LOGINFO("Using the ext4 block bitmap of '%s'\n", device.c_str());
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SPARSE_HEADER_MAGIC;
+	header.major_version = SPARSE_MAJOR_VERSION;
+	header.file_hdr_sz = sizeof(sparse_header);
+	header.chunk_hdr_sz = sizeof(chunk_header);
+	header.blk_sz = SPARSE_BLOCK_SIZE;
+	header.total_blks = total_blocks;
+	if (writeFully(out_fd, &header, sizeof(header)) != 0)
+		goto write_error;
+
+	for (block = 0; block < total_blocks; block += SPARSE_BUFFER_BLOCKS) {
+		unsigned long long count = total_blocks - block < SPARSE_BUFFER_BLOCKS ? total_blocks - block : SPARSE_BUFFER_BLOCKS;
+		unsigned long long raw_start = 0, raw_count = 0;
+		bool any_used = used.empty();
+
+		for (i = 0; i < count && !any_used; i++)
+			any_used = used[block + i];
+		if (any_used && readFully(in_fd, buf, count * SPARSE_BLOCK_SIZE, (off64_t) block * SPARSE_BLOCK_SIZE) != 0) {
+			LOGERR("Unable to read '%s': %s\n", device.c_str(), strerror(errno));
+			goto exit;
+		}
+
+		for (i = 0; i < count; i++) {
+			unsigned char* data = buf + i * SPARSE_BLOCK_SIZE;
+			uint16_t type;
+			uint32_t value = 0;
+
+			if (!used.empty() && !used[block + i]) {
+				type = CHUNK_TYPE_DONT_CARE;
+			} else if (memcmp(data, data + 4, SPARSE_BLOCK_SIZE - 4) == 0) {
+				// Every 32 bit word of the block is the same
+				type = CHUNK_TYPE_FILL;
+				memcpy(&value, data, sizeof(value));
+			} else {
+				type = CHUNK_TYPE_RAW;
+			}
+
+			if (type == CHUNK_TYPE_RAW) {
+				if (Flush_Pending(out_fd) != 0)
+					goto write_error;
+				if (raw_count == 0)
+					raw_start = i;
+				raw_count++;
+				continue;
+			}
+			// Raw chunks end with the buffer, so they can be written straight from it
+			if (raw_count) {
+				if (Write_Chunk(out_fd, CHUNK_TYPE_RAW, raw_count, buf + raw_start * SPARSE_BLOCK_SIZE, raw_count * SPARSE_BLOCK_SIZE) != 0)
+					goto write_error;
+				Raw_Bytes += raw_count * SPARSE_BLOCK_SIZE;
+				raw_count = 0;
+			}
+			if (pending_blocks && (pending_type != type || (type == CHUNK_TYPE_FILL && pending_value != value))) {
+				if (Flush_Pending(out_fd) != 0)
+					goto write_error;
+			}
+			pending_type = type;
+			pending_value = value;
+			pending_blocks++;
+		}
+		if (raw_count) {
+			if (Write_Chunk(out_fd, CHUNK_TYPE_RAW, raw_count, buf + raw_start * SPARSE_BLOCK_SIZE, raw_count * SPARSE_BLOCK_SIZE) != 0)
+				goto write_error;
+			Raw_Bytes += raw_count * SPARSE_BLOCK_SIZE;
+		}
+	}
+	if (Flush_Pending(out_fd) != 0)
+		goto write_error;
+
+	header.total_chunks = chunks;
+	if (pwrite64(out_fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) || fsync(out_fd) != 0)
+		goto write_error;
+	LOGINFO("Sparse image of '%s': %llu MB data, %llu MB filled, %llu MB unused in %u chunks\n", device.c_str(),
+		Raw_Bytes / 1048576, Fill_Bytes / 1048576, Dont_Care_Bytes / 1048576, chunks);
+	ret = 0;
+	goto exit;
+
+write_error:
+	LOGERR("Unable to write '%s': %s\n", file.c_str(), strerror(errno));
+exit:
+	free(buf);
+	close(in_fd);
+	close(out_fd);
+	used.clear();
+	return ret;
+}
+
+// Writes len bytes of value at offset. Zeros are left to the device when
+// it supports BLKZEROOUT.
+int twrpSparse::Fill_Range(int fd, unsigned long long offset, unsigned long long len, uint32_t value) {
+	if (value == 0) {
+		uint64_t range[2] = { offset, len };
+		if (ioctl(fd, BLKZEROOUT, &range) == 0)
+			return 0;
+	}
+
+	vector<uint32_t> fill(len < SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE ? len / sizeof(uint32_t) : SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE / sizeof(uint32_t), value);
+	if (lseek64(fd, offset, SEEK_SET) < 0)
+		return -1;
+	while (len > 0) {
+		size_t chunk = len < fill.size() * sizeof(uint32_t) ? len : fill.size() * sizeof(uint32_t);
+		if (writeFully(fd, &fill[0], chunk) != 0)
+			return -1;
+		len -= chunk;
+	}
+	return 0;
+}
+
+int twrpSparse::Restore(const string& file, const string& device, unsigned long long device_size) {
+	sparse_header header;
+	chunk_header chunk;
+	unsigned long long offset = 0, pos, len;
+	unsigned char* buf = NULL;
+	struct stat st;
+	uint32_t i, value;
+	int in_fd, out_fd = -1, ret = -1;
+
+	Raw_Bytes = Fill_Bytes = Dont_Care_Bytes = 0;
+	in_fd = open(file.c_str(), O_RDONLY);
+	if (in_fd < 0) {
+		LOGERR("Unable to open '%s': %s\n", file.c_str(), strerror(errno));
+		return -1;
+	}
+	if (readFully(in_fd, &header, sizeof(header), 0) != 0 || header.magic != SPARSE_HEADER_MAGIC ||
+		header.major_version != SPARSE_MAJOR_VERSION || header.file_hdr_sz < sizeof(sparse_header) ||
+		header.chunk_hdr_sz < sizeof(chunk_header) || header.blk_sz == 0 || header.blk_sz % 4 != 0) {
+		LOGERR("'%s' is not a valid sparse image\n", file.c_str());
+		goto exit;
+	}
+	if ((unsigned long long) header.total_blks * header.blk_sz > device_size) {
+		LOGERR("Size (%lluMB) of backup '%s' is larger than target device '%s' (%lluMB)\n",
+			(unsigned long long) header.total_blks * header.blk_sz / 1048576, file.c_str(), device.c_str(), device_size / 1048576);
+		goto exit;
+	}
+	out_fd = open(device.c_str(), O_WRONLY);
+	if (out_fd < 0) {
+		LOGERR("Unable to open '%s' for writing: %s\n", device.c_str(), strerror(errno));
+		goto exit;
+	}
+	buf = (unsigned char*) malloc(SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE);
+	if (buf == NULL) {
+		LOGERR("Unable to allocate sparse image buffer\n");
+		goto exit;
+	}
+
+	pos = header.file_hdr_sz;
+	for (i = 0; i < header.total_chunks; i++) {
+		if (readFully(in_fd, &chunk, sizeof(chunk), pos) != 0)
+			goto read_error;
+		pos += header.chunk_hdr_sz;
+		len = (unsigned long long) chunk.chunk_sz * header.blk_sz;
+		if (offset + len > (unsigned long long) header.total_blks * header.blk_sz) {
+			LOGERR("Chunk %u of '%s' is past the end of the image\n", i, file.c_str());
+			goto exit;
+		}
+
+		switch (chunk.chunk_type) {
+		case CHUNK_TYPE_RAW:
+			if (chunk.total_sz != header.chunk_hdr_sz + len || lseek64(out_fd, offset, SEEK_SET) < 0)
+				goto format_error;
+			while (len > 0) {
+				size_t count = len < SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE ? len : SPARSE_BUFFER_BLOCKS * SPARSE_BLOCK_SIZE;
+				if (readFully(in_fd, buf, count, pos) != 0)
+					goto read_error;
+				if (writeFully(out_fd, buf, count) != 0)
+					goto write_error;
+				pos += count;
+				len -= count;
+				Raw_Bytes += count;
+			}
+			break;
+		case CHUNK_TYPE_FILL:
+			if (chunk.total_sz != header.chunk_hdr_sz + sizeof(value))
+				goto format_error;
+			if (readFully(in_fd, &value, sizeof(value), pos) != 0)
+				goto read_error;
+			pos += sizeof(value);
+			if (Fill_Range(out_fd, offset, len, value) != 0)
+				goto write_error;
+			Fill_Bytes += len;
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			if (chunk.total_sz != header.chunk_hdr_sz)
+				goto format_error;
+			// The contents do not matter, let the flash know it is free
+			if (len) {
+				uint64_t range[2] = { offset, len };
+				ioctl(out_fd, BLKDISCARD, &range);
+			}
+			Dont_Care_Bytes += len;
+			break;
+		case CHUNK_TYPE_CRC32:
+			if (chunk.total_sz != header.chunk_hdr_sz + sizeof(uint32_t))
+				goto format_error;
+			pos += sizeof(uint32_t);
+			break;
+		default:
+			goto format_error;
+		}
+		offset += (unsigned long long) chunk.chunk_sz * header.blk_sz;
+	}
+
+	// Image files restored by tests need to end up with the full size
+	if (fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode) && (unsigned long long) st.st_size < offset)
+		ftruncate64(out_fd, offset);
+	if (fsync(out_fd) != 0)
+		goto write_error;
+	LOGINFO("Restored '%s': %llu MB data, %llu MB filled, %llu MB unused\n", device.c_str(),
+		Raw_Bytes / 1048576, Fill_Bytes / 1048576, Dont_Care_Bytes / 1048576);
+	ret = 0;
+	goto exit;
+
+format_error:
+	LOGERR("Chunk %u of '%s' is invalid\n", i, file.c_str());
+	goto exit;
+read_error:
+	LOGERR("Unable to read '%s': %s\n", file.c_str(), strerror(errno));
+	goto exit;
+write_error:
+	LOGERR("Unable to write '%s': %s\n", device.c_str(), strerror(errno));
+exit:
+	free(buf);
+	close(in_fd);
+	if (out_fd >= 0)
+		close(out_fd);
+	return ret;
+}
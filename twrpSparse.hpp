@@ -0,0 +1,88 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPSPARSE_HPP
+#define TWRPSPARSE_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Image backups in the Android sparse format used by fastboot and simg2img.
+// Blocks that only repeat one 32 bit value are stored as fill chunks and
+// blocks an ext4 filesystem does not use as don't care chunks, so only the
+// used data of a partition ends up in the backup. Restoring zeroes fill
+// chunks of zeros with BLKZEROOUT and discards the don't care ranges.
+
+#define SPARSE_HEADER_MAGIC     0xed26ff3a
+#define SPARSE_MAJOR_VERSION    1
+#define SPARSE_BLOCK_SIZE       4096
+
+#define CHUNK_TYPE_RAW          0xCAC1
+#define CHUNK_TYPE_FILL         0xCAC2
+#define CHUNK_TYPE_DONT_CARE    0xCAC3
+#define CHUNK_TYPE_CRC32        0xCAC4
+
+struct sparse_header {
+	uint32_t magic;
+	uint16_t major_version;
+	uint16_t minor_version;
+	uint16_t file_hdr_sz;
+	uint16_t chunk_hdr_sz;
+	uint32_t blk_sz;                              // Bytes per block, a multiple of 4
+	uint32_t total_blks;                          // Blocks in the unsparsed image
+	uint32_t total_chunks;
+	uint32_t image_checksum;
+};
+
+struct chunk_header {
+	uint16_t chunk_type;
+	uint16_t reserved1;
+	uint32_t chunk_sz;                            // In blocks of the output image
+	uint32_t total_sz;                            // In bytes of this chunk including the header
+};
+
+class twrpSparse {
+public:
+	twrpSparse();
+	static bool Is_Sparse(const string& file);   // Checks the magic of file
+	int Backup(const string& device, const string& file, unsigned long long size); // Returns 0 on success
+	int Restore(const string& file, const string& device, unsigned long long device_size); // Returns 0 on success
+
+	bool Use_Fs_Bitmap;                           // Store blocks a clean ext4 filesystem does not use as don't care
+	unsigned long long Raw_Bytes;                 // Statistics of the last backup or restore
+	unsigned long long Fill_Bytes;
+	unsigned long long Dont_Care_Bytes;
+
+private:
+	bool Load_Ext4_Bitmap(int fd, unsigned long long size);
+	static void Mark_Used(void* cookie, unsigned long long fs_block, unsigned long long count, unsigned fs_block_size); // Callback of ext4_used_blocks
+	int Write_Chunk(int fd, uint16_t type, uint32_t blocks, const void* data, size_t data_len);
+	int Flush_Pending(int fd);
+	int Fill_Range(int fd, unsigned long long offset, unsigned long long len, uint32_t value);
+
+	vector<bool> used;                            // Per sparse block, empty if every block is used
+	uint16_t pending_type;                        // Fill or don't care run not written yet
+	uint32_t pending_blocks;
+	uint32_t pending_value;
+	uint32_t chunks;
+};
+
+#endif // TWRPSPARSE_HPP
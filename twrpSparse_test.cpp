@@ -0,0 +1,281 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks ext4 used block imaging on loopback images: builds an ext4 image
+// from a directory of test files, images it and restores it onto a file
+// filled with 0xff. Every block that was not stored as don't care has to
+// come back exactly and the restored file system has to pass e2fsck and
+// hold the same files when loop mounted.
+//
+// usage: twrpsparse_test [MB] [work dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+#include "twrpSparse.hpp"
+
+#define BLOCK SPARSE_BLOCK_SIZE
+
+static int failures = 0;
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void fail(const char* what, const string& name) {
+	printf("FAIL: %s %s\n", what, name.c_str());
+	++failures;
+}
+
+static bool writeFile(const string& path, const vector<unsigned char>& data) {
+	FILE* fp = fopen(path.c_str(), "w");
+
+	if (fp == NULL)
+		return false;
+	bool ret = data.empty() || fwrite(&data[0], 1, data.size(), fp) == data.size();
+	fclose(fp);
+	return ret;
+}
+
+static bool readFile(const string& path, vector<unsigned char>& data) {
+	FILE* fp = fopen(path.c_str(), "r");
+	struct stat st;
+
+	if (fp == NULL || fstat(fileno(fp), &st) != 0) {
+		if (fp)
+			fclose(fp);
+		return false;
+	}
+	data.resize(st.st_size);
+	bool ret = data.empty() || fread(&data[0], 1, data.size(), fp) == data.size();
+	fclose(fp);
+	return ret;
+}
+
+// Random data, runs of zeros and of a fill pattern and many small files
+static vector<string> writeTestFiles(const string& dir) {
+	vector<string> names;
+	vector<unsigned char> data;
+	char name[64];
+	unsigned i;
+
+	mkdir(dir.c_str(), 0755);
+	mkdir((dir + "/small").c_str(), 0755);
+	data.resize(4 * 1024 * 1024);
+	for (i = 0; i < data.size(); i++)
+		data[i] = rand() >> 7;
+	writeFile(dir + "/random", data);
+	names.push_back("random");
+	data.assign(2 * 1024 * 1024, 0);
+	writeFile(dir + "/zeros", data);
+	names.push_back("zeros");
+	data.assign(1024 * 1024, 0x5a);
+	writeFile(dir + "/pattern", data);
+	names.push_back("pattern");
+	for (i = 0; i < 300; i++) {
+		snprintf(name, sizeof(name), "small/file%u", i);
+		data.resize(i * 37 % 9000);
+		for (size_t k = 0; k < data.size(); k++)
+			data[k] = (unsigned char) (i + k);
+		writeFile(dir + "/" + name, data);
+		names.push_back(name);
+	}
+	return names;
+}
+
+static bool makeImage(const string& image, const string& dir, unsigned mb) {
+	char cmd[1024];
+
+	unlink(image.c_str());
+	snprintf(cmd, sizeof(cmd), "make_ext4fs -l %uM '%s' '%s' >/dev/null 2>&1", mb, image.c_str(), dir.c_str());
+	if (system(cmd) == 0)
+		return true;
+	snprintf(cmd, sizeof(cmd), "mke2fs -q -F -t ext4 -b 4096 -d '%s' '%s' %uM >/dev/null 2>&1", dir.c_str(), image.c_str(), mb);
+	return system(cmd) == 0;
+}
+
+static bool fillFile(const string& path, size_t size, unsigned char value) {
+	vector<unsigned char> data(size, value);
+	return writeFile(path, data);
+}
+
+// Returns one flag per block, set for blocks stored as don't care
+static vector<bool> dontCareBlocks(const string& sparse_file) {
+	vector<unsigned char> data;
+	vector<bool> blocks;
+	size_t pos;
+	unsigned block = 0;
+
+	if (!readFile(sparse_file, data) || data.size() < sizeof(sparse_header))
+		return blocks;
+	sparse_header* header = (sparse_header*) &data[0];
+	blocks.assign(header->total_blks, false);
+	pos = header->file_hdr_sz;
+	for (unsigned i = 0; i < header->total_chunks && pos + sizeof(chunk_header) <= data.size(); i++) {
+		chunk_header* chunk = (chunk_header*) &data[pos];
+		if (chunk->chunk_type == CHUNK_TYPE_DONT_CARE) {
+			for (unsigned b = 0; b < chunk->chunk_sz && block + b < blocks.size(); b++)
+				blocks[block + b] = true;
+		}
+		if (chunk->chunk_type != CHUNK_TYPE_CRC32)
+			block += chunk->chunk_sz;
+		pos += chunk->total_sz;
+	}
+	return blocks;
+}
+
+static void checkMounted(const string& image, const string& mnt, const string& src, const vector<string>& names) {
+	char cmd[1024];
+	vector<unsigned char> a, b;
+	unsigned i;
+
+	mkdir(mnt.c_str(), 0755);
+	snprintf(cmd, sizeof(cmd), "mount -o loop,ro '%s' '%s' >/dev/null 2>&1", image.c_str(), mnt.c_str());
+	if (system(cmd) != 0) {
+		printf("SKIP: unable to loop mount %s\n", image.c_str());
+		return;
+	}
+	for (i = 0; i < names.size(); i++) {
+		if (!readFile(src + "/" + names[i], a) || !readFile(mnt + "/" + names[i], b) || a != b) {
+			fail("restored file differs:", names[i]);
+			break;
+		}
+	}
+	if (i == names.size())
+		printf("loop mounted image holds all %u files\n", (unsigned) names.size());
+	umount(mnt.c_str());
+}
+
+static void checkFsck(const string& image) {
+	char cmd[1024];
+
+	snprintf(cmd, sizeof(cmd), "e2fsck -fn '%s' >/dev/null 2>&1", image.c_str());
+	int ret = system(cmd);
+	if (ret == -1 || WEXITSTATUS(ret) == 127 || WEXITSTATUS(ret) == 8)
+		printf("SKIP: e2fsck not available\n");
+	else if (ret != 0)
+		fail("e2fsck reports errors on", image);
+	else
+		printf("e2fsck found no errors\n");
+}
+
+int main(int argc, char** argv) {
+	unsigned mb = argc > 1 ? atoi(argv[1]) : 64;
+	string work = argc > 2 ? argv[2] : "/tmp/twrpsparse_test";
+	string src = work + "/src", image = work + "/ext4.img", sparse_file = work + "/ext4.win";
+	string restored = work + "/restored.img", mnt = work + "/mnt";
+	unsigned long long size = (unsigned long long) mb * 1024 * 1024;
+	vector<unsigned char> original, copy;
+	vector<string> names;
+	double start;
+	size_t b;
+
+	mkdir(work.c_str(), 0755);
+	srand(1);
+	names = writeTestFiles(src);
+	if (!makeImage(image, src, mb)) {
+		printf("FAIL: unable to create an ext4 image, make_ext4fs or mke2fs is needed\n");
+		return 1;
+	}
+	readFile(image, original);
+	printf("%uMB ext4 image with %u files\n", mb, (unsigned) names.size());
+
+	// Without the bitmap every block has to come back
+	{
+		twrpSparse sparse;
+		struct stat st;
+		sparse.Use_Fs_Bitmap = false;
+		start = now_ms();
+		if (sparse.Backup(image, sparse_file, size) != 0)
+			fail("backup without bitmap of", image);
+		stat(sparse_file.c_str(), &st);
+		printf("%-16s %8.1f ms %8llu KB\n", "backup (zeros)", now_ms() - start, (unsigned long long) st.st_size / 1024);
+		fillFile(restored, size, 0xff);
+		if (sparse.Restore(sparse_file, restored, size) != 0 || !readFile(restored, copy) || copy != original)
+			fail("restore without bitmap differs from", image);
+	}
+
+	// With the bitmap only don't care blocks may differ
+	{
+		twrpSparse sparse;
+		struct stat st;
+		start = now_ms();
+		if (sparse.Backup(image, sparse_file, size) != 0)
+			fail("backup of", image);
+		stat(sparse_file.c_str(), &st);
+		printf("%-16s %8.1f ms %8llu KB\n", "backup (bitmap)", now_ms() - start, (unsigned long long) st.st_size / 1024);
+		if (sparse.Dont_Care_Bytes == 0)
+			fail("no free blocks were skipped in", image);
+		if ((unsigned long long) st.st_size >= size / 2)
+			fail("sparse image is not smaller than", image);
+
+		fillFile(restored, size, 0xff);
+		start = now_ms();
+		if (sparse.Restore(sparse_file, restored, size) != 0)
+			fail("restore of", sparse_file);
+		printf("%-16s %8.1f ms\n", "restore", now_ms() - start);
+
+		vector<bool> dont_care = dontCareBlocks(sparse_file);
+		readFile(restored, copy);
+		if (dont_care.size() != size / BLOCK || copy.size() != original.size()) {
+			fail("wrong size after restoring", sparse_file);
+		} else {
+			unsigned checked = 0;
+			for (b = 0; b < dont_care.size(); b++) {
+				if (dont_care[b])
+					continue;
+				checked++;
+				if (memcmp(&original[b * BLOCK], &copy[b * BLOCK], BLOCK) != 0) {
+					char block[32];
+					snprintf(block, sizeof(block), "%u", (unsigned) b);
+					fail("restored image differs in block", block);
+					break;
+				}
+			}
+			printf("%u of %u blocks stored and restored exactly\n", checked, (unsigned) dont_care.size());
+		}
+		checkFsck(restored);
+		checkMounted(restored, mnt, src, names);
+	}
+
+	// A target that is too small and a truncated image have to be refused
+	{
+		twrpSparse sparse;
+		if (sparse.Restore(sparse_file, restored, size - BLOCK) == 0)
+			fail("restored onto a too small target:", restored);
+		truncate(sparse_file.c_str(), 4096 + 100);
+		if (sparse.Restore(sparse_file, restored, size) == 0)
+			fail("restored a truncated image:", sparse_file);
+	}
+
+	unlink(image.c_str());
+	unlink(sparse_file.c_str());
+	unlink(restored.c_str());
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
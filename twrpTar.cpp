@@ -33,30 +33,94 @@ extern "C" {
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <pthread.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <sys/mman.h>
+#include <zlib.h>
 #include "twrpTar.hpp"
 #include "twcommon.h"
 #include "variables.h"
 #include "twrp-functions.hpp"
+#ifdef HAVE_SELINUX
+#include "selinux/selinux.h"
+#endif
 #ifndef BUILD_TWRPTAR_MAIN
 #include "data.hpp"
 #include "infomanager.hpp"
+#include "twrpThroughput.hpp"
 #endif //ndef BUILD_TWRPTAR_MAIN
 
 using namespace std;
 
+#define DEDUP_MIN_SIZE       4096        // Smaller files are not worth a lookup
+#define DEDUP_SAMPLE_SIZE    4096        // Bytes hashed at each end of a candidate
+#define DEDUP_STATS_MARKER   ~0ULL       // Precedes the dedup counts on the progress pipe
+
+// Compressed archives are written through the twrpGzip of their fd
+static map<int, twrpGzip*> gzip_fds;
+static map<int, twrpGunzip*> gunzip_fds;
+static pthread_mutex_t gzip_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t gzip_fds_atfork_once = PTHREAD_ONCE_INIT;
+
+// Backups of several partitions fork at the same time, the child must not
+// inherit gzip_fds_lock held by a sibling thread
+static void gzip_fds_atfork_prepare(void) {
+	pthread_mutex_lock(&gzip_fds_lock);
+}
+
+static void gzip_fds_atfork_release(void) {
+	pthread_mutex_unlock(&gzip_fds_lock);
+}
+
+static void gzip_fds_atfork_init(void) {
+	pthread_atfork(gzip_fds_atfork_prepare, gzip_fds_atfork_release, gzip_fds_atfork_release);
+}
+
+static int readFully(int fd, void* buf, size_t len, off64_t offset) {
+	char* p = (char*) buf;
+
+	while (len > 0) {
+		ssize_t ret = pread64(fd, p, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;                          // Error or the file shrank
+		p += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
 twrpTar::twrpTar(void) {
+	pthread_once(&gzip_fds_atfork_once, gzip_fds_atfork_init);
 	use_encryption = 0;
 	userdata_encryption = 0;
 	use_compression = 0;
+	compression_level = 6;
+	adaptive_compression = 1;
 	split_archives = 0;
+	max_archive_size = MAX_ARCHIVE_SIZE;
+	max_threads = 0;
+	dedup = 0;
 	has_data_media = 0;
 	pigz_pid = 0;
 	oaes_pid = 0;
 	Total_Backup_Size = 0;
 	include_root_dir = true;
+	gzip = NULL;
+	gz_deflated_in = 0;
+	gz_deflated_out = 0;
+	gz_stored_in = 0;
+	gz_stored_files = 0;
+	dedup_files = 0;
+	dedup_bytes = 0;
+	gunzip = NULL;
+	extract_offsets = NULL;
+	extract_paths = NULL;
+	extract_count = 0;
 }
 
 twrpTar::~twrpTar(void) {
@@ -123,6 +187,8 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 			core_count = sysconf(_SC_NPROCESSORS_CONF);
 			if (core_count > 8)
 				core_count = 8;
+			if (max_threads > 0 && core_count > (unsigned long long)max_threads)
+				core_count = max_threads;
 			LOGINFO("   Core Count      : %llu\n", core_count);
 			Archive_Current_Size = 0;
 
@@ -234,7 +300,12 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				reg.thread_id = 0;
 				reg.use_encryption = 0;
 				reg.use_compression = use_compression;
+				reg.compression_level = compression_level;
+				reg.adaptive_compression = adaptive_compression;
+				reg.max_threads = max_threads;
+				reg.dedup = dedup;
 				reg.split_archives = 1;
+				reg.max_archive_size = max_archive_size;
 				reg.progress_pipe_fd = progress_pipe_fd;
 				LOGINFO("Creating unencrypted backup...\n");
 				if (createList((void*)&reg) != 0) {
@@ -273,7 +344,12 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				enc[i].use_encryption = use_encryption;
 				enc[i].setpassword(password);
 				enc[i].use_compression = use_compression;
+				enc[i].compression_level = compression_level;
+				enc[i].adaptive_compression = adaptive_compression;
+				enc[i].max_threads = max_threads;
+				enc[i].dedup = dedup;
 				enc[i].split_archives = 1;
+				enc[i].max_archive_size = max_archive_size;
 				enc[i].progress_pipe_fd = progress_pipe_fd;
 				LOGINFO("Start encryption thread %i\n", i);
 				ret = pthread_create(&enc_thread[i], &tattr, createList, (void*)&enc[i]);
@@ -300,7 +376,7 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 						_exit(-1);
 					} else {
 						LOGINFO("Joined thread %i.\n", i);
-						ret = (int)thread_return;
+						ret = (int)(intptr_t)thread_return;
 						if (ret != 0) {
 							thread_error = 1;
 							LOGERR("Thread %i returned an error %i.\n", i, ret);
@@ -317,6 +393,16 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				close(progress_pipe[1]);
 				_exit(-1);
 			}
+			if (use_compression) {
+				addCompression(reg);
+				for (i = start_thread_id; i <= core_count; i++)
+					addCompression(enc[i]);
+				logCompression();
+			}
+			addDedup(reg);
+			for (i = start_thread_id; i <= core_count; i++)
+				addDedup(enc[i]);
+			sendDedup();
 			LOGINFO("Finished encrypted backup.\n");
 			close(progress_pipe[1]);
 			_exit(0);
@@ -342,9 +428,14 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 			reg.thread_id = 0;
 			reg.use_encryption = 0;
 			reg.use_compression = use_compression;
+			reg.compression_level = compression_level;
+			reg.adaptive_compression = adaptive_compression;
+			reg.max_threads = max_threads;
+			reg.dedup = dedup;
 			reg.setsize(Total_Backup_Size);
 			reg.progress_pipe_fd = progress_pipe_fd;
-			if (Total_Backup_Size > MAX_ARCHIVE_SIZE) {
+			reg.max_archive_size = max_archive_size;
+			if (Total_Backup_Size > max_archive_size) {
 				gui_print("Breaking backup file into multiple archives...\n");
 				reg.split_archives = 1;
 			} else {
@@ -358,12 +449,18 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				close(progress_pipe[1]);
 				_exit(-1);
 			}
+			if (use_compression) {
+				addCompression(reg);
+				logCompression();
+			}
+			addDedup(reg);
+			sendDedup();
 			close(progress_pipe[1]);
 			_exit(0);
 		}
 	} else {
 		// Parent side
-		unsigned long long fs, size_backup, files_backup, total_backup_size;
+		unsigned long long fs, size_backup, files_backup, total_backup_size, dedup_stats[2] = {0, 0};
 		int first_data = 0;
 		double display_percent, progress_percent;
 		char file_progress[1024];
@@ -385,6 +482,10 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				// Second incoming data is total size
 				total_backup_size = fs;
 				first_data = 2;
+			} else if (fs == DEDUP_STATS_MARKER) {
+				// The dedup counts follow in the same write
+				if (read(progress_pipe[0], dedup_stats, sizeof(dedup_stats)) != sizeof(dedup_stats))
+					dedup_stats[0] = dedup_stats[1] = 0;
 			} else {
 				files_backup++;
 				size_backup += fs;
@@ -392,6 +493,9 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 				sprintf(file_progress, "%llu of %llu files, %i%%", files_backup, file_count, (int)(display_percent));
 #ifndef BUILD_TWRPTAR_MAIN
 				DataManager::SetValue("tw_file_progress", file_progress);
+				// The throughput monitor shows the overall progress of a tracked run
+				if (Throughput.Add_Bytes(partition_name, fs))
+					continue;
 				display_percent = (double)(size_backup + *other_backups_size) / (double)(*overall_size) * 100;
 				sprintf(size_progress, "%lluMB of %lluMB, %i%%", (size_backup + *other_backups_size) / 1048576, *overall_size / 1048576, (int)(display_percent));
 				DataManager::SetValue("tw_size_progress", size_progress);
@@ -403,7 +507,8 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 		close(progress_pipe[0]);
 #ifndef BUILD_TWRPTAR_MAIN
 		DataManager::SetValue("tw_file_progress", "");
-		DataManager::SetValue("tw_size_progress", "");
+		if (!Throughput.Is_Tracking(partition_name))
+			DataManager::SetValue("tw_size_progress", "");
 
 		InfoManager backup_info(backup_folder + partition_name + ".info");
 		backup_info.SetValue("backup_size", size_backup);
@@ -416,6 +521,8 @@ int twrpTar::createTarFork(const unsigned long long *overall_size, const unsigne
 		else
 			backup_info.SetValue("backup_type", 0);
 		backup_info.SetValue("file_count", files_backup);
+		backup_info.SetValue("dedup_files", dedup_stats[0]);
+		backup_info.SetValue("dedup_bytes", dedup_stats[1]);
 		backup_info.SaveValues();
 #endif //ndef BUILD_TWRPTAR_MAIN
 		if (TWFunc::Wait_For_Child(pid, &status, "createTarFork()") != 0)
@@ -532,7 +639,7 @@ int twrpTar::extractTarFork(const unsigned long long *overall_size, unsigned lon
 							_exit(-1);
 						} else {
 							LOGINFO("Joined thread %i.\n", i);
-							ret = (int)thread_return;
+							ret = (int)(intptr_t)thread_return;
 							if (ret != 0) {
 								thread_error = 1;
 								LOGERR("Thread %i returned an error %i.\n", i, ret);
@@ -567,6 +674,10 @@ int twrpTar::extractTarFork(const unsigned long long *overall_size, unsigned lon
 			// Read progress data from children
 			while (read(progress_pipe[0], &fs, sizeof(fs)) > 0) {
 				size_backup += fs;
+#ifndef BUILD_TWRPTAR_MAIN
+				if (Throughput.Add_Bytes(partition_name, fs))
+					continue;
+#endif //ndef BUILD_TWRPTAR_MAIN
 				display_percent = (double)(size_backup + *other_backups_size) / (double)(*overall_size) * 100;
 				sprintf(size_progress, "%lluMB of %lluMB, %i%%", (size_backup + *other_backups_size) / 1048576, *overall_size / 1048576, (int)(display_percent));
 				progress_percent = (display_percent / 100);
@@ -643,9 +754,14 @@ int twrpTar::Generate_TarList(string Path, std::vector<TarListStruct> *TarList,
 
 int twrpTar::extractTar() {
 	char* charRootDir = (char*) tardir.c_str();
+	int ret;
 	if (openTar() == -1)
 		return -1;
-	if (tar_extract_all(t, charRootDir, &progress_pipe_fd) != 0) {
+	if (extract_offsets != NULL || extract_paths != NULL)
+		ret = scanTar();
+	else
+		ret = tar_extract_all(t, charRootDir, &progress_pipe_fd);
+	if (ret != 0) {
 		LOGERR("Unable to extract tar archive '%s'\n", tarfn.c_str());
 		return -1;
 	}
@@ -686,6 +802,279 @@ int twrpTar::extract() {
 	}
 }
 
+int twrpTar::extractPaths(const vector<string>& Paths) {
+	vector<string> archives;
+	vector<twrpTarIndex::Member> selected;
+	twrpTarIndex idx;
+	string orig_tarfn = tarfn, orig_tardir = tardir;
+	char actual_filename[PATH_MAX];
+	unsigned long found = 0;
+	int thread, part, ret = 0;
+	size_t i;
+
+	if (TWFunc::Path_Exists(tarfn)) {
+		archives.push_back(tarfn);
+	} else {
+		// Split archives hold full paths, extractMulti restores them without a prefix
+		tardir = "";
+		for (thread = 0; thread < 9; thread++) {
+			for (part = 0; part < 100; part++) {
+				snprintf(actual_filename, sizeof(actual_filename), "%s%i%02i", tarfn.c_str(), thread, part);
+				if (!TWFunc::Path_Exists(actual_filename))
+					break;
+				archives.push_back(actual_filename);
+			}
+		}
+	}
+	if (archives.empty()) {
+		LOGERR("Unable to locate '%s'\n", tarfn.c_str());
+		tardir = orig_tardir;
+		return -1;
+	}
+	progress_pipe_fd = 0;
+	for (i = 0; i < archives.size() && ret == 0; i++) {
+		if (!idx.Load(archives[i])) {
+			tarfn = archives[i];
+			if (TWFunc::Get_File_Type(tarfn) != 2) {
+				LOGERR("'%s' has no index, restore the whole backup instead\n", tarfn.c_str());
+				ret = -1;
+				break;
+			}
+			// Encrypted archives are not indexed, the members are found by their path
+			LOGINFO("Searching '%s' for the items to restore\n", tarfn.c_str());
+			extract_paths = &Paths;
+			extract_count = 0;
+			ret = extractScan();
+			extract_paths = NULL;
+			found += extract_count;
+			continue;
+		}
+		idx.Select(Paths, selected);
+		if (selected.empty())
+			continue;
+		tarfn = archives[i];
+		found += selected.size();
+		LOGINFO("Restoring %lu items from '%s'\n", (unsigned long)selected.size(), tarfn.c_str());
+		ret = extractMembers(idx, selected);
+	}
+	tarfn = orig_tarfn;
+	tardir = orig_tardir;
+	if (ret == 0 && found == 0) {
+		LOGERR("Nothing in '%s' matches the files to restore\n", tarfn.c_str());
+		return -1;
+	}
+	return ret;
+}
+
+int twrpTar::extractMembers(const twrpTarIndex& idx, const vector<twrpTarIndex::Member>& Selected) {
+	static tartype_t gunzip_type = { open, close, read_tar_gunzip, write_tar };
+	char* charRootDir = (char*) tardir.c_str();
+	set<unsigned long long> offsets;
+	const twrpTarIndex::Member* m;
+	int ret = 0;
+	size_t i;
+
+	for (i = 0; i < Selected.size(); i++)
+		offsets.insert(Selected[i].Offset);
+	Archive_Current_Type = TWFunc::Get_File_Type(tarfn);
+	if (Archive_Current_Type == 2 || (Archive_Current_Type == 1 && !idx.Has_Restarts())) {
+		// Encrypted archives and those without restart points are read from the
+		// start, data of a link is restored with the file it refers to then
+		for (i = 0; i < Selected.size(); i++) {
+			if (Selected[i].Target >= 0 && offsets.insert(Selected[i].Target).second) {
+				m = idx.Find(Selected[i].Target);
+				LOGINFO("Also restoring '%s', '%s' refers to it\n", m != NULL ? m->Path.c_str() : "?", Selected[i].Path.c_str());
+			}
+		}
+		extract_offsets = &offsets;
+		ret = extractScan();
+		extract_offsets = NULL;
+		return ret;
+	}
+
+	fd = open(tarfn.c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		LOGERR("Failed to open '%s'\n", tarfn.c_str());
+		return -1;
+	}
+	if (Archive_Current_Type == 1) {
+		gunzip = new twrpGunzip();
+		pthread_mutex_lock(&gzip_fds_lock);
+		gunzip_fds[fd] = gunzip;
+		pthread_mutex_unlock(&gzip_fds_lock);
+	}
+	if (tar_fdopen(&t, fd, charRootDir, gunzip != NULL ? &gunzip_type : NULL, O_RDONLY | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TAR_GNU | TAR_STORE_SELINUX) != 0) {
+		LOGERR("tar_fdopen failed\n");
+		close(fd);
+		ret = -1;
+	} else {
+		// Selected is in archive order, so a compressed archive is mostly read forward
+		offsets.clear();
+		for (i = 0; i < Selected.size() && ret == 0; i++) {
+			ret = extractMember(idx, Selected[i], offsets);
+			offsets.insert(Selected[i].Offset);
+		}
+		tar_close(t);
+	}
+	if (gunzip != NULL) {
+		pthread_mutex_lock(&gzip_fds_lock);
+		gunzip_fds.erase(fd);
+		pthread_mutex_unlock(&gzip_fds_lock);
+		delete gunzip;
+		gunzip = NULL;
+	}
+	return ret;
+}
+
+int twrpTar::extractScan() {
+	int ret, status;
+
+	ret = extract();
+	// extract() usually runs in a child that exits without reaping these
+	if (pigz_pid > 0)
+		waitpid(pigz_pid, &status, 0);
+	if (oaes_pid > 0)
+		waitpid(oaes_pid, &status, 0);
+	pigz_pid = 0;
+	oaes_pid = 0;
+	return ret;
+}
+
+int twrpTar::extractMember(const twrpTarIndex& idx, const twrpTarIndex::Member& m, const set<unsigned long long>& restored) {
+	char* charRootDir = (char*) tardir.c_str();
+	char realname[PATH_MAX];
+	char* filename;
+	struct tar_header link;
+	struct stat st;
+	size_t size;
+	bool found;
+
+	if (seekTar(idx, m.Offset) != 0 || th_read(t) != 0) {
+		LOGERR("Unable to read '%s' from '%s'\n", m.Path.c_str(), tarfn.c_str());
+		return -1;
+	}
+	filename = th_get_pathname(t);
+	snprintf(realname, sizeof(realname), "%s/%s", charRootDir, filename);
+	if (filename != t->th_buf.gnu_longname)
+		free(filename);
+	// Nothing is wiped first, a link cannot be made over an existing file
+	if (lstat(realname, &st) == 0 && !S_ISDIR(st.st_mode))
+		unlink(realname);
+	if (TH_ISLNK(t) && m.Target >= 0 && restored.find(m.Target) == restored.end()) {
+		// The data is stored with a file that is not restored, copy it from there
+		link = t->th_buf;
+		t->th_buf.gnu_longname = NULL;
+		t->th_buf.gnu_longlink = NULL;
+#ifdef HAVE_SELINUX
+		t->th_buf.selinux_context = NULL;
+#endif
+		found = (seekTar(idx, m.Target) == 0 && th_read(t) == 0 && TH_ISREG(t));
+		size = th_get_size(t);
+		free(t->th_buf.gnu_longname);
+		free(t->th_buf.gnu_longlink);
+#ifdef HAVE_SELINUX
+		free(t->th_buf.selinux_context);
+#endif
+		t->th_buf = link;
+		if (!found) {
+			LOGERR("Unable to read the data of '%s' from '%s'\n", m.Path.c_str(), tarfn.c_str());
+			return -1;
+		}
+		t->th_buf.typeflag = REGTYPE;
+		t->th_buf.dedup = 0;
+		th_set_size(t, size);
+	}
+	LOGINFO("Restoring '%s'\n", realname);
+	if (tar_extract_file(t, realname, charRootDir, &progress_pipe_fd) != 0) {
+		LOGERR("Unable to restore '%s'\n", realname);
+		return -1;
+	}
+	return 0;
+}
+
+int twrpTar::seekTar(const twrpTarIndex& idx, unsigned long long offset) {
+	unsigned long long tar_offset, file_offset;
+	char buf[T_BLOCKSIZE];
+
+	if (gunzip == NULL) {
+		if (lseek64(fd, offset, SEEK_SET) < 0)
+			return -1;
+		t->offset = offset;
+		return 0;
+	}
+	if (!idx.Restart_Before(offset, &tar_offset, &file_offset))
+		return -1;
+	// Inflating on is cheaper than going back unless a restart point is closer
+	if (!gunzip->Is_Open() || t->offset > offset || t->offset < tar_offset) {
+		if (gunzip->Open(fd, file_offset) != 0)
+			return -1;
+		t->offset = tar_offset;
+	}
+	while (t->offset < offset) {
+		if (tar_block_read(t, buf) != T_BLOCKSIZE)
+			return -1;
+	}
+	return 0;
+}
+
+int twrpTar::scanTar() {
+	char* charRootDir = (char*) tardir.c_str();
+	char realname[PATH_MAX];
+	char* filename;
+	struct stat st;
+	unsigned long long offset;
+	size_t left = extract_offsets != NULL ? extract_offsets->size() : 0;
+	string path;
+	bool wanted;
+	size_t i;
+	int ret;
+
+	// Read to the end so pigz and openaes finish normally
+	for (;;) {
+		offset = t->offset;
+		if ((ret = th_read(t)) != 0)
+			break;
+		filename = th_get_pathname(t);
+		snprintf(realname, sizeof(realname), "%s/%s", charRootDir, filename);
+		if (filename != t->th_buf.gnu_longname)
+			free(filename);
+		if (extract_offsets != NULL) {
+			wanted = extract_offsets->find(offset) != extract_offsets->end();
+		} else {
+			path.clear();
+			for (i = 0; realname[i] != '\0'; i++) {
+				if (realname[i] != '/' || path.empty() || path[path.size() - 1] != '/')
+					path += realname[i];
+			}
+			wanted = twrpTarIndex::Is_Selected(path, *extract_paths);
+		}
+		if (!wanted) {
+			if (TH_ISREG(t) && tar_skip_regfile(t) != 0)
+				return -1;
+			continue;
+		}
+		if (lstat(realname, &st) == 0 && !S_ISDIR(st.st_mode))
+			unlink(realname);
+		LOGINFO("Restoring '%s'\n", realname);
+		if (tar_extract_file(t, realname, charRootDir, &progress_pipe_fd) != 0) {
+			// Without an index the member holding the data of a link is not known
+			if (TH_ISLNK(t) && extract_paths != NULL)
+				LOGERR("'%s' refers to '%s', restore that too\n", realname, th_get_linkname(t));
+			return -1;
+		}
+		if (extract_offsets != NULL)
+			left--;
+		extract_count++;
+	}
+	if (ret != 1)
+		return -1;
+	if (left > 0) {
+		LOGERR("%lu indexed items were not found in '%s'\n", (unsigned long)left, tarfn.c_str());
+		return -1;
+	}
+	return 0;
+}
+
 int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 	struct stat st;
 	char buf[PATH_MAX];
@@ -694,6 +1083,12 @@ int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 	char actual_filename[PATH_MAX];
 	char *ptr;
 	unsigned long long fs;
+	DedupFile file;
+	const DedupFile* orig;
+	bool dedup_candidate;
+	unsigned long long offset;
+	long long target;
+	map<string, unsigned long long>::iterator link;
 
 	if (split_archives) {
 		basefn = tarfn;
@@ -715,9 +1110,31 @@ int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 		if (TarList->at(i).thread_id == thread_id) {
 			strcpy(buf, TarList->at(i).fn.c_str());
 			lstat(buf, &st);
+			orig = NULL;
+			dedup_candidate = false;
 			if (S_ISREG(st.st_mode)) { // item is a regular file
 				fs = (unsigned long long)(st.st_size);
-				if (split_archives && Archive_Current_Size + fs > MAX_ARCHIVE_SIZE) {
+				// Hardlinked files are already stored once by libtar
+				if (dedup && st.st_nlink == 1 && fs >= DEDUP_MIN_SIZE) {
+					file.fn = buf;
+					file.name = include_root_dir ? file.fn : Strip_Root_Dir(file.fn);
+					file.uid = st.st_uid;
+					file.gid = st.st_gid;
+					file.mode = st.st_mode;
+					file.context.clear();
+#ifdef HAVE_SELINUX
+					security_context_t context = NULL;
+					if (lgetfilecon(buf, &context) >= 0) {
+						file.context = context;
+						freecon(context);
+					}
+#endif
+					file.sampled = false;
+					orig = findDuplicate(file, fs);
+					dedup_candidate = (orig == NULL);
+				}
+				// A reference takes no space and has to stay in the archive of its original
+				if (orig == NULL && split_archives && Archive_Current_Size + fs > max_archive_size) {
 					if (closeTar() != 0) {
 						LOGERR("Error closing '%s' on thread %i\n", tarfn.c_str(), thread_id);
 						return -3;
@@ -736,14 +1153,35 @@ int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 					}
 					Archive_Current_Size = 0;
 				}
-				Archive_Current_Size += fs;
+				if (orig == NULL)
+					Archive_Current_Size += fs;
 				write(progress_pipe_fd, &fs, sizeof(fs));
 			}
-			LOGINFO("addFile '%s' including root: %i\n", buf, include_root_dir);
-			if (addFile(buf, include_root_dir) != 0) {
+			LOGTRACE("addFile '%s' including root: %i\n", buf, include_root_dir);
+			offset = t->offset;
+			if (addFile(buf, include_root_dir, orig) != 0) {
 				LOGERR("Error adding file '%s' to '%s'\n", buf, tarfn.c_str());
 				return -1;
 			}
+			// Links name the member holding their data, restoring one alone needs it
+			target = -1;
+			if (orig != NULL) {
+				target = orig->offset;
+			} else if (TH_ISLNK(t)) {
+				link = link_offsets.find(th_get_linkname(t));
+				if (link != link_offsets.end())
+					target = link->second;
+			} else if (S_ISREG(st.st_mode) && st.st_nlink > 1) {
+				link_offsets[include_root_dir ? string(buf) : Strip_Root_Dir(buf)] = offset;
+			}
+			index.Add_Member(offset, target, buf);
+			if (orig != NULL) {
+				dedup_files++;
+				dedup_bytes += fs;
+			} else if (dedup_candidate) {
+				file.offset = offset;
+				dedup_table[fs].push_back(file);
+			}
 		}
 		i++;
 	}
@@ -812,135 +1250,86 @@ int twrpTar::createTar() {
 	char* charTarFile = (char*) tarfn.c_str();
 	char* charRootDir = (char*) tardir.c_str();
 	static tartype_t type = { open, close, read, write_tar };
+	static tartype_t gz_type = { open, close, read, write_tar_gz };
+
+	// Archives are restored on their own, references may not cross them
+	dedup_table.clear();
+	link_offsets.clear();
+	// The index lists every path, an encrypted archive would leak them
+	if (!use_encryption)
+		index.Create(tarfn);
 
 	if (use_encryption && use_compression) {
 		// Compressed and encrypted
 		Archive_Current_Type = 3;
 		LOGINFO("Using encryption and compression...\n");
-		int i, pipes[4];
-
-		if (pipe(pipes) < 0) {
-			LOGERR("Error creating first pipe\n");
-			return -1;
-		}
-		if (pipe(pipes + 2) < 0) {
-			LOGERR("Error creating second pipe\n");
-			return -1;
-		}
+		int oaesfd[2];
 		int output_fd = open(tarfn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
 		if (output_fd < 0) {
 			LOGERR("Failed to open '%s'\n", tarfn.c_str());
-			for (i = 0; i < 4; i++)
-				close(pipes[i]); // close all
 			return -1;
 		}
-		pigz_pid = fork();
+		if (pipe(oaesfd) < 0) {
+			LOGERR("Error creating pipe\n");
+			close(output_fd);
+			return -1;
+		}
+		pigz_pid = 0;
+		oaes_pid = fork();
 
-		if (pigz_pid < 0) {
-			LOGERR("pigz fork() failed\n");
+		if (oaes_pid < 0) {
+			LOGERR("openaes fork() failed\n");
 			close(output_fd);
-			for (i = 0; i < 4; i++)
-				close(pipes[i]); // close all
+			close(oaesfd[0]);
+			close(oaesfd[1]);
 			return -1;
-		} else if (pigz_pid == 0) {
-			// pigz Child
-			close(pipes[1]);
-			close(pipes[2]);
-			close(0);
-			dup2(pipes[0], 0);
-			close(1);
-			dup2(pipes[3], 1);
-			if (execlp("pigz", "pigz", "-", NULL) < 0) {
-				LOGERR("execlp pigz ERROR!\n");
+		} else if (oaes_pid == 0) {
+			// openaes Child
+			close(oaesfd[1]);   // close unused
+			dup2(oaesfd[0], 0); // remap stdin
+			dup2(output_fd, 1); // remap stdout to output file
+			if (execlp("openaes", "openaes", "enc", "--key", password.c_str(), NULL) < 0) {
+				LOGERR("execlp openaes ERROR!\n");
 				close(output_fd);
-				close(pipes[0]);
-				close(pipes[3]);
+				close(oaesfd[0]);
 				_exit(-1);
 			}
 		} else {
-			// Parent
-			oaes_pid = fork();
-
-			if (oaes_pid < 0) {
-				LOGERR("openaes fork() failed\n");
-				close(output_fd);
-				for (i = 0; i < 4; i++)
-					close(pipes[i]); // close all
+			// Parent compresses into the openaes pipe
+			close(oaesfd[0]);
+			close(output_fd);
+			fd = oaesfd[1];
+			if (openGzip(fd) != 0) {
+				close(fd);
+				return -1;
+			}
+			if(tar_fdopen(&t, fd, charRootDir, &gz_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TAR_GNU | TAR_STORE_SELINUX) != 0) {
+				closeGzip();
+				close(fd);
+				LOGERR("tar_fdopen failed\n");
 				return -1;
-			} else if (oaes_pid == 0) {
-				// openaes Child
-				close(pipes[0]);
-				close(pipes[1]);
-				close(pipes[3]);
-				close(0);
-				dup2(pipes[2], 0);
-				close(1);
-				dup2(output_fd, 1);
-				if (execlp("openaes", "openaes", "enc", "--key", password.c_str(), NULL) < 0) {
-					LOGERR("execlp openaes ERROR!\n");
-					close(pipes[2]);
-					close(output_fd);
-					_exit(-1);
-				}
-			} else {
-				// Parent
-				close(pipes[0]);
-				close(pipes[2]);
-				close(pipes[3]);
-				fd = pipes[1];
-				if(tar_fdopen(&t, fd, charRootDir, NULL, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TAR_GNU | TAR_STORE_SELINUX) != 0) {
-					close(fd);
-					LOGERR("tar_fdopen failed\n");
-					return -1;
-				}
-				return 0;
 			}
+			return 0;
 		}
 	} else if (use_compression) {
 		// Compressed
 		Archive_Current_Type = 1;
 		LOGINFO("Using compression...\n");
-		int pigzfd[2];
-		int output_fd = open(tarfn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-		if (output_fd < 0) {
+		pigz_pid = 0;
+		fd = open(tarfn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd < 0) {
 			LOGERR("Failed to open '%s'\n", tarfn.c_str());
-			close(pigzfd[0]);
 			return -1;
 		}
-
-		if (pipe(pigzfd) < 0) {
-			LOGERR("Error creating pipe\n");
-			close(output_fd);
+		if (openGzip(fd) != 0) {
+			close(fd);
 			return -1;
 		}
-		pigz_pid = fork();
-
-		if (pigz_pid < 0) {
-			LOGERR("fork() failed\n");
-			close(output_fd);
-			close(pigzfd[0]);
-			close(pigzfd[1]);
+		if(tar_fdopen(&t, fd, charRootDir, &gz_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TAR_GNU | TAR_STORE_SELINUX) != 0) {
+			closeGzip();
+			close(fd);
+			LOGERR("tar_fdopen failed\n");
 			return -1;
-		} else if (pigz_pid == 0) {
-			// Child
-			close(pigzfd[1]);   // close unused output pipe
-			dup2(pigzfd[0], 0); // remap stdin
-			dup2(output_fd, 1); // remap stdout to output file
-			if (execlp("pigz", "pigz", "-", NULL) < 0) {
-				LOGERR("execlp pigz ERROR!\n");
-				close(output_fd);
-				close(pigzfd[0]);
-				_exit(-1);
-			}
-		} else {
-			// Parent
-			close(pigzfd[0]); // close parent input
-			fd = pigzfd[1];   // copy parent output
-			if(tar_fdopen(&t, fd, charRootDir, NULL, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TAR_GNU | TAR_STORE_SELINUX) != 0) {
-				close(fd);
-				LOGERR("tar_fdopen failed\n");
-				return -1;
-			}
 		}
 	} else if (use_encryption) {
 		// Encrypted
@@ -1198,8 +1587,32 @@ string twrpTar::Strip_Root_Dir(string Path) {
 	return temp;
 }
 
-int twrpTar::addFile(string fn, bool include_root) {
+int twrpTar::addFile(string fn, bool include_root, const DedupFile* orig) {
 	char* charTarFile = (char*) fn.c_str();
+	if (orig != NULL) {
+		// Only a header is written, the data is in the archive already
+		char* charOrigName = (char*) orig->name.c_str();
+		if (include_root) {
+			if (tar_append_dedup(t, charTarFile, NULL, charOrigName) == -1)
+				return -1;
+		} else {
+			string temp = Strip_Root_Dir(fn);
+			char* charTarPath = (char*) temp.c_str();
+			if (tar_append_dedup(t, charTarFile, charTarPath, charOrigName) == -1)
+				return -1;
+		}
+		return 0;
+	}
+	if (gzip != NULL && adaptive_compression) {
+		// Files that would not shrink are stored to save CPU time
+		struct stat st;
+		if (lstat(charTarFile, &st) == 0 && S_ISREG(st.st_mode) && !twrpGzip::Is_Compressible(fn, st.st_size)) {
+			gzip->Set_Level(0);
+			gz_stored_files++;
+		} else {
+			gzip->Set_Level(compression_level);
+		}
+	}
 	if (include_root) {
 		if (tar_append_file(t, charTarFile, NULL) == -1)
 			return -1;
@@ -1216,6 +1629,11 @@ int twrpTar::closeTar() {
 	flush_libtar_buffer(t->fd);
 	if (tar_append_eof(t) != 0) {
 		LOGERR("tar_append_eof(): %s\n", strerror(errno));
+		closeGzip();
+		tar_close(t);
+		return -1;
+	}
+	if (closeGzip() != 0) {
 		tar_close(t);
 		return -1;
 	}
@@ -1242,9 +1660,162 @@ int twrpTar::closeTar() {
 		LOGERR("Backup file size for '%s' is 0 bytes.\n", tarfn.c_str());
 		return -1;
 	}
+	index.Close();
 	return 0;
 }
 
+int twrpTar::openGzip(int out_fd) {
+	gzip = new twrpGzip();
+	if (gzip->Open(out_fd, compression_level, max_threads) != 0) {
+		LOGERR("Unable to start compression of '%s'\n", tarfn.c_str());
+		delete gzip;
+		gzip = NULL;
+		return -1;
+	}
+	pthread_mutex_lock(&gzip_fds_lock);
+	gzip_fds[out_fd] = gzip;
+	pthread_mutex_unlock(&gzip_fds_lock);
+	return 0;
+}
+
+int twrpTar::closeGzip() {
+	int ret;
+
+	if (gzip == NULL)
+		return 0;
+	pthread_mutex_lock(&gzip_fds_lock);
+	gzip_fds.erase(fd);
+	pthread_mutex_unlock(&gzip_fds_lock);
+	ret = gzip->Close();
+	if (ret != 0)
+		LOGERR("Error compressing '%s'\n", tarfn.c_str());
+	gz_deflated_in += gzip->Deflated_In;
+	gz_deflated_out += gzip->Deflated_Out;
+	gz_stored_in += gzip->Stored_In;
+	// The openaes stream around an encrypted archive cannot be entered in the middle
+	if (ret == 0 && Archive_Current_Type == 1) {
+		for (vector<twrpGzip::Restart_Point>::iterator r = gzip->Restarts.begin(); r != gzip->Restarts.end(); r++)
+			index.Add_Restart(r->In, r->Out);
+	}
+	delete gzip;
+	gzip = NULL;
+	return ret;
+}
+
+void twrpTar::addCompression(const twrpTar& other) {
+	gz_deflated_in += other.gz_deflated_in;
+	gz_deflated_out += other.gz_deflated_out;
+	gz_stored_in += other.gz_stored_in;
+	gz_stored_files += other.gz_stored_files;
+}
+
+void twrpTar::logCompression() {
+	string name = partition_name.empty() ? tardir : partition_name;
+
+	LOGINFO("Compression of %s: %llu files (%lluMB) stored, %lluMB deflated to %lluMB at level %i\n",
+		name.c_str(), gz_stored_files, gz_stored_in / 1048576, gz_deflated_in / 1048576,
+		gz_deflated_out / 1048576, compression_level);
+}
+
+const twrpTar::DedupFile* twrpTar::findDuplicate(DedupFile& file, unsigned long long size) {
+	map<unsigned long long, vector<DedupFile> >::iterator same_size = dedup_table.find(size);
+	size_t i;
+
+	// Most files have a unique size and are never read here
+	if (same_size == dedup_table.end())
+		return NULL;
+	for (i = 0; i < same_size->second.size(); i++) {
+		DedupFile& other = same_size->second[i];
+
+		if (other.uid != file.uid || other.gid != file.gid || other.mode != file.mode || other.context != file.context)
+			continue;
+		if (!file.sampled && !sampleFile(file, size))
+			return NULL;
+		if (!other.sampled && !sampleFile(other, size))
+			continue;
+		if (other.sample == file.sample && sameContents(other.fn, file.fn, size))
+			return &other;
+	}
+	return NULL;
+}
+
+bool twrpTar::sampleFile(DedupFile& file, unsigned long long size) {
+	unsigned char block[DEDUP_SAMPLE_SIZE];
+	uLong crc = crc32(0L, Z_NULL, 0);
+	ssize_t len;
+	int fd;
+
+	fd = open(file.fn.c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return false;
+	len = pread64(fd, block, sizeof(block), 0);
+	if (len > 0)
+		crc = crc32(crc, block, len);
+	if (len >= 0 && size > DEDUP_SAMPLE_SIZE) {
+		len = pread64(fd, block, sizeof(block), (off64_t)(size - DEDUP_SAMPLE_SIZE));
+		if (len > 0)
+			crc = crc32(crc, block, len);
+	}
+	close(fd);
+	if (len < 0)
+		return false;
+	file.sample = crc;
+	file.sampled = true;
+	return true;
+}
+
+bool twrpTar::sameContents(const string& fn1, const string& fn2, unsigned long long size) {
+	const size_t chunk = 65536;
+	unsigned long long offset = 0;
+	char *buf1, *buf2;
+	size_t len;
+	bool ret = false;
+	int fd1, fd2;
+
+	fd1 = open(fn1.c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd1 < 0)
+		return false;
+	fd2 = open(fn2.c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd2 < 0) {
+		close(fd1);
+		return false;
+	}
+	buf1 = (char*) malloc(chunk);
+	buf2 = (char*) malloc(chunk);
+	if (buf1 && buf2) {
+		// A matching sample is not proof, only a full compare allows a reference
+		ret = true;
+		while (ret && offset < size) {
+			len = size - offset < chunk ? (size_t)(size - offset) : chunk;
+			if (readFully(fd1, buf1, len, offset) != 0 || readFully(fd2, buf2, len, offset) != 0 ||
+				memcmp(buf1, buf2, len) != 0)
+				ret = false;
+			offset += len;
+		}
+	}
+	free(buf1);
+	free(buf2);
+	close(fd1);
+	close(fd2);
+	return ret;
+}
+
+void twrpTar::addDedup(const twrpTar& other) {
+	dedup_files += other.dedup_files;
+	dedup_bytes += other.dedup_bytes;
+}
+
+void twrpTar::sendDedup() {
+	unsigned long long stats[3] = { DEDUP_STATS_MARKER, dedup_files, dedup_bytes };
+	string name = partition_name.empty() ? tardir : partition_name;
+
+	if (dedup_files > 0)
+		LOGINFO("Deduplication of %s: %llu identical files (%lluMB) stored once\n",
+			name.c_str(), dedup_files, dedup_bytes / 1048576);
+	// One write keeps the counts together
+	write(progress_pipe_fd, stats, sizeof(stats));
+}
+
 int twrpTar::removeEOT(string tarFile) {
 	char* charTarFile = (char*) tarFile.c_str();
 	off_t tarFileEnd;
@@ -1390,3 +1961,35 @@ unsigned long long twrpTar::uncompressedSize(string filename, int *archive_type)
 extern "C" ssize_t write_tar(int fd, const void *buffer, size_t size) {
 	return (ssize_t) write_libtar_buffer(fd, buffer, size);
 }
+
+extern "C" ssize_t write_tar_gz(int fd, const void *buffer, size_t size) {
+	map<int, twrpGzip*>::iterator it;
+	twrpGzip* gz = NULL;
+
+	pthread_mutex_lock(&gzip_fds_lock);
+	it = gzip_fds.find(fd);
+	if (it != gzip_fds.end())
+		gz = it->second;
+	pthread_mutex_unlock(&gzip_fds_lock);
+	if (gz == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	return gz->Write(buffer, size);
+}
+
+extern "C" ssize_t read_tar_gunzip(int fd, void *buffer, size_t size) {
+	map<int, twrpGunzip*>::iterator it;
+	twrpGunzip* gz = NULL;
+
+	pthread_mutex_lock(&gzip_fds_lock);
+	it = gunzip_fds.find(fd);
+	if (it != gunzip_fds.end())
+		gz = it->second;
+	pthread_mutex_unlock(&gzip_fds_lock);
+	if (gz == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	return gz->Read(buffer, size);
+}
@@ -20,6 +20,8 @@
 #define _TWRPTAR_HEADER
 
 ssize_t write_tar(int fd, const void *buffer, size_t size);
+ssize_t write_tar_gz(int fd, const void *buffer, size_t size);
+ssize_t read_tar_gunzip(int fd, void *buffer, size_t size);
 
 #endif  // _TWRPTAR_HEADER
 
@@ -27,7 +27,11 @@ extern "C" {
 #include <fstream>
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
 #include "twrpDU.hpp"
+#include "twrpGzip.hpp"
+#include "twrpTarIndex.hpp"
 
 using namespace std;
 
@@ -47,6 +51,7 @@ public:
 	virtual ~twrpTar();
 	int createTarFork(const unsigned long long *overall_size, const unsigned long long *other_backups_size);
 	int extractTarFork(const unsigned long long *overall_size, unsigned long long *other_backups_size);
+	int extractPaths(const vector<string>& Paths);  // Restores only these files and folders, needs the .idx of each archive
 	void setfn(string fn);
 	void setdir(string dir);
 	void setsize(unsigned long long backup_size);
@@ -57,7 +62,12 @@ public:
 	int use_encryption;
 	int userdata_encryption;
 	int use_compression;
+	int compression_level;
+	int adaptive_compression;
 	int split_archives;
+	unsigned long long max_archive_size;           // Split archives are cut at this size
+	int max_threads;                               // Limits encryption and compression threads, 0 is one per core
+	int dedup;                                     // Stores identical files in an archive once
 	int has_data_media;
 	string backup_name;
 	int progress_pipe_fd;
@@ -65,10 +75,23 @@ public:
 	string backup_folder;
 
 private:
+	// A regular file that later identical files of an archive can refer to
+	struct DedupFile {
+		string fn;                                 // Path on disk
+		string name;                               // Name it is saved under in the archive
+		uid_t uid;                                 // A reference restores with the original's owner,
+		gid_t gid;                                 // mode and context, so these have to match
+		mode_t mode;
+		string context;
+		unsigned long sample;                      // CRC of the first and last block
+		bool sampled;
+		unsigned long long offset;                 // Header of the stored copy in the tar stream
+	};
+
 	int extract();
 	int addFilesToExistingTar(vector <string> files, string tarFile);
 	int createTar();
-	int addFile(string fn, bool include_root);
+	int addFile(string fn, bool include_root, const DedupFile* orig);
 	int entryExists(string entry);
 	int closeTar();
 	int removeEOT(string tarFile);
@@ -80,6 +103,20 @@ private:
 	static void* extractMulti(void *cookie);
 	int tarList(std::vector<TarListStruct> *TarList, unsigned thread_id);
 	unsigned long long uncompressedSize(string filename, int *archive_type);
+	int openGzip(int out_fd);
+	int closeGzip();
+	void addCompression(const twrpTar& other);
+	void logCompression();
+	const DedupFile* findDuplicate(DedupFile& file, unsigned long long size);
+	static bool sampleFile(DedupFile& file, unsigned long long size);
+	static bool sameContents(const string& fn1, const string& fn2, unsigned long long size);
+	void addDedup(const twrpTar& other);
+	void sendDedup();
+	int extractMembers(const twrpTarIndex& idx, const vector<twrpTarIndex::Member>& Selected);
+	int extractMember(const twrpTarIndex& idx, const twrpTarIndex::Member& m, const set<unsigned long long>& restored);
+	int seekTar(const twrpTarIndex& idx, unsigned long long offset);
+	int extractScan();
+	int scanTar();
 
 	int Archive_Current_Type;
 	unsigned long long Archive_Current_Size;
@@ -90,6 +127,20 @@ private:
 	pid_t pigz_pid;
 	pid_t oaes_pid;
 	unsigned long long file_count;
+	twrpGzip* gzip;
+	unsigned long long gz_deflated_in;
+	unsigned long long gz_deflated_out;
+	unsigned long long gz_stored_in;
+	unsigned long long gz_stored_files;
+	map<unsigned long long, vector<DedupFile> > dedup_table; // Files of the current archive by size
+	unsigned long long dedup_files;
+	unsigned long long dedup_bytes;
+	twrpTarIndex index;                            // Written next to each archive
+	map<string, unsigned long long> link_offsets;  // Hardlinked files of the current archive by name
+	twrpGunzip* gunzip;                            // Random access into a compressed archive
+	const set<unsigned long long>* extract_offsets; // Members scanTar restores, NULL restores all
+	const vector<string>* extract_paths;           // Or the members below these paths, for archives without an index
+	unsigned long extract_count;                   // Members scanTar restored
 
 	string tardir;
 	string tarfn;
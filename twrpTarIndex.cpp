@@ -0,0 +1,192 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "twcommon.h"
+#include "twrpTarIndex.hpp"
+
+#define TAR_INDEX_HEADER "twrpTarIndex 1"
+
+twrpTarIndex::twrpTarIndex() {
+	out = NULL;
+	out_error = false;
+}
+
+twrpTarIndex::~twrpTarIndex() {
+	if (out != NULL)
+		fclose(out);
+}
+
+string twrpTarIndex::Index_Name(const string& Archive) {
+	return Archive + ".idx";
+}
+
+bool twrpTarIndex::Create(const string& Archive) {
+	if (out != NULL)
+		fclose(out);
+	out_name = Index_Name(Archive);
+	out_error = false;
+	out = fopen(out_name.c_str(), "w");
+	if (out == NULL) {
+		LOGINFO("Unable to create '%s', single files cannot be restored from this archive\n", out_name.c_str());
+		return false;
+	}
+	if (fprintf(out, "%s\n", TAR_INDEX_HEADER) < 0)
+		out_error = true;
+	return true;
+}
+
+void twrpTarIndex::Add_Member(unsigned long long Offset, long long Target, const string& Path) {
+	if (out == NULL || out_error)
+		return;
+	// A name with a newline cannot be stored, such files are only restored with the rest
+	if (Path.find('\n') != string::npos)
+		return;
+	if (fprintf(out, "m %llu %lld %s\n", Offset, Target, Path.c_str()) < 0)
+		out_error = true;
+}
+
+void twrpTarIndex::Add_Restart(unsigned long long Tar_Offset, unsigned long long File_Offset) {
+	if (out == NULL || out_error)
+		return;
+	if (fprintf(out, "r %llu %llu\n", Tar_Offset, File_Offset) < 0)
+		out_error = true;
+}
+
+bool twrpTarIndex::Close() {
+	if (out == NULL)
+		return false;
+	if (fclose(out) != 0)
+		out_error = true;
+	out = NULL;
+	if (out_error) {
+		// A partial index could point at the wrong members
+		LOGINFO("Error writing '%s', removing it\n", out_name.c_str());
+		unlink(out_name.c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool Member_Before(const twrpTarIndex::Member& a, const twrpTarIndex::Member& b) {
+	return a.Offset < b.Offset;
+}
+
+bool twrpTarIndex::Load(const string& Archive) {
+	string name = Index_Name(Archive);
+	char line[PATH_MAX + 64];
+	FILE* fp;
+	size_t len;
+	int pos;
+
+	members.clear();
+	restarts.clear();
+	fp = fopen(name.c_str(), "r");
+	if (fp == NULL)
+		return false;
+	if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, TAR_INDEX_HEADER, strlen(TAR_INDEX_HEADER)) != 0) {
+		LOGINFO("'%s' is not a tar index\n", name.c_str());
+		fclose(fp);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (line[0] == 'm') {
+			Member m;
+
+			if (sscanf(line, "m %llu %lld %n", &m.Offset, &m.Target, &pos) < 2 || pos <= 0 || (size_t)pos >= len)
+				continue;
+			m.Path = line + pos;
+			members.push_back(m);
+		} else if (line[0] == 'r') {
+			Restart r;
+
+			if (sscanf(line, "r %llu %llu", &r.Tar_Offset, &r.File_Offset) == 2)
+				restarts.push_back(r);
+		}
+	}
+	fclose(fp);
+	// Written in archive order, sorting only guards against hand edited files
+	stable_sort(members.begin(), members.end(), Member_Before);
+	LOGINFO("Loaded '%s', %lu members, %lu restart points\n", name.c_str(), (unsigned long)members.size(), (unsigned long)restarts.size());
+	return true;
+}
+
+bool twrpTarIndex::Is_Selected(const string& Path, const vector<string>& Paths) {
+	size_t j, len;
+
+	for (j = 0; j < Paths.size(); j++) {
+		const string& w = Paths[j];
+
+		len = w.size();
+		while (len > 1 && w[len - 1] == '/')
+			len--;
+		if (len == 0)
+			continue;
+		if (Path.compare(0, len, w, 0, len) == 0 && (Path.size() == len || Path[len] == '/' || (len == 1 && w[0] == '/')))
+			return true;
+	}
+	return false;
+}
+
+void twrpTarIndex::Select(const vector<string>& Paths, vector<Member>& Selected) const {
+	size_t i;
+
+	Selected.clear();
+	for (i = 0; i < members.size(); i++) {
+		if (Is_Selected(members[i].Path, Paths))
+			Selected.push_back(members[i]);
+	}
+}
+
+const twrpTarIndex::Member* twrpTarIndex::Find(unsigned long long Offset) const {
+	size_t low = 0, high = members.size(), mid;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (members[mid].Offset < Offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < members.size() && members[low].Offset == Offset)
+		return &members[low];
+	return NULL;
+}
+
+bool twrpTarIndex::Restart_Before(unsigned long long Offset, unsigned long long* Tar_Offset, unsigned long long* File_Offset) const {
+	bool found = false;
+	size_t i;
+
+	for (i = 0; i < restarts.size() && restarts[i].Tar_Offset <= Offset; i++) {
+		*Tar_Offset = restarts[i].Tar_Offset;
+		*File_Offset = restarts[i].File_Offset;
+		found = true;
+	}
+	return found;
+}
+
+bool twrpTarIndex::Has_Restarts() const {
+	return !restarts.empty();
+}
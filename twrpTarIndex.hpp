@@ -0,0 +1,74 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPTARINDEX_HPP
+#define TWRPTARINDEX_HPP
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sidecar index of a tar archive, saved next to it as <archive>.idx.  It
+// maps the path of every member to the offset of its first header block
+// in the tar stream and lists the points where the inflating of a
+// compressed archive can start, so a few files can be restored without
+// reading the whole archive.  Encrypted archives get no index, it would
+// list their files in plain text.
+class twrpTarIndex {
+public:
+	struct Member {
+		unsigned long long Offset;                 // First header block in the tar stream
+		long long Target;                          // Member a hardlink or copy refers to, -1 if none
+		string Path;                               // Path on disk at backup time
+	};
+
+	twrpTarIndex();
+	~twrpTarIndex();
+
+	// Writing, lines are added while the archive is created
+	bool Create(const string& Archive);
+	void Add_Member(unsigned long long Offset, long long Target, const string& Path);
+	void Add_Restart(unsigned long long Tar_Offset, unsigned long long File_Offset);
+	bool Close();                                  // Returns false if a line could not be written
+
+	// Reading
+	bool Load(const string& Archive);              // Returns false if there is no usable index
+	void Select(const vector<string>& Paths, vector<Member>& Selected) const; // Members that are or are below one of Paths, in archive order
+	const Member* Find(unsigned long long Offset) const;
+	bool Restart_Before(unsigned long long Offset, unsigned long long* Tar_Offset, unsigned long long* File_Offset) const;
+	bool Has_Restarts() const;
+
+	static string Index_Name(const string& Archive);
+	static bool Is_Selected(const string& Path, const vector<string>& Paths); // Path is or is below one of Paths
+
+private:
+	struct Restart {
+		unsigned long long Tar_Offset;
+		unsigned long long File_Offset;            // Offset in the compressed file
+	};
+
+	FILE* out;
+	string out_name;
+	bool out_error;
+	vector<Member> members;                        // Sorted by Offset
+	vector<Restart> restarts;                      // Sorted by Tar_Offset
+};
+
+#endif // TWRPTARINDEX_HPP
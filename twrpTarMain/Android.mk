@@ -7,12 +7,15 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpGzip.cpp \
+	../twrpTarIndex.cpp \
 	../tarWrite.c \
 	../twrpDU.cpp
 LOCAL_CFLAGS:= -g -c -W -DBUILD_TWRPTAR_MAIN
 
 LOCAL_C_INCLUDES += bionic external/stlport/stlport
-LOCAL_STATIC_LIBRARIES := libc libtar_static libstlport_static libstdc++
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_STATIC_LIBRARIES := libc libtar_static libstlport_static libstdc++ libz
 
 ifeq ($(TWHAVE_SELINUX), true)
     LOCAL_C_INCLUDES += external/libselinux/include
@@ -43,12 +46,15 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpGzip.cpp \
+	../twrpTarIndex.cpp \
 	../tarWrite.c \
 	../twrpDU.cpp
 LOCAL_CFLAGS:= -g -c -W -DBUILD_TWRPTAR_MAIN
 
 LOCAL_C_INCLUDES += bionic external/stlport/stlport
-LOCAL_SHARED_LIBRARIES := libc libtar libstlport libstdc++
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_SHARED_LIBRARIES := libc libtar libstlport libstdc++ libz
 
 ifeq ($(TWHAVE_SELINUX), true)
     LOCAL_C_INCLUDES += external/libselinux/include
@@ -69,3 +75,52 @@ LOCAL_MODULE_TAGS:= eng
 LOCAL_MODULE_CLASS := UTILITY_EXECUTABLES
 LOCAL_MODULE_PATH := $(PRODUCT_OUT)/utilities
 include $(BUILD_EXECUTABLE)
+
+
+# Build a host binary for twrpTarBench, without encryption or SELinux
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	twrpTarMain.cpp \
+	../twrp-functions.cpp \
+	../twrpTar.cpp \
+	../twrpGzip.cpp \
+	../twrpTarIndex.cpp \
+	../tarWrite.c \
+	../twrpDU.cpp
+LOCAL_CFLAGS:= -g -W -DBUILD_TWRPTAR_MAIN -DTWRPTAR_HOST -DTW_EXCLUDE_ENCRYPTED_BACKUPS
+
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_STATIC_LIBRARIES := libtar_host libz
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE:= twrpTar
+LOCAL_MODULE_TAGS:= eng
+include $(BUILD_HOST_EXECUTABLE)
+
+
+# Build the benchmark for the host and the device
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	twrpTarBench.cpp
+LOCAL_CFLAGS:= -g -W
+
+LOCAL_MODULE:= twrpTarBench
+LOCAL_MODULE_TAGS:= eng
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	twrpTarBench.cpp
+LOCAL_CFLAGS:= -g -W
+
+LOCAL_C_INCLUDES += bionic external/stlport/stlport
+LOCAL_SHARED_LIBRARIES := libc libstlport libstdc++
+
+LOCAL_MODULE:= twrpTarBench
+LOCAL_MODULE_TAGS:= eng
+LOCAL_MODULE_CLASS := UTILITY_EXECUTABLES
+LOCAL_MODULE_PATH := $(PRODUCT_OUT)/utilities
+include $(BUILD_EXECUTABLE)
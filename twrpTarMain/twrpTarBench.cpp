@@ -0,0 +1,625 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks the twrpTar binary. Reproducible synthetic trees are created
+// once, then every tree is backed up and restored in every archive mode.
+// Each run prints one JSON object on a line of its own to stdout so the
+// results of two builds can be compared, progress goes to stderr. Only
+// POSIX and Linux interfaces are used, so it runs on a plain Linux host
+// as well as in recovery.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define BENCH_PASSWORD     "twrpTarBench"
+#define BENCH_SELINUX_XATTR "security.selinux"
+#define BENCH_SELINUX_LABEL "u:object_r:system_data_file:s0"
+
+struct bench_tree {
+	const char* name;
+	void (*generate)(const string& path, int scale);
+};
+
+struct bench_mode {
+	const char* name;
+	bool compress;
+	bool encrypt;
+	bool split;
+	int threads;                                   // 0 lets twrpTar use one per core
+};
+
+struct tree_stats {
+	unsigned long long files;
+	unsigned long long dirs;
+	unsigned long long links;                      // Symlinks
+	unsigned long long hardlinks;                  // Regular files with more than one link
+	unsigned long long bytes;
+};
+
+struct run_result {
+	int status;
+	double seconds;
+	long long read_syscalls;                       // -1 if the kernel has no I/O accounting
+	long long write_syscalls;
+	long peak_rss_kb;
+};
+
+static const bench_mode modes[] = {
+	{ "plain",           false, false, false, 0 },
+	{ "pigz",            true,  false, false, 0 },
+	{ "pigz_1thread",    true,  false, false, 1 },
+	{ "openaes",         false, true,  false, 0 },
+	{ "openaes_1thread", false, true,  false, 1 },
+	{ "pigz_openaes",    true,  true,  false, 0 },
+	{ "split",           false, false, true,  0 },
+};
+
+static uint64_t prng_state;
+static bool label_files = true;                    // Cleared once the file system refuses SELinux labels
+static const char* words[] = {
+	"system", "data", "app", "lib", "framework", "cache", "media", "android",
+	"recovery", "backup", "restore", "partition", "config", "xml", "true", "false",
+	"0", "1", "2048", "4096", "com", "org", "package", "version",
+};
+
+static void usage() {
+	printf("twrpTarBench [options]\n\n");
+	printf(" -b    twrpTar binary, default is twrpTar from the PATH\n");
+	printf(" -w    work folder, default /tmp/twrpTarBench\n");
+	printf(" -s    scale of the trees, default 1\n");
+	printf(" -p    archive size of the split mode in MB, default 16\n");
+	printf(" -t    comma separated trees to run: tiny,huge,deep,hardlinks\n");
+	printf(" -m    comma separated modes to run, default all available\n");
+	printf(" -k    keep the generated trees and archives\n");
+	printf("\n");
+	printf("Example: twrpTarBench -b out/host/linux-x86/bin/twrpTar -s 2 > results.json\n");
+	printf("Build the host binaries with: mmm bootable/recovery/twrpTarMain\n");
+}
+
+// xorshift64*, the same seed always builds the same tree
+static uint64_t Random() {
+	prng_state ^= prng_state >> 12;
+	prng_state ^= prng_state << 25;
+	prng_state ^= prng_state >> 27;
+	return prng_state * 2685821657736338717ULL;
+}
+
+static void Seed(const char* name) {
+	prng_state = 88172645463325252ULL;
+	while (*name)
+		prng_state = (prng_state ^ (unsigned char)*name++) * 1099511628211ULL;
+}
+
+static void Label(const string& path) {
+	if (!label_files)
+		return;
+	if (lsetxattr(path.c_str(), BENCH_SELINUX_XATTR, BENCH_SELINUX_LABEL, sizeof(BENCH_SELINUX_LABEL), 0) != 0) {
+		fprintf(stderr, "Unable to set SELinux labels (%s), continuing without them\n", strerror(errno));
+		label_files = false;
+	}
+}
+
+static void Make_Dir(const string& path) {
+	if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create '%s': %s\n", path.c_str(), strerror(errno));
+		exit(1);
+	}
+	Label(path);
+}
+
+// Writes size bytes of either text that deflates about 3:1 or random data
+static void Make_File(const string& path, unsigned long long size, bool compressible) {
+	char buffer[65536];
+	size_t len, i;
+	int fd;
+
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to create '%s': %s\n", path.c_str(), strerror(errno));
+		exit(1);
+	}
+	while (size > 0) {
+		len = size > sizeof(buffer) ? sizeof(buffer) : (size_t)size;
+		if (compressible) {
+			for (i = 0; i < len;) {
+				const char* word = words[Random() % (sizeof(words) / sizeof(words[0]))];
+				while (*word && i < len)
+					buffer[i++] = *word++;
+				if (i < len)
+					buffer[i++] = Random() % 8 ? ' ' : '\n';
+			}
+		} else {
+			for (i = 0; i + 8 <= len; i += 8) {
+				uint64_t r = Random();
+				memcpy(buffer + i, &r, 8);
+			}
+			for (; i < len; i++)
+				buffer[i] = (char)Random();
+		}
+		if (write(fd, buffer, len) != (ssize_t)len) {
+			fprintf(stderr, "Unable to write '%s': %s\n", path.c_str(), strerror(errno));
+			exit(1);
+		}
+		size -= len;
+	}
+	close(fd);
+	Label(path);
+}
+
+static string Number(const char* format, unsigned long long n) {
+	char buffer[64];
+
+	sprintf(buffer, format, n);
+	return buffer;
+}
+
+// Many small files, like /data/data
+static void Generate_Tiny(const string& path, int scale) {
+	unsigned long long i, count = 10000ULL * scale;
+	string dir;
+
+	for (i = 0; i < count; i++) {
+		if (i % 100 == 0) {
+			dir = path + Number("/dir%04llu", i / 100);
+			Make_Dir(dir);
+		}
+		Make_File(dir + Number("/file%llu", i), Random() % 4096, Random() % 4 != 0);
+	}
+}
+
+// A few large files, like apks and media, half of them incompressible
+static void Generate_Huge(const string& path, int scale) {
+	int i;
+
+	for (i = 0; i < 4; i++)
+		Make_File(path + Number("/huge%llu.bin", i), 64ULL * 1048576 * scale, i % 2 == 0);
+}
+
+// Long paths, close to what libtar has to store in GNU long name headers
+static void Generate_Deep(const string& path, int scale) {
+	string dir = path;
+	int depth, i, width;
+
+	for (width = 0; width < scale * 4; width++) {
+		dir = path + Number("/branch%llu", width);
+		Make_Dir(dir);
+		for (depth = 0; depth < 64; depth++) {
+			dir += Number("/level%02llu", depth);
+			Make_Dir(dir);
+			for (i = 0; i < 8; i++)
+				Make_File(dir + Number("/f%llu", i), 1024 + Random() % 16384, true);
+		}
+	}
+}
+
+// Files that are hardlinked into other folders and symlinks to them
+static void Generate_Hardlinks(const string& path, int scale) {
+	unsigned long long i, count = 1000ULL * scale;
+	string a = path + "/a", b = path + "/b", c = path + "/c", s = path + "/s";
+	string name;
+
+	Make_Dir(a);
+	Make_Dir(b);
+	Make_Dir(c);
+	Make_Dir(s);
+	for (i = 0; i < count; i++) {
+		name = Number("/file%llu", i);
+		Make_File(a + name, 4096 + Random() % 65536, Random() % 2 == 0);
+		if (link((a + name).c_str(), (b + name).c_str()) != 0 || link((a + name).c_str(), (c + name).c_str()) != 0) {
+			fprintf(stderr, "Unable to create hardlinks in '%s': %s\n", path.c_str(), strerror(errno));
+			exit(1);
+		}
+		if (symlink(("../a" + name).c_str(), (s + name).c_str()) != 0) {
+			fprintf(stderr, "Unable to create symlinks in '%s': %s\n", path.c_str(), strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+static const bench_tree trees[] = {
+	{ "tiny",      Generate_Tiny },
+	{ "huge",      Generate_Huge },
+	{ "deep",      Generate_Deep },
+	{ "hardlinks", Generate_Hardlinks },
+};
+
+static void Scan(const string& path, tree_stats* stats);
+
+static void Build_Tree(const bench_tree* tree, const string& path, int scale, tree_stats* stats) {
+	Seed(tree->name);
+	Make_Dir(path);
+	tree->generate(path, scale);
+	sync();
+	memset(stats, 0, sizeof(*stats));
+	Scan(path, stats);
+}
+
+static void Scan(const string& path, tree_stats* stats) {
+	struct dirent* de;
+	struct stat st;
+	DIR* d;
+
+	d = opendir(path.c_str());
+	if (d == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		string name = de->d_name;
+
+		if (name == "." || name == "..")
+			continue;
+		name = path + "/" + name;
+		if (lstat(name.c_str(), &st) != 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			stats->dirs++;
+			Scan(name, stats);
+		} else if (S_ISLNK(st.st_mode)) {
+			stats->links++;
+		} else if (S_ISREG(st.st_mode)) {
+			stats->files++;
+			stats->bytes += st.st_size;
+			if (st.st_nlink > 1)
+				stats->hardlinks++;
+		}
+	}
+	closedir(d);
+}
+
+static void Remove(const string& path) {
+	struct dirent* de;
+	struct stat st;
+	DIR* d;
+
+	if (lstat(path.c_str(), &st) != 0)
+		return;
+	if (S_ISDIR(st.st_mode)) {
+		d = opendir(path.c_str());
+		if (d != NULL) {
+			while ((de = readdir(d)) != NULL) {
+				if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+					Remove(path + "/" + de->d_name);
+			}
+			closedir(d);
+		}
+		rmdir(path.c_str());
+	} else {
+		unlink(path.c_str());
+	}
+}
+
+// twrpTar restores into the first folder of the backed up path, like /data
+static string Root_Dir(const string& path) {
+	size_t slash = path.find('/', 1);
+
+	return slash == string::npos ? path : path.substr(0, slash);
+}
+
+// Read and write syscalls of this process and every child it waited for
+static bool Syscalls(long long* reads, long long* writes) {
+	char line[128];
+	FILE* fp;
+	int found = 0;
+
+	fp = fopen("/proc/self/io", "r");
+	if (fp == NULL)
+		return false;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "syscr: %lld", reads) == 1 || sscanf(line, "syscw: %lld", writes) == 1)
+			found++;
+	}
+	fclose(fp);
+	return found == 2;
+}
+
+// Size of all archives of a backup, split and encrypted backups write several
+static unsigned long long Archive_Size(const string& folder, const string& name) {
+	unsigned long long size = 0;
+	struct dirent* de;
+	struct stat st;
+	DIR* d;
+
+	d = opendir(folder.c_str());
+	if (d == NULL)
+		return 0;
+	while ((de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+
+		// The .idx files are the selective restore index, not archive data
+		if (len > 4 && strcmp(de->d_name + len - 4, ".idx") == 0)
+			continue;
+		if (strncmp(de->d_name, name.c_str(), name.size()) == 0 && lstat((folder + "/" + de->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+			size += st.st_size;
+	}
+	closedir(d);
+	return size;
+}
+
+static bool In_Path(const char* name) {
+	const char* env = getenv("PATH");
+	string path = env ? env : "/sbin:/system/bin:/bin:/usr/bin";
+	size_t start = 0, end;
+
+	while (start <= path.size()) {
+		end = path.find(':', start);
+		if (end == string::npos)
+			end = path.size();
+		if (access((path.substr(start, end - start) + "/" + name).c_str(), X_OK) == 0)
+			return true;
+		start = end + 1;
+	}
+	return false;
+}
+
+static bool Selected(const string& list, const char* name) {
+	string padded = "," + list + ",";
+
+	return list.empty() || padded.find("," + string(name) + ",") != string::npos;
+}
+
+static int Run(const vector<string>& args, const string& log, run_result* result) {
+	long long reads_before = 0, writes_before = 0, reads_after = 0, writes_after = 0;
+	vector<char*> argv;
+	struct rusage usage;
+	struct timespec start, stop;
+	bool have_io;
+	pid_t pid;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < args.size(); i++)
+		argv.push_back((char*)args[i].c_str());
+	argv.push_back(NULL);
+
+	have_io = Syscalls(&reads_before, &writes_before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "Unable to fork: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0) {
+		fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], &argv[0]);
+		_exit(127);
+	}
+	if (wait4(pid, &result->status, 0, &usage) != pid) {
+		fprintf(stderr, "Unable to wait for '%s': %s\n", argv[0], strerror(errno));
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	result->seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+	// ru_maxrss of a waited for child includes the children it waited for
+	result->peak_rss_kb = usage.ru_maxrss;
+	if (have_io && Syscalls(&reads_after, &writes_after)) {
+		result->read_syscalls = reads_after - reads_before;
+		result->write_syscalls = writes_after - writes_before;
+	} else {
+		result->read_syscalls = result->write_syscalls = -1;
+	}
+	return WIFEXITED(result->status) && WEXITSTATUS(result->status) == 0 ? 0 : -1;
+}
+
+static void Report(const char* tree, const char* mode, const char* op, bool ok, const tree_stats& stats,
+	const run_result& result, unsigned long long archive_bytes, bool verified) {
+	double seconds = result.seconds > 0 ? result.seconds : 0.000001;
+
+	printf("{\"tree\":\"%s\",\"mode\":\"%s\",\"op\":\"%s\",\"ok\":%s,\"verified\":%s,"
+		"\"files\":%llu,\"bytes\":%llu,\"archive_bytes\":%llu,\"seconds\":%.3f,"
+		"\"mb_per_sec\":%.2f,\"files_per_sec\":%.1f,",
+		tree, mode, op, ok ? "true" : "false", verified ? "true" : "false",
+		stats.files, stats.bytes, archive_bytes, result.seconds,
+		stats.bytes / 1048576.0 / seconds, stats.files / seconds);
+	if (result.read_syscalls >= 0)
+		printf("\"read_syscalls\":%lld,\"write_syscalls\":%lld,\"syscalls\":%lld,",
+			result.read_syscalls, result.write_syscalls, result.read_syscalls + result.write_syscalls);
+	else
+		printf("\"read_syscalls\":null,\"write_syscalls\":null,\"syscalls\":null,");
+	printf("\"peak_rss_kb\":%ld}\n", result.peak_rss_kb);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	string binary = "twrpTar", work = "/tmp/twrpTarBench", tree_list, mode_list;
+	int scale = 1, split_mb = 16, i;
+	bool keep = false, have_pigz, have_openaes;
+	size_t t, m;
+
+	for (i = 1; i < argc; i++) {
+		string arg = argv[i];
+
+		if (arg == "-k") {
+			keep = true;
+			continue;
+		}
+		if (arg == "-h") {
+			usage();
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			printf("No argument specified for %s\n", argv[i]);
+			usage();
+			return -1;
+		}
+		i++;
+		if (arg == "-b")
+			binary = argv[i];
+		else if (arg == "-w")
+			work = argv[i];
+		else if (arg == "-s")
+			scale = atoi(argv[i]);
+		else if (arg == "-p")
+			split_mb = atoi(argv[i]);
+		else if (arg == "-t")
+			tree_list = argv[i];
+		else if (arg == "-m")
+			mode_list = argv[i];
+		else {
+			printf("Invalid option '%s' specified.\n", arg.c_str());
+			usage();
+			return -1;
+		}
+	}
+	if (scale < 1)
+		scale = 1;
+	if (split_mb < 1)
+		split_mb = 1;
+	if (work.empty() || work[0] != '/') {
+		char cwd[PATH_MAX];
+
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			printf("Unable to get the current folder: %s\n", strerror(errno));
+			return -1;
+		}
+		work = string(cwd) + "/" + work;
+	}
+
+	// Extracting compressed archives runs pigz, encryption runs openaes
+	have_pigz = In_Path("pigz");
+	have_openaes = In_Path("openaes");
+
+	Remove(work);
+	Make_Dir(work);
+	printf("{\"bench\":\"twrpTar\",\"binary\":\"%s\",\"cores\":%ld,\"scale\":%i,\"split_mb\":%i,\"pigz\":%s,\"openaes\":%s}\n",
+		binary.c_str(), sysconf(_SC_NPROCESSORS_ONLN), scale, split_mb,
+		have_pigz ? "true" : "false", have_openaes ? "true" : "false");
+	fflush(stdout);
+
+	for (t = 0; t < sizeof(trees) / sizeof(trees[0]); t++) {
+		string source = work + "/" + trees[t].name;
+		tree_stats stats;
+
+		if (!Selected(tree_list, trees[t].name))
+			continue;
+		fprintf(stderr, "Generating %s...\n", trees[t].name);
+		Build_Tree(&trees[t], source, scale, &stats);
+		printf("{\"tree\":\"%s\",\"files\":%llu,\"dirs\":%llu,\"links\":%llu,\"hardlinks\":%llu,\"bytes\":%llu,\"selinux\":%s}\n",
+			trees[t].name, stats.files, stats.dirs, stats.links, stats.hardlinks, stats.bytes, label_files ? "true" : "false");
+		fflush(stdout);
+
+		for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			const bench_mode* mode = &modes[m];
+			string out = work + "/" + trees[t].name + "-" + mode->name;
+			string archive = out + "/backup.win", log = out + "/twrpTar.log";
+			vector<string> args;
+			run_result result;
+			unsigned long long archive_bytes;
+			tree_stats restored;
+			bool ok, verified;
+
+			if (!Selected(mode_list, mode->name))
+				continue;
+			if ((mode->compress && !have_pigz) || (mode->encrypt && !have_openaes)) {
+				fprintf(stderr, "Skipping %s/%s, %s is not in the PATH\n", trees[t].name, mode->name,
+					mode->compress && !have_pigz ? "pigz" : "openaes");
+				continue;
+			}
+			Make_Dir(out);
+
+			fprintf(stderr, "Backing up %s as %s...\n", trees[t].name, mode->name);
+			args.push_back(binary);
+			args.push_back("-c");
+			args.push_back("-d");
+			args.push_back(source);
+			args.push_back("-t");
+			args.push_back(archive);
+			if (mode->compress)
+				args.push_back("-z");
+			if (mode->encrypt) {
+				args.push_back("-e");
+				args.push_back(BENCH_PASSWORD);
+			}
+			if (mode->split) {
+				args.push_back("-p");
+				args.push_back(Number("%llu", split_mb));
+			}
+			if (mode->threads > 0) {
+				args.push_back("-j");
+				args.push_back(Number("%llu", mode->threads));
+			}
+			ok = Run(args, log, &result) == 0;
+			sync();
+			archive_bytes = Archive_Size(out, "backup.win");
+			Report(trees[t].name, mode->name, "create", ok, stats, result, archive_bytes, ok);
+			if (!ok) {
+				fprintf(stderr, "Backup failed, see %s\n", log.c_str());
+				continue;
+			}
+
+			// Like a restore in recovery, the tree is wiped and restored in place
+			fprintf(stderr, "Restoring %s from %s...\n", trees[t].name, mode->name);
+			Remove(source);
+			args.clear();
+			args.push_back(binary);
+			args.push_back("-x");
+			args.push_back("-d");
+			args.push_back(Root_Dir(source));
+			args.push_back("-t");
+			args.push_back(archive);
+			if (mode->encrypt) {
+				args.push_back("-e");
+				args.push_back(BENCH_PASSWORD);
+			}
+			ok = Run(args, log, &result) == 0;
+			sync();
+			memset(&restored, 0, sizeof(restored));
+			Scan(source, &restored);
+			// Split archives store a hardlink whose target went to another
+			// archive as a full copy, so only the other modes keep the links
+			verified = ok && restored.files == stats.files && restored.dirs == stats.dirs &&
+				restored.links == stats.links && restored.bytes == stats.bytes &&
+				(mode->split || restored.hardlinks == stats.hardlinks);
+			Report(trees[t].name, mode->name, "extract", ok, stats, result, archive_bytes, verified);
+			if (!verified) {
+				fprintf(stderr, "Restore of %s from %s failed or differs, see %s\n", trees[t].name, mode->name, log.c_str());
+				Remove(source);
+				Build_Tree(&trees[t], source, scale, &stats);
+			}
+			if (!keep)
+				Remove(out);
+		}
+		if (!keep)
+			Remove(source);
+	}
+	if (!keep)
+		Remove(work);
+	return 0;
+}
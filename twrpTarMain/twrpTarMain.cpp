@@ -20,7 +20,9 @@
 #include "../twrp-functions.hpp"
 #include "../twrpTar.hpp"
 #include "../twrpDU.hpp"
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 twrpDU du;
 
@@ -31,7 +33,13 @@ void usage() {
 	printf(" -d    target directory\n");
 	printf(" -t    output file\n");
 	printf(" -m    skip media subfolder (has data media)\n");
-	printf(" -z    compress backup (/sbin/pigz must be present)\n");
+	printf(" -z    compress backup (/sbin/pigz must be present to extract)\n");
+	printf(" -l    compression level 0-9, default 6\n");
+	printf(" -s    deflate every file, even if it does not look compressible\n");
+	printf(" -p    split the backup into archives of this many MB\n");
+	printf(" -j    use at most this many compression/encryption threads\n");
+	printf(" -n    store identical files once per archive (only twrpTar restores them as copies)\n");
+	printf(" -i    only extract this file or folder, as it was named when backed up, may be repeated\n");
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
 	printf(" -e    encrypt/decrypt backup followed by password (/sbin/openaes must be present)\n");
 	printf(" -u    encrypt using userdata encryption (must be used with -e\n");
@@ -39,14 +47,18 @@ void usage() {
 	printf("\n\n");
 	printf("Example: twrpTar -c -d /cache -t /sdcard/test.tar\n");
 	printf("         twrpTar -x -d /cache -t /sdcard/test.tar\n");
+	printf("         twrpTar -x -d /cache -t /sdcard/test.tar -i /cache/recovery/log\n");
 }
 
 int main(int argc, char **argv) {
 	twrpTar tar;
 	int use_encryption = 0, userdata_encryption = 0, has_data_media = 0, use_compression = 0, include_root = 0;
+	int compression_level = 6, adaptive_compression = 1, max_threads = 0, dedup = 0;
+	unsigned long long max_archive_size = 0;
 	int i, action = 0;
 	unsigned j;
 	string Directory, Tar_Filename;
+	vector<string> Paths;
 	unsigned long long temp1 = 0, temp2 = 0;
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
 	string Password;
@@ -110,6 +122,48 @@ int main(int argc, char **argv) {
 			if (action == 2)
 				printf("NOTE: %s option not needed when extracting.\n", argv[i]);
 			use_compression = 1;
+		} else if (strcmp(argv[i], "-l") == 0) {
+			i++;
+			if (argc <= i) {
+				printf("No argument specified for %s\n", argv[i - 1]);
+				usage();
+				return -1;
+			} else {
+				compression_level = atoi(argv[i]);
+			}
+		} else if (strcmp(argv[i], "-s") == 0) {
+			adaptive_compression = 0;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			i++;
+			if (argc <= i) {
+				printf("No argument specified for %s\n", argv[i - 1]);
+				usage();
+				return -1;
+			} else {
+				max_archive_size = strtoull(argv[i], NULL, 10) * 1048576LLU;
+			}
+		} else if (strcmp(argv[i], "-j") == 0) {
+			i++;
+			if (argc <= i) {
+				printf("No argument specified for %s\n", argv[i - 1]);
+				usage();
+				return -1;
+			} else {
+				max_threads = atoi(argv[i]);
+			}
+		} else if (strcmp(argv[i], "-n") == 0) {
+			dedup = 1;
+		} else if (strcmp(argv[i], "-i") == 0) {
+			i++;
+			if (argc <= i) {
+				printf("No argument specified for %s\n", argv[i - 1]);
+				usage();
+				return -1;
+			} else {
+				if (action == 1)
+					printf("NOTE: %s option not needed when creating.\n", argv[i - 1]);
+				Paths.push_back(argv[i]);
+			}
 		} else if (strcmp(argv[i], "-u") == 0) {
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
 			if (action == 2)
@@ -128,6 +182,12 @@ int main(int argc, char **argv) {
 	tar.setfn(Tar_Filename);
 	tar.setsize(du.Get_Folder_Size(Directory));
 	tar.use_compression = use_compression;
+	tar.compression_level = compression_level;
+	tar.adaptive_compression = adaptive_compression;
+	tar.max_threads = max_threads;
+	tar.dedup = dedup;
+	if (max_archive_size > 0)
+		tar.max_archive_size = max_archive_size;
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
 	if (userdata_encryption && !use_encryption) {
 		printf("userdata encryption set without encryption option\n");
@@ -149,6 +209,13 @@ int main(int argc, char **argv) {
 		}
 		sync();
 		printf("\n\ntar created successfully.\n");
+	} else if (action == 2 && !Paths.empty()) {
+		if (tar.extractPaths(Paths) != 0) {
+			sync();
+			return -1;
+		}
+		sync();
+		printf("\n\nfiles extracted successfully.\n");
 	} else if (action == 2) {
 		if (tar.extractTarFork(&temp1, &temp2) != 0) {
 			sync();
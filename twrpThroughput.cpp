@@ -0,0 +1,297 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "twcommon.h"
+#include "data.hpp"
+#include "variables.h"
+#include "twrp-functions.hpp"
+#include "twrpThroughput.hpp"
+
+#define THROUGHPUT_UPDATE_MS       500         // Progress and ETA are published at most this often
+#define THROUGHPUT_SAMPLE_MS       1000        // Shortest interval for a rate sample
+#define THROUGHPUT_SMOOTHING       0.3         // Weight of a new sample in the live rate
+#define THROUGHPUT_IMAGE_CAP       95          // Percent an extrapolated job may reach before it finished
+
+// Rates used until a partition was backed up or restored once
+#define THROUGHPUT_DEFAULT_IMG_RATE       (30 * 1048576)
+#define THROUGHPUT_DEFAULT_FILE_RATE      (12 * 1048576)
+#define THROUGHPUT_DEFAULT_FILE_COMP_RATE (6 * 1048576)
+
+twrpThroughput::twrpThroughput() {
+	fraction = 0;
+	running = false;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+twrpThroughput::~twrpThroughput() {
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void twrpThroughput::Start(const string& Operation) {
+	Stop();
+	pthread_mutex_lock(&lock);
+	jobs.clear();
+	operation = Operation;
+	fraction = 0;
+	running = true;
+	if (pthread_create(&thread, NULL, Thread, this) != 0) {
+		LOGINFO("Unable to start the progress thread, progress is shown per partition\n");
+		running = false;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void twrpThroughput::Add_Job(const string& Name, const string& Method, unsigned long long Size) {
+	unsigned long long stored = 0;
+	job j;
+
+	j.Name = Name;
+	j.Key = "tw_rate_" + operation + "_" + Method + "_" + Name;
+	j.Size = Size;
+	j.Done = j.Sample_Done = 0;
+	j.Live = 0;
+	j.Learned = j.Fed = false;
+	j.State = PENDING;
+	if (DataManager::GetValue(j.Key, stored) == 0 && stored > 0) {
+		j.Rate = stored;
+		j.Known = true;
+	} else {
+		j.Rate = Default_Rate(Method);
+		j.Known = false;
+	}
+
+	pthread_mutex_lock(&lock);
+	if (Find_Job(Name) == NULL)
+		jobs.push_back(j);
+	pthread_mutex_unlock(&lock);
+}
+
+void twrpThroughput::Start_Job(const string& Name) {
+	pthread_mutex_lock(&lock);
+	job* j = Find_Job(Name);
+	if (j != NULL) {
+		j->State = RUNNING;
+		clock_gettime(CLOCK_MONOTONIC, &j->Started);
+		j->Sampled = j->Started;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+bool twrpThroughput::Add_Bytes(const string& Name, unsigned long long Bytes) {
+	bool ret = false;
+
+	pthread_mutex_lock(&lock);
+	job* j = Find_Job(Name);
+	if (running && j != NULL && j->State == RUNNING) {
+		j->Done += Bytes;
+		j->Fed = true;
+		ret = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+void twrpThroughput::Finish_Job(const string& Name, bool Success) {
+	unsigned long long bytes;
+	timespec now;
+	int elapsed;
+
+	pthread_mutex_lock(&lock);
+	job* j = Find_Job(Name);
+	if (j == NULL || j->State != RUNNING) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = TWFunc::timespec_diff_ms(j->Started, now);
+	bytes = j->Fed ? j->Done : j->Size;
+	j->State = FINISHED;
+	if (Success && elapsed >= THROUGHPUT_SAMPLE_MS && bytes > 0) {
+		double measured = (double)bytes * 1000 / elapsed;
+
+		// Same weighting as the average backup rates
+		if (j->Known)
+			j->Rate = (j->Rate * 4 + measured) / 5;
+		else
+			j->Rate = measured;
+		j->Known = j->Learned = true;
+		LOGINFO("%s %s: %llu MB/sec, expecting %llu MB/sec next time\n", operation.c_str(), Name.c_str(),
+			(unsigned long long)measured / 1048576, (unsigned long long)j->Rate / 1048576);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+bool twrpThroughput::Is_Tracking(const string& Name) {
+	bool ret;
+
+	pthread_mutex_lock(&lock);
+	ret = running && Find_Job(Name) != NULL;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+void twrpThroughput::Stop() {
+	vector<job> finished;
+	size_t i;
+
+	pthread_mutex_lock(&lock);
+	if (!running) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	running = false;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	pthread_mutex_lock(&lock);
+	finished.swap(jobs);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < finished.size(); i++) {
+		if (finished[i].Learned)
+			DataManager::SetValue(finished[i].Key, (unsigned long long)finished[i].Rate, 1);
+	}
+	DataManager::SetValue(TW_ETA_VAR, "");
+}
+
+void* twrpThroughput::Thread(void* cookie) {
+	twrpThroughput* t = (twrpThroughput*) cookie;
+
+	pthread_mutex_lock(&t->lock);
+	while (t->running) {
+		struct timespec timeout;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += THROUGHPUT_UPDATE_MS * 1000000L;
+		if (timeout.tv_nsec >= 1000000000L) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&t->cond, &t->lock, &timeout);
+		if (t->running)
+			t->Publish();
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+
+// Called with the lock held
+void twrpThroughput::Publish() {
+	unsigned long long total = 0, done = 0, job_done, cap;
+	double rate, left, running_left = 0, pending_left = 0, percent;
+	char size_progress[1024], eta[64];
+	timespec now;
+	int seconds;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < jobs.size(); i++) {
+		job* j = &jobs[i];
+
+		total += j->Size;
+		if (j->State == FINISHED) {
+			done += j->Size;
+			continue;
+		}
+		if (j->State == PENDING) {
+			// Jobs that run next to each other overlap, so this errs on the long side
+			pending_left += (double)j->Size / j->Rate;
+			continue;
+		}
+		if (j->Fed) {
+			int interval = TWFunc::timespec_diff_ms(j->Sampled, now);
+
+			if (interval >= THROUGHPUT_SAMPLE_MS) {
+				double sample = (double)(j->Done - j->Sample_Done) * 1000 / interval;
+
+				if (j->Live > 0)
+					j->Live = j->Live * (1 - THROUGHPUT_SMOOTHING) + sample * THROUGHPUT_SMOOTHING;
+				else
+					j->Live = sample;
+				j->Sample_Done = j->Done;
+				j->Sampled = now;
+			}
+			job_done = j->Done;
+		} else {
+			// Images do not report their bytes, assume they run at the learned rate
+			job_done = (unsigned long long)(TWFunc::timespec_diff_ms(j->Started, now) / 1000.0 * j->Rate);
+			cap = j->Size / 100 * THROUGHPUT_IMAGE_CAP;
+			if (job_done > cap)
+				job_done = cap;
+		}
+		if (job_done > j->Size)
+			job_done = j->Size;
+		done += job_done;
+		rate = j->Live > 0 ? j->Live : j->Rate;
+		left = (double)(j->Size - job_done) / rate;
+		if (left > running_left)
+			running_left = left;
+	}
+	if (total == 0)
+		return;
+
+	percent = (double)done / (double)total;
+	if (percent < fraction)
+		percent = fraction;
+	fraction = percent;
+	sprintf(size_progress, "%lluMB of %lluMB, %i%%", done / 1048576, total / 1048576, (int)(percent * 100));
+	DataManager::SetValue("tw_size_progress", size_progress);
+	DataManager::SetProgress((float)percent);
+
+	seconds = (int)(running_left + pending_left + 0.5);
+	if (seconds >= 3600)
+		sprintf(eta, "ETA %i:%02i:%02i", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+	else
+		sprintf(eta, "ETA %i:%02i", seconds / 60, seconds % 60);
+	DataManager::SetValue(TW_ETA_VAR, eta);
+}
+
+twrpThroughput::job* twrpThroughput::Find_Job(const string& Name) {
+	size_t i;
+
+	for (i = 0; i < jobs.size(); i++) {
+		if (jobs[i].Name == Name)
+			return &jobs[i];
+	}
+	return NULL;
+}
+
+double twrpThroughput::Default_Rate(const string& Method) {
+	unsigned long long avg = 0;
+
+	// The averages of the last backups are a better guess than a constant
+	if (operation == "backup") {
+		if (Method == "image")
+			DataManager::GetValue(TW_BACKUP_AVG_IMG_RATE, avg);
+		else if (Method == "files_gz")
+			DataManager::GetValue(TW_BACKUP_AVG_FILE_COMP_RATE, avg);
+		else
+			DataManager::GetValue(TW_BACKUP_AVG_FILE_RATE, avg);
+	}
+	if (avg > 0)
+		return avg;
+	if (Method == "image")
+		return THROUGHPUT_DEFAULT_IMG_RATE;
+	else if (Method == "files_gz")
+		return THROUGHPUT_DEFAULT_FILE_COMP_RATE;
+	return THROUGHPUT_DEFAULT_FILE_RATE;
+}
@@ -0,0 +1,84 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPTHROUGHPUT_HPP
+#define TWRPTHROUGHPUT_HPP
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Tracks the partitions of a backup or restore and publishes the overall
+// progress and an ETA a few times per second. Tar jobs report the bytes
+// they read from their progress pipe, image jobs are extrapolated from
+// the rate learned for the partition and method in earlier runs. The rate
+// of every finished partition is saved so the next estimate starts closer.
+class twrpThroughput {
+public:
+	twrpThroughput();
+	~twrpThroughput();
+	void Start(const string& Operation);           // Forgets all jobs and starts publishing, Operation is "backup" or "restore"
+	void Add_Job(const string& Name, const string& Method, unsigned long long Size); // Name is the Backup_Name of the partition
+	void Start_Job(const string& Name);
+	bool Add_Bytes(const string& Name, unsigned long long Bytes); // Returns false if Name is not tracked
+	void Finish_Job(const string& Name, bool Success);
+	bool Is_Tracking(const string& Name);
+	void Stop();                                   // Stops publishing and saves the learned rates
+
+private:
+	enum job_state {
+		PENDING,
+		RUNNING,
+		FINISHED
+	};
+
+	struct job {
+		string Name;
+		string Key;                                // Variable holding the learned rate
+		unsigned long long Size;
+		unsigned long long Done;                   // Bytes reported by the job
+		unsigned long long Sample_Done;            // Done at the last rate sample
+		double Rate;                               // Expected bytes per second
+		double Live;                               // Smoothed bytes per second of this run, 0 until sampled
+		bool Known;                                // Rate was learned, not guessed
+		bool Learned;                              // Rate was updated by this run
+		bool Fed;                                  // The job reports its bytes
+		job_state State;
+		timespec Started;
+		timespec Sampled;
+	};
+
+	static void* Thread(void* cookie);
+	void Publish();
+	job* Find_Job(const string& Name);
+	double Default_Rate(const string& Method);
+
+	vector<job> jobs;
+	string operation;
+	double fraction;                               // Last published progress, never goes back
+	bool running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+extern twrpThroughput Throughput;
+#endif // TWRPTHROUGHPUT_HPP
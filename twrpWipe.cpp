@@ -0,0 +1,307 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "twcommon.h"
+#include "data.hpp"
+#include "twrp-functions.hpp"
+#include "twrpWipe.hpp"
+
+#define WIPE_MAX_THREADS 8
+
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12,119)
+#endif
+#ifndef BLKSECDISCARD
+#define BLKSECDISCARD _IO(0x12,125)
+#endif
+
+twrpWipe::twrpWipe() {
+	Files = Dirs = 0;
+	Errors = 0;
+	outstanding = 0;
+	idle = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+	pthread_cond_init(&finished, NULL);
+}
+
+twrpWipe::~twrpWipe() {
+	for (size_t i = 0; i < queue.size(); i++)
+		delete queue[i];
+	pthread_cond_destroy(&cond);
+	pthread_cond_destroy(&finished);
+	pthread_mutex_destroy(&lock);
+}
+
+void twrpWipe::Add(const string& path, bool keep_path) {
+	job* j = new job;
+
+	j->path = path;
+	j->parent = NULL;
+	j->pending = 1;
+	j->keep = keep_path;
+	queue.push_back(j);
+	outstanding++;
+}
+
+// Called when a job and all of its child jobs are done
+void twrpWipe::Finish(job* j) {
+	while (j) {
+		job* parent = j->parent;
+
+		pthread_mutex_lock(&lock);
+		bool done = (--j->pending == 0);
+		pthread_mutex_unlock(&lock);
+		if (!done)
+			return;
+
+		if (!j->keep) {
+			if (rmdir(j->path.c_str()) == 0) {
+				__sync_fetch_and_add(&Dirs, 1);
+			} else if (errno != ENOENT) {
+				LOGINFO("Unable to remove '%s': %s\n", j->path.c_str(), strerror(errno));
+				__sync_fetch_and_add(&Errors, 1);
+			}
+		}
+		delete j;
+
+		pthread_mutex_lock(&lock);
+		if (--outstanding == 0) {
+			pthread_cond_broadcast(&cond);
+			pthread_cond_signal(&finished);
+		}
+		pthread_mutex_unlock(&lock);
+		j = parent;
+	}
+}
+
+// Removes everything below the directory open as fd and closes it. Only
+// the top level of a job hands out subdirectories, deeper levels are
+// removed by this thread so a directory is never removed while another
+// thread still works below it.
+void twrpWipe::Remove_Contents(int fd, job* j, bool spawn) {
+	DIR* d = fdopendir(fd);
+	struct dirent* de;
+
+	if (d == NULL) {
+		close(fd);
+		__sync_fetch_and_add(&Errors, 1);
+		return;
+	}
+	while ((de = readdir(d)) != NULL) {
+		bool is_dir;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat st;
+			if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			is_dir = S_ISDIR(st.st_mode);
+		} else {
+			is_dir = (de->d_type == DT_DIR);
+		}
+
+		if (!is_dir) {
+			if (unlinkat(fd, de->d_name, 0) == 0) {
+				__sync_fetch_and_add(&Files, 1);
+			} else if (errno != ENOENT) {
+				LOGINFO("Unable to unlink '%s/%s': %s\n", j->path.c_str(), de->d_name, strerror(errno));
+				__sync_fetch_and_add(&Errors, 1);
+			}
+			continue;
+		}
+
+		if (spawn && idle > 0) {
+			job* child = new job;
+
+			child->path = j->path + "/" + de->d_name;
+			child->parent = j;
+			child->pending = 1;
+			child->keep = false;
+			pthread_mutex_lock(&lock);
+			j->pending++;
+			outstanding++;
+			queue.push_back(child);
+			pthread_cond_signal(&cond);
+			pthread_mutex_unlock(&lock);
+			continue;
+		}
+
+		int child_fd = openat(fd, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		if (child_fd < 0) {
+			LOGINFO("Unable to open '%s/%s': %s\n", j->path.c_str(), de->d_name, strerror(errno));
+			__sync_fetch_and_add(&Errors, 1);
+			continue;
+		}
+		Remove_Contents(child_fd, j, false);
+		if (unlinkat(fd, de->d_name, AT_REMOVEDIR) == 0) {
+			__sync_fetch_and_add(&Dirs, 1);
+		} else if (errno != ENOENT) {
+			LOGINFO("Unable to remove '%s/%s': %s\n", j->path.c_str(), de->d_name, strerror(errno));
+			__sync_fetch_and_add(&Errors, 1);
+		}
+	}
+	closedir(d);
+}
+
+void twrpWipe::Remove_Job(job* j) {
+	int fd = open(j->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+	if (fd >= 0) {
+		Remove_Contents(fd, j, true);
+	} else if (errno == ENOTDIR || errno == ELOOP) {
+		// Added paths may be files or symlinks
+		if (!j->keep && unlink(j->path.c_str()) == 0)
+			__sync_fetch_and_add(&Files, 1);
+		j->keep = true;
+	} else {
+		if (errno != ENOENT) {
+			LOGINFO("Unable to open '%s': %s\n", j->path.c_str(), strerror(errno));
+			__sync_fetch_and_add(&Errors, 1);
+		}
+		j->keep = true;
+	}
+	Finish(j);
+}
+
+void twrpWipe::Work(void) {
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (queue.empty() && outstanding > 0) {
+			idle++;
+			pthread_cond_wait(&cond, &lock);
+			idle--;
+		}
+		if (queue.empty()) {
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		job* j = queue.back();
+		queue.pop_back();
+		pthread_mutex_unlock(&lock);
+		Remove_Job(j);
+	}
+}
+
+void* twrpWipe::Thread(void* cookie) {
+	((twrpWipe*) cookie)->Work();
+	return NULL;
+}
+
+int twrpWipe::Run(const string& name) {
+	pthread_t threads[WIPE_MAX_THREADS];
+	int thread_count = 0, wanted, i;
+	struct timespec start, now;
+	char progress[64];
+
+	Files = Dirs = 0;
+	Errors = 0;
+	if (queue.empty())
+		return 0;
+
+	// Wiping waits on the storage, so use more threads than cores
+	wanted = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	if (wanted > WIPE_MAX_THREADS)
+		wanted = WIPE_MAX_THREADS;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (thread_count < wanted) {
+		if (pthread_create(&threads[thread_count], NULL, Thread, this) != 0)
+			break;
+		thread_count++;
+	}
+	if (thread_count == 0) {
+		Work();
+	} else {
+		// Report progress until every job finished
+		pthread_mutex_lock(&lock);
+		while (outstanding > 0) {
+			struct timespec timeout;
+
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += 1;
+			pthread_cond_timedwait(&finished, &lock, &timeout);
+			sprintf(progress, "%llu files removed", Files);
+			DataManager::SetValue("tw_size_progress", progress);
+		}
+		pthread_mutex_unlock(&lock);
+		for (i = 0; i < thread_count; i++)
+			pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	DataManager::SetValue("tw_size_progress", "");
+	LOGINFO("Wiped %s: removed %llu files and %llu folders in %i ms using %i threads, %lu errors\n",
+		name.c_str(), Files, Dirs, TWFunc::timespec_diff_ms(start, now), thread_count, Errors);
+	return Errors ? -1 : 0;
+}
+
+// Discarding every block before a format lets the storage drop the old data
+// at once instead of the file system tools overwriting it, and lets mkfs
+// skip zeroing the inode tables. A positive length limits the discard to
+// the file system, a negative one keeps the crypto footer at the end.
+int twrpWipe::Discard(const string& device, long long length, bool secure) {
+	uint64_t range[2];
+	unsigned long long size;
+	struct timespec start, now;
+	int fd, ret = -1;
+
+	fd = open(device.c_str(), O_RDWR);
+	if (fd < 0) {
+		LOGINFO("Unable to open '%s' to discard: %s\n", device.c_str(), strerror(errno));
+		return -1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+		LOGINFO("Unable to get the size of '%s': %s\n", device.c_str(), strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (length > 0 && (unsigned long long) length < size)
+		size = length;
+	else if (length < 0 && (unsigned long long) -length < size)
+		size += length;
+	range[0] = 0;
+	range[1] = size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (secure) {
+		ret = ioctl(fd, BLKSECDISCARD, &range);
+		if (ret != 0)
+			LOGINFO("Secure discard of '%s' failed: %s\n", device.c_str(), strerror(errno));
+	}
+	if (ret != 0)
+		ret = ioctl(fd, BLKDISCARD, &range);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ret == 0)
+		LOGINFO("Discarded %llu MB of '%s' in %i ms\n", size / 1048576, device.c_str(), TWFunc::timespec_diff_ms(start, now));
+	else
+		LOGINFO("Discard of '%s' failed: %s\n", device.c_str(), strerror(errno));
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,66 @@
+/*
+	Copyright 2014 TeamWin
+	This file is part of TWRP/TeamWin Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPWIPE_HPP
+#define TWRPWIPE_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Removes directory trees with several threads. Every added path is a job;
+// while a thread walks a directory it hands subdirectories to idle threads
+// as new jobs, everything else is removed with unlinkat relative to the
+// open directory. A directory is removed once all jobs below it finished.
+class twrpWipe {
+public:
+	twrpWipe();
+	~twrpWipe();
+	void Add(const string& path, bool keep_path);  // Removes path, or only its contents if keep_path is set
+	int Run(const string& name);                   // Removes everything added, returns 0 if nothing failed
+	static int Discard(const string& device, long long length, bool secure); // Discards a block device before a format, length as in the fstab, returns 0 on success
+
+	unsigned long long Files;                      // Statistics of the last Run
+	unsigned long long Dirs;
+	unsigned long Errors;
+
+private:
+	struct job {
+		string path;
+		job* parent;                               // Directory that can only be removed after this job
+		int pending;                               // This job and its unfinished child jobs
+		bool keep;
+	};
+
+	static void* Thread(void* cookie);
+	void Work(void);
+	void Remove_Job(job* j);
+	void Remove_Contents(int fd, job* j, bool spawn);
+	void Finish(job* j);
+
+	vector<job*> queue;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;                           // Signaled for queued jobs, workers only
+	pthread_cond_t finished;                       // Signaled when the last job finished
+	int outstanding;                               // Jobs not finished yet
+	volatile int idle;                             // Threads waiting for a job
+};
+
+#endif // TWRPWIPE_HPP
@@ -82,6 +82,13 @@
 #define TW_FORCE_MD5_CHECK_VAR      "tw_force_md5_check"
 #define TW_SKIP_MD5_CHECK_VAR       "tw_skip_md5_check"
 #define TW_SKIP_MD5_GENERATE_VAR    "tw_skip_md5_generate"
+#define TW_SPARSE_IMAGES_VAR        "tw_sparse_images"
+#define TW_BACKUP_IO_JOBS_VAR       "tw_backup_io_jobs"
+#define TW_BACKUP_CPU_JOBS_VAR      "tw_backup_cpu_jobs"
+#define TW_COMPRESSION_LEVEL_VAR    "tw_compression_level"
+#define TW_COMPRESSION_LEVELS_VAR   "tw_compression_levels"
+#define TW_ADAPTIVE_COMPRESSION_VAR "tw_adaptive_compression"
+#define TW_BACKUP_DEDUP_VAR         "tw_backup_dedup"
 #define TW_SIGNED_ZIP_VERIFY_VAR    "tw_signed_zip_verify"
 #define TW_REBOOT_AFTER_FLASH_VAR   "tw_reboot_after_flash_option"
 #define TW_TIME_ZONE_VAR            "tw_time_zone"
@@ -101,6 +108,7 @@
 #define TW_TIME_ZONE_GUIDST         "tw_time_zone_guidst"
 
 #define TW_ACTION_BUSY              "tw_busy"
+#define TW_ETA_VAR                  "tw_eta"
 
 #define TW_ALLOW_PARTITION_SDCARD   "tw_allow_partition_sdcard"
 